@@ -38,6 +38,8 @@
 #include <bluetooth/sdp_lib.h>
 
 #include "log.h"
+#include "../src/adapter.h"
+#include "../src/manager.h"
 #include "device.h"
 #include "manager.h"
 #include "avdtp.h"
@@ -117,6 +119,8 @@ struct a2dp_server {
 };
 
 static GSList *servers = NULL;
+
+BTD_ADAPTER_SLOT(server_slot, "a2dp");
 static GSList *setups = NULL;
 static unsigned int cb_id = 0;
 
@@ -1431,17 +1435,15 @@ static sdp_record_t *a2dp_record(uint8_t type, uint16_t avdtp_ver)
 	return record;
 }
 
-static struct a2dp_server *find_server(GSList *list, const bdaddr_t *src)
+static struct a2dp_server *find_server(const bdaddr_t *src)
 {
+	struct btd_adapter *adapter;
 
-	for (; list; list = list->next) {
-		struct a2dp_server *server = list->data;
-
-		if (bacmp(&server->src, src) == 0)
-			return server;
-	}
+	adapter = manager_find_adapter(src);
+	if (adapter == NULL)
+		return NULL;
 
-	return NULL;
+	return btd_adapter_get_data(adapter, &server_slot);
 }
 
 int a2dp_register(DBusConnection *conn, const bdaddr_t *src, GKeyFile *config)
@@ -1453,8 +1455,13 @@ int a2dp_register(DBusConnection *conn, const bdaddr_t *src, GKeyFile *config)
 	char *str;
 	GError *err = NULL;
 	int i;
+	struct btd_adapter *adapter;
 	struct a2dp_server *server;
 
+	adapter = manager_find_adapter(src);
+	if (adapter == NULL)
+		return -ENODEV;
+
 	if (!config)
 		goto proceed;
 
@@ -1534,7 +1541,7 @@ proceed:
 	if (!connection)
 		connection = dbus_connection_ref(conn);
 
-	server = find_server(servers, src);
+	server = btd_adapter_get_data(adapter, &server_slot);
 	if (!server) {
 		int av_err;
 
@@ -1550,6 +1557,7 @@ proceed:
 
 		bacpy(&server->src, src);
 		servers = g_slist_append(servers, server);
+		btd_adapter_set_data(adapter, &server_slot, server);
 	}
 
 	if (config)
@@ -1602,9 +1610,14 @@ static void a2dp_unregister_sep(struct a2dp_sep *sep)
 
 void a2dp_unregister(const bdaddr_t *src)
 {
+	struct btd_adapter *adapter;
 	struct a2dp_server *server;
 
-	server = find_server(servers, src);
+	adapter = manager_find_adapter(src);
+	if (adapter == NULL)
+		return;
+
+	server = btd_adapter_get_data(adapter, &server_slot);
 	if (!server)
 		return;
 
@@ -1615,6 +1628,7 @@ void a2dp_unregister(const bdaddr_t *src)
 	avdtp_exit(src);
 
 	servers = g_slist_remove(servers, server);
+	btd_adapter_set_data(adapter, &server_slot, NULL);
 
 	if (server->source_record_id)
 		remove_record_from_server(server->source_record_id);
@@ -1644,7 +1658,7 @@ struct a2dp_sep *a2dp_add_sep(const bdaddr_t *src, uint8_t type,
 	sdp_record_t *record;
 	struct avdtp_sep_ind *ind;
 
-	server = find_server(servers, src);
+	server = find_server(src);
 	if (server == NULL) {
 		if (err)
 			*err = -EPROTONOSUPPORT;
@@ -1769,7 +1783,7 @@ struct a2dp_sep *a2dp_get(struct avdtp *session,
 	bdaddr_t src;
 
 	avdtp_get_peers(session, &src, NULL);
-	server = find_server(servers, &src);
+	server = find_server(&src);
 	if (!server)
 		return NULL;
 
@@ -2014,7 +2028,7 @@ static struct a2dp_sep *a2dp_select_sep(struct avdtp *session, uint8_t type,
 	bdaddr_t src;
 
 	avdtp_get_peers(session, &src, NULL);
-	server = find_server(servers, &src);
+	server = find_server(&src);
 	if (!server)
 		return NULL;
 
@@ -2107,7 +2121,7 @@ unsigned int a2dp_config(struct avdtp *session, struct a2dp_sep *sep,
 	bdaddr_t src;
 
 	avdtp_get_peers(session, &src, NULL);
-	server = find_server(servers, &src);
+	server = find_server(&src);
 	if (!server)
 		return 0;
 
@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include <bluetooth/bluetooth.h>
@@ -44,6 +45,7 @@
 #include <dbus/dbus.h>
 
 #include "log.h"
+#include "../src/metrics.h"
 
 #include "../src/adapter.h"
 #include "../src/manager.h"
@@ -317,6 +319,7 @@ struct pending_req {
 	struct avdtp_stream *stream; /* Set if the request targeted a stream */
 	guint timeout;
 	gboolean collided;
+	struct timespec sent;
 };
 
 struct avdtp_remote_sep {
@@ -332,9 +335,18 @@ struct avdtp_remote_sep {
 struct avdtp_server {
 	bdaddr_t src;
 	uint16_t version;
+	gboolean fast_connect;
 	GIOChannel *io;
 	GSList *seps;
 	GSList *sessions;
+	GSList *peers;
+};
+
+/* Per remote device state which outlives the AVDTP session */
+struct avdtp_peer {
+	bdaddr_t dst;
+	GSList *seps; /* Cached remote SEPs when fast connect is enabled */
+	struct avdtp_setup_times times;
 };
 
 struct avdtp_local_sep {
@@ -393,9 +405,11 @@ struct avdtp {
 	uint16_t version;
 
 	struct avdtp_server *server;
+	struct avdtp_peer *peer;
 	bdaddr_t dst;
 
 	avdtp_session_state_t state;
+	struct timespec connect_start;
 
 	/* True if the session should be automatically disconnected */
 	gboolean auto_dc;
@@ -408,6 +422,9 @@ struct avdtp {
 
 	GSList *seps; /* Elements of type struct avdtp_remote_sep * */
 
+	/* True while seps is the peer cache copy, not yet re-discovered */
+	gboolean seps_cached;
+
 	GSList *streams; /* Elements of type struct avdtp_stream * */
 
 	GSList *req_queue; /* Elements of type struct pending_req * */
@@ -440,6 +457,9 @@ static GSList *servers = NULL;
 
 static GSList *avdtp_callbacks = NULL;
 
+BTD_METRIC_COUNTER(avdtp_packets, "avdtp_packets");
+BTD_METRIC_HISTOGRAM(avdtp_response_us, "avdtp_response_us");
+
 static gboolean auto_connect = TRUE;
 
 static int send_request(struct avdtp *session, gboolean priority,
@@ -472,6 +492,28 @@ static struct avdtp_server *find_server(GSList *list, const bdaddr_t *src)
 	return NULL;
 }
 
+static struct avdtp_peer *find_peer(GSList *list, const bdaddr_t *dst)
+{
+	for (; list; list = list->next) {
+		struct avdtp_peer *peer = list->data;
+
+		if (bacmp(&peer->dst, dst) == 0)
+			return peer;
+	}
+
+	return NULL;
+}
+
+static uint32_t elapsed_usec(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+				(now.tv_nsec - start->tv_nsec) / 1000;
+}
+
 static const char *avdtp_statestr(avdtp_state_t state)
 {
 	switch (state) {
@@ -771,6 +813,15 @@ static void avdtp_set_state(struct avdtp *session,
 
 	session->state = new_state;
 
+	if (new_state == AVDTP_SESSION_STATE_CONNECTING) {
+		memset(&session->peer->times, 0,
+					sizeof(session->peer->times));
+		clock_gettime(CLOCK_MONOTONIC, &session->connect_start);
+	} else if (new_state == AVDTP_SESSION_STATE_CONNECTED &&
+			old_state == AVDTP_SESSION_STATE_CONNECTING)
+		session->peer->times.connect =
+					elapsed_usec(&session->connect_start);
+
 	avdtp_get_peers(session, &src, &dst);
 	dev = manager_get_device(&src, &dst, FALSE);
 	if (dev == NULL) {
@@ -1216,6 +1267,113 @@ static void sep_free(gpointer data)
 	g_free(sep);
 }
 
+static struct avdtp_remote_sep *sep_copy(struct avdtp_remote_sep *sep)
+{
+	struct avdtp_remote_sep *copy;
+	GSList *l;
+
+	copy = g_new0(struct avdtp_remote_sep, 1);
+	copy->seid = sep->seid;
+	copy->type = sep->type;
+	copy->media_type = sep->media_type;
+	copy->delay_reporting = sep->delay_reporting;
+
+	for (l = sep->caps; l != NULL; l = g_slist_next(l)) {
+		struct avdtp_service_capability *cap = l->data;
+		struct avdtp_service_capability *cpy;
+
+		cpy = g_memdup(cap, sizeof(*cap) + cap->length);
+		copy->caps = g_slist_append(copy->caps, cpy);
+
+		if (cap == sep->codec)
+			copy->codec = cpy;
+	}
+
+	return copy;
+}
+
+static GSList *seps_copy(GSList *seps)
+{
+	GSList *copy = NULL;
+
+	for (; seps != NULL; seps = g_slist_next(seps))
+		copy = g_slist_append(copy, sep_copy(seps->data));
+
+	return copy;
+}
+
+static void peer_cache_store(struct avdtp *session)
+{
+	struct avdtp_peer *peer = session->peer;
+
+	if (!session->server->fast_connect)
+		return;
+
+	g_slist_free_full(peer->seps, sep_free);
+	peer->seps = seps_copy(session->seps);
+
+	DBG("%p: cached %u remote SEPs", session, g_slist_length(peer->seps));
+}
+
+static void peer_cache_invalidate(struct avdtp *session)
+{
+	struct avdtp_peer *peer = session->peer;
+
+	/* Forget the copy this session started with too, so that the next
+	 * avdtp_discover() asks the device again. SEPs bound to a stream
+	 * are still referenced by the stream setup and have to stay. */
+	if (session->seps_cached && session->streams == NULL &&
+						session->discov_cb == NULL) {
+		g_slist_free_full(session->seps, sep_free);
+		session->seps = NULL;
+		session->seps_cached = FALSE;
+	}
+
+	if (peer->seps == NULL)
+		return;
+
+	DBG("%p: invalidating cached remote SEPs", session);
+
+	g_slist_free_full(peer->seps, sep_free);
+	peer->seps = NULL;
+}
+
+static void peer_free(gpointer data)
+{
+	struct avdtp_peer *peer = data;
+
+	g_slist_free_full(peer->seps, sep_free);
+	g_free(peer);
+}
+
+static void record_req_time(struct avdtp *session, struct pending_req *req)
+{
+	struct avdtp_setup_times *times = &session->peer->times;
+	uint32_t usec = elapsed_usec(&req->sent);
+
+	btd_metric_observe(&avdtp_response_us, usec);
+
+	switch (req->signal_id) {
+	case AVDTP_DISCOVER:
+		times->discover = usec;
+		times->get_capabilities = 0;
+		break;
+	case AVDTP_GET_CAPABILITIES:
+	case AVDTP_GET_ALL_CAPABILITIES:
+		times->get_capabilities += usec;
+		break;
+	case AVDTP_SET_CONFIGURATION:
+		times->set_configuration = usec;
+		break;
+	case AVDTP_OPEN:
+		times->open = usec;
+		break;
+	case AVDTP_START:
+		times->start = usec;
+		break;
+	}
+}
+
 void avdtp_unref(struct avdtp *session)
 {
 	struct avdtp_server *server;
@@ -2237,6 +2395,8 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		goto failed;
 	}
 
+	btd_metric_inc(&avdtp_packets);
+
 	switch (avdtp_parse_data(session, session->buf, size)) {
 	case PARSE_ERROR:
 		goto failed;
@@ -2289,6 +2449,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 
 	switch (header->message_type) {
 	case AVDTP_MSG_TYPE_ACCEPT:
+		record_req_time(session, session->req);
 		if (!avdtp_parse_resp(session, session->req->stream,
 						session->in.transaction,
 						session->in.signal_id,
@@ -2407,6 +2568,20 @@ static struct avdtp *avdtp_get_internal(const bdaddr_t *src, const bdaddr_t *dst
 
 	session->server = server;
 	bacpy(&session->dst, dst);
+
+	session->peer = find_peer(server->peers, dst);
+	if (session->peer == NULL) {
+		session->peer = g_new0(struct avdtp_peer, 1);
+		bacpy(&session->peer->dst, dst);
+		server->peers = g_slist_append(server->peers, session->peer);
+	}
+
+	/* Reuse the SEPs found on the last connection so that discovery
+	 * and capability queries can be skipped */
+	if (server->fast_connect) {
+		session->seps = seps_copy(session->peer->seps);
+		session->seps_cached = session->seps != NULL;
+	}
 	session->ref = 1;
 	/* We don't use avdtp_set_state() here since this isn't a state change
 	 * but just setting of the initial state */
@@ -2676,6 +2851,9 @@ static int cancel_request(struct avdtp *session, int err)
 
 	avdtp_error_init(&averr, AVDTP_ERRNO, err);
 
+	/* Don't trust cached SEPs of a device that stopped responding */
+	peer_cache_invalidate(session);
+
 	seid = req_get_seid(req);
 	if (seid)
 		stream = find_stream_by_rseid(session, seid);
@@ -2805,6 +2983,8 @@ static int send_req(struct avdtp *session, gboolean priority,
 		goto failed;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &req->sent);
+
 	session->req = req;
 
 	req->timeout = g_timeout_add_seconds(req->signal_id == AVDTP_ABORT ?
@@ -3071,8 +3251,10 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 		if (!avdtp_get_capabilities_resp(session, buf, size))
 			return FALSE;
 		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
-				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
+				next->signal_id == AVDTP_GET_ALL_CAPABILITIES))) {
+			peer_cache_store(session);
 			finalize_discovery(session, 0);
+		}
 		return TRUE;
 	}
 
@@ -3173,6 +3355,7 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("DISCOVER request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		peer_cache_invalidate(session);
 		return TRUE;
 	case AVDTP_GET_CAPABILITIES:
 	case AVDTP_GET_ALL_CAPABILITIES:
@@ -3180,6 +3363,7 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("GET_CAPABILITIES request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		peer_cache_invalidate(session);
 		return TRUE;
 	case AVDTP_OPEN:
 		if (!seid_rej_to_err(buf, size, &err))
@@ -3195,6 +3379,7 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		peer_cache_invalidate(session);
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -3461,6 +3646,7 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 		session->discov_cb = cb;
 		session->user_data = user_data;
 		session->discov_id = g_idle_add(process_discover, session);
+		session->peer->times.cached = session->seps_cached;
 		return 0;
 	}
 
@@ -3979,7 +4165,7 @@ void avdtp_get_peers(struct avdtp *session, bdaddr_t *src, bdaddr_t *dst)
 int avdtp_init(const bdaddr_t *src, GKeyFile *config, uint16_t *version)
 {
 	GError *err = NULL;
-	gboolean tmp, master = TRUE;
+	gboolean tmp, master = TRUE, fast_connect = FALSE;
 	struct avdtp_server *server;
 	uint16_t ver = 0x0102;
 
@@ -4004,12 +4190,16 @@ int avdtp_init(const bdaddr_t *src, GKeyFile *config, uint16_t *version)
 	if (g_key_file_get_boolean(config, "A2DP", "DelayReporting", NULL))
 		ver = 0x0103;
 
+	fast_connect = g_key_file_get_boolean(config, "A2DP", "FastConnect",
+									NULL);
+
 proceed:
 	server = g_new0(struct avdtp_server, 1);
 	if (!server)
 		return -ENOMEM;
 
 	server->version = ver;
+	server->fast_connect = fast_connect;
 
 	if (version)
 		*version = server->version;
@@ -4050,11 +4240,32 @@ void avdtp_exit(const bdaddr_t *src)
 
 	servers = g_slist_remove(servers, server);
 
+	g_slist_free_full(server->peers, peer_free);
+
 	g_io_channel_shutdown(server->io, TRUE, NULL);
 	g_io_channel_unref(server->io);
 	g_free(server);
 }
 
+gboolean avdtp_get_setup_times(const bdaddr_t *src, const bdaddr_t *dst,
+					struct avdtp_setup_times *times)
+{
+	struct avdtp_server *server;
+	struct avdtp_peer *peer;
+
+	server = find_server(servers, src);
+	if (server == NULL)
+		return FALSE;
+
+	peer = find_peer(server->peers, dst);
+	if (peer == NULL)
+		return FALSE;
+
+	*times = peer->times;
+
+	return TRUE;
+}
+
 gboolean avdtp_has_stream(struct avdtp *session, struct avdtp_stream *stream)
 {
 	return g_slist_find(session->streams, stream) ? TRUE : FALSE;
@@ -213,6 +213,17 @@ struct avdtp_sep_ind {
 typedef void (*avdtp_discover_cb_t) (struct avdtp *session, GSList *seps,
 					struct avdtp_error *err, void *user_data);
 
+/* Duration of each stream setup phase of the last connection, in usec */
+struct avdtp_setup_times {
+	gboolean cached;	/* Discovery answered from cached SEPs */
+	uint32_t connect;
+	uint32_t discover;
+	uint32_t get_capabilities;
+	uint32_t set_configuration;
+	uint32_t open;
+	uint32_t start;
+};
+
 struct avdtp *avdtp_get(bdaddr_t *src, bdaddr_t *dst);
 
 void avdtp_unref(struct avdtp *session);
@@ -307,6 +318,8 @@ int avdtp_error_error_code(struct avdtp_error *err);
 int avdtp_error_posix_errno(struct avdtp_error *err);
 
 void avdtp_get_peers(struct avdtp *session, bdaddr_t *src, bdaddr_t *dst);
+gboolean avdtp_get_setup_times(const bdaddr_t *src, const bdaddr_t *dst,
+					struct avdtp_setup_times *times);
 
 void avdtp_set_auto_disconnect(struct avdtp *session, gboolean auto_dc);
 gboolean avdtp_stream_setup_active(struct avdtp *session);
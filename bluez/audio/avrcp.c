@@ -165,6 +165,16 @@ struct avrcp_player {
 	uint8_t transaction_events[AVRCP_EVENT_LAST + 1];
 	struct pending_pdu *pending_pdu;
 
+	/* Events changed within the notification window */
+	guint notify_timer;
+	uint16_t changed_events;
+	uint8_t changed_status;
+	uint64_t changed_uid;
+
+	/* Attribute values of the current track, valid until it changes */
+	char *metadata[AVRCP_MEDIA_ATTRIBUTE_LAST + 1];
+	gboolean metadata_cached;
+
 	struct avrcp_player_cb *cb;
 	void *user_data;
 	GDestroyNotify destroy;
@@ -192,6 +202,7 @@ struct avrcp_tg_config {
 	uint16_t avctp_ver;
 	uint16_t avrcp_ver;
 	uint16_t disabled_features;
+	guint notify_delay;	/* Notification coalescing window in ms */
 };
 
 struct avrcp_ct_config avrcp_ct_config = {
@@ -205,6 +216,7 @@ struct avrcp_tg_config avrcp_tg_config = {
 	TRUE,
 	DEFAULT_PROTOCOL_VERSION,
 	DEFAULT_PROTOCOL_VERSION,
+	0,
 	0
 };
 
@@ -415,19 +427,62 @@ static void set_company_id(uint8_t cid[3], const uint32_t cid_in)
 	cid[2] = cid_in;
 }
 
-int avrcp_player_event(struct avrcp_player *player, uint8_t id, void *data)
+static void player_flush_metadata(struct avrcp_player *player)
+{
+	int i;
+
+	for (i = 0; i <= AVRCP_MEDIA_ATTRIBUTE_LAST; i++) {
+		g_free(player->metadata[i]);
+		player->metadata[i] = NULL;
+	}
+
+	player->metadata_cached = FALSE;
+}
+
+static const char *player_get_metadata(struct avrcp_player *player,
+								uint32_t id)
+{
+	uint32_t i;
+
+	if (id > AVRCP_MEDIA_ATTRIBUTE_LAST)
+		return NULL;
+
+	if (player->metadata_cached)
+		return player->metadata[id];
+
+	for (i = AVRCP_MEDIA_ATTRIBUTE_TITLE; i <= AVRCP_MEDIA_ATTRIBUTE_LAST;
+									i++) {
+		void *value = player->cb->get_metadata(i, player->user_data);
+
+		if (value == NULL)
+			continue;
+
+		switch (i) {
+		case AVRCP_MEDIA_ATTRIBUTE_TRACK:
+		case AVRCP_MEDIA_ATTRIBUTE_N_TRACKS:
+		case AVRCP_MEDIA_ATTRIBUTE_DURATION:
+			player->metadata[i] = g_strdup_printf("%u",
+						GPOINTER_TO_UINT(value));
+			break;
+		default:
+			player->metadata[i] = g_strdup(value);
+			break;
+		}
+	}
+
+	player->metadata_cached = TRUE;
+
+	return player->metadata[id];
+}
+
+static int player_send_event(struct avrcp_player *player, uint8_t id,
+								void *data)
 {
 	uint8_t buf[AVRCP_HEADER_LENGTH + 9];
 	struct avrcp_header *pdu = (void *) buf;
 	uint16_t size;
 	int err;
 
-	if (!player || player->session == NULL)
-		return -ENOTCONN;
-
-	if (!(player->registered_events & (1 << id)))
-		return 0;
-
 	memset(buf, 0, sizeof(buf));
 
 	set_company_id(pdu->company_id, IEEEID_BTSIG);
@@ -471,6 +526,91 @@ int avrcp_player_event(struct avrcp_player *player, uint8_t id, void *data)
 	return 0;
 }
 
+static gboolean notify_timeout(gpointer user_data)
+{
+	struct avrcp_player *player = user_data;
+	uint16_t events = player->changed_events;
+	uint8_t id;
+
+	player->notify_timer = 0;
+	player->changed_events = 0;
+
+	for (id = AVRCP_EVENT_STATUS_CHANGED;
+				id <= AVRCP_EVENT_TRACK_REACHED_START; id++) {
+		void *data = NULL;
+
+		if (!(events & (1 << id)))
+			continue;
+
+		/* The controller may have gone or not re-registered yet */
+		if (player->session == NULL ||
+				!(player->registered_events & (1 << id)))
+			continue;
+
+		if (id == AVRCP_EVENT_STATUS_CHANGED)
+			data = &player->changed_status;
+		else if (id == AVRCP_EVENT_TRACK_CHANGED)
+			data = &player->changed_uid;
+
+		player_send_event(player, id, data);
+	}
+
+	return FALSE;
+}
+
+static void player_cancel_events(struct avrcp_player *player)
+{
+	if (player->notify_timer > 0) {
+		g_source_remove(player->notify_timer);
+		player->notify_timer = 0;
+	}
+
+	player->changed_events = 0;
+}
+
+int avrcp_player_event(struct avrcp_player *player, uint8_t id, void *data)
+{
+	if (!player)
+		return -ENOTCONN;
+
+	if (id == AVRCP_EVENT_TRACK_CHANGED)
+		player_flush_metadata(player);
+
+	if (player->session == NULL)
+		return -ENOTCONN;
+
+	if (!(player->registered_events & (1 << id)))
+		return 0;
+
+	if (avrcp_tg_config.notify_delay == 0)
+		return player_send_event(player, id, data);
+
+	/* Only the latest value of each event within the window is sent */
+	switch (id) {
+	case AVRCP_EVENT_STATUS_CHANGED:
+		player->changed_status = *((uint8_t *) data);
+		break;
+	case AVRCP_EVENT_TRACK_CHANGED:
+		memcpy(&player->changed_uid, data, sizeof(uint64_t));
+		break;
+	case AVRCP_EVENT_TRACK_REACHED_END:
+	case AVRCP_EVENT_TRACK_REACHED_START:
+		break;
+	default:
+		error("Unknown event %u", id);
+		return -EINVAL;
+	}
+
+	player->changed_events |= 1 << id;
+
+	if (player->notify_timer == 0)
+		player->notify_timer = g_timeout_add(
+						avrcp_tg_config.notify_delay,
+						notify_timeout, player);
+
+	return 0;
+}
+
 static uint16_t player_write_media_attribute(struct avrcp_player *player,
 						uint32_t id, uint8_t *buf,
 						uint16_t *pos,
@@ -478,28 +618,18 @@ static uint16_t player_write_media_attribute(struct avrcp_player *player,
 {
 	uint16_t len;
 	uint16_t attr_len;
-	char valstr[20];
-	void *value;
+	const char *value;
 
 	DBG("%u", id);
 
-	value = player->cb->get_metadata(id, player->user_data);
+	value = player_get_metadata(player, id);
 	if (value == NULL) {
 		*offset = 0;
 		return 0;
 	}
 
-	switch (id) {
-	case AVRCP_MEDIA_ATTRIBUTE_TRACK:
-	case AVRCP_MEDIA_ATTRIBUTE_N_TRACKS:
-	case AVRCP_MEDIA_ATTRIBUTE_DURATION:
-		snprintf(valstr, 20, "%u", GPOINTER_TO_UINT(value));
-		value = valstr;
-		break;
-	}
-
 	attr_len = strlen(value);
-	value = ((char *) value) + *offset;
+	value += *offset;
 	len = attr_len - *offset;
 
 	if (len > AVRCP_PDU_MTU - *pos) {
@@ -723,7 +853,17 @@ static uint8_t avrcp_handle_get_element_attributes(struct avrcp_player *player,
 		 * Return all available information, at least
 		 * title must be returned if there's a track selected.
 		 */
-		attr_ids = player->cb->list_metadata(player->user_data);
+		uint32_t id;
+
+		for (id = AVRCP_MEDIA_ATTRIBUTE_LAST, attr_ids = NULL;
+				id > AVRCP_MEDIA_ATTRIBUTE_ILLEGAL; id--) {
+			if (player_get_metadata(player, id) == NULL)
+				continue;
+
+			attr_ids = g_list_prepend(attr_ids,
+							GUINT_TO_POINTER(id));
+		}
+
 		len = g_list_length(attr_ids);
 	} else {
 		unsigned int i;
@@ -1251,6 +1391,7 @@ static void state_changed(struct audio_device *dev, avctp_state_t old_state,
 		player->session = NULL;
 		player->dev = NULL;
 		player->registered_events = 0;
+		player_cancel_events(player);
 
 		if (player->handler) {
 			avctp_unregister_pdu_handler(player->handler);
@@ -1312,7 +1453,8 @@ static void setup_avrcp_tg_config(GKeyFile *config,
 				gboolean *enabled,
 				uint16_t *avctp_version,
 				uint16_t *avrcp_version,
-				uint16_t *disabled_features)
+				uint16_t *disabled_features,
+				guint *notify_delay)
 {
 	GError *err = NULL;
 	gboolean b;
@@ -1373,6 +1515,14 @@ static void setup_avrcp_tg_config(GKeyFile *config,
 			*disabled_features |= AVRCP_FEATURE_PLAYER_SETTINGS;
 	}
 	g_strfreev(list);
+
+	i = g_key_file_get_integer(config, "AVRCP", "NotificationDelay", &err);
+	if (err) {
+		DBG("audio.conf: %s", err->message);
+		g_error_free(err);
+		err = NULL;
+	} else if (i >= 0)
+		*notify_delay = i;
 }
 
 static void setup_avrcp_ct_config(GKeyFile *config,
@@ -1460,7 +1610,8 @@ int avrcp_register(DBusConnection *conn, const bdaddr_t *src, GKeyFile *config)
 				&avrcp_tg_config.enabled,
 				&avrcp_tg_config.avctp_ver,
 				&avrcp_tg_config.avrcp_ver,
-				&avrcp_tg_config.disabled_features);
+				&avrcp_tg_config.disabled_features,
+				&avrcp_tg_config.notify_delay);
 
 		setup_avrcp_ct_config(config,
 				&avrcp_ct_config.enabled,
@@ -1533,6 +1684,8 @@ static void player_destroy(gpointer data)
 		player->destroy(player->user_data);
 
 	player_abort_pending_pdu(player);
+	player_cancel_events(player);
+	player_flush_metadata(player);
 
 	if (player->handler)
 		avctp_unregister_pdu_handler(player->handler);
@@ -66,6 +66,8 @@
 
 #define BUF_SIZE 1024
 
+#define EVENT_HASH_SIZE 64
+
 #define HEADSET_GAIN_SPEAKER 'S'
 #define HEADSET_GAIN_MICROPHONE 'M'
 
@@ -80,6 +82,7 @@ static struct {
 	int number_type;		/* Incoming number type */
 	guint ring_timer;		/* For incoming call indication */
 	const char *chld;		/* Response to AT+CHLD=? */
+	char *cind_ranges;		/* Response to AT+CIND=? */
 } ag = {
 	.telephony_ready = FALSE,
 	.features = 0,
@@ -181,6 +184,7 @@ struct headset {
 struct event {
 	const char *cmd;
 	int (*callback) (struct audio_device *device, const char *buf);
+	size_t len;
 };
 
 static GSList *headset_callbacks = NULL;
@@ -287,17 +291,11 @@ static const char *state2str(headset_state_t state)
 	return NULL;
 }
 
-static int headset_send_valist(struct headset *hs, char *format, va_list ap)
+static int headset_write(struct headset *hs, const char *rsp, size_t count)
 {
-	char rsp[BUF_SIZE];
-	ssize_t total_written, count;
+	size_t total_written;
 	int fd;
 
-	count = vsnprintf(rsp, sizeof(rsp), format, ap);
-
-	if (count < 0)
-		return -EINVAL;
-
 	if (!hs->rfcomm) {
 		error("headset_send: the headset is not connected");
 		return -EIO;
@@ -320,6 +318,21 @@ static int headset_send_valist(struct headset *hs, char *format, va_list ap)
 	return 0;
 }
 
+static int headset_send_valist(struct headset *hs, char *format, va_list ap)
+{
+	char rsp[BUF_SIZE];
+	int count;
+
+	count = vsnprintf(rsp, sizeof(rsp), format, ap);
+	if (count < 0)
+		return -EINVAL;
+
+	if ((size_t) count >= sizeof(rsp))
+		count = sizeof(rsp) - 1;
+
+	return headset_write(hs, rsp, count);
+}
+
 static int __attribute__((format(printf, 2, 3)))
 			headset_send(struct headset *hs, char *format, ...)
 {
@@ -376,30 +389,30 @@ static char *indicator_ranges(const struct indicator *indicators)
 	return g_string_free(gstr, FALSE);
 }
 
-static char *indicator_values(const struct indicator *indicators)
+static size_t indicator_values(const struct indicator *indicators,
+						char *str, size_t size)
 {
+	size_t len;
 	int i;
-	GString *gstr;
 
-	gstr = g_string_new("\r\n+CIND: ");
+	len = snprintf(str, size, "\r\n+CIND: ");
 
-	for (i = 0; indicators[i].desc != NULL; i++) {
-		if (i == 0)
-			g_string_append_printf(gstr, "%d", indicators[i].val);
-		else
-			g_string_append_printf(gstr, ",%d", indicators[i].val);
-	}
+	for (i = 0; indicators[i].desc != NULL && len < size; i++)
+		len += snprintf(str + len, size - len, i == 0 ? "%d" : ",%d",
+							indicators[i].val);
 
-	g_string_append(gstr, "\r\n");
+	if (len < size)
+		len += snprintf(str + len, size - len, "\r\n");
 
-	return g_string_free(gstr, FALSE);
+	return len < size ? len : size - 1;
 }
 
 static int report_indicators(struct audio_device *device, const char *buf)
 {
 	struct headset *hs = device->headset;
+	char str[BUF_SIZE];
+	size_t len;
 	int err;
-	char *str;
 
 	if (strlen(buf) < 8)
 		return -EINVAL;
@@ -409,14 +422,18 @@ static int report_indicators(struct audio_device *device, const char *buf)
 		return headset_send(hs, "\r\nERROR\r\n");
 	}
 
-	if (buf[7] == '=')
-		str = indicator_ranges(ag.indicators);
-	else
-		str = indicator_values(ag.indicators);
-
-	err = headset_send(hs, "%s", str);
+	if (buf[7] == '=') {
+		/* The ranges never change after telephony_ready_ind so
+		 * the response is formatted only once */
+		if (ag.cind_ranges == NULL)
+			ag.cind_ranges = indicator_ranges(ag.indicators);
 
-	g_free(str);
+		err = headset_write(hs, ag.cind_ranges,
+						strlen(ag.cind_ranges));
+	} else {
+		len = indicator_values(ag.indicators, str, sizeof(str));
+		err = headset_write(hs, str, len);
+	}
 
 	if (err < 0)
 		return err;
@@ -443,7 +460,7 @@ static void pending_connect_finalize(struct audio_device *dev)
 		return;
 
 	if (p->svclass)
-		bt_cancel_discovery(&dev->src, &dev->dst);
+		bt_cancel_discovery(&dev->src, &dev->dst, dev);
 
 	g_slist_foreach(p->callbacks, (GFunc) pending_connect_complete, dev);
 
@@ -509,8 +526,22 @@ static void __attribute__((format(printf, 3, 4)))
 					int (*cmp) (struct headset *hs),
 					char *format, ...)
 {
+	char rsp[BUF_SIZE];
 	GSList *l;
 	va_list ap;
+	int count;
+
+	/* Format the response once and write the same buffer to every
+	 * matching headset */
+	va_start(ap, format);
+	count = vsnprintf(rsp, sizeof(rsp), format, ap);
+	va_end(ap);
+
+	if (count < 0)
+		return;
+
+	if ((size_t) count >= sizeof(rsp))
+		count = sizeof(rsp) - 1;
 
 	for (l = devices; l != NULL; l = l->next) {
 		struct audio_device *device = l->data;
@@ -522,12 +553,10 @@ static void __attribute__((format(printf, 3, 4)))
 		if (cmp && cmp(hs) != 0)
 			continue;
 
-		va_start(ap, format);
-		ret = headset_send_valist(hs, format, ap);
+		ret = headset_write(hs, rsp, count);
 		if (ret < 0)
 			error("Failed to send to headset: %s (%d)",
 					strerror(-ret), -ret);
-		va_end(ap);
 	}
 }
 
@@ -731,22 +760,29 @@ int telephony_event_reporting_rsp(void *telephony_device, cme_error_t err)
 
 static int event_reporting(struct audio_device *dev, const char *buf)
 {
-	char **tokens; /* <mode>, <keyp>, <disp>, <ind>, <bfr> */
+	const char *args[4]; /* <mode>, <keyp>, <disp>, <ind>, <bfr> */
+	const char *p;
+	int i;
 
 	if (strlen(buf) < 13)
 		return -EINVAL;
 
-	tokens = g_strsplit(&buf[8], ",", 5);
-	if (g_strv_length(tokens) < 4) {
-		g_strfreev(tokens);
-		return -EINVAL;
-	}
+	/* Slice the arguments in place instead of splitting them into
+	 * separately allocated strings */
+	p = &buf[8];
+	for (i = 0; i < 4; i++) {
+		if (p == NULL)
+			return -EINVAL;
 
-	ag.er_mode = atoi(tokens[0]);
-	ag.er_ind = atoi(tokens[3]);
+		args[i] = p;
 
-	g_strfreev(tokens);
-	tokens = NULL;
+		p = strchr(p, ',');
+		if (p != NULL)
+			p++;
+	}
+
+	ag.er_mode = atoi(args[0]);
+	ag.er_ind = atoi(args[3]);
 
 	DBG("Event reporting (CMER): mode=%d, ind=%d",
 			ag.er_mode, ag.er_ind);
@@ -1211,7 +1247,8 @@ static int apple_command(struct audio_device *device, const char *buf)
 static struct event event_callbacks[] = {
 	{ "ATA", answer_call },
 	{ "ATD", dial_number },
-	{ "AT+VG", signal_gain_setting },
+	{ "AT+VGS", signal_gain_setting },
+	{ "AT+VGM", signal_gain_setting },
 	{ "AT+BRSF", supported_features },
 	{ "AT+CIND", report_indicators },
 	{ "AT+CMER", event_reporting },
@@ -1234,18 +1271,91 @@ static struct event event_callbacks[] = {
 	{ 0 }
 };
 
+static struct event *event_hash[EVENT_HASH_SIZE];
+
+static unsigned int event_hash_key(const char *cmd, size_t len)
+{
+	unsigned int key = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		key = key * 31 + (unsigned char) cmd[i];
+
+	return key % EVENT_HASH_SIZE;
+}
+
+static void event_hash_init(void)
+{
+	struct event *ev;
+
+	for (ev = event_callbacks; ev->cmd; ev++) {
+		unsigned int key;
+
+		ev->len = strlen(ev->cmd);
+		key = event_hash_key(ev->cmd, ev->len);
+
+		while (event_hash[key] != NULL)
+			key = (key + 1) % EVENT_HASH_SIZE;
+
+		event_hash[key] = ev;
+	}
+}
+
+/* Returns the length of the command name at the start of buf: "ATx" for
+ * basic commands and "AT+NAME" for extended ones, so that the name can be
+ * looked up without copying it out of the receive buffer */
+static size_t event_token(const char *buf)
+{
+	size_t len;
+
+	if (buf[0] != 'A' || buf[1] != 'T' || buf[2] == '\0')
+		return 0;
+
+	if (buf[2] != '+')
+		return 3;
+
+	for (len = 3; buf[len] >= 'A' && buf[len] <= 'Z'; len++);
+
+	return len;
+}
+
+static struct event *find_event(const char *buf)
+{
+	unsigned int key;
+	size_t len;
+
+	if (event_callbacks[0].len == 0)
+		event_hash_init();
+
+	len = event_token(buf);
+	if (len == 0)
+		return NULL;
+
+	key = event_hash_key(buf, len);
+
+	while (event_hash[key] != NULL) {
+		struct event *ev = event_hash[key];
+
+		if (ev->len == len && memcmp(ev->cmd, buf, len) == 0)
+			return ev;
+
+		key = (key + 1) % EVENT_HASH_SIZE;
+	}
+
+	return NULL;
+}
+
 static int handle_event(struct audio_device *device, const char *buf)
 {
 	struct event *ev;
 
 	DBG("Received %s", buf);
 
-	for (ev = event_callbacks; ev->cmd; ev++) {
-		if (!strncmp(buf, ev->cmd, strlen(ev->cmd)))
-			return ev->callback(device, buf);
-	}
+	ev = find_event(buf);
+	if (ev == NULL)
+		return -EINVAL;
 
-	return -EINVAL;
+	return ev->callback(device, buf);
 }
 
 static void close_sco(struct audio_device *device)
@@ -1271,7 +1381,6 @@ static gboolean rfcomm_io_cb(GIOChannel *chan, GIOCondition cond,
 {
 	struct headset *hs;
 	struct headset_slc *slc;
-	unsigned char buf[BUF_SIZE];
 	ssize_t bytes_read;
 	size_t free_space;
 	int fd;
@@ -1291,21 +1400,23 @@ static gboolean rfcomm_io_cb(GIOChannel *chan, GIOCondition cond,
 
 	fd = g_io_channel_unix_get_fd(chan);
 
-	bytes_read = read(fd, buf, sizeof(buf) - 1);
-	if (bytes_read < 0)
-		return TRUE;
-
 	free_space = sizeof(slc->buf) - slc->data_start -
 			slc->data_length - 1;
 
-	if (free_space < (size_t) bytes_read) {
+	if (free_space == 0) {
 		/* Very likely that the HS is sending us garbage so
 		 * just ignore the data and disconnect */
 		error("Too much data to fit incoming buffer");
 		goto failed;
 	}
 
-	memcpy(&slc->buf[slc->data_start], buf, bytes_read);
+	/* Read straight into the command buffer, commands are parsed in
+	 * place from there */
+	bytes_read = read(fd, &slc->buf[slc->data_start + slc->data_length],
+								free_space);
+	if (bytes_read < 0)
+		return TRUE;
+
 	slc->data_length += bytes_read;
 
 	/* Make sure the data is null terminated so we can use string
@@ -1349,6 +1460,14 @@ static gboolean rfcomm_io_cb(GIOChannel *chan, GIOCondition cond,
 			slc->data_start = 0;
 	}
 
+	/* Move a partially received command to the start of the buffer so
+	 * that the rest of it always fits */
+	if (slc->data_start > 0) {
+		memmove(slc->buf, &slc->buf[slc->data_start],
+							slc->data_length);
+		slc->data_start = 0;
+	}
+
 	return TRUE;
 
 failed:
@@ -2923,6 +3042,9 @@ int telephony_ready_ind(uint32_t features,
 	ag.rh = rh;
 	ag.chld = chld;
 
+	g_free(ag.cind_ranges);
+	ag.cind_ranges = NULL;
+
 	DBG("Telephony plugin initialized");
 
 	print_ag_features(ag.features);
@@ -2935,6 +3057,7 @@ int telephony_ready_ind(uint32_t features,
 int telephony_deinit(void)
 {
 	g_free(ag.number);
+	g_free(ag.cind_ranges);
 
 	memset(&ag, 0, sizeof(ag));
 
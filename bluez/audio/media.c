@@ -1020,14 +1020,15 @@ static void media_player_free(gpointer data)
 						AVRCP_EVENT_STATUS_CHANGED,
 						&new_status);
 		} else {
-			if (new_status != AVRCP_PLAY_STATUS_STOPPED) {
+			if (new_status != AVRCP_PLAY_STATUS_STOPPED)
 				avrcp_player_event(adapter->avrcp_player,
 						AVRCP_EVENT_TRACK_REACHED_START,
 						NULL);
-				avrcp_player_event(adapter->avrcp_player,
+
+			/* The metadata now comes from another player */
+			avrcp_player_event(adapter->avrcp_player,
 						AVRCP_EVENT_TRACK_CHANGED,
 						&new_uid);
-			}
 		}
 	}
 
@@ -1297,18 +1298,6 @@ static int set_setting(uint8_t attr, uint8_t val, void *user_data)
 	return 0;
 }
 
-static GList *list_metadata(void *user_data)
-{
-	struct media_player *mp = user_data;
-
-	DBG("");
-
-	if (mp->track == NULL)
-		return NULL;
-
-	return g_hash_table_get_keys(mp->track);
-}
-
 static uint64_t get_uid(void *user_data)
 {
 	struct media_player *mp = user_data;
@@ -1897,18 +1886,6 @@ static int proxy_set_setting(uint8_t attr, uint8_t val, void *user_data)
 	return -EINVAL;
 }
 
-static GList *proxy_list_metadata(void *user_data)
-{
-	struct media_adapter *adapter = user_data;
-
-	DBG("");
-
-	if (adapter->players)
-		return list_metadata(g_slist_nth_data(adapter->players, 0));
-
-	return NULL;
-}
-
 static uint64_t proxy_get_uid(void *user_data)
 {
 	struct media_adapter *adapter = user_data;
@@ -1979,7 +1956,6 @@ static void proxy_free(gpointer data)
 static struct avrcp_player_cb proxy_cb = {
 	.get_setting = proxy_get_setting,
 	.set_setting = proxy_set_setting,
-	.list_metadata = proxy_list_metadata,
 	.get_uid = proxy_get_uid,
 	.get_metadata = proxy_get_metadata,
 	.get_position = proxy_get_position,
@@ -862,6 +862,33 @@ static snd_pcm_sframes_t bluetooth_hsp_read(snd_pcm_ioplug_t *io,
 	if (data->count > 0)
 		goto proceed;
 
+	buff = (unsigned char *) areas->addr +
+			(areas->first + areas->step * offset) / 8;
+
+	/* If a whole packet fits receive it straight into the ring buffer
+	 * instead of bouncing it through data->buffer */
+	if (size * frame_size >= data->link_mtu &&
+					data->link_mtu % frame_size == 0) {
+		nrecv = recv(data->stream.fd, buff, data->link_mtu,
+					io->nonblock ? MSG_DONTWAIT : 0);
+		if (nrecv < 0) {
+			ret = (errno == EPIPE) ? -EIO : -errno;
+			goto done;
+		}
+
+		if ((unsigned int) nrecv != data->link_mtu) {
+			ret = -EIO;
+			SNDERR(strerror(-ret));
+			goto done;
+		}
+
+		data->hw_ptr = (data->hw_ptr + data->link_mtu / frame_size) %
+					io->buffer_size;
+
+		ret = data->link_mtu / frame_size;
+		goto done;
+	}
+
 	nrecv = recv(data->stream.fd, data->buffer, data->link_mtu,
 					io->nonblock ? MSG_DONTWAIT : 0);
 
@@ -933,6 +960,22 @@ static snd_pcm_sframes_t bluetooth_hsp_write(snd_pcm_ioplug_t *io,
 	/* Ready for more data */
 	buff = (uint8_t *) areas->addr +
 			(areas->first + areas->step * offset) / 8;
+
+	/* A whole packet is available in the ring buffer so send it from
+	 * there without copying it to data->buffer first */
+	if (data->count == 0 && frames_to_read * frame_size == data->link_mtu) {
+		rsend = send(data->stream.fd, buff, data->link_mtu,
+				io->nonblock ? MSG_DONTWAIT : 0);
+		if (rsend > 0)
+			ret = frames_to_read;
+		else if (rsend < 0)
+			ret = (errno == EPIPE) ? -EIO : -errno;
+		else
+			ret = -EIO;
+
+		goto done;
+	}
+
 	memcpy(data->buffer + data->count, buff, frame_size * frames_to_read);
 
 	/* Remember we have some frames in the pipe now */
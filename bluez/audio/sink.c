@@ -572,6 +572,45 @@ static DBusMessage *sink_get_properties(DBusConnection *conn,
 	return reply;
 }
 
+static DBusMessage *sink_get_setup_times(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	struct audio_device *device = data;
+	struct avdtp_setup_times times;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter dict;
+
+	if (!avdtp_get_setup_times(&device->src, &device->dst, &times))
+		return btd_error_not_available(msg);
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+
+	dict_append_entry(&dict, "Cached", DBUS_TYPE_BOOLEAN, &times.cached);
+	dict_append_entry(&dict, "Connect", DBUS_TYPE_UINT32, &times.connect);
+	dict_append_entry(&dict, "Discover", DBUS_TYPE_UINT32,
+							&times.discover);
+	dict_append_entry(&dict, "GetCapabilities", DBUS_TYPE_UINT32,
+						&times.get_capabilities);
+	dict_append_entry(&dict, "SetConfiguration", DBUS_TYPE_UINT32,
+						&times.set_configuration);
+	dict_append_entry(&dict, "Open", DBUS_TYPE_UINT32, &times.open);
+	dict_append_entry(&dict, "Start", DBUS_TYPE_UINT32, &times.start);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
 static DBusMessage *sink_set_property(DBusConnection *conn,
 					DBusMessage *msg, void *data)
 {
@@ -627,6 +666,9 @@ static const GDBusMethodTable sink_methods[] = {
 	{ GDBUS_METHOD("SetProperty",
 			GDBUS_ARGS({ "name", "s" }, { "value", "v" }), NULL,
 			sink_set_property) },
+	{ GDBUS_METHOD("GetSetupTimes",
+				NULL, GDBUS_ARGS({ "times", "a{sv}" }),
+				sink_get_setup_times) },
 	{ }
 };
 
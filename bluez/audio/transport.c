@@ -103,6 +103,7 @@ struct media_transport {
 					DBusMessageIter *value);
 	GDestroyNotify		destroy;
 	void			*data;
+	struct property_batch	*props;		/* Pending PropertyChanged */
 };
 
 void media_transport_destroy(struct media_transport *transport)
@@ -1014,6 +1015,8 @@ static void media_transport_free(void *data)
 	if (transport->destroy != NULL)
 		transport->destroy(transport->data);
 
+	property_batch_free(transport->props);
+
 	if (transport->conn)
 		dbus_connection_unref(transport->conn);
 
@@ -1029,9 +1032,7 @@ static void headset_nrec_changed(struct audio_device *dev, gboolean nrec,
 
 	DBG("");
 
-	emit_property_changed(transport->conn, transport->path,
-				MEDIA_TRANSPORT_INTERFACE, "NREC",
-				DBUS_TYPE_BOOLEAN, &nrec);
+	property_batch_set(transport->props, "NREC", DBUS_TYPE_BOOLEAN, &nrec);
 }
 
 struct media_transport *media_transport_create(DBusConnection *conn,
@@ -1053,6 +1054,8 @@ struct media_transport *media_transport_create(DBusConnection *conn,
 	transport->size = size;
 	transport->path = g_strdup_printf("%s/fd%d", device->path, fd++);
 	transport->fd = -1;
+	transport->props = property_batch_new(conn, transport->path,
+						MEDIA_TRANSPORT_INTERFACE);
 
 	uuid = media_endpoint_get_uuid(endpoint);
 	if (strcasecmp(uuid, A2DP_SOURCE_UUID) == 0 ||
@@ -1127,9 +1130,8 @@ void media_transport_update_delay(struct media_transport *transport,
 
 	a2dp->delay = delay;
 
-	emit_property_changed(transport->conn, transport->path,
-				MEDIA_TRANSPORT_INTERFACE, "Delay",
-				DBUS_TYPE_UINT16, &a2dp->delay);
+	property_batch_set(transport->props, "Delay", DBUS_TYPE_UINT16,
+								&a2dp->delay);
 }
 
 struct audio_device *media_transport_get_dev(struct media_transport *transport)
@@ -1148,7 +1150,6 @@ void media_transport_update_volume(struct media_transport *transport,
 
 	a2dp->volume = volume;
 
-	emit_property_changed(transport->conn, transport->path,
-				MEDIA_TRANSPORT_INTERFACE, "Volume",
-				DBUS_TYPE_UINT16, &a2dp->volume);
+	property_batch_set(transport->props, "Volume", DBUS_TYPE_UINT16,
+								&a2dp->volume);
 }
@@ -30,15 +30,66 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include "bt.h"
+#include "mainloop.h"
 #include "btdev.h"
 
 #define le16_to_cpu(val) (val)
 #define cpu_to_le16(val) (val)
 
+#define BTDEV_HASH_SIZE 256
+#define CONN_HASH_SIZE 64
+
+#define acl_handle(h)		((h) & 0x0fff)
+#define acl_flags(h)		((h) >> 12)
+#define acl_handle_pack(h, f)	((uint16_t) ((h) | ((f) << 12)))
+
+#define MAX_CONN_HANDLE 0x0eff
+
+#define LE_LINK 0x80
+
+/* Random advDelay added to every advertising interval */
+#define ADV_DELAY_MAX 10000
+
+/* Cost of a retransmission when no bandwidth limit is set */
+#define RETRANSMIT_SLOT 1250
+
+struct btdev_conn {
+	struct btdev *dev;		/* Local controller */
+	struct btdev_conn *link;	/* Same link on the remote controller */
+	struct btdev_conn *next;	/* Next in the handle hash chain */
+	uint16_t handle;
+	uint8_t  link_type;
+	uint64_t tx_free;		/* When the link is done transmitting */
+	uint64_t rx_last;		/* Last delivery, keeps ACL in order */
+};
+
+enum btdev_event_type {
+	BTDEV_EVENT_DELIVER,
+	BTDEV_EVENT_COMPLETE,
+	BTDEV_EVENT_ADVERTISE,
+};
+
+struct btdev_event {
+	struct btdev_event *next;
+	uint64_t when;
+	enum btdev_event_type type;
+	struct btdev *dev;
+	uint16_t handle;
+	uint16_t len;
+	void *data;
+};
+
 struct btdev {
-	struct btdev *conn;
+	struct btdev *next;		/* Next in the bdaddr hash chain */
+
+	struct btdev_conn *conns[CONN_HASH_SIZE];
+	unsigned int num_conns;
+	uint16_t next_handle;
 
 	btdev_send_func send_handler;
 	void *send_data;
@@ -50,6 +101,8 @@ struct btdev {
 	uint8_t  features[8];
 	uint16_t acl_mtu;
 	uint16_t acl_max_pkt;
+	uint16_t acl_pkts_pending;
+	struct btdev_link_model link_model;
 	uint8_t  country_code;
 	uint8_t  bdaddr[6];
 	uint8_t  le_features[8];
@@ -73,52 +126,305 @@ struct btdev {
 	uint8_t  le_supported;
 	uint8_t  le_simultaneous;
 	uint8_t  le_event_mask[8];
+
+	uint8_t  random_addr[6];
+	uint16_t le_adv_interval;
+	uint8_t  le_adv_type;
+	uint8_t  le_adv_own_addr_type;
+	uint8_t  le_adv_direct_addr[6];
+	uint8_t  le_adv_data[31];
+	uint8_t  le_adv_data_len;
+	uint8_t  le_scan_data[31];
+	uint8_t  le_scan_data_len;
+	uint8_t  le_adv_enable;
+	struct btdev *le_adv_next;	/* Next advertising controller */
+
+	uint8_t  le_scan_type;
+	uint8_t  le_scan_own_addr_type;
+	uint8_t  le_scan_enable;
+	uint8_t  le_filter_dup;
+	struct btdev *le_scan_next;	/* Next scanning controller */
+
+	uint8_t  le_conn_pending;
+	uint8_t  le_conn_addr_type;
+	uint8_t  le_conn_addr[6];
+	uint8_t  le_conn_own_addr_type;
+	uint16_t le_conn_interval;
+	uint16_t le_conn_latency;
+	uint16_t le_conn_supv_timeout;
+	struct btdev *le_conn_next;	/* Next initiating controller */
+};
+
+static struct btdev *btdev_hash[BTDEV_HASH_SIZE] = { };
+
+static struct btdev_link_model default_link_model = {
+	.acl_mtu	= 192,
+	.acl_max_pkt	= 1,
 };
 
-#define MAX_BTDEV_ENTRIES 16
+static uint32_t random_state = 1;
+
+static struct btdev_event *event_queue = NULL;
+static int event_timer = -1;
+
+static struct btdev *le_advertisers = NULL;
+static struct btdev *le_scanners = NULL;
+static struct btdev *le_initiators = NULL;
+
+static inline unsigned int bdaddr_hash(const uint8_t *bdaddr)
+{
+	unsigned int i, hash = 0;
+
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + bdaddr[i];
+
+	return hash % BTDEV_HASH_SIZE;
+}
+
+static inline void add_btdev(struct btdev *btdev)
+{
+	struct btdev **tail = &btdev_hash[bdaddr_hash(btdev->bdaddr)];
+
+	/* Append, so that with duplicate addresses the oldest one wins */
+	while (*tail)
+		tail = &(*tail)->next;
+
+	btdev->next = NULL;
+	*tail = btdev;
+}
+
+static inline void del_btdev(struct btdev *btdev)
+{
+	struct btdev **prev = &btdev_hash[bdaddr_hash(btdev->bdaddr)];
+
+	for (; *prev; prev = &(*prev)->next) {
+		if (*prev == btdev) {
+			*prev = btdev->next;
+			break;
+		}
+	}
+}
+
+static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
+{
+	struct btdev *btdev;
+
+	for (btdev = btdev_hash[bdaddr_hash(bdaddr)]; btdev;
+						btdev = btdev->next) {
+		if (!memcmp(btdev->bdaddr, bdaddr, 6))
+			return btdev;
+	}
+
+	return NULL;
+}
+
+static struct btdev_conn *find_conn_by_handle(struct btdev *btdev,
+							uint16_t handle)
+{
+	struct btdev_conn *conn;
+
+	for (conn = btdev->conns[handle % CONN_HASH_SIZE]; conn;
+							conn = conn->next) {
+		if (conn->handle == handle)
+			return conn;
+	}
+
+	return NULL;
+}
+
+static struct btdev_conn *find_conn_by_bdaddr(struct btdev *btdev,
+							const uint8_t *bdaddr)
+{
+	unsigned int i;
+
+	for (i = 0; i < CONN_HASH_SIZE; i++) {
+		struct btdev_conn *conn;
+
+		for (conn = btdev->conns[i]; conn; conn = conn->next) {
+			if (conn->link && !memcmp(conn->link->dev->bdaddr,
+								bdaddr, 6))
+				return conn;
+		}
+	}
+
+	return NULL;
+}
+
+static inline uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
+static inline uint32_t get_random(void)
+{
+	/* xorshift32, seeded by the user so runs are reproducible */
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
 
-static inline int add_btdev(struct btdev *btdev)
+	return random_state;
+}
+
+static inline int link_model_active(const struct btdev_link_model *model)
 {
-	int i, index = -1;
+	return model->bandwidth || model->latency || model->jitter ||
+								model->loss;
+}
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == NULL) {
-			index = i;
-			btdev_list[index] = btdev;
+static void event_free(struct btdev_event *event)
+{
+	free(event->data);
+	free(event);
+}
+
+static void purge_events(struct btdev *btdev, uint16_t handle)
+{
+	struct btdev_event **prev = &event_queue;
+
+	while (*prev) {
+		struct btdev_event *event = *prev;
+
+		if (event->dev != btdev || event->handle != handle) {
+			prev = &event->next;
+			continue;
+		}
+
+		/* The host gets its buffers back on disconnection */
+		if (event->type == BTDEV_EVENT_COMPLETE)
+			btdev->acl_pkts_pending--;
+
+		*prev = event->next;
+		event_free(event);
+	}
+}
+
+static uint16_t alloc_handle(struct btdev *btdev)
+{
+	unsigned int i;
+
+	if (btdev->num_conns >= MAX_CONN_HANDLE)
+		return 0;
+
+	/* Handles are handed out round robin, like most controllers do,
+	 * so that a stale handle is not immediately reused */
+	for (i = 0; i < MAX_CONN_HANDLE; i++) {
+		uint16_t handle = btdev->next_handle;
+
+		if (handle == 0x0000 || handle > MAX_CONN_HANDLE)
+			handle = 0x0001;
+
+		btdev->next_handle = handle + 1;
+
+		if (!find_conn_by_handle(btdev, handle))
+			return handle;
+	}
+
+	return 0;
+}
+
+static struct btdev_conn *conn_add(struct btdev *btdev, uint8_t link_type)
+{
+	struct btdev_conn *conn;
+	uint16_t handle;
+
+	handle = alloc_handle(btdev);
+	if (!handle)
+		return NULL;
+
+	conn = malloc(sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	memset(conn, 0, sizeof(*conn));
+	conn->dev = btdev;
+	conn->handle = handle;
+	conn->link_type = link_type;
+
+	conn->next = btdev->conns[handle % CONN_HASH_SIZE];
+	btdev->conns[handle % CONN_HASH_SIZE] = conn;
+	btdev->num_conns++;
+
+	return conn;
+}
+
+static void conn_del(struct btdev_conn *conn)
+{
+	struct btdev *btdev = conn->dev;
+	struct btdev_conn **prev = &btdev->conns[conn->handle % CONN_HASH_SIZE];
+
+	for (; *prev; prev = &(*prev)->next) {
+		if (*prev == conn) {
+			*prev = conn->next;
+			btdev->num_conns--;
 			break;
 		}
 	}
 
-	return index;
+	if (conn->link)
+		conn->link->link = NULL;
+
+	purge_events(btdev, conn->handle);
+
+	free(conn);
 }
 
-static inline int del_btdev(struct btdev *btdev)
+static void le_adv_stop(struct btdev *btdev)
 {
-	int i, index = -1;
+	struct btdev **prev;
+
+	if (!btdev->le_adv_enable)
+		return;
+
+	btdev->le_adv_enable = 0x00;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == btdev) {
-			index = i;
-			btdev_list[index] = NULL;
+	for (prev = &le_advertisers; *prev; prev = &(*prev)->le_adv_next) {
+		if (*prev == btdev) {
+			*prev = btdev->le_adv_next;
 			break;
 		}
 	}
 
-	return index;
+	purge_events(btdev, 0x0000);
 }
 
-static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
+static void le_scan_stop(struct btdev *btdev)
 {
-	int i;
+	struct btdev **prev;
+
+	if (!btdev->le_scan_enable)
+		return;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
-			return btdev_list[i];
+	btdev->le_scan_enable = 0x00;
+
+	for (prev = &le_scanners; *prev; prev = &(*prev)->le_scan_next) {
+		if (*prev == btdev) {
+			*prev = btdev->le_scan_next;
+			break;
+		}
 	}
+}
 
-	return NULL;
+static int le_create_conn_cancel(struct btdev *btdev)
+{
+	struct btdev **prev;
+
+	if (!btdev->le_conn_pending)
+		return -1;
+
+	btdev->le_conn_pending = 0x00;
+
+	for (prev = &le_initiators; *prev; prev = &(*prev)->le_conn_next) {
+		if (*prev == btdev) {
+			*prev = btdev->le_conn_next;
+			break;
+		}
+	}
+
+	return 0;
 }
 
 static void hexdump(const unsigned char *buf, uint16_t len)
@@ -170,7 +476,42 @@ static void get_bdaddr(uint16_t id, uint8_t *bdaddr)
 	bdaddr[5] = 0x00;
 }
 
-struct btdev *btdev_create(uint16_t id)
+static void send_packet(struct btdev *btdev, const void *data, uint16_t len)
+{
+	if (!btdev->send_handler)
+		return;
+
+	btdev->send_handler(data, len, btdev->send_data);
+}
+
+static void send_event(struct btdev *btdev, uint8_t event,
+						const void *data, uint8_t len)
+{
+	struct bt_hci_evt_hdr *hdr;
+	uint16_t pkt_len;
+	void *pkt_data;
+
+	pkt_len = 1 + sizeof(*hdr) + len;
+
+	pkt_data = malloc(pkt_len);
+	if (!pkt_data)
+		return;
+
+	((uint8_t *) pkt_data)[0] = BT_H4_EVT_PKT;
+
+	hdr = pkt_data + 1;
+	hdr->evt = event;
+	hdr->plen = len;
+
+	if (len > 0)
+		memcpy(pkt_data + 1 + sizeof(*hdr), data, len);
+
+	send_packet(btdev, pkt_data, pkt_len);
+
+	free(pkt_data);
+}
+
+static struct btdev *btdev_new(void)
 {
 	struct btdev *btdev;
 
@@ -207,71 +548,125 @@ struct btdev *btdev_create(uint16_t id)
 	btdev->features[7] |= 0x02;	/* Inquiry TX Power Level */
 	btdev->features[7] |= 0x80;	/* Extended features */
 
-	btdev->acl_mtu = 192;
-	btdev->acl_max_pkt = 1;
+	btdev->link_model = default_link_model;
+	btdev->acl_mtu = default_link_model.acl_mtu;
+	btdev->acl_max_pkt = default_link_model.acl_max_pkt;
 
 	btdev->country_code = 0x00;
 
-	get_bdaddr(id, btdev->bdaddr);
+	btdev->next_handle = 0x0001;
 
-	add_btdev(btdev);
+	btdev->le_adv_interval = 0x0800;
 
 	return btdev;
 }
 
-void btdev_destroy(struct btdev *btdev)
+struct btdev *btdev_create(uint16_t id)
 {
+	struct btdev *btdev;
+
+	btdev = btdev_new();
 	if (!btdev)
-		return;
+		return NULL;
 
-	del_btdev(btdev);
+	get_bdaddr(id, btdev->bdaddr);
 
-	free(btdev);
+	add_btdev(btdev);
+
+	return btdev;
 }
 
-void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
-							void *user_data)
+struct btdev *btdev_create_peer(uint16_t id)
 {
+	struct btdev *btdev;
+	uint8_t len;
+
+	btdev = btdev_new();
 	if (!btdev)
-		return;
+		return NULL;
 
-	btdev->send_handler = handler;
-	btdev->send_data = user_data;
+	/* Peers live in their own address range so they never clash
+	 * with the controllers handed out to vhci and server clients */
+	get_bdaddr(id, btdev->bdaddr);
+	btdev->bdaddr[2] = 0x01;
+
+	btdev->scan_enable = 0x03;
+	btdev->simple_pairing_mode = 0x01;
+
+	btdev->dev_class[0] = 0x0c;	/* Smart phone */
+	btdev->dev_class[1] = 0x02;
+	btdev->dev_class[2] = 0x5a;
+
+	len = snprintf((char *) btdev->name, sizeof(btdev->name),
+						"BlueZ peer %u", id);
+
+	/* Complete local name, so discovery needs no name requests */
+	btdev->ext_inquiry_rsp[0] = len + 1;
+	btdev->ext_inquiry_rsp[1] = 0x09;
+	memcpy(btdev->ext_inquiry_rsp + 2, btdev->name, len);
+
+	add_btdev(btdev);
+
+	return btdev;
 }
 
-static void send_packet(struct btdev *btdev, const void *data, uint16_t len)
+void btdev_destroy(struct btdev *btdev)
 {
-	if (!btdev->send_handler)
+	struct bt_hci_evt_disconnect_complete dc;
+	unsigned int i;
+
+	if (!btdev)
 		return;
 
-	btdev->send_handler(data, len, btdev->send_data);
-}
+	del_btdev(btdev);
 
-static void send_event(struct btdev *btdev, uint8_t event,
-						const void *data, uint8_t len)
-{
-	struct bt_hci_evt_hdr *hdr;
-	uint16_t pkt_len;
-	void *pkt_data;
+	le_adv_stop(btdev);
+	le_scan_stop(btdev);
+	le_create_conn_cancel(btdev);
 
-	pkt_len = 1 + sizeof(*hdr) + len;
+	dc.status = BT_HCI_ERR_SUCCESS;
+	dc.reason = BT_HCI_ERR_CONN_TIMEOUT;
 
-	pkt_data = malloc(pkt_len);
-	if (!pkt_data)
-		return;
+	for (i = 0; i < CONN_HASH_SIZE; i++) {
+		while (btdev->conns[i]) {
+			struct btdev_conn *conn = btdev->conns[i];
 
-	((uint8_t *) pkt_data)[0] = BT_H4_EVT_PKT;
+			if (conn->link) {
+				struct btdev_conn *link = conn->link;
 
-	hdr = pkt_data + 1;
-	hdr->evt = event;
-	hdr->plen = len;
+				dc.handle = cpu_to_le16(link->handle);
+				send_event(link->dev,
+					BT_HCI_EVT_DISCONNECT_COMPLETE,
+							&dc, sizeof(dc));
+				conn_del(link);
+			}
 
-	if (len > 0)
-		memcpy(pkt_data + 1 + sizeof(*hdr), data, len);
+			conn_del(conn);
+		}
+	}
 
-	send_packet(btdev, pkt_data, pkt_len);
+	free(btdev);
+}
 
-	free(pkt_data);
+void btdev_set_default_link_model(const struct btdev_link_model *model,
+							unsigned int seed)
+{
+	default_link_model = *model;
+
+	if (default_link_model.loss > 99)
+		default_link_model.loss = 99;
+
+	random_state = seed ? seed : 1;
+}
+
+void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
+							void *user_data)
+{
+	if (!btdev)
+		return;
+
+	btdev->send_handler = handler;
+	btdev->send_data = user_data;
 }
 
 static void cmd_complete(struct btdev *btdev, uint16_t opcode,
@@ -317,68 +712,70 @@ static void cmd_status(struct btdev *btdev, uint8_t status, uint16_t opcode)
 	send_event(btdev, BT_HCI_EVT_CMD_STATUS, &cs, sizeof(cs));
 }
 
-static void num_completed_packets(struct btdev *btdev)
+static void num_completed_packets(struct btdev *btdev, uint16_t handle)
 {
-	if (btdev->conn) {
-		struct bt_hci_evt_num_completed_packets ncp;
+	struct bt_hci_evt_num_completed_packets ncp;
 
-		ncp.num_handles = 1;
-		ncp.handle = cpu_to_le16(42);
-		ncp.count = cpu_to_le16(1);
+	ncp.num_handles = 1;
+	ncp.handle = cpu_to_le16(handle);
+	ncp.count = cpu_to_le16(1);
 
-		send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS,
-							&ncp, sizeof(ncp));
-	}
+	send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS, &ncp, sizeof(ncp));
 }
 
-static void inquiry_complete(struct btdev *btdev, uint8_t status)
+static void inquiry_result(struct btdev *btdev, struct btdev *remote)
 {
-	struct bt_hci_evt_inquiry_complete ic;
-	int i;
+	if (!(remote->scan_enable & 0x02))
+		return;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (!btdev_list[i] || btdev_list[i] == btdev)
-			continue;
+	if (btdev->inquiry_mode == 0x02 && remote->ext_inquiry_rsp[0]) {
+		struct bt_hci_evt_ext_inquiry_result ir;
 
-		if (!(btdev_list[i]->scan_enable & 0x02))
-			continue;
+		ir.num_resp = 0x01;
+		memcpy(ir.bdaddr, remote->bdaddr, 6);
+		memcpy(ir.dev_class, remote->dev_class, 3);
+		ir.rssi = -60;
+		memcpy(ir.data, remote->ext_inquiry_rsp, 240);
 
-		if (btdev->inquiry_mode == 0x02 &&
-					btdev_list[i]->ext_inquiry_rsp[0]) {
-			struct bt_hci_evt_ext_inquiry_result ir;
+		send_event(btdev, BT_HCI_EVT_EXT_INQUIRY_RESULT,
+							&ir, sizeof(ir));
+		return;
+	}
 
-			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
-			ir.rssi = -60;
-			memcpy(ir.data, btdev_list[i]->ext_inquiry_rsp, 240);
+	if (btdev->inquiry_mode > 0x00) {
+		struct bt_hci_evt_inquiry_result_with_rssi ir;
 
-			send_event(btdev, BT_HCI_EVT_EXT_INQUIRY_RESULT,
-							&ir, sizeof(ir));
-			continue;
-		}
+		ir.num_resp = 0x01;
+		memcpy(ir.bdaddr, remote->bdaddr, 6);
+		memcpy(ir.dev_class, remote->dev_class, 3);
+		ir.rssi = -60;
 
-		if (btdev->inquiry_mode > 0x00) {
-			struct bt_hci_evt_inquiry_result_with_rssi ir;
+		send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT_WITH_RSSI,
+							&ir, sizeof(ir));
+	} else {
+		struct bt_hci_evt_inquiry_result ir;
 
-			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
-			ir.rssi = -60;
+		ir.num_resp = 0x01;
+		memcpy(ir.bdaddr, remote->bdaddr, 6);
+		memcpy(ir.dev_class, remote->dev_class, 3);
 
-			send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT_WITH_RSSI,
+		send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT,
 							&ir, sizeof(ir));
-		} else {
-			struct bt_hci_evt_inquiry_result ir;
+	}
+}
 
-			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
+static void inquiry_complete(struct btdev *btdev, uint8_t status)
+{
+	struct bt_hci_evt_inquiry_complete ic;
+	struct btdev *remote;
+	int i;
 
-			send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT,
-							&ir, sizeof(ir));
+	for (i = 0; i < BTDEV_HASH_SIZE; i++) {
+		for (remote = btdev_hash[i]; remote; remote = remote->next) {
+			if (remote != btdev)
+				inquiry_result(btdev, remote);
 		}
-        }
+	}
 
 	ic.status = status;
 
@@ -389,23 +786,40 @@ static void conn_complete(struct btdev *btdev,
 					const uint8_t *bdaddr, uint8_t status)
 {
 	struct bt_hci_evt_conn_complete cc;
+	struct btdev *remote = NULL;
+	struct btdev_conn *conn = NULL, *link = NULL;
 
 	if (!status) {
-		struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
+		remote = find_btdev_by_bdaddr(bdaddr);
+		if (!remote)
+			status = BT_HCI_ERR_UNKNOWN_CONN_ID;
+	}
+
+	if (!status) {
+		conn = conn_add(btdev, 0x01);
+		link = conn ? conn_add(remote, 0x01) : NULL;
+
+		if (!link) {
+			if (conn)
+				conn_del(conn);
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+		}
+	}
 
-		btdev->conn = remote;
-		remote->conn = btdev;
+	if (!status) {
+		conn->link = link;
+		link->link = conn;
 
 		cc.status = status;
 		memcpy(cc.bdaddr, btdev->bdaddr, 6);
 		cc.encr_mode = 0x00;
 
-		cc.handle = cpu_to_le16(42);
+		cc.handle = cpu_to_le16(link->handle);
 		cc.link_type = 0x01;
 
 		send_event(remote, BT_HCI_EVT_CONN_COMPLETE, &cc, sizeof(cc));
 
-		cc.handle = cpu_to_le16(42);
+		cc.handle = cpu_to_le16(conn->handle);
 		cc.link_type = 0x01;
 	} else {
 		cc.handle = cpu_to_le16(0x0000);
@@ -424,7 +838,16 @@ static void conn_request(struct btdev *btdev, const uint8_t *bdaddr)
 	struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
 
 	if (remote) {
-		if (remote->scan_enable & 0x01) {
+		if (find_conn_by_bdaddr(btdev, bdaddr))
+			conn_complete(btdev, bdaddr,
+						BT_HCI_ERR_ACL_CONN_EXISTS);
+		else if (!(remote->scan_enable & 0x01))
+			conn_complete(btdev, bdaddr, BT_HCI_ERR_PAGE_TIMEOUT);
+		else if (!remote->send_handler)
+			/* No host behind this one, accept on its behalf */
+			conn_complete(remote, btdev->bdaddr,
+							BT_HCI_ERR_SUCCESS);
+		else {
 			struct bt_hci_evt_conn_request cr;
 
 			memcpy(cr.bdaddr, btdev->bdaddr, 6);
@@ -433,8 +856,7 @@ static void conn_request(struct btdev *btdev, const uint8_t *bdaddr)
 
 			send_event(remote, BT_HCI_EVT_CONN_REQUEST,
 							&cr, sizeof(cr));
-		} else
-			conn_complete(btdev, bdaddr, BT_HCI_ERR_PAGE_TIMEOUT);
+		}
 	} else
 		conn_complete(btdev, bdaddr, BT_HCI_ERR_UNKNOWN_CONN_ID);
 }
@@ -443,9 +865,10 @@ static void disconnect_complete(struct btdev *btdev, uint16_t handle,
 							uint8_t reason)
 {
 	struct bt_hci_evt_disconnect_complete dc;
-	struct btdev *remote;
+	struct btdev_conn *conn;
 
-	if (!btdev) {
+	conn = find_conn_by_handle(btdev, handle);
+	if (!conn) {
 		dc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		dc.handle = cpu_to_le16(handle);
 		dc.reason = 0x00;
@@ -459,13 +882,19 @@ static void disconnect_complete(struct btdev *btdev, uint16_t handle,
 	dc.handle = cpu_to_le16(handle);
 	dc.reason = reason;
 
-	remote = btdev->conn;
+	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+
+	if (conn->link) {
+		struct btdev_conn *link = conn->link;
 
-	btdev->conn = NULL;
-	remote->conn = NULL;
+		dc.handle = cpu_to_le16(link->handle);
 
-	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
-	send_event(remote, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+		send_event(link->dev, BT_HCI_EVT_DISCONNECT_COMPLETE,
+							&dc, sizeof(dc));
+		conn_del(link);
+	}
+
+	conn_del(conn);
 }
 
 static void name_request_complete(struct btdev *btdev,
@@ -490,14 +919,26 @@ static void name_request_complete(struct btdev *btdev,
 							&nc, sizeof(nc));
 }
 
+static struct btdev *find_remote_by_handle(struct btdev *btdev,
+							uint16_t handle)
+{
+	struct btdev_conn *conn = find_conn_by_handle(btdev, handle);
+
+	if (!conn || !conn->link)
+		return NULL;
+
+	return conn->link->dev;
+}
+
 static void remote_features_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_features_complete rfc;
+	struct btdev *remote = find_remote_by_handle(btdev, handle);
 
-	if (btdev->conn) {
+	if (remote) {
 		rfc.status = BT_HCI_ERR_SUCCESS;
 		rfc.handle = cpu_to_le16(handle);
-		memcpy(rfc.features, btdev->conn->features, 8);
+		memcpy(rfc.features, remote->features, 8);
 	} else {
 		rfc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rfc.handle = cpu_to_le16(handle);
@@ -512,8 +953,9 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 								uint8_t page)
 {
 	struct bt_hci_evt_remote_ext_features_complete refc;
+	struct btdev *remote = find_remote_by_handle(btdev, handle);
 
-	if (btdev->conn && page < 0x02) {
+	if (remote && page < 0x02) {
 		refc.handle = cpu_to_le16(handle);
 		refc.page = page;
 		refc.max_page = 0x01;
@@ -521,7 +963,7 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 		switch (page) {
 		case 0x00:
 			refc.status = BT_HCI_ERR_SUCCESS;
-			memcpy(refc.features, btdev->conn->features, 8);
+			memcpy(refc.features, remote->features, 8);
 			break;
 		case 0x01:
 			refc.status = BT_HCI_ERR_SUCCESS;
@@ -547,13 +989,14 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 static void remote_version_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_version_complete rvc;
+	struct btdev *remote = find_remote_by_handle(btdev, handle);
 
-	if (btdev->conn) {
+	if (remote) {
 		rvc.status = BT_HCI_ERR_SUCCESS;
 		rvc.handle = cpu_to_le16(handle);
-		rvc.lmp_ver = btdev->conn->version;
-		rvc.manufacturer = cpu_to_le16(btdev->conn->manufacturer);
-		rvc.lmp_subver = cpu_to_le16(btdev->conn->revision);
+		rvc.lmp_ver = remote->version;
+		rvc.manufacturer = cpu_to_le16(remote->manufacturer);
+		rvc.lmp_subver = cpu_to_le16(remote->revision);
 	} else {
 		rvc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rvc.handle = cpu_to_le16(handle);
@@ -566,6 +1009,349 @@ static void remote_version_complete(struct btdev *btdev, uint16_t handle)
 							&rvc, sizeof(rvc));
 }
 
+static void le_meta_event(struct btdev *btdev, uint8_t sub_event,
+						const void *data, uint8_t len)
+{
+	uint8_t buf[255];
+
+	if (len > sizeof(buf) - 1)
+		return;
+
+	buf[0] = sub_event;
+	memcpy(buf + 1, data, len);
+
+	send_event(btdev, BT_HCI_EVT_LE_META_EVENT, buf, len + 1);
+}
+
+static inline const uint8_t *le_adv_addr(struct btdev *btdev)
+{
+	if (btdev->le_adv_own_addr_type == 0x01)
+		return btdev->random_addr;
+
+	return btdev->bdaddr;
+}
+
+static inline uint64_t adv_interval_usec(struct btdev *btdev)
+{
+	return (uint64_t) btdev->le_adv_interval * 625 +
+					get_random() % (ADV_DELAY_MAX + 1);
+}
+
+static int le_adv_connectable(struct btdev *adv, struct btdev *btdev)
+{
+	switch (adv->le_adv_type) {
+	case 0x00:
+		return 1;
+	case 0x01:
+		return !memcmp(adv->le_adv_direct_addr, btdev->bdaddr, 6);
+	}
+
+	return 0;
+}
+
+static void send_adv_report(struct btdev *btdev, struct btdev *adv,
+				uint8_t event_type, const uint8_t *data,
+				uint8_t data_len)
+{
+	uint8_t buf[sizeof(struct bt_hci_evt_le_adv_report) + 31 + 1];
+	struct bt_hci_evt_le_adv_report *ar = (void *) buf;
+
+	ar->num_reports = 0x01;
+	ar->event_type = event_type;
+	ar->addr_type = adv->le_adv_own_addr_type;
+	memcpy(ar->addr, le_adv_addr(adv), 6);
+	ar->data_len = data_len;
+	memcpy(ar->data, data, data_len);
+	ar->data[data_len] = (uint8_t) -60;	/* RSSI */
+
+	le_meta_event(btdev, BT_HCI_EVT_LE_ADV_REPORT, buf,
+					sizeof(*ar) + data_len + 1);
+}
+
+static void le_adv_report(struct btdev *btdev, struct btdev *adv)
+{
+	/* Directed advertising is only seen by its target */
+	if (adv->le_adv_type == 0x01) {
+		if (le_adv_connectable(adv, btdev))
+			send_adv_report(btdev, adv, 0x01, NULL, 0);
+		return;
+	}
+
+	send_adv_report(btdev, adv, adv->le_adv_type, adv->le_adv_data,
+						adv->le_adv_data_len);
+
+	/* Active scanning gets the scan response of scannable ones */
+	if (btdev->le_scan_type == 0x01 && (adv->le_adv_type == 0x00 ||
+						adv->le_adv_type == 0x02))
+		send_adv_report(btdev, adv, 0x04, adv->le_scan_data,
+						adv->le_scan_data_len);
+}
+
+static void le_adv_report_all(struct btdev *adv)
+{
+	struct btdev *btdev;
+
+	for (btdev = le_scanners; btdev; btdev = btdev->le_scan_next) {
+		if (btdev != adv && !btdev->le_filter_dup)
+			le_adv_report(btdev, adv);
+	}
+}
+
+static void le_conn_complete(struct btdev *btdev, struct btdev *adv,
+							uint8_t status)
+{
+	struct bt_hci_evt_le_conn_complete lcc;
+	struct btdev_conn *conn = NULL, *link = NULL;
+
+	memset(&lcc, 0, sizeof(lcc));
+
+	if (!status) {
+		conn = conn_add(btdev, LE_LINK);
+		link = conn ? conn_add(adv, LE_LINK) : NULL;
+
+		if (!link) {
+			if (conn)
+				conn_del(conn);
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+		}
+	}
+
+	lcc.status = status;
+	lcc.peer_addr_type = btdev->le_conn_addr_type;
+	memcpy(lcc.peer_addr, btdev->le_conn_addr, 6);
+
+	if (status) {
+		le_meta_event(btdev, BT_HCI_EVT_LE_CONN_COMPLETE,
+							&lcc, sizeof(lcc));
+		return;
+	}
+
+	conn->link = link;
+	link->link = conn;
+
+	/* The advertiser becomes slave and stops advertising */
+	le_adv_stop(adv);
+
+	lcc.interval = cpu_to_le16(btdev->le_conn_interval);
+	lcc.latency = cpu_to_le16(btdev->le_conn_latency);
+	lcc.supv_timeout = cpu_to_le16(btdev->le_conn_supv_timeout);
+	lcc.clock_accuracy = 0x00;
+
+	lcc.handle = cpu_to_le16(conn->handle);
+	lcc.role = 0x00;
+	le_meta_event(btdev, BT_HCI_EVT_LE_CONN_COMPLETE, &lcc, sizeof(lcc));
+
+	lcc.handle = cpu_to_le16(link->handle);
+	lcc.role = 0x01;
+	lcc.peer_addr_type = btdev->le_conn_own_addr_type;
+	if (btdev->le_conn_own_addr_type == 0x01)
+		memcpy(lcc.peer_addr, btdev->random_addr, 6);
+	else
+		memcpy(lcc.peer_addr, btdev->bdaddr, 6);
+	le_meta_event(adv, BT_HCI_EVT_LE_CONN_COMPLETE, &lcc, sizeof(lcc));
+}
+
+static void event_timer_arm(void)
+{
+	struct itimerspec itimer;
+
+	if (event_timer < 0)
+		return;
+
+	memset(&itimer, 0, sizeof(itimer));
+
+	if (event_queue) {
+		itimer.it_value.tv_sec = event_queue->when / 1000000;
+		itimer.it_value.tv_nsec = (event_queue->when % 1000000) * 1000;
+	}
+
+	timerfd_settime(event_timer, TFD_TIMER_ABSTIME, &itimer, NULL);
+}
+
+static void event_insert(struct btdev_event *event)
+{
+	struct btdev_event **prev;
+
+	/* Keep the queue sorted, equal times stay in submission order */
+	for (prev = &event_queue; *prev; prev = &(*prev)->next) {
+		if ((*prev)->when > event->when)
+			break;
+	}
+
+	event->next = *prev;
+	*prev = event;
+
+	if (event_queue == event)
+		event_timer_arm();
+}
+
+static void event_timer_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t expired, now;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	if (read(fd, &expired, sizeof(expired)) < 0)
+		return;
+
+	now = get_time();
+
+	while (event_queue && event_queue->when <= now) {
+		struct btdev_event *event = event_queue;
+
+		event_queue = event->next;
+
+		switch (event->type) {
+		case BTDEV_EVENT_DELIVER:
+			send_packet(event->dev, event->data, event->len);
+			break;
+		case BTDEV_EVENT_COMPLETE:
+			event->dev->acl_pkts_pending--;
+			num_completed_packets(event->dev, event->handle);
+			break;
+		case BTDEV_EVENT_ADVERTISE:
+			le_adv_report_all(event->dev);
+
+			/* Advertising repeats until it gets disabled */
+			event->when = now + adv_interval_usec(event->dev);
+			event_insert(event);
+			continue;
+		}
+
+		event_free(event);
+	}
+
+	event_timer_arm();
+}
+
+static int schedule_event(uint64_t when, enum btdev_event_type type,
+				struct btdev *btdev, uint16_t handle,
+				void *data, uint16_t len)
+{
+	struct btdev_event *event;
+
+	if (event_timer < 0) {
+		event_timer = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+		if (event_timer < 0)
+			return -1;
+
+		if (mainloop_add_fd(event_timer, EPOLLIN,
+				event_timer_callback, NULL, NULL) < 0) {
+			close(event_timer);
+			event_timer = -1;
+			return -1;
+		}
+	}
+
+	event = malloc(sizeof(*event));
+	if (!event)
+		return -1;
+
+	memset(event, 0, sizeof(*event));
+	event->when = when;
+	event->type = type;
+	event->dev = btdev;
+	event->handle = handle;
+	event->data = data;
+	event->len = len;
+
+	event_insert(event);
+
+	return 0;
+}
+
+static void le_adv_start(struct btdev *btdev)
+{
+	struct btdev *scanner, **prev;
+
+	btdev->le_adv_enable = 0x01;
+
+	btdev->le_adv_next = le_advertisers;
+	le_advertisers = btdev;
+
+	/* Every scanner sees the new advertiser right away. This is the
+	 * only report filtering scanners get, the others keep receiving
+	 * the periodic advertising events. */
+	for (scanner = le_scanners; scanner; scanner = scanner->le_scan_next) {
+		if (scanner != btdev)
+			le_adv_report(scanner, btdev);
+	}
+
+	schedule_event(get_time() + adv_interval_usec(btdev),
+			BTDEV_EVENT_ADVERTISE, btdev, 0x0000, NULL, 0);
+
+	/* Pending LE Create Connection towards this one */
+	for (prev = &le_initiators; *prev; prev = &(*prev)->le_conn_next) {
+		struct btdev *initiator = *prev;
+
+		if (le_adv_connectable(btdev, initiator) &&
+				initiator->le_conn_addr_type ==
+						btdev->le_adv_own_addr_type &&
+				!memcmp(initiator->le_conn_addr,
+						le_adv_addr(btdev), 6)) {
+			*prev = initiator->le_conn_next;
+			initiator->le_conn_pending = 0x00;
+			le_conn_complete(initiator, btdev,
+						BT_HCI_ERR_SUCCESS);
+			break;
+		}
+	}
+}
+
+static void le_scan_start(struct btdev *btdev, uint8_t filter_dup)
+{
+	struct btdev *adv;
+
+	btdev->le_scan_enable = 0x01;
+	btdev->le_filter_dup = filter_dup;
+
+	btdev->le_scan_next = le_scanners;
+	le_scanners = btdev;
+
+	if (!filter_dup)
+		return;
+
+	/* With duplicate filtering every advertiser is reported once,
+	 * right away, and never again during this scan */
+	for (adv = le_advertisers; adv; adv = adv->le_adv_next) {
+		if (adv != btdev)
+			le_adv_report(btdev, adv);
+	}
+}
+
+static void le_create_conn(struct btdev *btdev,
+				const struct bt_hci_cmd_le_create_conn *lcc)
+{
+	struct btdev *adv;
+
+	btdev->le_conn_addr_type = lcc->peer_addr_type;
+	memcpy(btdev->le_conn_addr, lcc->peer_addr, 6);
+	btdev->le_conn_own_addr_type = lcc->own_addr_type;
+	btdev->le_conn_interval = le16_to_cpu(lcc->max_interval);
+	btdev->le_conn_latency = le16_to_cpu(lcc->latency);
+	btdev->le_conn_supv_timeout = le16_to_cpu(lcc->supv_timeout);
+
+	for (adv = le_advertisers; adv; adv = adv->le_adv_next) {
+		if (adv == btdev || !le_adv_connectable(adv, btdev))
+			continue;
+
+		if (adv->le_adv_own_addr_type != lcc->peer_addr_type)
+			continue;
+
+		if (!memcmp(le_adv_addr(adv), lcc->peer_addr, 6)) {
+			le_conn_complete(btdev, adv, BT_HCI_ERR_SUCCESS);
+			return;
+		}
+	}
+
+	/* Nobody advertising yet, keep initiating until cancelled */
+	btdev->le_conn_pending = 0x01;
+	btdev->le_conn_next = le_initiators;
+	le_initiators = btdev;
+}
+
 static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 {
 	const struct bt_hci_cmd_hdr *hdr = data;
@@ -595,6 +1381,14 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	const struct bt_hci_cmd_write_simple_pairing_mode *wspm;
 	const struct bt_hci_cmd_write_le_host_supported *wlhs;
 	const struct bt_hci_cmd_le_set_event_mask *lsem;
+	const struct bt_hci_cmd_le_set_random_address *lsra;
+	const struct bt_hci_cmd_le_set_adv_parameters *lsap;
+	const struct bt_hci_cmd_le_set_adv_data *lsad;
+	const struct bt_hci_cmd_le_set_scan_rsp_data *lssrd;
+	const struct bt_hci_cmd_le_set_adv_enable *lsae;
+	const struct bt_hci_cmd_le_set_scan_parameters *lssp;
+	const struct bt_hci_cmd_le_set_scan_enable *lsse;
+	const struct bt_hci_cmd_le_create_conn *lcc;
 	struct bt_hci_rsp_read_default_link_policy rdlp;
 	struct bt_hci_rsp_read_stored_link_key rslk;
 	struct bt_hci_rsp_write_stored_link_key wslk;
@@ -623,6 +1417,7 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	struct bt_hci_rsp_le_read_buffer_size lrbs;
 	struct bt_hci_rsp_le_read_local_features lrlf;
 	struct bt_hci_rsp_le_read_supported_states lrss;
+	struct bt_hci_rsp_le_read_adv_tx_power lratp;
 	uint16_t opcode;
 	uint8_t status, page;
 
@@ -1024,14 +1819,125 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 		cmd_complete(btdev, opcode, &lrlf, sizeof(lrlf));
 		break;
 
-	case BT_HCI_CMD_LE_SET_SCAN_PARAMETERS:
+	case BT_HCI_CMD_LE_SET_RANDOM_ADDRESS:
+		lsra = data + sizeof(*hdr);
+		memcpy(btdev->random_addr, lsra->addr, 6);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_PARAMETERS:
+		lsap = data + sizeof(*hdr);
+		if (btdev->le_adv_enable)
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+		else if (lsap->type > 0x03 || lsap->own_addr_type > 0x01 ||
+				le16_to_cpu(lsap->min_interval) < 0x0020 ||
+				le16_to_cpu(lsap->min_interval) > 0x4000)
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+		else {
+			btdev->le_adv_interval = le16_to_cpu(lsap->min_interval);
+			btdev->le_adv_type = lsap->type;
+			btdev->le_adv_own_addr_type = lsap->own_addr_type;
+			memcpy(btdev->le_adv_direct_addr, lsap->direct_addr, 6);
+			status = BT_HCI_ERR_SUCCESS;
+		}
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_READ_ADV_TX_POWER:
+		lratp.status = BT_HCI_ERR_SUCCESS;
+		lratp.level = 0;
+		cmd_complete(btdev, opcode, &lratp, sizeof(lratp));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_DATA:
+		lsad = data + sizeof(*hdr);
+		if (lsad->len > 31)
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+		else {
+			btdev->le_adv_data_len = lsad->len;
+			memcpy(btdev->le_adv_data, lsad->data, lsad->len);
+			status = BT_HCI_ERR_SUCCESS;
+		}
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_SET_SCAN_RSP_DATA:
+		lssrd = data + sizeof(*hdr);
+		if (lssrd->len > 31)
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+		else {
+			btdev->le_scan_data_len = lssrd->len;
+			memcpy(btdev->le_scan_data, lssrd->data, lssrd->len);
+			status = BT_HCI_ERR_SUCCESS;
+		}
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_ENABLE:
+		lsae = data + sizeof(*hdr);
+		if (lsae->enable > 0x01) {
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_complete(btdev, opcode, &status, sizeof(status));
+		if (!lsae->enable)
+			le_adv_stop(btdev);
+		else if (!btdev->le_adv_enable)
+			le_adv_start(btdev);
+		break;
+
+	case BT_HCI_CMD_LE_SET_SCAN_PARAMETERS:
+		lssp = data + sizeof(*hdr);
+		if (btdev->le_scan_enable)
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+		else if (lssp->type > 0x01 || lssp->own_addr_type > 0x01)
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+		else {
+			btdev->le_scan_type = lssp->type;
+			btdev->le_scan_own_addr_type = lssp->own_addr_type;
+			status = BT_HCI_ERR_SUCCESS;
+		}
+		cmd_complete(btdev, opcode, &status, sizeof(status));
 		break;
 
 	case BT_HCI_CMD_LE_SET_SCAN_ENABLE:
+		lsse = data + sizeof(*hdr);
+		if (lsse->enable > 0x01) {
+			status = BT_HCI_ERR_INVALID_PARAMETERS;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		if (!lsse->enable)
+			le_scan_stop(btdev);
+		else if (!btdev->le_scan_enable)
+			le_scan_start(btdev, lsse->filter_dup);
+		break;
+
+	case BT_HCI_CMD_LE_CREATE_CONN:
+		lcc = data + sizeof(*hdr);
+		if (btdev->le_conn_pending) {
+			cmd_status(btdev, BT_HCI_ERR_COMMAND_DISALLOWED,
+								opcode);
+			break;
+		}
+		cmd_status(btdev, BT_HCI_ERR_SUCCESS, opcode);
+		le_create_conn(btdev, lcc);
+		break;
+
+	case BT_HCI_CMD_LE_CREATE_CONN_CANCEL:
+		if (le_create_conn_cancel(btdev) < 0) {
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_complete(btdev, opcode, &status, sizeof(status));
+		le_conn_complete(btdev, NULL, BT_HCI_ERR_UNKNOWN_CONN_ID);
 		break;
 
 	case BT_HCI_CMD_LE_READ_SUPPORTED_STATES:
@@ -1048,6 +1954,150 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	}
 }
 
+static void *acl_copy(const void *data, uint16_t len, uint16_t handle)
+{
+	const struct bt_hci_acl_hdr *hdr = data + 1;
+	struct bt_hci_acl_hdr *pkt_hdr;
+	uint16_t flags;
+	void *pkt_data;
+
+	pkt_data = malloc(len);
+	if (!pkt_data)
+		return NULL;
+
+	memcpy(pkt_data, data, len);
+
+	/* Each side of the link knows it by its own handle */
+	pkt_hdr = pkt_data + 1;
+	flags = acl_flags(le16_to_cpu(hdr->handle));
+	pkt_hdr->handle = cpu_to_le16(acl_handle_pack(handle, flags));
+
+	return pkt_data;
+}
+
+static void schedule_acl(struct btdev_conn *conn, const void *data,
+								uint16_t len)
+{
+	struct btdev *btdev = conn->dev;
+	const struct btdev_link_model *model = &btdev->link_model;
+	uint64_t now, airtime, done;
+
+	if (btdev->acl_pkts_pending >= btdev->acl_max_pkt) {
+		printf("ACL buffer overflow on handle %u\n", conn->handle);
+		return;
+	}
+
+	now = get_time();
+
+	if (model->bandwidth)
+		airtime = (uint64_t) (len - 1) * 1000000 / model->bandwidth;
+	else
+		airtime = 0;
+
+	done = (conn->tx_free > now ? conn->tx_free : now) + airtime;
+
+	/* Failed baseband transmissions are retried until they succeed,
+	 * so loss shows up as lower throughput and higher latency */
+	while (model->loss && get_random() % 100 < model->loss)
+		done += airtime ? airtime : RETRANSMIT_SLOT;
+
+	conn->tx_free = done;
+
+	if (conn->link) {
+		struct btdev_conn *link = conn->link;
+		uint64_t deliver = done + model->latency;
+		void *pkt_data;
+
+		if (model->jitter)
+			deliver += get_random() % (model->jitter + 1);
+
+		if (deliver < conn->rx_last)
+			deliver = conn->rx_last;
+
+		conn->rx_last = deliver;
+
+		pkt_data = acl_copy(data, len, link->handle);
+		if (pkt_data && schedule_event(deliver, BTDEV_EVENT_DELIVER,
+					link->dev, link->handle,
+					pkt_data, len) < 0)
+			free(pkt_data);
+	}
+
+	if (schedule_event(done, BTDEV_EVENT_COMPLETE, btdev,
+					conn->handle, NULL, 0) < 0) {
+		num_completed_packets(btdev, conn->handle);
+		return;
+	}
+
+	btdev->acl_pkts_pending++;
+}
+
+static void process_acl(struct btdev *btdev, const void *data, uint16_t len)
+{
+	const struct bt_hci_acl_hdr *hdr = data + 1;
+	struct btdev_conn *conn;
+	uint16_t handle;
+
+	if (len < 1 + sizeof(*hdr))
+		return;
+
+	handle = acl_handle(le16_to_cpu(hdr->handle));
+
+	conn = find_conn_by_handle(btdev, handle);
+	if (!conn)
+		return;
+
+	if (link_model_active(&btdev->link_model)) {
+		schedule_acl(conn, data, len);
+		return;
+	}
+
+	if (conn->link) {
+		void *pkt_data;
+
+		pkt_data = acl_copy(data, len, conn->link->handle);
+		if (!pkt_data)
+			return;
+
+		send_packet(conn->link->dev, pkt_data, len);
+
+		free(pkt_data);
+	}
+
+	num_completed_packets(btdev, handle);
+}
+
+void btdev_start_advertising(struct btdev *btdev, uint16_t interval)
+{
+	size_t len;
+
+	if (!btdev || btdev->le_adv_enable)
+		return;
+
+	btdev->le_adv_interval = interval;
+	btdev->le_adv_type = 0x00;
+	btdev->le_adv_own_addr_type = 0x00;
+
+	/* Flags: LE General Discoverable, then as much of the name as
+	 * fits, marked shortened if it had to be cut */
+	btdev->le_adv_data[0] = 0x02;
+	btdev->le_adv_data[1] = 0x01;
+	btdev->le_adv_data[2] = 0x02;
+
+	len = strlen((char *) btdev->name);
+	if (len > 31 - 5) {
+		len = 31 - 5;
+		btdev->le_adv_data[4] = 0x08;
+	} else
+		btdev->le_adv_data[4] = 0x09;
+
+	btdev->le_adv_data[3] = len + 1;
+	memcpy(btdev->le_adv_data + 5, btdev->name, len);
+	btdev->le_adv_data_len = len + 5;
+
+	le_adv_start(btdev);
+}
+
 void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
 {
 	uint8_t pkt_type;
@@ -1065,9 +2115,7 @@ void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
 		process_cmd(btdev, data + 1, len - 1);
 		break;
 	case BT_H4_ACL_PKT:
-		if (btdev->conn)
-			send_packet(btdev->conn, data, len);
-		num_completed_packets(btdev);
+		process_acl(btdev, data, len);
 		break;
 	default:
 		printf("Unsupported packet 0x%2.2x\n", pkt_type);
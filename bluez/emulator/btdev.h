@@ -29,10 +29,25 @@ typedef void (*btdev_send_func) (const void *data, uint16_t len,
 
 struct btdev;
 
+struct btdev_link_model {
+	uint16_t acl_mtu;	/* Size of one ACL buffer */
+	uint16_t acl_max_pkt;	/* Number of ACL buffers */
+	uint32_t bandwidth;	/* Bytes per second, 0 for no limit */
+	uint32_t latency;	/* Microseconds */
+	uint32_t jitter;	/* Microseconds */
+	uint8_t  loss;		/* Percentage of failed transmissions */
+};
+
+void btdev_set_default_link_model(const struct btdev_link_model *model,
+							unsigned int seed);
+
 struct btdev *btdev_create(uint16_t id);
+struct btdev *btdev_create_peer(uint16_t id);
 void btdev_destroy(struct btdev *btdev);
 
 void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
 							void *user_data);
 
+void btdev_start_advertising(struct btdev *btdev, uint16_t interval);
+
 void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len);
@@ -27,10 +27,18 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
 
 #include "mainloop.h"
+#include "btdev.h"
 #include "server.h"
+#include "worker.h"
 #include "vhci.h"
+#include "replay.h"
+
+#define MAX_PEERS 0xffff
+#define MAX_WORKERS 64
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -42,32 +50,248 @@ static void signal_callback(int signum, void *user_data)
 	}
 }
 
+static void usage(void)
+{
+	printf("btvirt - Bluetooth emulator\n"
+		"Usage:\n");
+	printf("\tbtvirt [options]\n");
+	printf("options:\n"
+		"\t-p, --peers <num>     Number of virtual peers to create\n"
+		"\t-a, --adv-interval <ms>  Peer LE advertising interval\n"
+		"\t-m, --acl-mtu <size>  Size of the ACL buffers\n"
+		"\t-n, --acl-pkts <num>  Number of ACL buffers\n"
+		"\t-b, --bandwidth <kb>  Link bandwidth in kbit/s\n"
+		"\t-l, --latency <ms>    Link latency in milliseconds\n"
+		"\t-j, --jitter <ms>     Link jitter in milliseconds\n"
+		"\t-L, --loss <percent>  Failed transmissions in percent\n"
+		"\t-s, --seed <num>      Seed for jitter and loss\n"
+		"\t-w, --workers <num>   Threads serving client sockets\n"
+		"\t-r, --replay <file>   Replay btsnoop capture as controller\n"
+		"\t-f, --fast-replay     Replay without the captured timing\n"
+		"\t-h, --help            Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "peers",	required_argument, NULL, 'p'	},
+	{ "adv-interval", required_argument, NULL, 'a'	},
+	{ "acl-mtu",	required_argument, NULL, 'm'	},
+	{ "acl-pkts",	required_argument, NULL, 'n'	},
+	{ "bandwidth",	required_argument, NULL, 'b'	},
+	{ "latency",	required_argument, NULL, 'l'	},
+	{ "jitter",	required_argument, NULL, 'j'	},
+	{ "loss",	required_argument, NULL, 'L'	},
+	{ "seed",	required_argument, NULL, 's'	},
+	{ "workers",	required_argument, NULL, 'w'	},
+	{ "replay",	required_argument, NULL, 'r'	},
+	{ "fast-replay", no_argument,	   NULL, 'f'	},
+	{ "version",	no_argument,	   NULL, 'v'	},
+	{ "help",	no_argument,	   NULL, 'h'	},
+	{ }
+};
+
+static int parse_number(const char *arg, unsigned long min,
+				unsigned long max, unsigned long *value)
+{
+	char *endptr;
+
+	*value = strtoul(arg, &endptr, 10);
+	if (*arg == '\0' || *endptr != '\0' || *value < min || *value > max) {
+		fprintf(stderr, "Invalid value %s\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct btdev **create_peers(unsigned int num, uint16_t adv_interval)
+{
+	struct btdev **peers;
+	unsigned int i;
+
+	peers = calloc(num, sizeof(*peers));
+	if (!peers)
+		return NULL;
+
+	for (i = 0; i < num; i++) {
+		peers[i] = btdev_create_peer(i);
+		if (!peers[i]) {
+			while (i-- > 0)
+				btdev_destroy(peers[i]);
+			free(peers);
+			return NULL;
+		}
+
+		if (adv_interval)
+			btdev_start_advertising(peers[i], adv_interval);
+	}
+
+	return peers;
+}
+
+static void destroy_peers(struct btdev **peers, unsigned int num)
+{
+	unsigned int i;
+
+	if (!peers)
+		return;
+
+	for (i = 0; i < num; i++)
+		btdev_destroy(peers[i]);
+
+	free(peers);
+}
+
 int main(int argc, char *argv[])
 {
 	struct vhci *vhci;
 	struct server *server;
+	struct btdev **peers = NULL;
+	struct btdev_link_model model = {
+		.acl_mtu	= 192,
+		.acl_max_pkt	= 1,
+	};
+	unsigned long num_peers = 0, num_workers = 0, value, seed = 1;
+	uint16_t adv_interval = 0;
+	const char *replay_path = NULL;
+	bool fast_replay = false;
 	sigset_t mask;
+	int exit_status;
 
 	mainloop_init();
 
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "p:a:m:n:b:l:j:L:s:w:r:fvh",
+						main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'p':
+			if (parse_number(optarg, 0, MAX_PEERS, &num_peers) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'a':
+			if (parse_number(optarg, 20, 10240, &value) < 0)
+				return EXIT_FAILURE;
+			/* Advertising interval is in 0.625 ms units */
+			adv_interval = value * 8 / 5;
+			break;
+		case 'm':
+			if (parse_number(optarg, 27, 0xffff, &value) < 0)
+				return EXIT_FAILURE;
+			model.acl_mtu = value;
+			break;
+		case 'n':
+			if (parse_number(optarg, 1, 0xffff, &value) < 0)
+				return EXIT_FAILURE;
+			model.acl_max_pkt = value;
+			break;
+		case 'b':
+			if (parse_number(optarg, 0, 0xffffffff / 125,
+							&value) < 0)
+				return EXIT_FAILURE;
+			model.bandwidth = value * 125;
+			break;
+		case 'l':
+			if (parse_number(optarg, 0, 60000, &value) < 0)
+				return EXIT_FAILURE;
+			model.latency = value * 1000;
+			break;
+		case 'j':
+			if (parse_number(optarg, 0, 60000, &value) < 0)
+				return EXIT_FAILURE;
+			model.jitter = value * 1000;
+			break;
+		case 'L':
+			if (parse_number(optarg, 0, 99, &value) < 0)
+				return EXIT_FAILURE;
+			model.loss = value;
+			break;
+		case 's':
+			if (parse_number(optarg, 1, 0xffffffff, &seed) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'w':
+			if (parse_number(optarg, 0, MAX_WORKERS,
+							&num_workers) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'f':
+			fast_replay = true;
+			break;
+		case 'v':
+			printf("%s\n", VERSION);
+			return EXIT_SUCCESS;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	btdev_set_default_link_model(&model, seed);
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	vhci = vhci_open(VHCI_TYPE_BREDR, 0x23);
+	if (replay_path) {
+		struct replay *replay;
+
+		replay = replay_open(replay_path, fast_replay);
+		if (!replay)
+			return 1;
+
+		vhci = vhci_open_replay(replay);
+		if (!vhci)
+			replay_close(replay);
+	} else
+		vhci = vhci_open(VHCI_TYPE_BREDR, 0x23);
+
 	if (!vhci) {
 		fprintf(stderr, "Failed to open Virtual HCI device\n");
 		return 1;
 	}
 
+	if (num_workers > 0 && worker_pool_init(num_workers) < 0) {
+		fprintf(stderr, "Failed to start worker threads\n");
+		vhci_close(vhci);
+		return 1;
+	}
+
 	server = server_open_unix("/tmp/bt-server-bredr", 0x42);
 	if (!server) {
 		fprintf(stderr, "Failed to open server channel\n");
+		worker_pool_cleanup();
 		vhci_close(vhci);
 		return 1;
 	}
 
-	return mainloop_run();
+	if (num_peers > 0) {
+		peers = create_peers(num_peers, adv_interval);
+		if (!peers) {
+			fprintf(stderr, "Failed to create virtual peers\n");
+			server_close(server);
+			worker_pool_cleanup();
+			vhci_close(vhci);
+			return 1;
+		}
+
+		printf("Created %lu virtual peers\n", num_peers);
+	}
+
+	exit_status = mainloop_run();
+
+	worker_pool_cleanup();
+	destroy_peers(peers, num_peers);
+
+	return exit_status;
 }
@@ -0,0 +1,541 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+
+#include "bt.h"
+#include "mainloop.h"
+#include "replay.h"
+
+/*
+ * Replay plays the controller side of a btsnoop capture. Packets the
+ * controller sent are sent to the host again, commands the host sent
+ * act as sync points: the script stops at each of them until the host
+ * issues the same command. Host ACL and SCO data never blocks the
+ * script, it is not part of the command flow control.
+ */
+
+#define BTSNOOP_TYPE_HCI	1001
+#define BTSNOOP_TYPE_UART	1002
+
+#define BTSNOOP_FLAG_RECEIVED	0x01
+#define BTSNOOP_FLAG_COMMAND	0x02
+
+#define MAX_EARLY_COMMANDS	16
+#define FAST_BATCH		64
+
+struct btsnoop_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	type;		/* Datalink Type */
+} __attribute__ ((packed));
+#define BTSNOOP_HDR_SIZE (sizeof(struct btsnoop_hdr))
+
+struct btsnoop_pkt {
+	uint32_t	size;		/* Original Length */
+	uint32_t	len;		/* Included Length */
+	uint32_t	flags;		/* Packet Flags */
+	uint32_t	drops;		/* Cumulative Drops */
+	uint64_t	ts;		/* Timestamp microseconds */
+	uint8_t		data[0];	/* Packet Data */
+} __attribute__ ((packed));
+#define BTSNOOP_PKT_SIZE (sizeof(struct btsnoop_pkt))
+
+static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
+				      0x6f, 0x6f, 0x70, 0x00 };
+
+struct replay_pkt {
+	uint64_t ts;
+	uint8_t *data;			/* H4 packet, type byte first */
+	uint16_t len;
+	bool from_host;
+};
+
+struct replay {
+	struct replay_pkt *pkts;
+	unsigned int num_pkts;
+	unsigned int next;
+	uint8_t *buf;
+
+	bool fast;
+	bool started;
+	int timer_fd;
+
+	uint64_t anchor_time;		/* Local time of anchor_ts */
+	uint64_t anchor_ts;		/* Capture time */
+
+	uint16_t early[MAX_EARLY_COMMANDS];
+	unsigned int num_early;
+
+	uint64_t start_time;
+	unsigned int num_sent;
+	unsigned int num_matched;
+	unsigned int num_mismatched;
+
+	replay_send_func send_handler;
+	void *send_data;
+};
+
+static inline uint64_t ntoh64(uint64_t n)
+{
+	uint64_t h;
+	uint64_t tmp = ntohl(n & 0x00000000ffffffff);
+
+	h = ntohl(n >> 32);
+	h |= tmp << 32;
+
+	return h;
+}
+
+static inline uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t *load_file(const char *path, size_t *size)
+{
+	struct stat st;
+	uint8_t *buf;
+	size_t offset = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("Failed to open capture file");
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) BTSNOOP_HDR_SIZE) {
+		fprintf(stderr, "Invalid capture file %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(st.st_size);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	while (offset < (size_t) st.st_size) {
+		ssize_t len = read(fd, buf + offset, st.st_size - offset);
+
+		if (len <= 0) {
+			perror("Failed to read capture file");
+			free(buf);
+			close(fd);
+			return NULL;
+		}
+
+		offset += len;
+	}
+
+	close(fd);
+
+	*size = st.st_size;
+
+	return buf;
+}
+
+static int parse_capture(struct replay *replay, const uint8_t *file,
+								size_t size)
+{
+	const struct btsnoop_hdr *hdr = (const void *) file;
+	unsigned int num = 0, max = 0;
+	uint8_t *ptr;
+	size_t offset, total = 0;
+	uint32_t type;
+
+	if (memcmp(hdr->id, btsnoop_id, sizeof(btsnoop_id)) ||
+						ntohl(hdr->version) != 1) {
+		fprintf(stderr, "Not a btsnoop capture\n");
+		return -EINVAL;
+	}
+
+	type = ntohl(hdr->type);
+	if (type != BTSNOOP_TYPE_HCI && type != BTSNOOP_TYPE_UART) {
+		fprintf(stderr, "Unsupported datalink type %u\n", type);
+		return -EINVAL;
+	}
+
+	/* First pass counts the packets and the space for H4 copies */
+	for (offset = BTSNOOP_HDR_SIZE; offset + BTSNOOP_PKT_SIZE <= size;) {
+		const struct btsnoop_pkt *pkt = (const void *) (file + offset);
+		uint32_t len = ntohl(pkt->len);
+
+		if (offset + BTSNOOP_PKT_SIZE + len > size || len > 0xfffe)
+			break;
+
+		total += len + 1;
+		offset += BTSNOOP_PKT_SIZE + len;
+		max++;
+	}
+
+	replay->pkts = calloc(max ? max : 1, sizeof(*replay->pkts));
+	replay->buf = malloc(total ? total : 1);
+	if (!replay->pkts || !replay->buf)
+		return -ENOMEM;
+
+	ptr = replay->buf;
+
+	/* Skipped records don't count, so walk the same records by offset */
+	for (offset = BTSNOOP_HDR_SIZE; offset + BTSNOOP_PKT_SIZE <= size &&
+								num < max;) {
+		const struct btsnoop_pkt *pkt = (const void *) (file + offset);
+		struct replay_pkt *rp = &replay->pkts[num];
+		uint32_t len = ntohl(pkt->len);
+		uint32_t flags = ntohl(pkt->flags);
+
+		if (offset + BTSNOOP_PKT_SIZE + len > size || len > 0xfffe)
+			break;
+
+		offset += BTSNOOP_PKT_SIZE + len;
+
+		/* Only differences matter, the epoch is irrelevant */
+		rp->ts = ntoh64(pkt->ts);
+		rp->from_host = !(flags & BTSNOOP_FLAG_RECEIVED);
+		rp->data = ptr;
+
+		if (type == BTSNOOP_TYPE_HCI) {
+			/* Unencapsulated, the flags carry the packet type */
+			if (flags & BTSNOOP_FLAG_COMMAND)
+				*ptr = rp->from_host ? BT_H4_CMD_PKT :
+							BT_H4_EVT_PKT;
+			else
+				*ptr = BT_H4_ACL_PKT;
+
+			memcpy(ptr + 1, pkt->data, len);
+			rp->len = len + 1;
+		} else {
+			if (len == 0)
+				continue;
+
+			memcpy(ptr, pkt->data, len);
+			rp->len = len;
+		}
+
+		/* Commands need at least an opcode to be matched */
+		if (rp->from_host && rp->data[0] == BT_H4_CMD_PKT &&
+								rp->len < 3)
+			continue;
+
+		ptr += rp->len;
+		num++;
+	}
+
+	replay->num_pkts = num;
+
+	return 0;
+}
+
+static uint16_t pkt_opcode(const struct replay_pkt *pkt)
+{
+	return pkt->data[1] | (pkt->data[2] << 8);
+}
+
+static bool pkt_is_command(const struct replay_pkt *pkt)
+{
+	return pkt->from_host && pkt->data[0] == BT_H4_CMD_PKT;
+}
+
+static void send_packet(struct replay *replay, const void *data,
+								uint16_t len)
+{
+	if (!replay->send_handler)
+		return;
+
+	replay->send_handler(data, len, replay->send_data);
+}
+
+static void reject_command(struct replay *replay, uint16_t opcode)
+{
+	uint8_t pkt[1 + sizeof(struct bt_hci_evt_hdr) +
+				sizeof(struct bt_hci_evt_cmd_status)];
+	struct bt_hci_evt_hdr *hdr = (void *) (pkt + 1);
+	struct bt_hci_evt_cmd_status *cs = (void *) (pkt + 1 + sizeof(*hdr));
+
+	pkt[0] = BT_H4_EVT_PKT;
+	hdr->evt = BT_HCI_EVT_CMD_STATUS;
+	hdr->plen = sizeof(*cs);
+	cs->status = BT_HCI_ERR_UNKNOWN_COMMAND;
+	cs->ncmd = 0x01;
+	cs->opcode = opcode;
+
+	send_packet(replay, pkt, sizeof(pkt));
+}
+
+static void timer_arm(struct replay *replay, uint64_t when)
+{
+	struct itimerspec itimer;
+
+	memset(&itimer, 0, sizeof(itimer));
+
+	/* A zero value would disarm the timer, keep it in the past */
+	if (when == 0)
+		when = 1;
+
+	itimer.it_value.tv_sec = when / 1000000;
+	itimer.it_value.tv_nsec = (when % 1000000) * 1000;
+
+	timerfd_settime(replay->timer_fd, TFD_TIMER_ABSTIME, &itimer, NULL);
+}
+
+static void replay_finished(struct replay *replay)
+{
+	uint64_t elapsed = get_time() - replay->start_time;
+
+	printf("Replay finished: %u packets in %llu.%06llu seconds",
+				replay->num_sent,
+				(unsigned long long) elapsed / 1000000,
+				(unsigned long long) elapsed % 1000000);
+
+	if (elapsed > 0)
+		printf(" (%llu packets/s)", (unsigned long long)
+				replay->num_sent * 1000000ull / elapsed);
+
+	printf(", %u commands matched, %u rejected\n",
+				replay->num_matched, replay->num_mismatched);
+}
+
+static bool match_command(struct replay *replay, uint16_t opcode)
+{
+	struct replay_pkt *pkt = &replay->pkts[replay->next];
+
+	if (pkt_opcode(pkt) != opcode) {
+		printf("Replay diverged at packet %u: command 0x%4.4x, "
+				"expected 0x%4.4x\n", replay->next,
+				opcode, pkt_opcode(pkt));
+		replay->num_mismatched++;
+		reject_command(replay, opcode);
+		return false;
+	}
+
+	replay->num_matched++;
+	replay->next++;
+
+	/* Controller responses are timed relative to the command */
+	replay->anchor_time = get_time();
+	replay->anchor_ts = pkt->ts;
+
+	return true;
+}
+
+static void process_script(struct replay *replay)
+{
+	unsigned int count = 0;
+
+	while (replay->next < replay->num_pkts) {
+		struct replay_pkt *pkt = &replay->pkts[replay->next];
+
+		if (pkt_is_command(pkt)) {
+			uint16_t opcode;
+
+			if (replay->num_early == 0)
+				return;
+
+			opcode = replay->early[0];
+			replay->num_early--;
+			memmove(replay->early, replay->early + 1,
+				replay->num_early * sizeof(replay->early[0]));
+
+			match_command(replay, opcode);
+			continue;
+		}
+
+		if (pkt->from_host) {
+			replay->next++;
+			continue;
+		}
+
+		if (replay->fast) {
+			/* Yield to the mainloop now and then */
+			if (count++ == FAST_BATCH) {
+				timer_arm(replay, 0);
+				return;
+			}
+		} else {
+			uint64_t when = replay->anchor_time +
+					(pkt->ts - replay->anchor_ts);
+
+			if (pkt->ts > replay->anchor_ts && when > get_time()) {
+				timer_arm(replay, when);
+				return;
+			}
+		}
+
+		/* Advance first, the host may answer from within the send */
+		replay->num_sent++;
+		replay->next++;
+
+		send_packet(replay, pkt->data, pkt->len);
+	}
+
+	if (replay->next == replay->num_pkts) {
+		replay_finished(replay);
+		replay->next++;
+	}
+}
+
+static void timer_callback(int fd, uint32_t events, void *user_data)
+{
+	struct replay *replay = user_data;
+	uint64_t expired;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	if (read(fd, &expired, sizeof(expired)) < 0)
+		return;
+
+	process_script(replay);
+}
+
+struct replay *replay_open(const char *path, bool fast)
+{
+	struct replay *replay;
+	uint8_t *file;
+	size_t size;
+
+	file = load_file(path, &size);
+	if (!file)
+		return NULL;
+
+	replay = malloc(sizeof(*replay));
+	if (!replay) {
+		free(file);
+		return NULL;
+	}
+
+	memset(replay, 0, sizeof(*replay));
+	replay->fast = fast;
+
+	if (parse_capture(replay, file, size) < 0) {
+		free(file);
+		goto failed;
+	}
+
+	free(file);
+
+	replay->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+	if (replay->timer_fd < 0)
+		goto failed;
+
+	if (mainloop_add_fd(replay->timer_fd, EPOLLIN, timer_callback,
+							replay, NULL) < 0) {
+		close(replay->timer_fd);
+		goto failed;
+	}
+
+	printf("Loaded %u packets from %s\n", replay->num_pkts, path);
+
+	return replay;
+
+failed:
+	free(replay->pkts);
+	free(replay->buf);
+	free(replay);
+	return NULL;
+}
+
+void replay_close(struct replay *replay)
+{
+	if (!replay)
+		return;
+
+	mainloop_remove_fd(replay->timer_fd);
+	close(replay->timer_fd);
+
+	free(replay->pkts);
+	free(replay->buf);
+	free(replay);
+}
+
+void replay_set_send_handler(struct replay *replay, replay_send_func handler,
+							void *user_data)
+{
+	if (!replay)
+		return;
+
+	replay->send_handler = handler;
+	replay->send_data = user_data;
+}
+
+void replay_start(struct replay *replay)
+{
+	if (!replay || replay->started)
+		return;
+
+	replay->started = true;
+	replay->start_time = get_time();
+
+	if (replay->num_pkts > 0) {
+		replay->anchor_time = replay->start_time;
+		replay->anchor_ts = replay->pkts[0].ts;
+	}
+
+	process_script(replay);
+}
+
+void replay_receive_h4(struct replay *replay, const void *data, uint16_t len)
+{
+	const uint8_t *ptr = data;
+	uint16_t opcode;
+
+	if (len < 4 || ptr[0] != BT_H4_CMD_PKT)
+		return;
+
+	opcode = ptr[1] | (ptr[2] << 8);
+
+	/* Once the script is done the controller knows nothing anymore */
+	if (replay->next >= replay->num_pkts ||
+			replay->num_early == MAX_EARLY_COMMANDS) {
+		replay->num_mismatched++;
+		reject_command(replay, opcode);
+		return;
+	}
+
+	/* The host may run ahead of the script, the command is matched
+	 * once all controller packets before it have been sent */
+	replay->early[replay->num_early++] = opcode;
+
+	if (replay->started)
+		process_script(replay);
+}
@@ -43,6 +43,7 @@
 #include "mainloop.h"
 #include "btdev.h"
 #include "server.h"
+#include "worker.h"
 
 struct server {
 	uint16_t id;
@@ -52,6 +53,7 @@ struct server {
 struct client {
 	int fd;
 	struct btdev *btdev;
+	struct worker_conn *conn;
 	uint8_t *pkt_data;
 	uint8_t pkt_type;
 	uint16_t pkt_expect;
@@ -74,8 +76,13 @@ static void client_destroy(void *user_data)
 
 	btdev_destroy(client->btdev);
 
-	close(client->fd);
+	/* With a worker the socket is closed once it let go of it */
+	if (client->conn)
+		worker_detach(client->conn);
+	else
+		close(client->fd);
 
+	free(client->pkt_data);
 	free(client);
 }
 
@@ -90,6 +97,29 @@ static void client_write_callback(const void *data, uint16_t len,
 		return;
 }
 
+static void client_worker_write_callback(const void *data, uint16_t len,
+							void *user_data)
+{
+	struct client *client = user_data;
+
+	worker_send(client->conn, data, len);
+}
+
+static void client_worker_packet_callback(const void *data, uint16_t len,
+							void *user_data)
+{
+	struct client *client = user_data;
+
+	btdev_receive_h4(client->btdev, data, len);
+}
+
+static void client_worker_hangup_callback(void *user_data)
+{
+	struct client *client = user_data;
+
+	client_destroy(client);
+}
+
 static void client_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct client *client = user_data;
@@ -203,13 +233,30 @@ static void server_accept_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	client->btdev = btdev_create(server->id);
+	/* Every client gets a controller with an address of its own */
+	client->btdev = btdev_create(server->id++);
 	if (!client->btdev) {
 		close(client->fd);
 		free(client);
 		return;
 	}
 
+	if (worker_pool_active()) {
+		client->conn = worker_attach(client->fd,
+					client_worker_packet_callback,
+					client_worker_hangup_callback, client);
+		if (!client->conn) {
+			btdev_destroy(client->btdev);
+			close(client->fd);
+			free(client);
+			return;
+		}
+
+		btdev_set_send_handler(client->btdev,
+					client_worker_write_callback, client);
+		return;
+	}
+
 	btdev_set_send_handler(client->btdev, client_write_callback, client);
 
 	if (mainloop_add_fd(client->fd, EPOLLIN, client_read_callback,
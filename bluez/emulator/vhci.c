@@ -35,12 +35,14 @@
 
 #include "mainloop.h"
 #include "btdev.h"
+#include "replay.h"
 #include "vhci.h"
 
 struct vhci {
 	enum vhci_type type;
 	int fd;
 	struct btdev *btdev;
+	struct replay *replay;
 };
 
 static void vhci_destroy(void *user_data)
@@ -48,6 +50,7 @@ static void vhci_destroy(void *user_data)
 	struct vhci *vhci = user_data;
 
 	btdev_destroy(vhci->btdev);
+	replay_close(vhci->replay);
 
 	close(vhci->fd);
 
@@ -77,7 +80,10 @@ static void vhci_read_callback(int fd, uint32_t events, void *user_data)
 	if (len < 0)
 		return;
 
-	btdev_receive_h4(vhci->btdev, buf, len);
+	if (vhci->replay)
+		replay_receive_h4(vhci->replay, buf, len);
+	else
+		btdev_receive_h4(vhci->btdev, buf, len);
 }
 
 struct vhci *vhci_open(enum vhci_type type, uint16_t id)
@@ -124,6 +130,38 @@ struct vhci *vhci_open(enum vhci_type type, uint16_t id)
 	return vhci;
 }
 
+struct vhci *vhci_open_replay(struct replay *replay)
+{
+	struct vhci *vhci;
+
+	vhci = malloc(sizeof(*vhci));
+	if (!vhci)
+		return NULL;
+
+	memset(vhci, 0, sizeof(*vhci));
+	vhci->type = VHCI_TYPE_BREDR;
+
+	vhci->fd = open("/dev/vhci", O_RDWR | O_NONBLOCK);
+	if (vhci->fd < 0) {
+		free(vhci);
+		return NULL;
+	}
+
+	if (mainloop_add_fd(vhci->fd, EPOLLIN, vhci_read_callback,
+						vhci, vhci_destroy) < 0) {
+		close(vhci->fd);
+		free(vhci);
+		return NULL;
+	}
+
+	/* From here on the replay belongs to the virtual controller */
+	vhci->replay = replay;
+	replay_set_send_handler(replay, vhci_write_callback, vhci);
+	replay_start(replay);
+
+	return vhci;
+}
+
 void vhci_close(struct vhci *vhci)
 {
 	if (!vhci)
@@ -30,6 +30,8 @@ enum vhci_type {
 };
 
 struct vhci;
+struct replay;
 
 struct vhci *vhci_open(enum vhci_type type, uint16_t id);
+struct vhci *vhci_open_replay(struct replay *replay);
 void vhci_close(struct vhci *vhci);
@@ -0,0 +1,689 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "bt.h"
+#include "mainloop.h"
+#include "worker.h"
+
+/*
+ * Worker threads own the client sockets: they read, split the byte
+ * stream into H4 packets and write outgoing packets. Everything that
+ * touches btdev state stays on the mainloop thread. The two sides only
+ * talk through single producer, single consumer rings, one per
+ * direction and worker, plus an eventfd each for wakeups. Detaching a
+ * connection is rare and goes through mutex protected lists instead,
+ * so that it can never block on a full ring.
+ */
+
+#define RING_SIZE 4096
+#define MAX_WORKERS 64
+#define MAX_EPOLL_EVENTS 32
+#define READ_BUF_SIZE 4096
+
+enum worker_msg_type {
+	WORKER_MSG_PACKET,
+	WORKER_MSG_HANGUP,
+};
+
+struct worker_msg {
+	enum worker_msg_type type;
+	struct worker_conn *conn;
+	uint16_t len;
+	uint8_t data[0];
+};
+
+struct ring {
+	void *entries[RING_SIZE];
+	unsigned int head;		/* Only written by the producer */
+	unsigned int tail;		/* Only written by the consumer */
+};
+
+struct worker {
+	pthread_t thread;
+	int epoll_fd;
+	int wake_fd;			/* Mainloop to worker */
+	int notify_fd;			/* Worker to mainloop */
+	int wake_pending;
+	int notify_pending;
+	int terminate;
+	struct ring rx;			/* Worker to mainloop */
+	struct ring tx;			/* Mainloop to worker */
+	struct worker_conn *stalled;	/* Only used by the worker */
+	pthread_mutex_t lock;
+	struct worker_conn *detach;	/* Requested by the mainloop */
+	struct worker_conn *detached;	/* Acknowledged by the worker */
+};
+
+struct worker_conn {
+	int fd;
+	struct worker *worker;
+	worker_packet_func packet;
+	worker_hangup_func hangup;
+	void *user_data;
+	int detaching;			/* Only used by the mainloop */
+
+	/* Only used by the worker */
+	uint8_t *buf;
+	unsigned int buf_size;
+	unsigned int buf_len;
+	struct worker_msg *pending;
+	struct worker_conn *stalled_next;
+
+	struct worker_conn *detach_next;	/* Protected by lock */
+};
+
+static struct worker *workers[MAX_WORKERS];
+static unsigned int num_workers = 0;
+static unsigned int next_worker = 0;
+
+static int ring_push(struct ring *ring, void *entry)
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail == RING_SIZE)
+		return -ENOBUFS;
+
+	ring->entries[head % RING_SIZE] = entry;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void *ring_pop(struct ring *ring)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	void *entry;
+
+	if (head == tail)
+		return NULL;
+
+	entry = ring->entries[tail % RING_SIZE];
+
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return entry;
+}
+
+static void signal_fd(int fd, int *pending)
+{
+	uint64_t val = 1;
+
+	/* Only the first signal after the other side drained counts */
+	if (__atomic_exchange_n(pending, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (write(fd, &val, sizeof(val)) < 0)
+		return;
+}
+
+static void clear_fd(int fd, int *pending)
+{
+	uint64_t val;
+
+	__atomic_store_n(pending, 0, __ATOMIC_RELEASE);
+
+	if (read(fd, &val, sizeof(val)) < 0)
+		return;
+}
+
+static struct worker_msg *msg_new(enum worker_msg_type type,
+					struct worker_conn *conn,
+					const void *data, uint16_t len)
+{
+	struct worker_msg *msg;
+
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg)
+		return NULL;
+
+	msg->type = type;
+	msg->conn = conn;
+	msg->len = len;
+
+	if (len > 0)
+		memcpy(msg->data, data, len);
+
+	return msg;
+}
+
+static int packet_length(const uint8_t *buf, unsigned int len)
+{
+	if (len < 1)
+		return 0;
+
+	switch (buf[0]) {
+	case BT_H4_CMD_PKT:
+		if (len < 1 + sizeof(struct bt_hci_cmd_hdr))
+			return 0;
+		return 1 + sizeof(struct bt_hci_cmd_hdr) + buf[3];
+	case BT_H4_ACL_PKT:
+		if (len < 1 + sizeof(struct bt_hci_acl_hdr))
+			return 0;
+		return 1 + sizeof(struct bt_hci_acl_hdr) +
+						(buf[3] | (buf[4] << 8));
+	case BT_H4_SCO_PKT:
+		if (len < 4)
+			return 0;
+		return 4 + buf[3];
+	}
+
+	return -EPROTO;
+}
+
+/* Called on the worker thread */
+static int conn_queue(struct worker_conn *conn, struct worker_msg *msg)
+{
+	struct worker *worker = conn->worker;
+
+	if (ring_push(&worker->rx, msg) == 0)
+		return 0;
+
+	/* Mainloop is behind, stop reading until it caught up */
+	conn->pending = msg;
+	conn->stalled_next = worker->stalled;
+	worker->stalled = conn;
+
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	return -ENOBUFS;
+}
+
+static void conn_hangup(struct worker_conn *conn)
+{
+	struct worker_msg *msg;
+
+	epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	msg = msg_new(WORKER_MSG_HANGUP, conn, NULL, 0);
+	if (!msg)
+		return;
+
+	if (conn_queue(conn, msg) < 0)
+		conn->buf_len = 0;
+}
+
+/* Queue every complete packet in the buffer, keeping the remainder */
+static int conn_parse(struct worker_conn *conn)
+{
+	unsigned int offset = 0;
+	int err = 0;
+
+	while (offset < conn->buf_len) {
+		struct worker_msg *msg;
+		int pkt_len;
+
+		pkt_len = packet_length(conn->buf + offset,
+						conn->buf_len - offset);
+		if (pkt_len < 0) {
+			fprintf(stderr, "Invalid packet type 0x%2.2x\n",
+							conn->buf[offset]);
+			conn->buf_len = 0;
+			conn_hangup(conn);
+			return pkt_len;
+		}
+
+		if (pkt_len == 0 || (unsigned int) pkt_len >
+						conn->buf_len - offset) {
+			/* Make room for a packet larger than the buffer */
+			if (pkt_len > 0 && (unsigned int) pkt_len >
+							conn->buf_size) {
+				uint8_t *buf = realloc(conn->buf, pkt_len);
+
+				if (!buf)
+					break;
+
+				conn->buf = buf;
+				conn->buf_size = pkt_len;
+			}
+			break;
+		}
+
+		msg = msg_new(WORKER_MSG_PACKET, conn, conn->buf + offset,
+								pkt_len);
+		offset += pkt_len;
+
+		if (msg) {
+			err = conn_queue(conn, msg);
+			if (err < 0)
+				break;
+		}
+	}
+
+	conn->buf_len -= offset;
+	memmove(conn->buf, conn->buf + offset, conn->buf_len);
+
+	return err;
+}
+
+static void conn_read(struct worker_conn *conn)
+{
+	ssize_t len;
+
+	len = recv(conn->fd, conn->buf + conn->buf_len,
+				conn->buf_size - conn->buf_len, MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (len <= 0) {
+		conn_hangup(conn);
+		return;
+	}
+
+	conn->buf_len += len;
+
+	conn_parse(conn);
+}
+
+static void conn_requeue(struct worker *worker, struct worker_conn *conn)
+{
+	struct worker_msg *msg = conn->pending;
+	enum worker_msg_type type = msg->type;
+	struct epoll_event ev;
+
+	conn->pending = NULL;
+
+	/* Once queued the message belongs to the mainloop */
+	if (conn_queue(conn, msg) < 0 || type == WORKER_MSG_HANGUP)
+		return;
+
+	/* Packets that arrived together with the stalled one are still
+	 * buffered and the peer may wait for their replies before it
+	 * sends anything else */
+	if (conn_parse(conn) < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+}
+
+static void conn_resume(struct worker *worker)
+{
+	struct worker_conn *conn = worker->stalled;
+
+	worker->stalled = NULL;
+
+	while (conn) {
+		struct worker_conn *next = conn->stalled_next;
+
+		conn_requeue(worker, conn);
+
+		conn = next;
+	}
+}
+
+static void conn_unstall(struct worker *worker, struct worker_conn *conn)
+{
+	struct worker_conn **prev = &worker->stalled;
+
+	while (*prev) {
+		if (*prev == conn) {
+			*prev = conn->stalled_next;
+			break;
+		}
+
+		prev = &(*prev)->stalled_next;
+	}
+
+	free(conn->pending);
+	conn->pending = NULL;
+}
+
+static void worker_process_tx(struct worker *worker)
+{
+	struct worker_conn *conn, *detach;
+	struct worker_msg *msg;
+
+	/* Take the detach requests first, any packet queued before a
+	 * request is then guaranteed to be visible in the ring */
+	pthread_mutex_lock(&worker->lock);
+	detach = worker->detach;
+	worker->detach = NULL;
+	pthread_mutex_unlock(&worker->lock);
+
+	while ((msg = ring_pop(&worker->tx))) {
+		if (send(msg->conn->fd, msg->data, msg->len,
+							MSG_DONTWAIT) < 0)
+			fprintf(stderr, "Failed to send packet: %s\n",
+							strerror(errno));
+
+		free(msg);
+	}
+
+	while (detach) {
+		conn = detach;
+		detach = conn->detach_next;
+
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+		conn_unstall(worker, conn);
+
+		pthread_mutex_lock(&worker->lock);
+		conn->detach_next = worker->detached;
+		worker->detached = conn;
+		pthread_mutex_unlock(&worker->lock);
+	}
+}
+
+static void *worker_thread(void *user_data)
+{
+	struct worker *worker = user_data;
+
+	while (!__atomic_load_n(&worker->terminate, __ATOMIC_ACQUIRE)) {
+		struct epoll_event events[MAX_EPOLL_EVENTS];
+		int n, nfds, wake = 0;
+
+		nfds = epoll_wait(worker->epoll_fd, events,
+						MAX_EPOLL_EVENTS, -1);
+		if (nfds < 0)
+			continue;
+
+		for (n = 0; n < nfds; n++) {
+			struct worker_conn *conn = events[n].data.ptr;
+
+			if (!conn) {
+				wake = 1;
+				continue;
+			}
+
+			if (events[n].events & (EPOLLERR | EPOLLHUP))
+				conn_hangup(conn);
+			else
+				conn_read(conn);
+		}
+
+		/* Detaching hands connections back to the mainloop to be
+		 * freed, so it has to wait until no event of this batch
+		 * can refer to them anymore */
+		if (wake) {
+			clear_fd(worker->wake_fd, &worker->wake_pending);
+			worker_process_tx(worker);
+			conn_resume(worker);
+		}
+
+		signal_fd(worker->notify_fd, &worker->notify_pending);
+	}
+
+	return NULL;
+}
+
+/* Called on the mainloop thread */
+static void worker_notify_callback(int fd, uint32_t events, void *user_data)
+{
+	struct worker *worker = user_data;
+	struct worker_conn *detached;
+	struct worker_msg *msg;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	clear_fd(worker->notify_fd, &worker->notify_pending);
+
+	/* Same ordering as on the worker side, messages for detached
+	 * connections are all in the ring before the acknowledgement */
+	pthread_mutex_lock(&worker->lock);
+	detached = worker->detached;
+	worker->detached = NULL;
+	pthread_mutex_unlock(&worker->lock);
+
+	while ((msg = ring_pop(&worker->rx))) {
+		struct worker_conn *conn = msg->conn;
+
+		switch (msg->type) {
+		case WORKER_MSG_PACKET:
+			if (!conn->detaching)
+				conn->packet(msg->data, msg->len,
+							conn->user_data);
+			break;
+		case WORKER_MSG_HANGUP:
+			if (!conn->detaching && conn->hangup)
+				conn->hangup(conn->user_data);
+			break;
+		}
+
+		free(msg);
+	}
+
+	while (detached) {
+		struct worker_conn *conn = detached;
+
+		detached = conn->detach_next;
+
+		close(conn->fd);
+		free(conn->buf);
+		free(conn);
+	}
+
+	/* Stalled connections may continue now that there is room */
+	signal_fd(worker->wake_fd, &worker->wake_pending);
+}
+
+static void worker_free(struct worker *worker)
+{
+	struct worker_msg *msg;
+
+	while ((msg = ring_pop(&worker->rx)))
+		free(msg);
+
+	while ((msg = ring_pop(&worker->tx)))
+		free(msg);
+
+	if (worker->notify_fd >= 0)
+		close(worker->notify_fd);
+
+	if (worker->wake_fd >= 0)
+		close(worker->wake_fd);
+
+	if (worker->epoll_fd >= 0)
+		close(worker->epoll_fd);
+
+	pthread_mutex_destroy(&worker->lock);
+	free(worker);
+}
+
+static struct worker *worker_new(void)
+{
+	struct worker *worker;
+	struct epoll_event ev;
+
+	worker = malloc(sizeof(*worker));
+	if (!worker)
+		return NULL;
+
+	memset(worker, 0, sizeof(*worker));
+	pthread_mutex_init(&worker->lock, NULL);
+
+	worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	worker->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (worker->epoll_fd < 0 || worker->wake_fd < 0 ||
+						worker->notify_fd < 0)
+		goto failed;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+
+	if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd,
+								&ev) < 0)
+		goto failed;
+
+	if (mainloop_add_fd(worker->notify_fd, EPOLLIN,
+				worker_notify_callback, worker, NULL) < 0)
+		goto failed;
+
+	if (pthread_create(&worker->thread, NULL, worker_thread,
+							worker) != 0) {
+		mainloop_remove_fd(worker->notify_fd);
+		goto failed;
+	}
+
+	return worker;
+
+failed:
+	worker_free(worker);
+	return NULL;
+}
+
+int worker_pool_init(unsigned int num)
+{
+	if (num_workers > 0 || num == 0 || num > MAX_WORKERS)
+		return -EINVAL;
+
+	for (num_workers = 0; num_workers < num; num_workers++) {
+		workers[num_workers] = worker_new();
+		if (!workers[num_workers]) {
+			worker_pool_cleanup();
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+void worker_pool_cleanup(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_workers; i++) {
+		struct worker *worker = workers[i];
+
+		__atomic_store_n(&worker->terminate, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&worker->wake_pending, 0, __ATOMIC_RELEASE);
+		signal_fd(worker->wake_fd, &worker->wake_pending);
+
+		pthread_join(worker->thread, NULL);
+
+		mainloop_remove_fd(worker->notify_fd);
+		worker_free(worker);
+		workers[i] = NULL;
+	}
+
+	num_workers = 0;
+}
+
+int worker_pool_active(void)
+{
+	return num_workers > 0;
+}
+
+struct worker_conn *worker_attach(int fd, worker_packet_func packet,
+				worker_hangup_func hangup, void *user_data)
+{
+	struct worker_conn *conn;
+	struct epoll_event ev;
+
+	if (num_workers == 0 || !packet)
+		return NULL;
+
+	conn = malloc(sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = fd;
+	conn->packet = packet;
+	conn->hangup = hangup;
+	conn->user_data = user_data;
+
+	conn->buf = malloc(READ_BUF_SIZE);
+	if (!conn->buf) {
+		free(conn);
+		return NULL;
+	}
+
+	conn->buf_size = READ_BUF_SIZE;
+
+	/* Spread connections evenly, each one stays with its worker */
+	conn->worker = workers[next_worker++ % num_workers];
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+
+	if (epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		free(conn->buf);
+		free(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+void worker_detach(struct worker_conn *conn)
+{
+	struct worker *worker;
+
+	if (!conn || conn->detaching)
+		return;
+
+	conn->detaching = 1;
+	worker = conn->worker;
+
+	/* Socket and memory are released once the worker acknowledged */
+	pthread_mutex_lock(&worker->lock);
+	conn->detach_next = worker->detach;
+	worker->detach = conn;
+	pthread_mutex_unlock(&worker->lock);
+
+	signal_fd(conn->worker->wake_fd, &conn->worker->wake_pending);
+}
+
+void worker_send(struct worker_conn *conn, const void *data, uint16_t len)
+{
+	struct worker_msg *msg;
+
+	if (conn->detaching)
+		return;
+
+	msg = msg_new(WORKER_MSG_PACKET, conn, data, len);
+	if (!msg)
+		return;
+
+	/* Same as a full socket buffer, the packet is lost */
+	if (ring_push(&conn->worker->tx, msg) < 0) {
+		free(msg);
+		return;
+	}
+
+	signal_fd(conn->worker->wake_fd, &conn->worker->wake_pending);
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+
+typedef void (*worker_packet_func) (const void *data, uint16_t len,
+							void *user_data);
+typedef void (*worker_hangup_func) (void *user_data);
+
+struct worker_conn;
+
+int worker_pool_init(unsigned int num);
+void worker_pool_cleanup(void);
+int worker_pool_active(void);
+
+struct worker_conn *worker_attach(int fd, worker_packet_func packet,
+				worker_hangup_func hangup, void *user_data);
+void worker_detach(struct worker_conn *conn);
+
+void worker_send(struct worker_conn *conn, const void *data, uint16_t len);
@@ -43,9 +43,16 @@ struct generic_data {
 	char *introspect;
 };
 
+struct method_index {
+	const GDBusMethodTable *methods;
+	GHashTable *table;
+	unsigned int refcount;
+};
+
 struct interface_data {
 	char *name;
 	const GDBusMethodTable *methods;
+	struct method_index *index;
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
 	void *user_data;
@@ -59,6 +66,58 @@ struct security_data {
 	void *iface_user_data;
 };
 
+/* Method tables are static and shared by all objects of a kind, so their
+ * name lookup tables are shared as well */
+static GHashTable *method_indexes = NULL;
+
+static struct method_index *method_index_ref(const GDBusMethodTable *methods)
+{
+	const GDBusMethodTable *method;
+	struct method_index *index;
+
+	if (method_indexes == NULL)
+		method_indexes = g_hash_table_new(NULL, NULL);
+
+	index = g_hash_table_lookup(method_indexes, methods);
+	if (index != NULL) {
+		index->refcount++;
+		return index;
+	}
+
+	index = g_new0(struct method_index, 1);
+	index->methods = methods;
+	index->table = g_hash_table_new(g_str_hash, g_str_equal);
+	index->refcount = 1;
+
+	/* Overloaded methods point at their first entry */
+	for (method = methods; method && method->name && method->function;
+								method++) {
+		if (g_hash_table_lookup(index->table, method->name) == NULL)
+			g_hash_table_insert(index->table,
+					(gpointer) method->name,
+					(gpointer) method);
+	}
+
+	g_hash_table_insert(method_indexes, (gpointer) methods, index);
+
+	return index;
+}
+
+static void method_index_unref(struct method_index *index)
+{
+	if (--index->refcount > 0)
+		return;
+
+	g_hash_table_remove(method_indexes, index->methods);
+	g_hash_table_destroy(index->table);
+	g_free(index);
+
+	if (g_hash_table_size(method_indexes) == 0) {
+		g_hash_table_destroy(method_indexes);
+		method_indexes = NULL;
+	}
+}
+
 static void print_arguments(GString *gstr, const GDBusArgInfo *args,
 						const char *direction)
 {
@@ -418,18 +477,27 @@ static DBusHandlerResult generic_message(DBusConnection *connection,
 	struct generic_data *data = user_data;
 	struct interface_data *iface;
 	const GDBusMethodTable *method;
-	const char *interface;
+	const char *interface, *member;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
 	interface = dbus_message_get_interface(message);
 
 	iface = find_interface(data->interfaces, interface);
-	if (iface == NULL)
+	if (iface == NULL || iface->index == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	member = dbus_message_get_member(message);
+	if (member == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (method = iface->methods; method &&
-			method->name && method->function; method++) {
-		if (dbus_message_is_method_call(message, iface->name,
-							method->name) == FALSE)
+	method = g_hash_table_lookup(iface->index->table, member);
+	if (method == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	for (; method->name && method->function; method++) {
+		if (strcmp(method->name, member) != 0)
 			continue;
 
 		if (g_dbus_args_have_signature(method->in_args,
@@ -505,6 +573,8 @@ static void add_interface(struct generic_data *data, const char *name,
 	iface = g_new0(struct interface_data, 1);
 	iface->name = g_strdup(name);
 	iface->methods = methods;
+	if (methods != NULL)
+		iface->index = method_index_ref(methods);
 	iface->signals = signals;
 	iface->properties = properties;
 	iface->user_data = user_data;
@@ -559,6 +629,9 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 	if (iface->destroy)
 		iface->destroy(iface->user_data);
 
+	if (iface->index)
+		method_index_unref(iface->index);
+
 	g_free(iface->name);
 	g_free(iface);
 
@@ -71,6 +71,69 @@ static sdp_data_t *sdp_copy_seq(sdp_data_t *data);
 static int sdp_attr_add_new_with_length(sdp_record_t *rec,
 	uint16_t attr, uint8_t dtd, const void *value, uint32_t len);
 static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d);
+static void record_detach(sdp_record_t *rec);
+
+/*
+ * Records parsed by sdp_extract_pdu_arena() live in one allocation: the
+ * sdp_record_t, an array of list nodes that serves both as rec->attrlist
+ * and as an index sorted by attribute id, and then every sdp_data_t,
+ * string and pattern UUID of the record. Such records are read-only,
+ * anything that modifies one first moves its attributes and pattern to
+ * individually allocated lists with record_detach().
+ */
+#define ARENA_MAGIC 0x53445041	/* "SDPA" */
+
+struct arena_record {
+	sdp_record_t rec;
+	uint32_t magic;
+	int count;
+	sdp_list_t attrs[0];
+};
+
+struct sdp_arena {
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+};
+
+#define ARENA_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+static void *arena_alloc(struct sdp_arena *arena, size_t size)
+{
+	void *ptr;
+
+	if (!arena)
+		return malloc(size);
+
+	size = ARENA_ALIGN(size);
+	if (arena->used + size > arena->size)
+		return NULL;
+
+	ptr = arena->buf + arena->used;
+	arena->used += size;
+
+	return ptr;
+}
+
+static void arena_free(struct sdp_arena *arena, void *ptr)
+{
+	/* Arena space is released together with the record */
+	if (!arena)
+		free(ptr);
+}
+
+static int record_in_arena(const sdp_record_t *rec)
+{
+	const struct arena_record *ar = (const struct arena_record *) rec;
+
+	/* Only an arena record has its attribute list right behind it,
+	 * so the header is never read for ordinary records unless the
+	 * allocator happened to place their first list node there */
+	if (rec->attrlist == NULL || rec->attrlist != ar->attrs)
+		return 0;
+
+	return ar->magic == ARENA_MAGIC;
+}
 
 /* Message structure. */
 struct tupla {
@@ -582,8 +645,11 @@ static void extract_svclass_uuid(sdp_data_t *data, uuid_t *uuid)
 
 int sdp_attr_add(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 {
-	sdp_data_t *p = sdp_data_get(rec, attr);
+	sdp_data_t *p;
 
+	record_detach(rec);
+
+	p = sdp_data_get(rec, attr);
 	if (p)
 		return -1;
 
@@ -598,8 +664,11 @@ int sdp_attr_add(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 
 void sdp_attr_remove(sdp_record_t *rec, uint16_t attr)
 {
-	sdp_data_t *d = sdp_data_get(rec, attr);
+	sdp_data_t *d;
 
+	record_detach(rec);
+
+	d = sdp_data_get(rec, attr);
 	if (d)
 		rec->attrlist = sdp_list_remove(rec->attrlist, d);
 
@@ -938,8 +1007,11 @@ int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 
 void sdp_attr_replace(sdp_record_t *rec, uint16_t attr, sdp_data_t *d)
 {
-	sdp_data_t *p = sdp_data_get(rec, attr);
+	sdp_data_t *p;
+
+	record_detach(rec);
 
+	p = sdp_data_get(rec, attr);
 	if (p) {
 		rec->attrlist = sdp_list_remove(rec->attrlist, p);
 		sdp_data_free(p);
@@ -1036,7 +1108,8 @@ int sdp_uuid_extract(const uint8_t *p, int bufsize, uuid_t *uuid, int *scanned)
 	return 0;
 }
 
-static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
+static sdp_data_t *extract_int(const void *p, int bufsize, int *len,
+						struct sdp_arena *arena)
 {
 	sdp_data_t *d;
 
@@ -1045,7 +1118,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = arena_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1064,7 +1137,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint8_t);
@@ -1074,7 +1147,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint16_t);
@@ -1084,7 +1157,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT32:
 		if (bufsize < (int) sizeof(uint32_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint32_t);
@@ -1094,7 +1167,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT64:
 		if (bufsize < (int) sizeof(uint64_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint64_t);
@@ -1104,23 +1177,69 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT128:
 		if (bufsize < (int) sizeof(uint128_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint128_t);
 		ntoh128((uint128_t *) p, &d->val.uint128);
 		break;
 	default:
-		free(d);
+		arena_free(arena, d);
 		d = NULL;
 	}
 	return d;
 }
 
+static void arena_pattern_add(struct sdp_arena *arena, sdp_record_t *rec,
+							const uuid_t *uuid)
+{
+	sdp_list_t *n, *p, *q;
+	uuid_t uuid128;
+
+	memset(&uuid128, 0, sizeof(uuid128));
+	switch (uuid->type) {
+	case SDP_UUID128:
+		uuid128 = *uuid;
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&uuid128, uuid);
+		break;
+	}
+
+	for (q = NULL, p = rec->pattern; p; q = p, p = p->next) {
+		int cmp = sdp_uuid128_cmp(p->data, &uuid128);
+
+		if (cmp == 0)
+			return;
+
+		if (cmp > 0)
+			break;
+	}
+
+	n = arena_alloc(arena, sizeof(sdp_list_t));
+	if (!n)
+		return;
+
+	n->data = arena_alloc(arena, sizeof(uuid_t));
+	if (!n->data)
+		return;
+
+	*((uuid_t *) n->data) = uuid128;
+
+	n->next = p;
+	if (q)
+		q->next = n;
+	else
+		rec->pattern = n;
+}
+
 static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
-							sdp_record_t *rec)
+				sdp_record_t *rec, struct sdp_arena *arena)
 {
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = arena_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1128,11 +1247,13 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 	SDPDBG("Extracting UUID");
 	memset(d, 0, sizeof(sdp_data_t));
 	if (sdp_uuid_extract(p, bufsize, &d->val.uuid, len) < 0) {
-		free(d);
+		arena_free(arena, d);
 		return NULL;
 	}
 	d->dtd = *p;
-	if (rec)
+	if (rec && arena)
+		arena_pattern_add(arena, rec, &d->val.uuid);
+	else if (rec)
 		sdp_pattern_add_uuid(rec, &d->val.uuid);
 	return d;
 }
@@ -1140,7 +1261,8 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 /*
  * Extract strings from the PDU (could be service description and similar info)
  */
-static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
+static sdp_data_t *extract_str(const void *p, int bufsize, int *len,
+						struct sdp_arena *arena)
 {
 	char *s;
 	int n;
@@ -1151,7 +1273,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = arena_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1166,7 +1288,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		n = *(uint8_t *) p;
@@ -1178,30 +1300,30 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			arena_free(arena, d);
 			return NULL;
 		}
 		n = ntohs(bt_get_unaligned((uint16_t *) p));
 		p += sizeof(uint16_t);
-		*len += sizeof(uint16_t) + n;
+		*len += sizeof(uint16_t);
 		bufsize -= sizeof(uint16_t);
 		break;
 	default:
 		SDPERR("Sizeof text string > UINT16_MAX\n");
-		free(d);
+		arena_free(arena, d);
 		return NULL;
 	}
 
 	if (bufsize < n) {
 		SDPERR("String too long to fit in packet");
-		free(d);
+		arena_free(arena, d);
 		return NULL;
 	}
 
-	s = malloc(n + 1);
+	s = arena_alloc(arena, n + 1);
 	if (!s) {
 		SDPERR("Not enough memory for incoming string");
-		free(d);
+		arena_free(arena, d);
 		return NULL;
 	}
 	memset(s, 0, n + 1);
@@ -1270,12 +1392,15 @@ int sdp_extract_seqtype(const uint8_t *buf, int bufsize, uint8_t *dtdp, int *siz
 	return scanned;
 }
 
+static sdp_data_t *extract_attr(const uint8_t *p, int bufsize, int *size,
+				sdp_record_t *rec, struct sdp_arena *arena);
+
 static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
-							sdp_record_t *rec)
+				sdp_record_t *rec, struct sdp_arena *arena)
 {
 	int seqlen, n = 0;
 	sdp_data_t *curr, *prev;
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = arena_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1290,7 +1415,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 
 	if (*len > bufsize) {
 		SDPERR("Packet not big enough to hold sequence.");
-		free(d);
+		arena_free(arena, d);
 		return NULL;
 	}
 
@@ -1299,7 +1424,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 	prev = NULL;
 	while (n < seqlen) {
 		int attrlen = 0;
-		curr = sdp_extract_attr(p, bufsize, &attrlen, rec);
+		curr = extract_attr(p, bufsize, &attrlen, rec, arena);
 		if (curr == NULL)
 			break;
 
@@ -1313,14 +1438,19 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 		bufsize -= attrlen;
 
 		SDPDBG("Extracted: %d SequenceLength: %d", n, seqlen);
+
+		/* Only a truncated sequence header consumes nothing, and
+		 * nothing can follow it */
+		if (attrlen == 0)
+			break;
 	}
 
 	*len += n;
 	return d;
 }
 
-sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
-							sdp_record_t *rec)
+static sdp_data_t *extract_attr(const uint8_t *p, int bufsize, int *size,
+				sdp_record_t *rec, struct sdp_arena *arena)
 {
 	sdp_data_t *elem;
 	int n = 0;
@@ -1347,12 +1477,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_INT32:
 	case SDP_INT64:
 	case SDP_INT128:
-		elem = extract_int(p, bufsize, &n);
+		elem = extract_int(p, bufsize, &n, arena);
 		break;
 	case SDP_UUID16:
 	case SDP_UUID32:
 	case SDP_UUID128:
-		elem = extract_uuid(p, bufsize, &n, rec);
+		elem = extract_uuid(p, bufsize, &n, rec, arena);
 		break;
 	case SDP_TEXT_STR8:
 	case SDP_TEXT_STR16:
@@ -1360,7 +1490,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_URL_STR8:
 	case SDP_URL_STR16:
 	case SDP_URL_STR32:
-		elem = extract_str(p, bufsize, &n);
+		elem = extract_str(p, bufsize, &n, arena);
 		break;
 	case SDP_SEQ8:
 	case SDP_SEQ16:
@@ -1368,7 +1498,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
-		elem = extract_seq(p, bufsize, &n, rec);
+		elem = extract_seq(p, bufsize, &n, rec, arena);
 		break;
 	default:
 		SDPERR("Unknown data descriptor : 0x%x terminating\n", dtd);
@@ -1378,6 +1508,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	return elem;
 }
 
+sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
+							sdp_record_t *rec)
+{
+	return extract_attr(p, bufsize, size, rec, NULL);
+}
+
 #ifdef SDP_DEBUG
 static void attr_print_func(void *value, void *userData)
 {
@@ -1464,6 +1600,250 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 	return rec;
 }
 
+/*
+ * Walks one data element the same way extract_attr() does and adds the
+ * arena space it needs to *size. Returns the number of bytes scanned or
+ * -1 if extract_attr() would fail on it. A truncated sequence header
+ * scans 0 bytes, extract_seq() keeps it as an empty sequence.
+ */
+static int arena_measure(const uint8_t *p, int bufsize, size_t *size)
+{
+	int len, seqlen, n;
+	uint8_t dtd;
+
+	if (bufsize < (int) sizeof(uint8_t))
+		return -1;
+
+	*size += ARENA_ALIGN(sizeof(sdp_data_t));
+
+	switch (*p) {
+	case SDP_DATA_NIL:
+		return sizeof(uint8_t);
+	case SDP_BOOL:
+	case SDP_INT8:
+	case SDP_UINT8:
+		len = sizeof(uint8_t);
+		break;
+	case SDP_INT16:
+	case SDP_UINT16:
+		len = sizeof(uint16_t);
+		break;
+	case SDP_INT32:
+	case SDP_UINT32:
+		len = sizeof(uint32_t);
+		break;
+	case SDP_INT64:
+	case SDP_UINT64:
+		len = sizeof(uint64_t);
+		break;
+	case SDP_INT128:
+	case SDP_UINT128:
+		len = sizeof(uint128_t);
+		break;
+	case SDP_UUID16:
+	case SDP_UUID32:
+	case SDP_UUID128:
+		*size += ARENA_ALIGN(sizeof(sdp_list_t)) +
+					ARENA_ALIGN(sizeof(uuid_t));
+		len = *p == SDP_UUID16 ? sizeof(uint16_t) :
+			*p == SDP_UUID32 ? sizeof(uint32_t) : sizeof(uint128_t);
+		break;
+	case SDP_TEXT_STR8:
+	case SDP_URL_STR8:
+		if (bufsize < 2)
+			return -1;
+		n = p[1];
+		*size += ARENA_ALIGN(n + 1);
+		len = sizeof(uint8_t) + n;
+		break;
+	case SDP_TEXT_STR16:
+	case SDP_URL_STR16:
+		if (bufsize < 3)
+			return -1;
+		n = ntohs(bt_get_unaligned((uint16_t *) (p + 1)));
+		*size += ARENA_ALIGN(n + 1);
+		len = sizeof(uint16_t) + n;
+		break;
+	case SDP_SEQ8:
+	case SDP_SEQ16:
+	case SDP_SEQ32:
+	case SDP_ALT8:
+	case SDP_ALT16:
+	case SDP_ALT32:
+		len = sdp_extract_seqtype(p, bufsize, &dtd, &seqlen);
+		if (len == 0)
+			return 0;
+
+		p += len;
+		bufsize -= len;
+		for (n = 0; n < seqlen; ) {
+			int elem = arena_measure(p, bufsize, size);
+			if (elem < 0)
+				break;
+
+			p += elem;
+			n += elem;
+			bufsize -= elem;
+
+			if (elem == 0)
+				break;
+		}
+
+		return len + n;
+	default:
+		return -1;
+	}
+
+	if (bufsize < (int) sizeof(uint8_t) + len)
+		return -1;
+
+	return sizeof(uint8_t) + len;
+}
+
+static int arena_attr_cmp(const void *a, const void *b)
+{
+	const sdp_data_t *d1 = ((const sdp_list_t *) a)->data;
+	const sdp_data_t *d2 = ((const sdp_list_t *) b)->data;
+
+	if (d1->attrId != d2->attrId)
+		return d1->attrId - d2->attrId;
+
+	/* Later duplicates sit at higher addresses in the arena */
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+/* Sorts the attribute index, keeps the last of duplicated attributes
+ * like sdp_attr_replace() would and links it up as rec->attrlist */
+static void arena_index(struct arena_record *ar, int count)
+{
+	int i, n;
+
+	for (i = 1; i < count; i++) {
+		const sdp_data_t *prev = ar->attrs[i - 1].data;
+		const sdp_data_t *curr = ar->attrs[i].data;
+
+		if (prev->attrId >= curr->attrId) {
+			qsort(ar->attrs, count, sizeof(sdp_list_t),
+							arena_attr_cmp);
+			break;
+		}
+	}
+
+	for (i = 0, n = 0; i < count; i++) {
+		const sdp_data_t *d = ar->attrs[i].data;
+
+		if (i + 1 < count && d->attrId ==
+				((sdp_data_t *) ar->attrs[i + 1].data)->attrId)
+			continue;
+
+		ar->attrs[n++].data = ar->attrs[i].data;
+	}
+
+	for (i = 0; i < n; i++)
+		ar->attrs[i].next = i + 1 < n ? &ar->attrs[i + 1] : NULL;
+
+	ar->count = n;
+	if (n > 0) {
+		ar->rec.attrlist = ar->attrs;
+	} else {
+		ar->rec.attrlist = NULL;
+		ar->rec.pattern = NULL;
+	}
+}
+
+/*
+ * Same as sdp_extract_pdu() but the record is built in a single
+ * allocation, see struct arena_record. sdp_record_free() releases it.
+ */
+sdp_record_t *sdp_extract_pdu_arena(const uint8_t *buf, int bufsize,
+								int *scanned)
+{
+	struct arena_record *ar;
+	struct sdp_arena arena;
+	int extracted = 0, seqlen = 0, nattrs = 0, count = 0;
+	size_t size = 0;
+	const uint8_t *p = buf;
+	uint8_t dtd;
+
+	*scanned = sdp_extract_seqtype(buf, bufsize, &dtd, &seqlen);
+	p += *scanned;
+	bufsize -= *scanned;
+
+	/* First pass only sizes the arena */
+	while (extracted < seqlen && bufsize > 0) {
+		int n = sizeof(uint8_t) + sizeof(uint16_t), attrlen;
+
+		if (bufsize < n)
+			break;
+
+		attrlen = arena_measure(p + n, bufsize - n, &size);
+		if (attrlen < 0)
+			break;
+
+		n += attrlen;
+		nattrs++;
+		extracted += n;
+		p += n;
+		bufsize -= n;
+	}
+
+	arena.used = sizeof(struct arena_record) +
+					nattrs * sizeof(sdp_list_t);
+	arena.size = arena.used + size;
+	arena.buf = malloc(arena.size);
+	if (!arena.buf)
+		return NULL;
+
+	memset(arena.buf, 0, arena.size);
+
+	ar = (struct arena_record *) arena.buf;
+	ar->rec.handle = 0xffffffff;
+	ar->magic = ARENA_MAGIC;
+
+	p = buf + *scanned;
+	bufsize += extracted;
+	extracted = 0;
+
+	while (extracted < seqlen && bufsize > 0 && count < nattrs) {
+		int n = sizeof(uint8_t), attrlen = 0;
+		sdp_data_t *data;
+		uint16_t attr;
+
+		if (bufsize < n + (int) sizeof(uint16_t)) {
+			SDPERR("Unexpected end of packet");
+			break;
+		}
+
+		attr = ntohs(bt_get_unaligned((uint16_t *) (p + n)));
+		n += sizeof(uint16_t);
+
+		data = extract_attr(p + n, bufsize - n, &attrlen, &ar->rec,
+									&arena);
+
+		n += attrlen;
+		if (data == NULL)
+			break;
+
+		if (attr == SDP_ATTR_RECORD_HANDLE)
+			ar->rec.handle = data->val.uint32;
+
+		if (attr == SDP_ATTR_SVCLASS_ID_LIST)
+			extract_svclass_uuid(data, &ar->rec.svclass);
+
+		data->attrId = attr;
+		ar->attrs[count++].data = data;
+
+		extracted += n;
+		p += n;
+		bufsize -= n;
+	}
+
+	arena_index(ar, count);
+
+	*scanned += seqlen;
+	return &ar->rec;
+}
+
 static void sdp_copy_pattern(void *value, void *udata)
 {
 	uuid_t *uuid = value;
@@ -1597,6 +1977,81 @@ sdp_record_t *sdp_copy_record(sdp_record_t *rec)
 	return cpy;
 }
 
+/* Strings keep the terminating NUL extract_str() added, unlike the
+ * copies sdp_copy_record() makes */
+static sdp_data_t *arena_data_copy(const sdp_data_t *d)
+{
+	sdp_data_t *cpy, *child, **next;
+
+	cpy = malloc(sizeof(sdp_data_t));
+	if (!cpy)
+		return NULL;
+
+	memcpy(cpy, d, sizeof(sdp_data_t));
+	cpy->next = NULL;
+
+	switch (d->dtd) {
+	case SDP_SEQ8:
+	case SDP_SEQ16:
+	case SDP_SEQ32:
+	case SDP_ALT8:
+	case SDP_ALT16:
+	case SDP_ALT32:
+		next = &cpy->val.dataseq;
+		*next = NULL;
+		for (child = d->val.dataseq; child; child = child->next) {
+			*next = arena_data_copy(child);
+			if (!*next)
+				break;
+			next = &(*next)->next;
+		}
+		break;
+	case SDP_URL_STR8:
+	case SDP_URL_STR16:
+	case SDP_TEXT_STR8:
+	case SDP_TEXT_STR16:
+		cpy->val.str = malloc(d->unitSize);
+		if (!cpy->val.str) {
+			free(cpy);
+			return NULL;
+		}
+		memcpy(cpy->val.str, d->val.str, d->unitSize);
+		break;
+	}
+
+	return cpy;
+}
+
+/* Gives an arena record its own attribute and pattern lists so it can
+ * be modified, the arena itself goes away with the record */
+static void record_detach(sdp_record_t *rec)
+{
+	sdp_list_t *attrlist = NULL, *pattern = NULL, *l;
+
+	if (!record_in_arena(rec))
+		return;
+
+	for (l = rec->pattern; l; l = l->next) {
+		uuid_t *uuid = malloc(sizeof(uuid_t));
+
+		if (!uuid)
+			continue;
+
+		*uuid = *((uuid_t *) l->data);
+		pattern = sdp_list_append(pattern, uuid);
+	}
+
+	for (l = rec->attrlist; l; l = l->next) {
+		sdp_data_t *d = arena_data_copy(l->data);
+
+		if (d)
+			attrlist = sdp_list_append(attrlist, d);
+	}
+
+	rec->pattern = pattern;
+	rec->attrlist = attrlist;
+}
+
 #ifdef SDP_DEBUG
 static void print_dataseq(sdp_data_t *p)
 {
@@ -1671,8 +2126,33 @@ void sdp_data_print(sdp_data_t *d)
 }
 #endif
 
+static sdp_data_t *arena_data_get(const struct arena_record *ar,
+							uint16_t attrId)
+{
+	int lo = 0, hi = ar->count - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		sdp_data_t *d = ar->attrs[mid].data;
+
+		if (d->attrId == attrId)
+			return d;
+
+		if (d->attrId < attrId)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return NULL;
+}
+
 sdp_data_t *sdp_data_get(const sdp_record_t *rec, uint16_t attrId)
 {
+	if (record_in_arena(rec))
+		return arena_data_get((const struct arena_record *) rec,
+								attrId);
+
 	if (rec->attrlist) {
 		sdp_data_t sdpTemplate;
 		sdp_list_t *p;
@@ -3130,14 +3610,21 @@ sdp_record_t *sdp_record_alloc(void)
  */
 void sdp_record_free(sdp_record_t *rec)
 {
-	sdp_list_free(rec->attrlist, (sdp_free_func_t) sdp_data_free);
-	sdp_list_free(rec->pattern, free);
+	if (!record_in_arena(rec)) {
+		sdp_list_free(rec->attrlist, (sdp_free_func_t) sdp_data_free);
+		sdp_list_free(rec->pattern, free);
+	}
+
 	free(rec);
 }
 
 void sdp_pattern_add_uuid(sdp_record_t *rec, uuid_t *uuid)
 {
-	uuid_t *uuid128 = sdp_uuid_to_uuid128(uuid);
+	uuid_t *uuid128;
+
+	record_detach(rec);
+
+	uuid128 = sdp_uuid_to_uuid128(uuid);
 
 	SDPDBG("Elements in target pattern : %d\n", sdp_list_len(rec->pattern));
 	SDPDBG("Trying to add : 0x%lx\n", (unsigned long) uuid128);
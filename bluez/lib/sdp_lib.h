@@ -600,6 +600,15 @@ int sdp_set_supp_feat(sdp_record_t *rec, const sdp_list_t *sf);
 int sdp_get_supp_feat(const sdp_record_t *rec, sdp_list_t **seqp);
 
 sdp_record_t *sdp_extract_pdu(const uint8_t *pdata, int bufsize, int *scanned);
+
+/*
+ * Like sdp_extract_pdu() but all of the record is placed in a single
+ * allocation and sdp_data_get() uses a sorted attribute index. The
+ * record must only be modified through the sdp_attr_* and sdp_set_*
+ * functions and is released with sdp_record_free().
+ */
+sdp_record_t *sdp_extract_pdu_arena(const uint8_t *pdata, int bufsize,
+								int *scanned);
 sdp_record_t *sdp_copy_record(sdp_record_t *rec);
 
 void sdp_data_print(sdp_data_t *data);
@@ -82,21 +82,9 @@ struct network_server {
 };
 
 static DBusConnection *connection = NULL;
-static GSList *adapters = NULL;
 static gboolean security = TRUE;
 
-static struct network_adapter *find_adapter(GSList *list,
-					struct btd_adapter *adapter)
-{
-	for (; list; list = list->next) {
-		struct network_adapter *na = list->data;
-
-		if (na->adapter == adapter)
-			return na;
-	}
-
-	return NULL;
-}
+BTD_ADAPTER_SLOT(adapter_slot, "network");
 
 static struct network_server *find_server(GSList *list, uint16_t id)
 {
@@ -682,7 +670,7 @@ static void path_unregister(void *data)
 	if (na->servers)
 		return;
 
-	adapters = g_slist_remove(adapters, na);
+	btd_adapter_set_data(na->adapter, &adapter_slot, NULL);
 	adapter_free(na);
 }
 
@@ -732,12 +720,12 @@ int server_register(struct btd_adapter *adapter)
 	struct network_server *ns;
 	const char *path;
 
-	na = find_adapter(adapters, adapter);
+	na = btd_adapter_get_data(adapter, &adapter_slot);
 	if (!na) {
 		na = create_adapter(adapter);
 		if (!na)
 			return -EINVAL;
-		adapters = g_slist_append(adapters, na);
+		btd_adapter_set_data(adapter, &adapter_slot, na);
 	}
 
 	ns = find_server(na->servers, BNEP_SVC_NAP);
@@ -777,7 +765,7 @@ int server_unregister(struct btd_adapter *adapter)
 	struct network_server *ns;
 	uint16_t id = BNEP_SVC_NAP;
 
-	na = find_adapter(adapters, adapter);
+	na = btd_adapter_get_data(adapter, &adapter_slot);
 	if (!na)
 		return -EINVAL;
 
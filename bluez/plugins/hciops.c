@@ -43,10 +43,12 @@
 #include "hcid.h"
 #include "sdpd.h"
 #include "btio.h"
+#include "glib-helper.h"
 #include "adapter.h"
 #include "device.h"
 #include "plugin.h"
 #include "log.h"
+#include "metrics.h"
 #include "storage.h"
 #include "event.h"
 #include "manager.h"
@@ -120,6 +122,9 @@ struct found_dev {
 };
 
 static int max_dev = -1;
+
+BTD_METRIC_COUNTER(hci_events, "hci_events");
+BTD_METRIC_HISTOGRAM(hci_event_us, "hci_event_us");
 static struct dev_info {
 	int id;
 	int sk;
@@ -158,7 +163,7 @@ static struct dev_info {
 	guint watch_id;
 
 	gboolean debug_keys;
-	GSList *keys;
+	GHashTable *keys;		/* bdaddr -> link_key_info */
 	uint8_t pin_length;
 
 	GSList *oob_data;
@@ -1071,12 +1076,28 @@ static int get_auth_info(int index, bdaddr_t *bdaddr, uint8_t *auth)
 
 /* Link Key handling */
 
+static struct link_key_info *find_key(struct dev_info *dev, bdaddr_t *bdaddr)
+{
+	if (dev->keys == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(dev->keys, bdaddr);
+}
+
+static void add_key(struct dev_info *dev, struct link_key_info *key_info)
+{
+	if (dev->keys == NULL)
+		dev->keys = g_hash_table_new_full(bt_bdaddr_hash,
+						bt_bdaddr_equal, NULL, g_free);
+
+	g_hash_table_replace(dev->keys, &key_info->bdaddr, key_info);
+}
+
 static void link_key_request(int index, bdaddr_t *dba)
 {
 	struct dev_info *dev = &devs[index];
 	struct link_key_info *key_info;
 	struct bt_conn *conn;
-	GSList *match;
 	char da[18];
 
 	ba2str(dba, da);
@@ -1090,11 +1111,7 @@ static void link_key_request(int index, bdaddr_t *dba)
 
 	DBG("kernel auth requirements = 0x%02x", conn->loc_auth);
 
-	match = g_slist_find_custom(dev->keys, dba, (GCompareFunc) bacmp);
-	if (match)
-		key_info = match->data;
-	else
-		key_info = NULL;
+	key_info = find_key(dev, dba);
 
 	DBG("Matching key %s", key_info ? "found" : "not found");
 
@@ -1134,7 +1151,6 @@ static void link_key_notify(int index, void *ptr)
 	struct link_key_info *key_info;
 	uint8_t old_key_type, key_type;
 	struct bt_conn *conn;
-	GSList *match;
 	char da[18];
 	uint8_t status = 0;
 
@@ -1143,18 +1159,13 @@ static void link_key_notify(int index, void *ptr)
 
 	conn = get_connection(dev, &evt->bdaddr);
 
-	match = g_slist_find_custom(dev->keys, dba, (GCompareFunc) bacmp);
-	if (match)
-		key_info = match->data;
-	else
-		key_info = NULL;
-
+	key_info = find_key(dev, dba);
 	if (key_info == NULL) {
 		key_info = g_new0(struct link_key_info, 1);
 		bacpy(&key_info->bdaddr, &evt->bdaddr);
 		old_key_type = 0xff;
 	} else {
-		dev->keys = g_slist_remove(dev->keys, key_info);
+		g_hash_table_steal(dev->keys, dba);
 		old_key_type = key_info->type;
 	}
 
@@ -1229,7 +1240,7 @@ done:
 		return;
 	}
 
-	dev->keys = g_slist_prepend(dev->keys, key_info);
+	add_key(dev, key_info);
 
 	/* If we're connected and not dedicated bonding initiators we're
 	 * done with the bonding process */
@@ -2519,7 +2530,8 @@ static void stop_hci_dev(int index)
 
 	hci_close_dev(dev->sk);
 
-	g_slist_free_full(dev->keys, g_free);
+	if (dev->keys != NULL)
+		g_hash_table_destroy(dev->keys);
 	g_slist_free_full(dev->uuids, g_free);
 	g_slist_free_full(dev->connections, g_free);
 
@@ -2538,6 +2550,7 @@ static gboolean io_security_event(GIOChannel *chan, GIOCondition cond,
 	ssize_t len;
 	hci_event_hdr *eh;
 	evt_cmd_status *evt;
+	uint64_t start;
 	int fd;
 
 	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR)) {
@@ -2563,6 +2576,9 @@ static gboolean io_security_event(GIOChannel *chan, GIOCondition cond,
 	eh = (hci_event_hdr *) ptr;
 	ptr += HCI_EVENT_HDR_SIZE;
 
+	btd_metric_inc(&hci_events);
+	start = btd_metric_now();
+
 	memset(&di, 0, sizeof(di));
 	if (hci_devinfo(index, &di) == 0) {
 		bacpy(&dev->bdaddr, &di.bdaddr);
@@ -2676,6 +2692,8 @@ static gboolean io_security_event(GIOChannel *chan, GIOCondition cond,
 		break;
 	}
 
+	btd_metric_observe_since(&hci_event_us, start);
+
 	return TRUE;
 }
 
@@ -3521,17 +3539,13 @@ static int hciops_remove_bonding(int index, bdaddr_t *bdaddr,
 {
 	struct dev_info *dev = &devs[index];
 	delete_stored_link_key_cp cp;
-	GSList *match;
 	char addr[18];
 
 	ba2str(bdaddr, addr);
 	DBG("hci%d dba %s", index, addr);
 
-	match = g_slist_find_custom(dev->keys, bdaddr, (GCompareFunc) bacmp);
-	if (match) {
-		g_free(match->data);
-		dev->keys = g_slist_delete_link(dev->keys, match);
-	}
+	if (dev->keys != NULL)
+		g_hash_table_remove(dev->keys, bdaddr);
 
 	memset(&cp, 0, sizeof(cp));
 	bacpy(&cp.bdaddr, bdaddr);
@@ -3731,7 +3745,7 @@ static int hciops_load_keys(int index, GSList *keys, gboolean debug_keys)
 	DBG("hci%d keys %d debug_keys %d", index, g_slist_length(keys),
 								debug_keys);
 
-	if (dev->keys != NULL)
+	if (dev->keys != NULL && g_hash_table_size(dev->keys) > 0)
 		return -EEXIST;
 
 	for (l = keys; l; l = l->next) {
@@ -3741,7 +3755,7 @@ static int hciops_load_keys(int index, GSList *keys, gboolean debug_keys)
 
 		dup = g_memdup(orig, sizeof(*orig));
 
-		dev->keys = g_slist_prepend(dev->keys, dup);
+		add_key(dev, dup);
 	}
 
 	dev->debug_keys = debug_keys;
@@ -25,12 +25,14 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 
 #include <glib.h>
@@ -43,6 +45,7 @@
 
 #include "plugin.h"
 #include "log.h"
+#include "metrics.h"
 #include "adapter.h"
 #include "manager.h"
 #include "device.h"
@@ -52,6 +55,12 @@
 
 #define MGMT_BUF_SIZE 1024
 
+/* Packets received with one recvmmsg call */
+#define MGMT_BATCH_SIZE 16
+
+/* Upper limit per wakeup so other sources still get to run */
+#define MGMT_MAX_EVENTS 256
+
 struct pending_uuid {
 	uuid_t uuid;
 	uint8_t svc_hint;
@@ -82,6 +91,10 @@ static struct controller_info {
 } *controllers = NULL;
 
 static int mgmt_sock = -1;
+
+BTD_METRIC_COUNTER(mgmt_events, "mgmt_events");
+BTD_METRIC_HISTOGRAM(mgmt_event_us, "mgmt_event_us");
+BTD_METRIC_COUNTER(mgmt_wakeups, "mgmt_wakeups");
 static guint mgmt_watch = 0;
 
 static uint8_t mgmt_version = 0;
@@ -162,7 +175,7 @@ static void get_connections(int sk, uint16_t index)
 						strerror(errno), errno);
 }
 
-static void mgmt_index_added(int sk, uint16_t index)
+static void mgmt_index_added(int sk, uint16_t index, void *buf, size_t len)
 {
 	add_controller(index);
 	read_info(sk, index);
@@ -186,7 +199,8 @@ static void remove_controller(uint16_t index)
 	DBG("Removed controller %u", index);
 }
 
-static void mgmt_index_removed(int sk, uint16_t index)
+static void mgmt_index_removed(int sk, uint16_t index, void *buf,
+								size_t len)
 {
 	remove_controller(index);
 }
@@ -1547,59 +1561,46 @@ static void mgmt_local_name_changed(int sk, uint16_t index, void *buf, size_t le
 		adapter_name_changed(adapter, (char *) ev->name);
 }
 
-static void mgmt_device_found(int sk, uint16_t index, void *buf, size_t len)
+static gboolean parse_device_found(uint16_t index, void *buf, size_t len,
+						struct found_dev_info *dev)
 {
 	struct mgmt_ev_device_found *ev = buf;
-	struct controller_info *info;
 	char addr[18];
 	uint32_t flags;
 	uint16_t eir_len;
-	uint8_t *eir;
-	gboolean confirm_name;
 
 	if (len < sizeof(*ev)) {
 		error("mgmt_device_found too short (%zu bytes)", len);
-		return;
+		return FALSE;
 	}
 
 	eir_len = bt_get_le16(&ev->eir_len);
 	if (len != sizeof(*ev) + eir_len) {
 		error("mgmt_device_found event size mismatch (%zu != %zu)",
 						len, sizeof(*ev) + eir_len);
-		return;
+		return FALSE;
 	}
 
 	if (index > max_index) {
 		error("Unexpected index %u in device_found event", index);
-		return;
+		return FALSE;
 	}
 
-	info = &controllers[index];
-
-	if (eir_len == 0)
-		eir = NULL;
-	else
-		eir = ev->eir;
-
 	flags = btohl(ev->flags);
 
 	ba2str(&ev->addr.bdaddr, addr);
 	DBG("hci%u addr %s, rssi %d flags 0x%04x eir_len %u",
 			index, addr, ev->rssi, flags, eir_len);
 
-	if (flags & MGMT_DEV_FOUND_LEGACY_PAIRING)
-		btd_event_set_legacy_pairing(&info->bdaddr, &ev->addr.bdaddr,
-									TRUE);
-	else
-		btd_event_set_legacy_pairing(&info->bdaddr, &ev->addr.bdaddr,
-									FALSE);
+	bacpy(&dev->bdaddr, &ev->addr.bdaddr);
+	dev->bdaddr_type = ev->addr.type;
+	dev->rssi = ev->rssi;
+	dev->confirm_name = (flags & MGMT_DEV_FOUND_CONFIRM_NAME) ? 1 : 0;
+	dev->legacy = (flags & MGMT_DEV_FOUND_LEGACY_PAIRING) ? TRUE : FALSE;
+	dev->eir = eir_len > 0 ? ev->eir : NULL;
+	dev->eir_len = eir_len;
 
-	confirm_name = (flags & MGMT_DEV_FOUND_CONFIRM_NAME);
-
-	btd_event_device_found(&info->bdaddr, &ev->addr.bdaddr,
-						ev->addr.type,
-						ev->rssi, confirm_name,
-						eir, eir_len);
+	return TRUE;
 }
 
 static void mgmt_discovering(int sk, uint16_t index, void *buf, size_t len)
@@ -1734,7 +1735,7 @@ static void mgmt_new_ltk(int sk, uint16_t index, void *buf, size_t len)
 		bonding_complete(info, &ev->key.addr.bdaddr, 0);
 }
 
-static void mgmt_cod_changed(int sk, uint16_t index)
+static void mgmt_cod_changed(int sk, uint16_t index, void *buf, size_t len)
 {
 	struct controller_info *info;
 
@@ -1753,13 +1754,115 @@ static void mgmt_cod_changed(int sk, uint16_t index)
 	}
 }
 
-static gboolean mgmt_event(GIOChannel *io, GIOCondition cond, gpointer user_data)
+typedef void (*mgmt_event_func) (int sk, uint16_t index, void *buf,
+								size_t len);
+
+static const mgmt_event_func mgmt_handlers[] = {
+	[MGMT_EV_CMD_COMPLETE]		= mgmt_cmd_complete,
+	[MGMT_EV_CMD_STATUS]		= mgmt_cmd_status,
+	[MGMT_EV_CONTROLLER_ERROR]	= mgmt_controller_error,
+	[MGMT_EV_INDEX_ADDED]		= mgmt_index_added,
+	[MGMT_EV_INDEX_REMOVED]		= mgmt_index_removed,
+	[MGMT_EV_NEW_SETTINGS]		= mgmt_new_settings,
+	[MGMT_EV_CLASS_OF_DEV_CHANGED]	= mgmt_cod_changed,
+	[MGMT_EV_LOCAL_NAME_CHANGED]	= mgmt_local_name_changed,
+	[MGMT_EV_NEW_LINK_KEY]		= mgmt_new_link_key,
+	[MGMT_EV_NEW_LONG_TERM_KEY]	= mgmt_new_ltk,
+	[MGMT_EV_DEVICE_CONNECTED]	= mgmt_device_connected,
+	[MGMT_EV_DEVICE_DISCONNECTED]	= mgmt_device_disconnected,
+	[MGMT_EV_CONNECT_FAILED]	= mgmt_connect_failed,
+	[MGMT_EV_PIN_CODE_REQUEST]	= mgmt_pin_code_request,
+	[MGMT_EV_USER_CONFIRM_REQUEST]	= mgmt_user_confirm_request,
+	[MGMT_EV_USER_PASSKEY_REQUEST]	= mgmt_passkey_request,
+	[MGMT_EV_AUTH_FAILED]		= mgmt_auth_failed,
+	[MGMT_EV_DISCOVERING]		= mgmt_discovering,
+	[MGMT_EV_DEVICE_BLOCKED]	= mgmt_device_blocked,
+	[MGMT_EV_DEVICE_UNBLOCKED]	= mgmt_device_unblocked,
+	[MGMT_EV_DEVICE_UNPAIRED]	= mgmt_device_unpaired,
+};
+
+/* Device found events received in a row for the same controller. They
+ * are handed to the adapter together before any other event is
+ * dispatched, so ordering is kept. */
+struct found_batch {
+	uint16_t index;
+	int count;
+	struct found_dev_info devs[MGMT_BATCH_SIZE];
+};
+
+static void flush_found(struct found_batch *batch)
+{
+	uint64_t start;
+
+	if (batch->count == 0)
+		return;
+
+	start = btd_metric_now();
+
+	btd_event_devices_found(&controllers[batch->index].bdaddr,
+						batch->devs, batch->count);
+	batch->count = 0;
+
+	btd_metric_observe_since(&mgmt_event_us, start);
+}
+
+static void mgmt_dispatch(int sk, uint8_t *buf, size_t size,
+						struct found_batch *batch)
 {
-	char buf[MGMT_BUF_SIZE];
 	struct mgmt_hdr *hdr = (void *) buf;
-	int sk;
-	ssize_t ret;
 	uint16_t len, opcode, index;
+	uint64_t start;
+
+	if (size < MGMT_HDR_SIZE) {
+		error("Too small Management packet");
+		return;
+	}
+
+	opcode = btohs(bt_get_unaligned(&hdr->opcode));
+	len = btohs(bt_get_unaligned(&hdr->len));
+	index = btohs(bt_get_unaligned(&hdr->index));
+
+	if (size != (size_t) (MGMT_HDR_SIZE + len)) {
+		error("Packet length mismatch. ret %zu len %u", size, len);
+		return;
+	}
+
+	btd_metric_inc(&mgmt_events);
+
+	if (opcode == MGMT_EV_DEVICE_FOUND) {
+		if (batch->count > 0 && batch->index != index)
+			flush_found(batch);
+
+		batch->index = index;
+		if (parse_device_found(index, buf + MGMT_HDR_SIZE, len,
+						&batch->devs[batch->count]))
+			batch->count++;
+
+		return;
+	}
+
+	flush_found(batch);
+
+	if (opcode >= G_N_ELEMENTS(mgmt_handlers) ||
+					mgmt_handlers[opcode] == NULL) {
+		error("Unknown Management opcode %u (index %u)", opcode, index);
+		return;
+	}
+
+	start = btd_metric_now();
+
+	mgmt_handlers[opcode](sk, index, buf + MGMT_HDR_SIZE, len);
+
+	btd_metric_observe_since(&mgmt_event_us, start);
+}
+
+static gboolean mgmt_event(GIOChannel *io, GIOCondition cond, gpointer user_data)
+{
+	uint8_t bufs[MGMT_BATCH_SIZE][MGMT_BUF_SIZE];
+	struct mmsghdr msgs[MGMT_BATCH_SIZE];
+	struct iovec iov[MGMT_BATCH_SIZE];
+	struct found_batch batch;
+	int sk, total, ret, i;
 
 	DBG("cond %d", cond);
 
@@ -1773,99 +1876,40 @@ static gboolean mgmt_event(GIOChannel *io, GIOCondition cond, gpointer user_data
 		return FALSE;
 	}
 
-	ret = read(sk, buf, sizeof(buf));
-	if (ret < 0) {
-		error("Unable to read from management socket: %s (%d)",
-						strerror(errno), errno);
-		return TRUE;
-	}
+	btd_metric_inc(&mgmt_wakeups);
 
-	DBG("Received %zd bytes from management socket", ret);
+	batch.count = 0;
 
-	if (ret < MGMT_HDR_SIZE) {
-		error("Too small Management packet");
-		return TRUE;
-	}
+	/* Drain the socket instead of waking up once per event, device
+	 * found events come in bursts while discovering */
+	for (total = 0; total < MGMT_MAX_EVENTS; total += ret) {
+		memset(msgs, 0, sizeof(msgs));
 
-	opcode = btohs(bt_get_unaligned(&hdr->opcode));
-	len = btohs(bt_get_unaligned(&hdr->len));
-	index = btohs(bt_get_unaligned(&hdr->index));
+		for (i = 0; i < MGMT_BATCH_SIZE; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = MGMT_BUF_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
 
-	if (ret != MGMT_HDR_SIZE + len) {
-		error("Packet length mismatch. ret %zd len %u", ret, len);
-		return TRUE;
-	}
+		ret = recvmmsg(sk, msgs, MGMT_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				error("Unable to read from management socket:"
+						" %s (%d)", strerror(errno), errno);
+			break;
+		}
 
-	switch (opcode) {
-	case MGMT_EV_CMD_COMPLETE:
-		mgmt_cmd_complete(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_CMD_STATUS:
-		mgmt_cmd_status(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_CONTROLLER_ERROR:
-		mgmt_controller_error(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_INDEX_ADDED:
-		mgmt_index_added(sk, index);
-		break;
-	case MGMT_EV_INDEX_REMOVED:
-		mgmt_index_removed(sk, index);
-		break;
-	case MGMT_EV_NEW_SETTINGS:
-		mgmt_new_settings(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_CLASS_OF_DEV_CHANGED:
-		mgmt_cod_changed(sk, index);
-		break;
-	case MGMT_EV_NEW_LINK_KEY:
-		mgmt_new_link_key(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_CONNECTED:
-		mgmt_device_connected(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_DISCONNECTED:
-		mgmt_device_disconnected(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_CONNECT_FAILED:
-		mgmt_connect_failed(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_PIN_CODE_REQUEST:
-		mgmt_pin_code_request(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_USER_CONFIRM_REQUEST:
-		mgmt_user_confirm_request(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_AUTH_FAILED:
-		mgmt_auth_failed(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_LOCAL_NAME_CHANGED:
-		mgmt_local_name_changed(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_FOUND:
-		mgmt_device_found(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DISCOVERING:
-		mgmt_discovering(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_BLOCKED:
-		mgmt_device_blocked(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_UNBLOCKED:
-		mgmt_device_unblocked(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_DEVICE_UNPAIRED:
-		mgmt_device_unpaired(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_USER_PASSKEY_REQUEST:
-		mgmt_passkey_request(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	case MGMT_EV_NEW_LONG_TERM_KEY:
-		mgmt_new_ltk(sk, index, buf + MGMT_HDR_SIZE, len);
-		break;
-	default:
-		error("Unknown Management opcode %u (index %u)", opcode, index);
-		break;
+		DBG("Received %d packets from management socket", ret);
+
+		for (i = 0; i < ret; i++)
+			mgmt_dispatch(sk, bufs[i], msgs[i].msg_len, &batch);
+
+		/* The device found entries point into bufs */
+		flush_found(&batch);
+
+		if (ret < MGMT_BATCH_SIZE)
+			break;
 	}
 
 	return TRUE;
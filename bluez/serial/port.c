@@ -151,7 +151,7 @@ static int port_release(struct serial_port *port)
 			port->io = NULL;
 		} else
 			bt_cancel_discovery(&port->device->src,
-						&port->device->dst);
+						&port->device->dst, port);
 
 		return 0;
 	}
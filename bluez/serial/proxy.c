@@ -97,9 +97,10 @@ struct serial_proxy {
 	struct serial_adapter *adapter;	/* Adapter pointer */
 };
 
-static GSList *adapters = NULL;
 static int sk_counter = 0;
 
+BTD_ADAPTER_SLOT(adapter_slot, "serial");
+
 static void disable_proxy(struct serial_proxy *prx)
 {
 	if (prx->rfcomm) {
@@ -1110,7 +1111,7 @@ static void manager_path_unregister(void *data)
 	if (adapter->conn)
 		dbus_connection_unref(adapter->conn);
 
-	adapters = g_slist_remove(adapters, adapter);
+	btd_adapter_set_data(adapter->btd_adapter, &adapter_slot, NULL);
 	g_slist_free(adapter->proxies);
 	btd_adapter_unref(adapter->btd_adapter);
 	g_free(adapter);
@@ -1137,19 +1138,6 @@ static const GDBusSignalTable manager_signals[] = {
 	{ }
 };
 
-static struct serial_adapter *find_adapter(GSList *list,
-					struct btd_adapter *btd_adapter)
-{
-	for (; list; list = list->next) {
-		struct serial_adapter *adapter = list->data;
-
-		if (adapter->btd_adapter == btd_adapter)
-			return adapter;
-	}
-
-	return NULL;
-}
-
 static void serial_proxy_init(struct serial_adapter *adapter)
 {
 	GKeyFile *config;
@@ -1226,7 +1214,7 @@ int proxy_register(DBusConnection *conn, struct btd_adapter *btd_adapter)
 	struct serial_adapter *adapter;
 	const char *path;
 
-	adapter = find_adapter(adapters, btd_adapter);
+	adapter = btd_adapter_get_data(btd_adapter, &adapter_slot);
 	if (adapter)
 		return -EINVAL;
 
@@ -1245,7 +1233,7 @@ int proxy_register(DBusConnection *conn, struct btd_adapter *btd_adapter)
 		return -1;
 	}
 
-	adapters = g_slist_append(adapters, adapter);
+	btd_adapter_set_data(btd_adapter, &adapter_slot, adapter);
 
 	DBG("Registered interface %s on path %s",
 		SERIAL_MANAGER_INTERFACE, path);
@@ -1259,7 +1247,7 @@ void proxy_unregister(struct btd_adapter *btd_adapter)
 {
 	struct serial_adapter *adapter;
 
-	adapter = find_adapter(adapters, btd_adapter);
+	adapter = btd_adapter_get_data(btd_adapter, &adapter_slot);
 	if (!adapter)
 		return;
 
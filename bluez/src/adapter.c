@@ -55,6 +55,7 @@
 #include "glib-helper.h"
 #include "agent.h"
 #include "storage.h"
+#include "keystore.h"
 #include "gattrib.h"
 #include "att.h"
 #include "gatt.h"
@@ -132,6 +133,10 @@ struct btd_adapter {
 	guint auth_idle_id;		/* Ongoing authorization */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *device_index;	/* Devices by address */
+	GHashTable *pending_probes;	/* Stored devices not probed yet */
+	GQueue *probe_queue;		/* Probing order of stored devices */
+	guint probe_id;			/* Deferred driver probing */
 	GSList *mode_sessions;		/* Request Mode sessions */
 	GSList *disc_sessions;		/* Discovery sessions */
 	guint discov_id;		/* Discovery timer */
@@ -153,8 +158,19 @@ struct btd_adapter {
 	GSList *pin_callbacks;
 
 	GSList *loaded_drivers;
+
+	struct property_batch *props;	/* Pending PropertyChanged */
+
+	GPtrArray *slots;		/* Per module data */
 };
 
+/* Registered adapters by index and by address */
+static GHashTable *adapter_ids = NULL;
+static GHashTable *adapter_addrs = NULL;
+
+/* Slot indexes are handed out on first use */
+static int slot_count = 0;
+
 static void dev_info_free(void *data)
 {
 	struct remote_dev_info *dev = data;
@@ -638,7 +654,6 @@ static DBusMessage *set_discoverable_timeout(DBusConnection *conn,
 							void *data)
 {
 	struct btd_adapter *adapter = data;
-	const char *path;
 
 	if (adapter->discov_timeout == timeout && timeout == 0)
 		return dbus_message_new_method_return(msg);
@@ -650,11 +665,8 @@ static DBusMessage *set_discoverable_timeout(DBusConnection *conn,
 
 	write_discoverable_timeout(&adapter->bdaddr, timeout);
 
-	path = dbus_message_get_path(msg);
-
-	emit_property_changed(conn, path,
-				ADAPTER_INTERFACE, "DiscoverableTimeout",
-				DBUS_TYPE_UINT32, &timeout);
+	property_batch_set(adapter->props, "DiscoverableTimeout",
+						DBUS_TYPE_UINT32, &timeout);
 
 	return dbus_message_new_method_return(msg);
 }
@@ -665,7 +677,6 @@ static DBusMessage *set_pairable_timeout(DBusConnection *conn,
 						void *data)
 {
 	struct btd_adapter *adapter = data;
-	const char *path;
 
 	if (adapter->pairable_timeout == timeout && timeout == 0)
 		return dbus_message_new_method_return(msg);
@@ -677,11 +688,8 @@ static DBusMessage *set_pairable_timeout(DBusConnection *conn,
 
 	write_pairable_timeout(&adapter->bdaddr, timeout);
 
-	path = dbus_message_get_path(msg);
-
-	emit_property_changed(conn, path,
-				ADAPTER_INTERFACE, "PairableTimeout",
-				DBUS_TYPE_UINT32, &timeout);
+	property_batch_set(adapter->props, "PairableTimeout",
+						DBUS_TYPE_UINT32, &timeout);
 
 	return dbus_message_new_method_return(msg);
 }
@@ -704,9 +712,8 @@ void btd_adapter_class_changed(struct btd_adapter *adapter, uint32_t new_class)
 		attrib_gap_set(adapter, GATT_CHARAC_APPEARANCE, class, 2);
 	}
 
-	emit_property_changed(connection, adapter->path,
-				ADAPTER_INTERFACE, "Class",
-				DBUS_TYPE_UINT32, &new_class);
+	property_batch_set(adapter->props, "Class", DBUS_TYPE_UINT32,
+								&new_class);
 }
 
 void adapter_name_changed(struct btd_adapter *adapter, const char *name)
@@ -717,10 +724,7 @@ void adapter_name_changed(struct btd_adapter *adapter, const char *name)
 	g_free(adapter->name);
 	adapter->name = g_strdup(name);
 
-	if (connection)
-		emit_property_changed(connection, adapter->path,
-					ADAPTER_INTERFACE, "Name",
-					DBUS_TYPE_STRING, &name);
+	property_batch_set(adapter->props, "Name", DBUS_TYPE_STRING, &name);
 
 	if (main_opts.gatt_enabled)
 		attrib_gap_set(adapter, GATT_CHARAC_DEVICE_NAME,
@@ -780,21 +784,133 @@ static DBusMessage *set_name(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+struct stored_probe {
+	gboolean profiles;
+	GSList *uuids;
+	GSList *primaries;
+};
+
+static void stored_probe_free(gpointer data)
+{
+	struct stored_probe *probe = data;
+
+	g_slist_free_full(probe->uuids, g_free);
+	g_slist_free_full(probe->primaries, g_free);
+	g_free(probe);
+}
+
+static void run_stored_probe(struct btd_device *device,
+						struct stored_probe *probe)
+{
+	GSList *list, *uuids, *l;
+
+	if (probe->profiles) {
+		list = device_services_from_record(device, probe->uuids);
+		if (list)
+			device_register_services(connection, device, list,
+								ATT_PSM);
+
+		device_probe_drivers(device, probe->uuids);
+	}
+
+	if (probe->primaries == NULL)
+		return;
+
+	for (l = probe->primaries, uuids = NULL; l; l = l->next) {
+		struct gatt_primary *prim = l->data;
+		uuids = g_slist_append(uuids, prim->uuid);
+	}
+
+	/* The device takes over the primary services */
+	device_register_services(connection, device, probe->primaries, -1);
+	probe->primaries = NULL;
+
+	device_probe_drivers(device, uuids);
+
+	g_slist_free(uuids);
+}
+
+/* Runs the driver probing deferred by load_devices() for a device that
+ * is about to be used */
+void adapter_probe_stored_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct stored_probe *probe;
+
+	probe = g_hash_table_lookup(adapter->pending_probes, device);
+	if (probe == NULL)
+		return;
+
+	g_hash_table_steal(adapter->pending_probes, device);
+
+	run_stored_probe(device, probe);
+
+	stored_probe_free(probe);
+}
+
+static void cancel_stored_probe(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	g_hash_table_remove(adapter->pending_probes, device);
+	g_queue_remove(adapter->probe_queue, device);
+}
+
+static void adapter_index_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	bdaddr_t bdaddr;
+	char addr[18];
+
+	device_get_address(device, &bdaddr, NULL);
+	ba2str(&bdaddr, addr);
+
+	g_hash_table_replace(adapter->device_index, g_strdup(addr), device);
+}
+
+static void adapter_unindex_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	bdaddr_t bdaddr;
+	char addr[18];
+
+	device_get_address(device, &bdaddr, NULL);
+	ba2str(&bdaddr, addr);
+
+	if (g_hash_table_lookup(adapter->device_index, addr) == device)
+		g_hash_table_remove(adapter->device_index, addr);
+}
+
+static struct btd_device *lookup_device(struct btd_adapter *adapter,
+							const char *address)
+{
+	char addr[18];
+	int i;
+
+	/* The index uses the upper case form ba2str() creates */
+	for (i = 0; i < 17 && address[i] != '\0'; i++)
+		addr[i] = g_ascii_toupper(address[i]);
+
+	if (i < 17 || address[i] != '\0')
+		return NULL;
+
+	addr[i] = '\0';
+
+	return g_hash_table_lookup(adapter->device_index, addr);
+}
+
 struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 							const char *dest)
 {
 	struct btd_device *device;
-	GSList *l;
 
-	if (!adapter)
+	if (!adapter || !dest)
 		return NULL;
 
-	l = g_slist_find_custom(adapter->devices, dest,
-					(GCompareFunc) device_address_cmp);
-	if (!l)
+	device = lookup_device(adapter, dest);
+	if (!device)
 		return NULL;
 
-	device = l->data;
+	adapter_probe_stored_device(adapter, device);
 
 	return device;
 }
@@ -947,6 +1063,7 @@ static struct btd_device *adapter_create_device(DBusConnection *conn,
 	device_set_temporary(device, TRUE);
 
 	adapter->devices = g_slist_append(adapter->devices, device);
+	adapter_index_device(adapter, device);
 
 	path = device_get_path(device);
 	g_dbus_emit_signal(conn, adapter->path,
@@ -966,6 +1083,9 @@ void adapter_remove_device(DBusConnection *conn, struct btd_adapter *adapter,
 	const gchar *dev_path = device_get_path(device);
 	struct agent *agent;
 
+	cancel_stored_probe(adapter, device);
+	adapter_unindex_device(adapter, device);
+
 	adapter->devices = g_slist_remove(adapter->devices, device);
 	adapter->connections = g_slist_remove(adapter->connections, device);
 
@@ -1078,13 +1198,10 @@ static DBusMessage *adapter_stop_discovery(DBusConnection *conn,
 	return dbus_message_new_method_return(msg);
 }
 
-static DBusMessage *get_properties(DBusConnection *conn,
-					DBusMessage *msg, void *data)
+void adapter_append_properties(struct btd_adapter *adapter,
+						DBusMessageIter *iter)
 {
-	struct btd_adapter *adapter = data;
 	const char *property;
-	DBusMessage *reply;
-	DBusMessageIter iter;
 	DBusMessageIter dict;
 	char srcaddr[18];
 	gboolean value;
@@ -1095,16 +1212,7 @@ static DBusMessage *get_properties(DBusConnection *conn,
 
 	ba2str(&adapter->bdaddr, srcaddr);
 
-	if (check_address(srcaddr) < 0)
-		return btd_error_invalid_args(msg);
-
-	reply = dbus_message_new_method_return(msg);
-	if (!reply)
-		return NULL;
-
-	dbus_message_iter_init_append(reply, &iter);
-
-	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
 			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
 			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
@@ -1173,11 +1281,39 @@ static DBusMessage *get_properties(DBusConnection *conn,
 
 	g_strfreev(uuids);
 
-	dbus_message_iter_close_container(&iter, &dict);
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+static DBusMessage *get_properties(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	struct btd_adapter *adapter = data;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	char srcaddr[18];
+
+	ba2str(&adapter->bdaddr, srcaddr);
+
+	if (check_address(srcaddr) < 0)
+		return btd_error_invalid_args(msg);
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	adapter_append_properties(adapter, &iter);
 
 	return reply;
 }
 
+void adapter_foreach_device(struct btd_adapter *adapter, device_cb func,
+							gpointer user_data)
+{
+	g_slist_foreach(adapter->devices, (GFunc) func, user_data);
+}
+
 static DBusMessage *set_property(DBusConnection *conn,
 					DBusMessage *msg, void *data)
 {
@@ -1567,20 +1703,16 @@ static DBusMessage *find_device(DBusConnection *conn, DBusMessage *msg,
 	struct btd_device *device;
 	DBusMessage *reply;
 	const gchar *address;
-	GSList *l;
 	const gchar *dev_path;
 
 	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &address,
 						DBUS_TYPE_INVALID))
 		return btd_error_invalid_args(msg);
 
-	l = g_slist_find_custom(adapter->devices,
-			address, (GCompareFunc) device_address_cmp);
-	if (!l)
+	device = adapter_find_device(adapter, address);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
-	device = l->data;
-
 	reply = dbus_message_new_method_return(msg);
 	if (!reply)
 		return NULL;
@@ -1720,195 +1852,97 @@ static const GDBusSignalTable adapter_signals[] = {
 	{ }
 };
 
-static void create_stored_device_from_profiles(char *key, char *value,
-						void *user_data)
-{
-	struct btd_adapter *adapter = user_data;
-	GSList *list, *uuids = bt_string2list(value);
-	struct btd_device *device;
-
-	if (g_slist_find_custom(adapter->devices,
-				key, (GCompareFunc) device_address_cmp))
-		return;
-
-	device = device_create(connection, adapter, key, BDADDR_BREDR);
-	if (!device)
-		return;
-
-	device_set_temporary(device, FALSE);
-	adapter->devices = g_slist_append(adapter->devices, device);
-
-	list = device_services_from_record(device, uuids);
-	if (list)
-		device_register_services(connection, device, list, ATT_PSM);
-
-	device_probe_drivers(device, uuids);
-
-	g_slist_free_full(uuids, g_free);
-}
+struct stored_device {
+	char address[18];
+	uint8_t bdaddr_type;
+	struct stored_probe *probe;
+};
 
-struct adapter_keys {
+/* State of one load_devices() pass. Every storage file is read once and
+ * the devices are only created when all of them have been seen. */
+struct device_loader {
 	struct btd_adapter *adapter;
+	GHashTable *stored;		/* Upper case address to device */
+	GSList *order;			/* In reverse order of appearance */
 	GSList *keys;
 };
 
-static int str2buf(const char *str, uint8_t *buf, size_t blen)
+static struct stored_device *add_stored_device(struct device_loader *loader,
+						const char *address,
+						uint8_t bdaddr_type)
 {
-	int i, dlen;
+	struct stored_device *stored;
+	char *key;
 
-	if (str == NULL)
-		return -EINVAL;
-
-	memset(buf, 0, blen);
-
-	dlen = MIN((strlen(str) / 2), blen);
-
-	for (i = 0; i < dlen; i++)
-		sscanf(str + (i * 2), "%02hhX", &buf[i]);
-
-	return 0;
-}
+	if (strlen(address) != 17)
+		return NULL;
 
-static struct link_key_info *get_key_info(const char *addr, const char *value)
-{
-	struct link_key_info *info;
-	char tmp[3];
-	long int l;
+	key = g_ascii_strup(address, -1);
 
-	if (strlen(value) < 36) {
-		error("Unexpectedly short (%zu) link key line", strlen(value));
+	if (g_hash_table_lookup(loader->stored, key) != NULL ||
+				lookup_device(loader->adapter, key) != NULL) {
+		g_free(key);
 		return NULL;
 	}
 
-	info = g_new0(struct link_key_info, 1);
-
-	str2ba(addr, &info->bdaddr);
+	stored = g_new0(struct stored_device, 1);
+	strcpy(stored->address, address);
+	stored->bdaddr_type = bdaddr_type;
 
-	str2buf(value, info->key, sizeof(info->key));
+	g_hash_table_insert(loader->stored, key, stored);
+	loader->order = g_slist_prepend(loader->order, stored);
 
-	memcpy(tmp, value + 33, 2);
-	info->type = (uint8_t) strtol(tmp, NULL, 10);
-
-	memcpy(tmp, value + 35, 2);
-	l = strtol(tmp, NULL, 10);
-	if (l < 0)
-		l = 0;
-	info->pin_len = l;
-
-	return info;
+	return stored;
 }
 
-static struct smp_ltk_info *get_ltk_info(const char *addr, uint8_t bdaddr_type,
-							const char *value)
+static void create_stored_device_from_profiles(char *key, char *value,
+						void *user_data)
 {
-	struct smp_ltk_info *ltk;
-	char *ptr;
-	int i, ret;
-
-	if (strlen(value) < 60) {
-		error("Unexpectedly short (%zu) LTK", strlen(value));
-		return NULL;
-	}
-
-	ltk = g_new0(struct smp_ltk_info, 1);
-
-	str2ba(addr, &ltk->bdaddr);
-
-	ltk->bdaddr_type = bdaddr_type;
+	struct device_loader *loader = user_data;
+	struct stored_device *stored;
 
-	str2buf(value, ltk->val, sizeof(ltk->val));
-
-	ptr = (char *) value + 2 * sizeof(ltk->val) + 1;
-
-	ret = sscanf(ptr, " %hhd %hhd %hhd %hd %n",
-		     &ltk->authenticated, &ltk->master, &ltk->enc_size,
-							&ltk->ediv, &i);
-	if (ret < 2) {
-		g_free(ltk);
-		return NULL;
-	}
-	ptr += i;
-
-	str2buf(ptr, ltk->rand, sizeof(ltk->rand));
+	stored = add_stored_device(loader, key, BDADDR_BREDR);
+	if (!stored)
+		return;
 
-	return ltk;
+	stored->probe = g_new0(struct stored_probe, 1);
+	stored->probe->profiles = TRUE;
+	stored->probe->uuids = bt_string2list(value);
 }
 
-static void create_stored_device_from_linkkeys(char *key, char *value,
+static void create_stored_device_from_link_key(struct link_key_info *info,
 							void *user_data)
 {
-	struct adapter_keys *keys = user_data;
-	struct btd_adapter *adapter = keys->adapter;
-	struct btd_device *device;
-	struct link_key_info *info;
-
-	info = get_key_info(key, value);
-	if (info)
-		keys->keys = g_slist_append(keys->keys, info);
+	struct device_loader *loader = user_data;
+	char address[18];
 
-	if (g_slist_find_custom(adapter->devices, key,
-					(GCompareFunc) device_address_cmp))
-		return;
+	loader->keys = g_slist_prepend(loader->keys, info);
 
-	device = device_create(connection, adapter, key, BDADDR_BREDR);
-	if (device) {
-		device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
-	}
+	ba2str(&info->bdaddr, address);
+	add_stored_device(loader, address, BDADDR_BREDR);
 }
 
-static void create_stored_device_from_ltks(char *key, char *value,
+static void create_stored_device_from_ltk(struct smp_ltk_info *info,
 							void *user_data)
 {
-	struct adapter_keys *keys = user_data;
-	struct btd_adapter *adapter = keys->adapter;
-	struct btd_device *device;
-	struct smp_ltk_info *info;
-	char address[18], srcaddr[18];
-	uint8_t bdaddr_type;
-	bdaddr_t src;
-
-	if (sscanf(key, "%17s#%hhu", address, &bdaddr_type) < 2)
-		return;
-
-	info = get_ltk_info(address, bdaddr_type, value);
-	if (info == NULL)
-		return;
-
-	keys->keys = g_slist_append(keys->keys, info);
-
-	if (g_slist_find_custom(adapter->devices, address,
-					(GCompareFunc) device_address_cmp))
-		return;
+	struct device_loader *loader = user_data;
+	char address[18];
 
-	adapter_get_address(adapter, &src);
-	ba2str(&src, srcaddr);
+	loader->keys = g_slist_prepend(loader->keys, info);
 
-	if (g_strcmp0(srcaddr, address) == 0)
+	if (bacmp(&info->bdaddr, &loader->adapter->bdaddr) == 0)
 		return;
 
-	device = device_create(connection, adapter, address, bdaddr_type);
-	if (device) {
-		device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
-	}
+	ba2str(&info->bdaddr, address);
+	add_stored_device(loader, address, info->bdaddr_type);
 }
 
 static void create_stored_device_from_blocked(char *key, char *value,
 							void *user_data)
 {
-	struct btd_adapter *adapter = user_data;
-	struct btd_device *device;
+	struct device_loader *loader = user_data;
 
-	if (g_slist_find_custom(adapter->devices,
-				key, (GCompareFunc) device_address_cmp))
-		return;
-
-	device = device_create(connection, adapter, key, BDADDR_BREDR);
-	if (device) {
-		device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
-	}
+	add_stored_device(loader, key, BDADDR_BREDR);
 }
 
 static GSList *string_to_primary_list(char *str)
@@ -1949,90 +1983,151 @@ static GSList *string_to_primary_list(char *str)
 static void create_stored_device_from_primaries(char *key, char *value,
 							void *user_data)
 {
-	struct btd_adapter *adapter = user_data;
-	struct btd_device *device;
-	GSList *services, *uuids, *l;
+	struct device_loader *loader = user_data;
+	struct stored_device *stored;
+	GSList *services;
 	char address[18];
 	uint8_t bdaddr_type;
 
 	if (sscanf(key, "%17s#%hhu", address, &bdaddr_type) < 2)
 		return;
 
-	if (g_slist_find_custom(adapter->devices,
-			address, (GCompareFunc) device_address_cmp))
-		return;
-
-	device = device_create(connection, adapter, address, bdaddr_type);
-	if (!device)
+	stored = add_stored_device(loader, address, bdaddr_type);
+	if (!stored)
 		return;
 
-	device_set_temporary(device, FALSE);
-	adapter->devices = g_slist_append(adapter->devices, device);
-
 	services = string_to_primary_list(value);
 	if (services == NULL)
 		return;
 
-	for (l = services, uuids = NULL; l; l = l->next) {
-		struct gatt_primary *prim = l->data;
-		uuids = g_slist_append(uuids, prim->uuid);
+	stored->probe = g_new0(struct stored_probe, 1);
+	stored->probe->primaries = services;
+}
+
+/* Keeps the daemon responsive while thousands of stored devices get
+ * their drivers probed */
+#define PROBE_BATCH 32
+
+static gboolean probe_stored_devices(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	struct btd_device *device;
+	int i;
+
+	for (i = 0; i < PROBE_BATCH; i++) {
+		device = g_queue_pop_head(adapter->probe_queue);
+		if (device == NULL)
+			break;
+
+		adapter_probe_stored_device(adapter, device);
 	}
 
-	device_register_services(connection, device, services, -1);
+	if (!g_queue_is_empty(adapter->probe_queue))
+		return TRUE;
+
+	DBG("hci%u stored devices probed", adapter->dev_id);
 
-	device_probe_drivers(device, uuids);
+	adapter->probe_id = 0;
 
-	g_slist_free(uuids);
+	return FALSE;
 }
 
-static void smp_key_free(void *data)
+static void create_stored_devices(struct device_loader *loader)
 {
-	struct smp_ltk_info *info = data;
+	struct btd_adapter *adapter = loader->adapter;
+	GSList *l, *devices = NULL;
+
+	loader->order = g_slist_reverse(loader->order);
+
+	for (l = loader->order; l; l = l->next) {
+		struct stored_device *stored = l->data;
+		struct btd_device *device;
+
+		device = device_create(connection, adapter, stored->address,
+							stored->bdaddr_type);
+		if (!device) {
+			if (stored->probe)
+				stored_probe_free(stored->probe);
+			continue;
+		}
+
+		device_set_temporary(device, FALSE);
+		adapter_index_device(adapter, device);
+		devices = g_slist_prepend(devices, device);
+
+		/* Drivers are probed from idle or when the device is looked
+		 * up, whatever comes first */
+		if (stored->probe) {
+			g_hash_table_insert(adapter->pending_probes, device,
+								stored->probe);
+			g_queue_push_tail(adapter->probe_queue, device);
+		}
+	}
 
-	g_free(info);
+	DBG("hci%u %u stored devices", adapter->dev_id,
+						g_slist_length(devices));
+
+	adapter->devices = g_slist_concat(adapter->devices,
+						g_slist_reverse(devices));
+
+	if (!g_queue_is_empty(adapter->probe_queue) && adapter->probe_id == 0)
+		adapter->probe_id = g_idle_add(probe_stored_devices, adapter);
 }
 
 static void load_devices(struct btd_adapter *adapter)
 {
 	char filename[PATH_MAX + 1];
 	char srcaddr[18];
-	struct adapter_keys keys = { adapter, NULL };
+	struct device_loader loader;
 	int err;
 
+	memset(&loader, 0, sizeof(loader));
+	loader.adapter = adapter;
+	loader.stored = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+
 	ba2str(&adapter->bdaddr, srcaddr);
 
 	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "profiles");
 	textfile_foreach(filename, create_stored_device_from_profiles,
-								adapter);
+								&loader);
 
 	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "primaries");
 	textfile_foreach(filename, create_stored_device_from_primaries,
-								adapter);
+								&loader);
 
-	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "linkkeys");
-	textfile_foreach(filename, create_stored_device_from_linkkeys, &keys);
+	/* The keys belong to the key store, the adapter ops copy them */
+	keystore_foreach_link_key(&adapter->bdaddr,
+				create_stored_device_from_link_key, &loader);
 
-	err = adapter_ops->load_keys(adapter->dev_id, keys.keys,
+	err = adapter_ops->load_keys(adapter->dev_id, loader.keys,
 							main_opts.debug_keys);
 	if (err < 0)
 		error("Unable to load keys to adapter_ops: %s (%d)",
 							strerror(-err), -err);
 
-	g_slist_free_full(keys.keys, g_free);
-	keys.keys = NULL;
+	g_slist_free(loader.keys);
+	loader.keys = NULL;
 
-	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "longtermkeys");
-	textfile_foreach(filename, create_stored_device_from_ltks, &keys);
+	keystore_foreach_ltk(&adapter->bdaddr, create_stored_device_from_ltk,
+								&loader);
 
-	err = adapter_ops->load_ltks(adapter->dev_id, keys.keys);
+	err = adapter_ops->load_ltks(adapter->dev_id, loader.keys);
 	if (err < 0)
 		error("Unable to load keys to adapter_ops: %s (%d)",
 							strerror(-err), -err);
-	g_slist_free_full(keys.keys, smp_key_free);
-	keys.keys = NULL;
+
+	g_slist_free(loader.keys);
+	loader.keys = NULL;
 
 	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "blocked");
-	textfile_foreach(filename, create_stored_device_from_blocked, adapter);
+	textfile_foreach(filename, create_stored_device_from_blocked,
+								&loader);
+
+	create_stored_devices(&loader);
+
+	g_slist_free_full(loader.order, g_free);
+	g_hash_table_destroy(loader.stored);
 }
 
 int btd_adapter_block_address(struct btd_adapter *adapter, bdaddr_t *bdaddr,
@@ -2381,6 +2476,67 @@ static void off_timer_remove(struct btd_adapter *adapter)
 	adapter->off_timer = 0;
 }
 
+static void registry_remove(struct btd_adapter *adapter)
+{
+	gpointer id = GINT_TO_POINTER(adapter->dev_id);
+
+	if (adapter_ids == NULL)
+		return;
+
+	if (g_hash_table_lookup(adapter_ids, id) == adapter)
+		g_hash_table_remove(adapter_ids, id);
+
+	if (g_hash_table_lookup(adapter_addrs, &adapter->bdaddr) == adapter)
+		g_hash_table_remove(adapter_addrs, &adapter->bdaddr);
+
+	if (g_hash_table_size(adapter_ids) > 0)
+		return;
+
+	g_hash_table_destroy(adapter_ids);
+	adapter_ids = NULL;
+	g_hash_table_destroy(adapter_addrs);
+	adapter_addrs = NULL;
+}
+
+struct btd_adapter *adapter_find(const bdaddr_t *sba)
+{
+	if (adapter_addrs == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(adapter_addrs, sba);
+}
+
+struct btd_adapter *adapter_find_by_id(int id)
+{
+	if (adapter_ids == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(adapter_ids, GINT_TO_POINTER(id));
+}
+
+void *btd_adapter_get_data(struct btd_adapter *adapter,
+					struct btd_adapter_slot *slot)
+{
+	if (slot->index < 0 || (guint) slot->index >= adapter->slots->len)
+		return NULL;
+
+	return g_ptr_array_index(adapter->slots, slot->index);
+}
+
+void btd_adapter_set_data(struct btd_adapter *adapter,
+				struct btd_adapter_slot *slot, void *data)
+{
+	if (slot->index < 0) {
+		slot->index = slot_count++;
+		DBG("%s slot %d", slot->name, slot->index);
+	}
+
+	if ((guint) slot->index >= adapter->slots->len)
+		g_ptr_array_set_size(adapter->slots, slot->index + 1);
+
+	adapter->slots->pdata[slot->index] = data;
+}
+
 static void adapter_free(gpointer user_data)
 {
 	struct btd_adapter *adapter = user_data;
@@ -2402,6 +2558,15 @@ static void adapter_free(gpointer user_data)
 
 	g_slist_free(adapter->oor_devices);
 
+	g_hash_table_destroy(adapter->device_index);
+	g_hash_table_destroy(adapter->pending_probes);
+	g_queue_free(adapter->probe_queue);
+
+	/* Still registered if adapter_remove never ran */
+	registry_remove(adapter);
+	g_ptr_array_free(adapter->slots, TRUE);
+
+	property_batch_free(adapter->props);
 	g_free(adapter->path);
 	g_free(adapter->name);
 	g_free(adapter);
@@ -2447,6 +2612,9 @@ gboolean adapter_init(struct btd_adapter *adapter, gboolean up)
 		return FALSE;
 	}
 
+	/* Drivers loaded below may already look the adapter up */
+	g_hash_table_replace(adapter_addrs, &adapter->bdaddr, adapter);
+
 	sdp_init_services_list(&adapter->bdaddr);
 
 	if (main_opts.gatt_enabled)
@@ -2488,6 +2656,13 @@ struct btd_adapter *adapter_create(DBusConnection *conn, int id)
 
 	snprintf(path, sizeof(path), "%s/hci%d", base_path, id);
 	adapter->path = g_strdup(path);
+	adapter->props = property_batch_new(conn, path, ADAPTER_INTERFACE);
+	adapter->device_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+	adapter->pending_probes = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL, stored_probe_free);
+	adapter->probe_queue = g_queue_new();
+	adapter->slots = g_ptr_array_new();
 
 	if (!g_dbus_register_interface(conn, path, ADAPTER_INTERFACE,
 					adapter_methods, adapter_signals, NULL,
@@ -2497,6 +2672,14 @@ struct btd_adapter *adapter_create(DBusConnection *conn, int id)
 		return NULL;
 	}
 
+	if (adapter_ids == NULL) {
+		adapter_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+		adapter_addrs = g_hash_table_new(bt_bdaddr_hash,
+							bt_bdaddr_equal);
+	}
+
+	g_hash_table_replace(adapter_ids, GINT_TO_POINTER(id), adapter);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -2506,9 +2689,19 @@ void adapter_remove(struct btd_adapter *adapter)
 
 	DBG("Removing adapter %s", adapter->path);
 
+	if (adapter->probe_id > 0) {
+		g_source_remove(adapter->probe_id);
+		adapter->probe_id = 0;
+	}
+
+	g_queue_clear(adapter->probe_queue);
+	g_hash_table_remove_all(adapter->pending_probes);
+	g_hash_table_remove_all(adapter->device_index);
+
 	for (l = adapter->devices; l; l = l->next)
 		device_remove(l->data, FALSE);
 	g_slist_free(adapter->devices);
+	adapter->devices = NULL;
 
 	unload_drivers(adapter);
 	if (main_opts.gatt_enabled)
@@ -2518,6 +2711,10 @@ void adapter_remove(struct btd_adapter *adapter)
 
 	/* Return adapter to down state if it was not up on init */
 	adapter_ops->restore_powered(adapter->dev_id);
+
+	/* Kept until here so drivers can still be looked up while they
+	 * are being removed */
+	registry_remove(adapter);
 }
 
 uint16_t adapter_get_dev_id(struct btd_adapter *adapter)
@@ -2862,7 +3059,8 @@ static char *read_stored_data(bdaddr_t *local, bdaddr_t *peer, const char *file)
 	return textfile_get(filename, peer_addr);
 }
 
-void adapter_update_found_devices(struct btd_adapter *adapter,
+/* Returns TRUE if found_devices needs to be sorted again */
+static gboolean update_found_device(struct btd_adapter *adapter,
 					bdaddr_t *bdaddr, uint8_t bdaddr_type,
 					int8_t rssi, uint8_t confirm_name,
 					uint8_t *data, uint8_t data_len)
@@ -2878,7 +3076,7 @@ void adapter_update_found_devices(struct btd_adapter *adapter,
 	err = eir_parse(&eir_data, data, data_len);
 	if (err < 0) {
 		error("Error parsing EIR data: %s (%d)", strerror(-err), -err);
-		return;
+		return FALSE;
 	}
 
 	dev_class = eir_data.dev_class[0] | (eir_data.dev_class[1] << 8) |
@@ -2911,7 +3109,7 @@ void adapter_update_found_devices(struct btd_adapter *adapter,
 
 		eir_data_free(&eir_data);
 
-		return;
+		return FALSE;
 	}
 
 	/* New device in the discovery session */
@@ -2948,15 +3146,55 @@ void adapter_update_found_devices(struct btd_adapter *adapter,
 done:
 	dev->rssi = rssi;
 
-	adapter->found_devices = g_slist_sort(adapter->found_devices,
-						(GCompareFunc) dev_rssi_cmp);
-
 	g_slist_foreach(eir_data.services, remove_same_uuid, dev);
 	g_slist_foreach(eir_data.services, dev_prepend_uuid, dev);
 
 	adapter_emit_device_found(adapter, dev);
 
 	eir_data_free(&eir_data);
+
+	return TRUE;
+}
+
+void adapter_update_found_devices(struct btd_adapter *adapter,
+					bdaddr_t *bdaddr, uint8_t bdaddr_type,
+					int8_t rssi, uint8_t confirm_name,
+					uint8_t *data, uint8_t data_len)
+{
+	if (!update_found_device(adapter, bdaddr, bdaddr_type, rssi,
+						confirm_name, data, data_len))
+		return;
+
+	adapter->found_devices = g_slist_sort(adapter->found_devices,
+						(GCompareFunc) dev_rssi_cmp);
+}
+
+void adapter_update_found_devices_batch(struct btd_adapter *adapter,
+					struct found_dev_info *devs, int count)
+{
+	gboolean resort = FALSE;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct found_dev_info *info = &devs[i];
+		struct remote_dev_info *dev;
+
+		dev = adapter_search_found_devices(adapter, &info->bdaddr);
+		if (dev)
+			dev->legacy = info->legacy;
+
+		if (update_found_device(adapter, &info->bdaddr,
+					info->bdaddr_type, info->rssi,
+					info->confirm_name, info->eir,
+					info->eir_len))
+			resort = TRUE;
+	}
+
+	/* Only the order of name requests depends on the sorting, so once
+	 * per batch is enough */
+	if (resort)
+		adapter->found_devices = g_slist_sort(adapter->found_devices,
+						(GCompareFunc) dev_rssi_cmp);
 }
 
 void adapter_mode_changed(struct btd_adapter *adapter, uint8_t scan_mode)
@@ -61,6 +61,17 @@ struct smp_ltk_info {
 	uint8_t val[16];
 };
 
+/* One device found event, eir points into the event buffer */
+struct found_dev_info {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	int8_t rssi;
+	uint8_t confirm_name;
+	gboolean legacy;
+	uint8_t *eir;
+	uint8_t eir_len;
+};
+
 struct remote_dev_info {
 	bdaddr_t bdaddr;
 	uint8_t bdaddr_type;
@@ -91,6 +102,15 @@ struct btd_device *adapter_get_device(DBusConnection *conn,
 				struct btd_adapter *adapter, const char *address);
 
 struct btd_device *adapter_find_device(struct btd_adapter *adapter, const char *dest);
+void adapter_probe_stored_device(struct btd_adapter *adapter,
+						struct btd_device *device);
+
+typedef void (*device_cb) (struct btd_device *device, gpointer user_data);
+
+void adapter_foreach_device(struct btd_adapter *adapter, device_cb func,
+							gpointer user_data);
+void adapter_append_properties(struct btd_adapter *adapter,
+						DBusMessageIter *iter);
 
 void adapter_remove_device(DBusConnection *conn, struct btd_adapter *adapter,
 						struct btd_device *device,
@@ -112,6 +132,8 @@ void adapter_update_found_devices(struct btd_adapter *adapter,
 					bdaddr_t *bdaddr, uint8_t bdaddr_type,
 					int8_t rssi, uint8_t confirm_name,
 					uint8_t *data, uint8_t data_len);
+void adapter_update_found_devices_batch(struct btd_adapter *adapter,
+					struct found_dev_info *devs, int count);
 void adapter_emit_device_found(struct btd_adapter *adapter,
 						struct remote_dev_info *dev);
 void adapter_mode_changed(struct btd_adapter *adapter, uint8_t scan_mode);
@@ -134,6 +156,25 @@ gboolean adapter_has_discov_sessions(struct btd_adapter *adapter);
 struct btd_adapter *btd_adapter_ref(struct btd_adapter *adapter);
 void btd_adapter_unref(struct btd_adapter *adapter);
 
+struct btd_adapter *adapter_find(const bdaddr_t *sba);
+struct btd_adapter *adapter_find_by_id(int id);
+
+/* Per adapter data owned by a module, see BTD_ADAPTER_SLOT */
+struct btd_adapter_slot {
+	const char *name;
+	int index;
+};
+
+#define BTD_ADAPTER_SLOT(var, slot_name) \
+	static struct btd_adapter_slot var = { \
+		.name = slot_name, .index = -1, \
+	}
+
+void *btd_adapter_get_data(struct btd_adapter *adapter,
+					struct btd_adapter_slot *slot);
+void btd_adapter_set_data(struct btd_adapter *adapter,
+				struct btd_adapter_slot *slot, void *data);
+
 int btd_adapter_set_class(struct btd_adapter *adapter, uint8_t major,
 							uint8_t minor);
 
@@ -38,6 +38,7 @@
 #include <bluetooth/sdp_lib.h>
 
 #include "log.h"
+#include "metrics.h"
 #include "gdbus.h"
 #include "btio.h"
 #include "sdpd.h"
@@ -53,7 +54,10 @@
 
 #include "attrib-server.h"
 
-static GSList *servers = NULL;
+BTD_ADAPTER_SLOT(server_slot, "gatt");
+
+BTD_METRIC_COUNTER(att_requests, "att_requests");
+BTD_METRIC_HISTOGRAM(att_request_us, "att_request_us");
 
 struct gatt_server {
 	struct btd_adapter *adapter;
@@ -149,34 +153,16 @@ static void gatt_server_free(struct gatt_server *server)
 	g_free(server);
 }
 
-static gint adapter_cmp_addr(gconstpointer a, gconstpointer b)
-{
-	const struct gatt_server *server = a;
-	const bdaddr_t *bdaddr = b;
-	bdaddr_t src;
-
-	adapter_get_address(server->adapter, &src);
-
-	return bacmp(&src, bdaddr);
-}
-
-static gint adapter_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct gatt_server *server = a;
-	const struct btd_adapter *adapter = b;
-
-	if (server->adapter == adapter)
-		return 0;
-
-	return -1;
-}
-
 static struct gatt_server *find_gatt_server(const bdaddr_t *bdaddr)
 {
-	GSList *l;
+	struct btd_adapter *adapter;
+	struct gatt_server *server = NULL;
 
-	l = g_slist_find_custom(servers, bdaddr, adapter_cmp_addr);
-	if (l == NULL) {
+	adapter = manager_find_adapter(bdaddr);
+	if (adapter != NULL)
+		server = btd_adapter_get_data(adapter, &server_slot);
+
+	if (server == NULL) {
 		char addr[18];
 
 		ba2str(bdaddr, addr);
@@ -184,7 +170,7 @@ static struct gatt_server *find_gatt_server(const bdaddr_t *bdaddr)
 		return NULL;
 	}
 
-	return l->data;
+	return server;
 }
 
 static sdp_record_t *server_record_new(uuid_t *uuid, uint16_t start, uint16_t end)
@@ -906,10 +892,9 @@ static gboolean channel_watch_cb(GIOChannel *io, GIOCondition cond,
 	return FALSE;
 }
 
-static void channel_handler(const uint8_t *ipdu, uint16_t len,
-							gpointer user_data)
+static void handle_pdu(struct gatt_channel *channel, const uint8_t *ipdu,
+								uint16_t len)
 {
-	struct gatt_channel *channel = user_data;
 	uint8_t opdu[ATT_MAX_MTU], value[ATT_MAX_MTU];
 	uint16_t length, start, end, mtu, offset;
 	bt_uuid_t uuid;
@@ -1034,6 +1019,18 @@ done:
 							NULL, NULL, NULL);
 }
 
+static void channel_handler(const uint8_t *ipdu, uint16_t len,
+							gpointer user_data)
+{
+	uint64_t start = btd_metric_now();
+
+	btd_metric_inc(&att_requests);
+
+	handle_pdu(user_data, ipdu, len);
+
+	btd_metric_observe_since(&att_request_us, start);
+}
+
 guint attrib_channel_attach(GAttrib *attrib)
 {
 	struct gatt_server *server;
@@ -1284,36 +1281,34 @@ int btd_adapter_gatt_server_start(struct btd_adapter *adapter)
 		/* Doesn't have LE support, continue */
 	}
 
-	servers = g_slist_prepend(servers, server);
+	btd_adapter_set_data(adapter, &server_slot, server);
 	return 0;
 }
 
 void btd_adapter_gatt_server_stop(struct btd_adapter *adapter)
 {
 	struct gatt_server *server;
-	GSList *l;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return;
 
 	DBG("Stop GATT server in hci%d", adapter_get_dev_id(adapter));
 
-	server = l->data;
-	servers = g_slist_remove(servers, server);
+	btd_adapter_set_data(adapter, &server_slot, NULL);
 	gatt_server_free(server);
 }
 
 uint32_t attrib_create_sdp(struct btd_adapter *adapter, uint16_t handle,
 							const char *name)
 {
-	GSList *l;
+	struct gatt_server *server;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return 0;
 
-	return attrib_create_sdp_new(l->data, handle, name);
+	return attrib_create_sdp_new(server, handle, name);
 }
 
 void attrib_free_sdp(uint32_t sdp_handle)
@@ -1325,14 +1320,12 @@ static uint16_t find_uuid16_avail(struct btd_adapter *adapter, uint16_t nitems)
 {
 	struct gatt_server *server;
 	uint16_t handle;
-	GSList *l;
 	GList *dl;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return 0;
 
-	server = l->data;
 	if (server->database == NULL)
 		return 0x0001;
 
@@ -1368,13 +1361,11 @@ static uint16_t find_uuid128_avail(struct btd_adapter *adapter, uint16_t nitems)
 	uint16_t handle = 0, end = 0xffff;
 	struct gatt_server *server;
 	GList *dl;
-	GSList *l;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return 0;
 
-	server = l->data;
 	if (server->database == NULL)
 		return 0xffff - nitems + 1;
 
@@ -1432,13 +1423,13 @@ struct attribute *attrib_db_add(struct btd_adapter *adapter, uint16_t handle,
 				bt_uuid_t *uuid, int read_reqs, int write_reqs,
 						const uint8_t *value, int len)
 {
-	GSList *l;
+	struct gatt_server *server;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return NULL;
 
-	return attrib_db_add_new(l->data, handle, uuid, read_reqs, write_reqs,
+	return attrib_db_add_new(server, handle, uuid, read_reqs, write_reqs,
 								value, len);
 }
 
@@ -1448,16 +1439,13 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 {
 	struct gatt_server *server;
 	struct attribute *a;
-	GSList *l;
 	GList *dl;
 	guint h = handle;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return -ENOENT;
 
-	server = l->data;
-
 	DBG("handle=0x%04x", handle);
 
 	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
@@ -1487,16 +1475,13 @@ int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 {
 	struct gatt_server *server;
 	struct attribute *a;
-	GSList *l;
 	GList *dl;
 	guint h = handle;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return -ENOENT;
 
-	server = l->data;
-
 	DBG("handle=0x%04x", handle);
 
 	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
@@ -1517,14 +1502,11 @@ int attrib_gap_set(struct btd_adapter *adapter, uint16_t uuid,
 {
 	struct gatt_server *server;
 	uint16_t handle;
-	GSList *l;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
+	server = btd_adapter_get_data(adapter, &server_slot);
+	if (server == NULL)
 		return -ENOENT;
 
-	server = l->data;
-
 	/* FIXME: Missing Privacy and Reconnection Address */
 
 	switch (uuid) {
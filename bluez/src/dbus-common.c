@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -170,6 +171,227 @@ dbus_bool_t emit_array_property_changed(DBusConnection *conn,
 	return g_dbus_send_message(conn, signal);
 }
 
+union property_data {
+	dbus_bool_t boolean;
+	uint8_t byte;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+	double dbl;
+	char *str;
+};
+
+struct property_value {
+	char *name;
+	int type;
+	gboolean sent;			/* last holds what is on the bus */
+	gboolean pending;		/* next differs from last */
+	union property_data last;
+	union property_data next;
+};
+
+struct property_batch {
+	DBusConnection *conn;
+	char *path;
+	char *interface;
+	GSList *values;
+	guint idle_id;
+};
+
+static gboolean property_data_set(union property_data *data, int type,
+							const void *value)
+{
+	switch (type) {
+	case DBUS_TYPE_BOOLEAN:
+	case DBUS_TYPE_INT32:
+	case DBUS_TYPE_UINT32:
+		memcpy(&data->u32, value, sizeof(data->u32));
+		return TRUE;
+	case DBUS_TYPE_BYTE:
+		data->byte = *((const uint8_t *) value);
+		return TRUE;
+	case DBUS_TYPE_INT16:
+	case DBUS_TYPE_UINT16:
+		memcpy(&data->u16, value, sizeof(data->u16));
+		return TRUE;
+	case DBUS_TYPE_INT64:
+	case DBUS_TYPE_UINT64:
+		memcpy(&data->u64, value, sizeof(data->u64));
+		return TRUE;
+	case DBUS_TYPE_DOUBLE:
+		memcpy(&data->dbl, value, sizeof(data->dbl));
+		return TRUE;
+	case DBUS_TYPE_STRING:
+	case DBUS_TYPE_OBJECT_PATH:
+		g_free(data->str);
+		data->str = g_strdup(*((const char * const *) value));
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean property_data_equal(const union property_data *a,
+					const union property_data *b, int type)
+{
+	switch (type) {
+	case DBUS_TYPE_BOOLEAN:
+	case DBUS_TYPE_INT32:
+	case DBUS_TYPE_UINT32:
+		return a->u32 == b->u32;
+	case DBUS_TYPE_BYTE:
+		return a->byte == b->byte;
+	case DBUS_TYPE_INT16:
+	case DBUS_TYPE_UINT16:
+		return a->u16 == b->u16;
+	case DBUS_TYPE_INT64:
+	case DBUS_TYPE_UINT64:
+		return a->u64 == b->u64;
+	case DBUS_TYPE_DOUBLE:
+		return memcmp(&a->dbl, &b->dbl, sizeof(a->dbl)) == 0;
+	case DBUS_TYPE_STRING:
+	case DBUS_TYPE_OBJECT_PATH:
+		return g_strcmp0(a->str, b->str) == 0;
+	}
+
+	return FALSE;
+}
+
+static void property_value_free(void *data)
+{
+	struct property_value *prop = data;
+
+	if (prop->type == DBUS_TYPE_STRING ||
+					prop->type == DBUS_TYPE_OBJECT_PATH) {
+		g_free(prop->last.str);
+		g_free(prop->next.str);
+	}
+
+	g_free(prop->name);
+	g_free(prop);
+}
+
+static struct property_value *property_value_get(struct property_batch *batch,
+						const char *name, int type)
+{
+	struct property_value *prop;
+	GSList *l;
+
+	for (l = batch->values; l; l = l->next) {
+		prop = l->data;
+
+		if (g_str_equal(prop->name, name))
+			return prop;
+	}
+
+	prop = g_new0(struct property_value, 1);
+	prop->name = g_strdup(name);
+	prop->type = type;
+
+	batch->values = g_slist_append(batch->values, prop);
+
+	return prop;
+}
+
+void property_batch_flush(struct property_batch *batch)
+{
+	GSList *l;
+
+	if (batch->idle_id > 0) {
+		g_source_remove(batch->idle_id);
+		batch->idle_id = 0;
+	}
+
+	for (l = batch->values; l; l = l->next) {
+		struct property_value *prop = l->data;
+
+		if (!prop->pending)
+			continue;
+
+		prop->pending = FALSE;
+		prop->sent = TRUE;
+
+		if (prop->type == DBUS_TYPE_STRING ||
+					prop->type == DBUS_TYPE_OBJECT_PATH) {
+			g_free(prop->last.str);
+			prop->last.str = prop->next.str;
+			prop->next.str = NULL;
+		} else
+			prop->last = prop->next;
+
+		emit_property_changed(batch->conn, batch->path,
+					batch->interface, prop->name,
+					prop->type, &prop->last);
+	}
+}
+
+static gboolean property_batch_idle(gpointer user_data)
+{
+	struct property_batch *batch = user_data;
+
+	batch->idle_id = 0;
+
+	property_batch_flush(batch);
+
+	return FALSE;
+}
+
+void property_batch_set(struct property_batch *batch, const char *name,
+						int type, const void *value)
+{
+	struct property_value *prop;
+
+	prop = property_value_get(batch, name, type);
+
+	if (!property_data_set(&prop->next, type, value)) {
+		error("Unsupported type %c for %s.%s", type,
+						batch->interface, name);
+		return;
+	}
+
+	/* A value that went back to what listeners already have is not
+	 * a change at all, drop it together with anything queued before */
+	if (prop->sent && property_data_equal(&prop->last, &prop->next,
+								type)) {
+		prop->pending = FALSE;
+		return;
+	}
+
+	prop->pending = TRUE;
+
+	if (batch->idle_id == 0)
+		batch->idle_id = g_idle_add(property_batch_idle, batch);
+}
+
+struct property_batch *property_batch_new(DBusConnection *conn,
+						const char *path,
+						const char *interface)
+{
+	struct property_batch *batch;
+
+	batch = g_new0(struct property_batch, 1);
+	batch->conn = dbus_connection_ref(conn);
+	batch->path = g_strdup(path);
+	batch->interface = g_strdup(interface);
+
+	return batch;
+}
+
+void property_batch_free(struct property_batch *batch)
+{
+	if (batch == NULL)
+		return;
+
+	if (batch->idle_id > 0)
+		g_source_remove(batch->idle_id);
+
+	g_slist_free_full(batch->values, property_value_free);
+	dbus_connection_unref(batch->conn);
+	g_free(batch->interface);
+	g_free(batch->path);
+	g_free(batch);
+}
+
 void set_dbus_connection(DBusConnection *conn)
 {
 	connection = conn;
@@ -43,6 +43,20 @@ dbus_bool_t emit_array_property_changed(DBusConnection *conn,
 					const char *name,
 					int type, void *value, int num);
 
+/* Accumulates PropertyChanged signals of one object so that a property
+ * changed several times within a main loop iteration is signalled once,
+ * with its final value, and only if that differs from the last value
+ * sent. All changes of a property must go through the same batch. */
+struct property_batch;
+
+struct property_batch *property_batch_new(DBusConnection *conn,
+						const char *path,
+						const char *interface);
+void property_batch_free(struct property_batch *batch);
+void property_batch_set(struct property_batch *batch, const char *name,
+						int type, const void *value);
+void property_batch_flush(struct property_batch *batch);
+
 void set_dbus_connection(DBusConnection *conn);
 DBusConnection *get_dbus_connection(void);
 
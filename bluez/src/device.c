@@ -59,6 +59,7 @@
 #include "agent.h"
 #include "sdp-xml.h"
 #include "storage.h"
+#include "keystore.h"
 #include "btio.h"
 #include "attrib-server.h"
 #include "attrib/client.h"
@@ -107,6 +108,7 @@ struct browse_req {
 	sdp_list_t *records;
 	int search_uuid;
 	int reconnect_attempt;
+	gboolean pnp_found;
 	guint listener_id;
 };
 
@@ -138,6 +140,7 @@ struct btd_device {
 	uint16_t	version;
 	struct btd_adapter	*adapter;
 	GSList		*uuids;
+	GHashTable	*uuid_index;	/* 128 bit UUID -> entry in uuids */
 	GSList		*services;		/* Primary services path */
 	GSList		*primaries;		/* List of primary services */
 	GSList		*drivers;		/* List of device drivers */
@@ -171,6 +174,8 @@ struct btd_device {
 
 	GIOChannel      *att_io;
 	guint		cleanup_id;
+
+	struct property_batch	*props;
 };
 
 static uint16_t uuid_list[] = {
@@ -182,6 +187,73 @@ static uint16_t uuid_list[] = {
 
 static GSList *device_drivers = NULL;
 
+/* 128 bit UUID -> drivers handling it, in registration order */
+static GHashTable *driver_index = NULL;
+
+static guint uuid128_hash(gconstpointer key)
+{
+	const uint8_t *data = key;
+	guint hash = 0;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		hash = hash * 31 + data[i];
+
+	return hash;
+}
+
+static gboolean uuid128_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(a, b, sizeof(uint128_t)) == 0;
+}
+
+/* Only 128 bit UUID strings are keyed, same as the strcasecmp() based
+ * matching this replaces */
+static gboolean uuid128_from_string(const char *str, uint128_t *key)
+{
+	uuid_t uuid;
+
+	if (bt_string2uuid(&uuid, str) < 0 || uuid.type != SDP_UUID128)
+		return FALSE;
+
+	*key = uuid.value.uuid128;
+
+	return TRUE;
+}
+
+static GSList *driver_index_lookup(const uint128_t *key)
+{
+	if (driver_index == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(driver_index, key);
+}
+
+static void device_index_uuid(struct btd_device *device, char *uuid)
+{
+	uint128_t key;
+
+	if (!uuid128_from_string(uuid, &key))
+		return;
+
+	g_hash_table_replace(device->uuid_index,
+				g_memdup(&key, sizeof(key)), uuid);
+}
+
+static char *device_find_uuid(struct btd_device *device, const char *uuid)
+{
+	uint128_t key;
+	GSList *l;
+
+	if (uuid128_from_string(uuid, &key))
+		return g_hash_table_lookup(device->uuid_index, &key);
+
+	l = g_slist_find_custom(device->uuids, uuid,
+					(GCompareFunc) strcasecmp);
+
+	return l ? l->data : NULL;
+}
+
 static void browse_request_free(struct browse_req *req)
 {
 	if (req->listener_id)
@@ -235,7 +307,7 @@ static void browse_request_cancel(struct browse_req *req)
 
 	adapter_get_address(adapter, &src);
 
-	bt_cancel_discovery(&src, &device->bdaddr);
+	bt_cancel_discovery(&src, &device->bdaddr, req);
 
 	att_cleanup(device);
 
@@ -257,6 +329,7 @@ static void device_free(gpointer user_data)
 		agent_cancel(agent);
 
 	g_slist_free_full(device->services, g_free);
+	g_hash_table_destroy(device->uuid_index);
 	g_slist_free_full(device->uuids, g_free);
 	g_slist_free_full(device->primaries, g_free);
 	g_slist_free_full(device->attios, g_free);
@@ -282,6 +355,7 @@ static void device_free(gpointer user_data)
 	if (device->authr)
 		g_free(device->authr->pincode);
 	g_free(device->authr);
+	property_batch_free(device->props);
 	g_free(device->path);
 	g_free(device->alias);
 	g_free(device);
@@ -312,13 +386,10 @@ gboolean device_is_trusted(struct btd_device *device)
 	return device->trusted;
 }
 
-static DBusMessage *get_properties(DBusConnection *conn,
-				DBusMessage *msg, void *user_data)
+void device_append_properties(struct btd_device *device,
+						DBusMessageIter *iter)
 {
-	struct btd_device *device = user_data;
 	struct btd_adapter *adapter = device->adapter;
-	DBusMessage *reply;
-	DBusMessageIter iter;
 	DBusMessageIter dict;
 	bdaddr_t src;
 	char name[MAX_NAME_LENGTH + 1], srcaddr[18], dstaddr[18];
@@ -330,15 +401,13 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	int i;
 	GSList *l;
 
-	ba2str(&device->bdaddr, dstaddr);
+	/* UUIDs and Services of stored devices are only known once their
+	 * deferred driver probing ran, don't report them empty before */
+	adapter_probe_stored_device(adapter, device);
 
-	reply = dbus_message_new_method_return(msg);
-	if (!reply)
-		return NULL;
-
-	dbus_message_iter_init_append(reply, &iter);
+	ba2str(&device->bdaddr, dstaddr);
 
-	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
 			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
 			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
@@ -432,7 +501,23 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	ptr = adapter_get_path(adapter);
 	dict_append_entry(&dict, "Adapter", DBUS_TYPE_OBJECT_PATH, &ptr);
 
-	dbus_message_iter_close_container(&iter, &dict);
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+static DBusMessage *get_properties(DBusConnection *conn,
+				DBusMessage *msg, void *user_data)
+{
+	struct btd_device *device = user_data;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	device_append_properties(device, &iter);
 
 	return reply;
 }
@@ -464,9 +549,7 @@ static DBusMessage *set_alias(DBusConnection *conn, DBusMessage *msg,
 	g_free(device->alias);
 	device->alias = g_str_equal(alias, "") ? NULL : g_strdup(alias);
 
-	emit_property_changed(conn, dbus_message_get_path(msg),
-				DEVICE_INTERFACE, "Alias",
-				DBUS_TYPE_STRING, &alias);
+	property_batch_set(device->props, "Alias", DBUS_TYPE_STRING, &alias);
 
 	return dbus_message_new_method_return(msg);
 }
@@ -493,9 +576,7 @@ static DBusMessage *set_trust(DBusConnection *conn, DBusMessage *msg,
 
 	device->trusted = value;
 
-	emit_property_changed(conn, dbus_message_get_path(msg),
-				DEVICE_INTERFACE, "Trusted",
-				DBUS_TYPE_BOOLEAN, &value);
+	property_batch_set(device->props, "Trusted", DBUS_TYPE_BOOLEAN, &value);
 
 	return dbus_message_new_method_return(msg);
 }
@@ -551,8 +632,8 @@ int device_block(DBusConnection *conn, struct btd_device *device,
 
 	device_set_temporary(device, FALSE);
 
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE, "Blocked",
-					DBUS_TYPE_BOOLEAN, &device->blocked);
+	property_batch_set(device->props, "Blocked", DBUS_TYPE_BOOLEAN,
+							&device->blocked);
 
 	return 0;
 }
@@ -582,8 +663,7 @@ int device_unblock(DBusConnection *conn, struct btd_device *device,
 		error("write_blocked(): %s (%d)", strerror(-err), -err);
 
 	if (!silent) {
-		emit_property_changed(conn, device->path,
-					DEVICE_INTERFACE, "Blocked",
+		property_batch_set(device->props, "Blocked",
 					DBUS_TYPE_BOOLEAN, &device->blocked);
 		device_probe_drivers(device, device->uuids);
 	}
@@ -993,54 +1073,43 @@ void device_remove_disconnect_watch(struct btd_device *device, guint id)
 
 static void device_set_vendor(struct btd_device *device, uint16_t value)
 {
-	DBusConnection *conn = get_dbus_connection();
-
 	if (device->vendor == value)
 		return;
 
 	device->vendor = value;
 
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE, "Vendor",
-				DBUS_TYPE_UINT16, &value);
+	property_batch_set(device->props, "Vendor", DBUS_TYPE_UINT16, &value);
 }
 
 static void device_set_vendor_src(struct btd_device *device, uint16_t value)
 {
-	DBusConnection *conn = get_dbus_connection();
-
 	if (device->vendor_src == value)
 		return;
 
 	device->vendor_src = value;
 
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE,
-				"VendorSource", DBUS_TYPE_UINT16, &value);
+	property_batch_set(device->props, "VendorSource", DBUS_TYPE_UINT16,
+								&value);
 }
 
 static void device_set_product(struct btd_device *device, uint16_t value)
 {
-	DBusConnection *conn = get_dbus_connection();
-
 	if (device->product == value)
 		return;
 
 	device->product = value;
 
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE, "Product",
-				DBUS_TYPE_UINT16, &value);
+	property_batch_set(device->props, "Product", DBUS_TYPE_UINT16, &value);
 }
 
 static void device_set_version(struct btd_device *device, uint16_t value)
 {
-	DBusConnection *conn = get_dbus_connection();
-
 	if (device->version == value)
 		return;
 
 	device->version = value;
 
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE, "Version",
-				DBUS_TYPE_UINT16, &value);
+	property_batch_set(device->props, "Version", DBUS_TYPE_UINT16, &value);
 }
 
 struct btd_device *device_create(DBusConnection *conn,
@@ -1058,11 +1127,17 @@ struct btd_device *device_create(DBusConnection *conn,
 	if (device == NULL)
 		return NULL;
 
+	device->uuid_index = g_hash_table_new_full(uuid128_hash,
+						uuid128_equal, g_free, NULL);
+
 	address_up = g_ascii_strup(address, -1);
 	device->path = g_strdup_printf("%s/dev_%s", adapter_path, address_up);
 	g_strdelimit(device->path, ":", '_');
 	g_free(address_up);
 
+	device->props = property_batch_new(conn, device->path,
+							DEVICE_INTERFACE);
+
 	DBG("Creating device %s", device->path);
 
 	if (g_dbus_register_interface(conn, device->path, DEVICE_INTERFACE,
@@ -1108,23 +1183,17 @@ struct btd_device *device_create(DBusConnection *conn,
 
 void device_set_name(struct btd_device *device, const char *name)
 {
-	DBusConnection *conn = get_dbus_connection();
-
 	if (strncmp(name, device->name, MAX_NAME_LENGTH) == 0)
 		return;
 
 	strncpy(device->name, name, MAX_NAME_LENGTH);
 
-	emit_property_changed(conn, device->path,
-				DEVICE_INTERFACE, "Name",
-				DBUS_TYPE_STRING, &name);
+	property_batch_set(device->props, "Name", DBUS_TYPE_STRING, &name);
 
 	if (device->alias != NULL)
 		return;
 
-	emit_property_changed(conn, device->path,
-				DEVICE_INTERFACE, "Alias",
-				DBUS_TYPE_STRING, &name);
+	property_batch_set(device->props, "Alias", DBUS_TYPE_STRING, &name);
 }
 
 void device_get_name(struct btd_device *device, char *name, size_t len)
@@ -1166,9 +1235,16 @@ static void device_remove_stored(struct btd_device *device)
 	delete_entry(&src, "trusts", key);
 
 	if (device_is_bonded(device)) {
-		delete_entry(&src, "linkkeys", key);
+		keystore_remove_link_key(&src, &device->bdaddr);
 		delete_entry(&src, "aliases", key);
 
+		keystore_remove_ltk(&src, &device->bdaddr,
+						device->bdaddr_type);
+
+		/* The key store imports the old text files when it has no
+		 * usable store of its own, so the keys must not stay there */
+		delete_entry(&src, "linkkeys", key);
+
 		/* key: address#type */
 		sprintf(&key[17], "#%hhu", device->bdaddr_type);
 
@@ -1234,87 +1310,76 @@ gint device_address_cmp(struct btd_device *device, const gchar *address)
 	return strcasecmp(addr, address);
 }
 
+struct profile_match {
+	char *uuid;
+	const sdp_record_t *rec;
+};
+
 static gboolean record_has_uuid(const sdp_record_t *rec,
-				const char *profile_uuid)
+						const uint128_t *key)
 {
 	sdp_list_t *pat;
 
+	/* The pattern only holds 128 bit UUIDs */
 	for (pat = rec->pattern; pat != NULL; pat = pat->next) {
-		char *uuid;
-		int ret;
-
-		uuid = bt_uuid2string(pat->data);
-		if (!uuid)
-			continue;
-
-		ret = strcasecmp(uuid, profile_uuid);
+		const uuid_t *uuid = pat->data;
 
-		g_free(uuid);
-
-		if (ret == 0)
+		if (uuid128_equal(&uuid->value.uuid128, key))
 			return TRUE;
 	}
 
 	return FALSE;
 }
 
-static GSList *device_match_pattern(struct btd_device *device,
-					const char *match_uuid,
-					GSList *profiles)
-{
-	GSList *l, *uuids = NULL;
-
-	for (l = profiles; l; l = l->next) {
-		char *profile_uuid = l->data;
-		const sdp_record_t *rec;
-
-		rec = btd_device_get_record(device, profile_uuid);
-		if (!rec)
-			continue;
-
-		if (record_has_uuid(rec, match_uuid))
-			uuids = g_slist_append(uuids, profile_uuid);
-	}
-
-	return uuids;
-}
-
-static GSList *device_match_driver(struct btd_device *device,
-					struct btd_device_driver *driver,
-					GSList *profiles)
+static GSList *device_match_driver(struct btd_device_driver *driver,
+					GHashTable *profiles,
+					const struct profile_match *match,
+					int count)
 {
 	const char **uuid;
 	GSList *uuids = NULL;
 
 	for (uuid = driver->uuids; *uuid; uuid++) {
-		GSList *match;
+		char *profile;
+		uint128_t key;
+		int i;
 
-		/* skip duplicated uuids */
-		if (g_slist_find_custom(uuids, *uuid,
-				(GCompareFunc) strcasecmp))
+		if (!uuid128_from_string(*uuid, &key))
 			continue;
 
-		/* match profile driver */
-		match = g_slist_find_custom(profiles, *uuid,
-					(GCompareFunc) strcasecmp);
-		if (match) {
-			uuids = g_slist_append(uuids, match->data);
+		/* match profile driver, skipping duplicated uuids */
+		profile = g_hash_table_lookup(profiles, &key);
+		if (profile) {
+			if (!g_slist_find(uuids, profile))
+				uuids = g_slist_append(uuids, profile);
 			continue;
 		}
 
 		/* match pattern driver */
-		match = device_match_pattern(device, *uuid, profiles);
-		uuids = g_slist_concat(uuids, match);
+		for (i = 0; i < count; i++) {
+			if (match[i].rec && record_has_uuid(match[i].rec, &key))
+				uuids = g_slist_append(uuids, match[i].uuid);
+		}
 	}
 
 	return uuids;
 }
 
+static void add_candidates(GHashTable *candidates, const uint128_t *key)
+{
+	GSList *l;
+
+	for (l = driver_index_lookup(key); l; l = l->next)
+		g_hash_table_insert(candidates, l->data, l->data);
+}
+
 void device_probe_drivers(struct btd_device *device, GSList *profiles)
 {
+	struct profile_match *match;
+	GHashTable *table, *candidates;
 	GSList *list;
 	char addr[18];
-	int err;
+	int err, count, i;
 
 	ba2str(&device->bdaddr, addr);
 
@@ -1325,11 +1390,47 @@ void device_probe_drivers(struct btd_device *device, GSList *profiles)
 
 	DBG("Probing drivers for %s", addr);
 
+	/* Only drivers registered for one of the profiles, or for a UUID
+	 * in one of their records, need to be looked at */
+	count = g_slist_length(profiles);
+	match = g_new0(struct profile_match, count);
+	table = g_hash_table_new_full(uuid128_hash, uuid128_equal,
+								g_free, NULL);
+	candidates = g_hash_table_new(NULL, NULL);
+
+	for (list = profiles, i = 0; list; list = list->next, i++) {
+		sdp_list_t *pat;
+		uint128_t key;
+
+		match[i].uuid = list->data;
+		match[i].rec = btd_device_get_record(device, list->data);
+
+		if (uuid128_from_string(list->data, &key)) {
+			if (!g_hash_table_lookup(table, &key))
+				g_hash_table_insert(table,
+						g_memdup(&key, sizeof(key)),
+						list->data);
+			add_candidates(candidates, &key);
+		}
+
+		if (match[i].rec == NULL)
+			continue;
+
+		for (pat = match[i].rec->pattern; pat; pat = pat->next) {
+			const uuid_t *uuid = pat->data;
+
+			add_candidates(candidates, &uuid->value.uuid128);
+		}
+	}
+
 	for (list = device_drivers; list; list = list->next) {
 		struct btd_device_driver *driver = list->data;
 		GSList *probe_uuids;
 
-		probe_uuids = device_match_driver(device, driver, profiles);
+		if (!g_hash_table_lookup(candidates, driver))
+			continue;
+
+		probe_uuids = device_match_driver(driver, table, match, count);
 
 		if (!probe_uuids)
 			continue;
@@ -1346,16 +1447,21 @@ void device_probe_drivers(struct btd_device *device, GSList *profiles)
 		g_slist_free(probe_uuids);
 	}
 
+	g_hash_table_destroy(candidates);
+	g_hash_table_destroy(table);
+	g_free(match);
+
 add_uuids:
 	for (list = profiles; list; list = list->next) {
-		GSList *l = g_slist_find_custom(device->uuids, list->data,
-						(GCompareFunc) strcasecmp);
-		if (l)
+		char *uuid;
+
+		if (device_find_uuid(device, list->data))
 			continue;
 
-		device->uuids = g_slist_insert_sorted(device->uuids,
-						g_strdup(list->data),
+		uuid = g_strdup(list->data);
+		device->uuids = g_slist_insert_sorted(device->uuids, uuid,
 						(GCompareFunc) strcasecmp);
+		device_index_uuid(device, uuid);
 	}
 }
 
@@ -1363,6 +1469,7 @@ static void device_remove_drivers(struct btd_device *device, GSList *uuids)
 {
 	struct btd_adapter *adapter = device_get_adapter(device);
 	GSList *list, *next;
+	GHashTable *removed;
 	char srcaddr[18], dstaddr[18];
 	bdaddr_t src;
 	sdp_list_t *records;
@@ -1375,6 +1482,17 @@ static void device_remove_drivers(struct btd_device *device, GSList *uuids)
 
 	DBG("Removing drivers for %s", dstaddr);
 
+	removed = g_hash_table_new_full(uuid128_hash, uuid128_equal,
+								g_free, NULL);
+
+	for (list = uuids; list; list = list->next) {
+		uint128_t key;
+
+		if (uuid128_from_string(list->data, &key))
+			g_hash_table_replace(removed,
+					g_memdup(&key, sizeof(key)), NULL);
+	}
+
 	for (list = device->drivers; list; list = next) {
 		struct btd_device_driver *driver = list->data;
 		const char **uuid;
@@ -1382,8 +1500,11 @@ static void device_remove_drivers(struct btd_device *device, GSList *uuids)
 		next = list->next;
 
 		for (uuid = driver->uuids; *uuid; uuid++) {
-			if (!g_slist_find_custom(uuids, *uuid,
-						(GCompareFunc) strcasecmp))
+			uint128_t key;
+
+			if (!uuid128_from_string(*uuid, &key) ||
+				!g_hash_table_lookup_extended(removed, &key,
+								NULL, NULL))
 				continue;
 
 			DBG("UUID %s was removed from device %s",
@@ -1396,8 +1517,14 @@ static void device_remove_drivers(struct btd_device *device, GSList *uuids)
 		}
 	}
 
+	g_hash_table_destroy(removed);
+
 	for (list = uuids; list; list = list->next) {
 		sdp_record_t *rec;
+		uint128_t key;
+
+		if (uuid128_from_string(list->data, &key))
+			g_hash_table_remove(device->uuid_index, &key);
 
 		device->uuids = g_slist_remove(device->uuids, list->data);
 
@@ -1457,7 +1584,7 @@ static void update_services(struct browse_req *req, sdp_list_t *recs)
 		sdp_record_t *rec = (sdp_record_t *) seq->data;
 		sdp_list_t *svcclass = NULL;
 		gchar *profile_uuid;
-		GSList *l;
+		char *uuid;
 
 		if (!rec)
 			break;
@@ -1482,6 +1609,8 @@ static void update_services(struct browse_req *req, sdp_list_t *recs)
 			uint16_t source, vendor, product, version;
 			sdp_data_t *pdlist;
 
+			req->pnp_found = TRUE;
+
 			pdlist = sdp_data_get(rec, SDP_ATTR_VENDOR_ID_SOURCE);
 			source = pdlist ? pdlist->val.uint16 : 0x0000;
 
@@ -1518,16 +1647,15 @@ static void update_services(struct browse_req *req, sdp_list_t *recs)
 		req->records = sdp_list_append(req->records,
 							sdp_copy_record(rec));
 
-		l = g_slist_find_custom(device->uuids, profile_uuid,
-							(GCompareFunc) strcmp);
-		if (!l)
+		uuid = device_find_uuid(device, profile_uuid);
+		if (!uuid)
 			req->profiles_added =
 					g_slist_append(req->profiles_added,
 							profile_uuid);
 		else {
 			req->profiles_removed =
 					g_slist_remove(req->profiles_removed,
-							l->data);
+							uuid);
 			g_free(profile_uuid);
 		}
 
@@ -1570,11 +1698,10 @@ static void create_device_reply(struct btd_device *device, struct browse_req *re
 GSList *device_services_from_record(struct btd_device *device, GSList *profiles)
 {
 	GSList *l, *prim_list = NULL;
-	char *att_uuid;
-	uuid_t proto_uuid;
+	uuid_t proto_uuid, att_uuid;
 
 	sdp_uuid16_create(&proto_uuid, ATT_UUID);
-	att_uuid = bt_uuid2string(&proto_uuid);
+	sdp_uuid16_to_uuid128(&att_uuid, &proto_uuid);
 
 	for (l = profiles; l; l = l->next) {
 		const char *profile_uuid = l->data;
@@ -1587,7 +1714,7 @@ GSList *device_services_from_record(struct btd_device *device, GSList *profiles)
 		if (!rec)
 			continue;
 
-		if (!record_has_uuid(rec, att_uuid))
+		if (!record_has_uuid(rec, &att_uuid.value.uuid128))
 			continue;
 
 		if (!gatt_parse_record(rec, &prim_uuid, &psm, &start, &end))
@@ -1601,8 +1728,6 @@ GSList *device_services_from_record(struct btd_device *device, GSList *profiles)
 		prim_list = g_slist_append(prim_list, prim);
 	}
 
-	g_free(att_uuid);
-
 	return prim_list;
 }
 
@@ -1710,6 +1835,15 @@ static void browse_cb(sdp_list_t *recs, int err, gpointer user_data)
 
 	update_services(req, recs);
 
+	/* The PnP Information record is an L2CAP service as well, so the
+	 * L2CAP search normally returns it already and searching for it
+	 * again only costs another round trip. The records were already
+	 * processed above, so don't hand them to search_cb() again. */
+	if (req->search_uuid == 1 && req->records && req->pnp_found) {
+		search_cb(NULL, err, user_data);
+		return;
+	}
+
 	adapter_get_address(adapter, &src);
 
 	/* Search for mandatory uuids */
@@ -2995,8 +3129,7 @@ void btd_device_add_uuid(struct btd_device *device, const char *uuid)
 	GSList *uuid_list;
 	char *new_uuid;
 
-	if (g_slist_find_custom(device->uuids, uuid,
-				(GCompareFunc) strcasecmp))
+	if (device_find_uuid(device, uuid))
 		return;
 
 	new_uuid = g_strdup(uuid);
@@ -3051,6 +3184,31 @@ const sdp_record_t *btd_device_get_record(struct btd_device *device,
 
 int btd_register_device_driver(struct btd_device_driver *driver)
 {
+	const char **uuid;
+
+	if (driver_index == NULL)
+		driver_index = g_hash_table_new_full(uuid128_hash,
+						uuid128_equal, g_free, NULL);
+
+	for (uuid = driver->uuids; *uuid; uuid++) {
+		GSList *list;
+		uint128_t key;
+
+		if (!uuid128_from_string(*uuid, &key)) {
+			warn("%s driver UUID %s is not a 128 bit UUID",
+							driver->name, *uuid);
+			continue;
+		}
+
+		list = g_hash_table_lookup(driver_index, &key);
+		if (g_slist_find(list, driver))
+			continue;
+
+		list = g_slist_append(list, driver);
+		g_hash_table_replace(driver_index,
+					g_memdup(&key, sizeof(key)), list);
+	}
+
 	device_drivers = g_slist_append(device_drivers, driver);
 
 	return 0;
@@ -3058,7 +3216,28 @@ int btd_register_device_driver(struct btd_device_driver *driver)
 
 void btd_unregister_device_driver(struct btd_device_driver *driver)
 {
+	const char **uuid;
+
 	device_drivers = g_slist_remove(device_drivers, driver);
+
+	for (uuid = driver->uuids; *uuid; uuid++) {
+		GSList *list;
+		uint128_t key;
+
+		if (!uuid128_from_string(*uuid, &key))
+			continue;
+
+		list = g_hash_table_lookup(driver_index, &key);
+		if (!g_slist_find(list, driver))
+			continue;
+
+		list = g_slist_remove(list, driver);
+		if (list)
+			g_hash_table_replace(driver_index,
+					g_memdup(&key, sizeof(key)), list);
+		else
+			g_hash_table_remove(driver_index, &key);
+	}
 }
 
 struct btd_device *btd_device_ref(struct btd_device *device)
@@ -3091,10 +3270,7 @@ void btd_device_unref(struct btd_device *device)
 
 void device_set_class(struct btd_device *device, uint32_t value)
 {
-	DBusConnection *conn = get_dbus_connection();
-
-	emit_property_changed(conn, device->path, DEVICE_INTERFACE, "Class",
-				DBUS_TYPE_UINT32, &value);
+	property_batch_set(device->props, "Class", DBUS_TYPE_UINT32, &value);
 }
 
 static gboolean notify_attios(gpointer user_data)
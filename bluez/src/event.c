@@ -48,6 +48,7 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "storage.h"
+#include "keystore.h"
 #include "event.h"
 
 static gboolean get_adapter_and_device(bdaddr_t *src, bdaddr_t *dst,
@@ -276,6 +277,29 @@ void btd_event_device_found(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type
 						confirm_name, data, data_len);
 }
 
+void btd_event_devices_found(bdaddr_t *local, struct found_dev_info *devs,
+								int count)
+{
+	struct btd_adapter *adapter;
+	int i;
+
+	adapter = manager_find_adapter(local);
+	if (!adapter) {
+		error("No matching adapter found");
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		update_lastseen(local, &devs[i].bdaddr);
+
+		if (devs[i].eir)
+			write_remote_eir(local, &devs[i].bdaddr, devs[i].eir,
+							devs[i].eir_len);
+	}
+
+	adapter_update_found_devices_batch(adapter, devs, count);
+}
+
 void btd_event_set_legacy_pairing(bdaddr_t *local, bdaddr_t *peer,
 							gboolean legacy)
 {
@@ -349,54 +373,24 @@ void btd_event_remote_name(bdaddr_t *local, bdaddr_t *peer, char *name)
 		device_set_name(device, name);
 }
 
-static char *buf2str(uint8_t *data, int datalen)
-{
-	char *buf;
-	int i;
-
-	buf = g_try_new0(char, (datalen * 2) + 1);
-	if (buf == NULL)
-		return NULL;
-
-	for (i = 0; i < datalen; i++)
-		sprintf(buf + (i * 2), "%2.2x", data[i]);
-
-	return buf;
-}
-
 static int store_longtermkey(bdaddr_t *local, bdaddr_t *peer,
 				uint8_t bdaddr_type, unsigned char *key,
 				uint8_t master, uint8_t authenticated,
 				uint8_t enc_size, uint16_t ediv, uint8_t rand[8])
 {
-	GString *newkey;
-	char *val, *str;
-	int err;
-
-	val = buf2str(key, 16);
-	if (val == NULL)
-		return -ENOMEM;
-
-	newkey = g_string_new(val);
-	g_free(val);
-
-	g_string_append_printf(newkey, " %d %d %d %d ", authenticated, master,
-								enc_size, ediv);
-
-	str = buf2str(rand, 8);
-	if (str == NULL) {
-		g_string_free(newkey, TRUE);
-		return -ENOMEM;
-	}
-
-	newkey = g_string_append(newkey, str);
-	g_free(str);
-
-	err = write_longtermkeys(local, peer, bdaddr_type, newkey->str);
-
-	g_string_free(newkey, TRUE);
-
-	return err;
+	struct smp_ltk_info ltk;
+
+	memset(&ltk, 0, sizeof(ltk));
+	bacpy(&ltk.bdaddr, peer);
+	ltk.bdaddr_type = bdaddr_type;
+	ltk.authenticated = authenticated;
+	ltk.master = master;
+	ltk.enc_size = enc_size;
+	ltk.ediv = ediv;
+	memcpy(ltk.rand, rand, sizeof(ltk.rand));
+	memcpy(ltk.val, key, sizeof(ltk.val));
+
+	return keystore_add_ltk(local, &ltk);
 }
 
 int btd_event_link_key_notify(bdaddr_t *local, bdaddr_t *peer,
@@ -253,3 +253,18 @@ GSList *bt_string2list(const gchar *str)
 
 	return l;
 }
+
+/* GHashTable helpers for bdaddr_t keys */
+guint bt_bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	/* The low bytes are the ones that differ between controllers */
+	return bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+						(guint) bdaddr->b[3] << 24;
+}
+
+gboolean bt_bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return bacmp(a, b) == 0;
+}
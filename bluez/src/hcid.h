@@ -39,6 +39,7 @@ struct main_opts {
 	gboolean	name_resolv;
 	gboolean	debug_keys;
 	gboolean	gatt_enabled;
+	uint32_t	stall_threshold;
 
 	uint8_t		mode;
 
@@ -0,0 +1,530 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/sdp.h>
+
+#include "log.h"
+#include "glib-helper.h"
+#include "textfile.h"
+#include "adapter.h"
+#include "keystore.h"
+
+/*
+ * Link keys and LTKs of one adapter. They are loaded on first use and
+ * stay in memory, every change rewrites the binary file.
+ */
+struct keystore {
+	bdaddr_t local;
+	GHashTable *link_keys;		/* bdaddr -> link_key_info */
+	GHashTable *ltks;		/* bdaddr and type -> smp_ltk_info */
+};
+
+static GHashTable *stores = NULL;
+
+static guint ltk_hash(gconstpointer key)
+{
+	const struct smp_ltk_info *ltk = key;
+
+	return bt_bdaddr_hash(&ltk->bdaddr) ^ ltk->bdaddr_type;
+}
+
+static gboolean ltk_equal(gconstpointer a, gconstpointer b)
+{
+	const struct smp_ltk_info *ltk1 = a, *ltk2 = b;
+
+	return ltk1->bdaddr_type == ltk2->bdaddr_type &&
+				bacmp(&ltk1->bdaddr, &ltk2->bdaddr) == 0;
+}
+
+static void create_path(char *buf, size_t size, const bdaddr_t *local,
+							const char *name)
+{
+	char addr[18];
+
+	ba2str(local, addr);
+	create_name(buf, size, STORAGEDIR, addr, name);
+}
+
+static void add_link_key(struct keystore *ks, struct link_key_info *key)
+{
+	g_hash_table_replace(ks->link_keys, &key->bdaddr, key);
+}
+
+static void add_ltk(struct keystore *ks, struct smp_ltk_info *ltk)
+{
+	g_hash_table_replace(ks->ltks, ltk, ltk);
+}
+
+static int str2buf(const char *str, uint8_t *buf, size_t blen)
+{
+	int i, dlen;
+
+	if (str == NULL)
+		return -EINVAL;
+
+	memset(buf, 0, blen);
+
+	dlen = MIN((strlen(str) / 2), blen);
+
+	for (i = 0; i < dlen; i++)
+		sscanf(str + (i * 2), "%02hhX", &buf[i]);
+
+	return 0;
+}
+
+static void import_link_key(char *key, char *value, void *user_data)
+{
+	struct keystore *ks = user_data;
+	struct link_key_info *info;
+	char tmp[3];
+	long int l;
+
+	if (strlen(value) < 36) {
+		error("Unexpectedly short (%zu) link key line", strlen(value));
+		return;
+	}
+
+	info = g_new0(struct link_key_info, 1);
+
+	str2ba(key, &info->bdaddr);
+
+	str2buf(value, info->key, sizeof(info->key));
+
+	memset(tmp, 0, sizeof(tmp));
+
+	memcpy(tmp, value + 33, 2);
+	info->type = (uint8_t) strtol(tmp, NULL, 10);
+
+	memcpy(tmp, value + 35, 2);
+	l = strtol(tmp, NULL, 10);
+	if (l < 0)
+		l = 0;
+	info->pin_len = l;
+
+	add_link_key(ks, info);
+}
+
+static void import_ltk(char *key, char *value, void *user_data)
+{
+	struct keystore *ks = user_data;
+	struct smp_ltk_info *ltk;
+	char address[18], *ptr;
+	uint8_t bdaddr_type;
+	int i, ret;
+
+	if (sscanf(key, "%17s#%hhu", address, &bdaddr_type) < 2)
+		return;
+
+	if (strlen(value) < 60) {
+		error("Unexpectedly short (%zu) LTK", strlen(value));
+		return;
+	}
+
+	ltk = g_new0(struct smp_ltk_info, 1);
+
+	str2ba(address, &ltk->bdaddr);
+
+	ltk->bdaddr_type = bdaddr_type;
+
+	str2buf(value, ltk->val, sizeof(ltk->val));
+
+	ptr = value + 2 * sizeof(ltk->val) + 1;
+
+	ret = sscanf(ptr, " %hhd %hhd %hhd %hd %n",
+		     &ltk->authenticated, &ltk->master, &ltk->enc_size,
+							&ltk->ediv, &i);
+	if (ret < 2) {
+		g_free(ltk);
+		return;
+	}
+	ptr += i;
+
+	str2buf(ptr, ltk->rand, sizeof(ltk->rand));
+
+	add_ltk(ks, ltk);
+}
+
+static void add_record(struct keystore *ks, struct btd_keystore_rec *rec)
+{
+	struct link_key_info *key;
+	struct smp_ltk_info *ltk;
+
+	switch (rec->kind) {
+	case BTD_KEYSTORE_LINK_KEY:
+		key = g_new0(struct link_key_info, 1);
+		bacpy(&key->bdaddr, &rec->bdaddr);
+		memcpy(key->key, rec->val, sizeof(key->key));
+		key->type = rec->type;
+		key->pin_len = rec->pin_len;
+		add_link_key(ks, key);
+		break;
+	case BTD_KEYSTORE_LTK:
+		ltk = g_new0(struct smp_ltk_info, 1);
+		bacpy(&ltk->bdaddr, &rec->bdaddr);
+		ltk->bdaddr_type = rec->bdaddr_type;
+		ltk->authenticated = rec->type;
+		ltk->master = rec->master;
+		ltk->enc_size = rec->enc_size;
+		ltk->ediv = rec->ediv;
+		memcpy(ltk->val, rec->val, sizeof(ltk->val));
+		memcpy(ltk->rand, rec->rand, sizeof(ltk->rand));
+		add_ltk(ks, ltk);
+		break;
+	default:
+		DBG("Skipping record of unknown kind %u", rec->kind);
+		break;
+	}
+}
+
+static int keystore_read(struct keystore *ks)
+{
+	char filename[PATH_MAX + 1];
+	struct btd_keystore_hdr hdr;
+	struct btd_keystore_rec rec;
+	uint32_t i;
+	FILE *fp;
+	int err = 0;
+
+	create_path(filename, PATH_MAX, &ks->local, BTD_KEYSTORE_NAME);
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		return -errno;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			memcmp(hdr.magic, BTD_KEYSTORE_MAGIC,
+						sizeof(hdr.magic)) != 0 ||
+			hdr.version != BTD_KEYSTORE_VERSION) {
+		error("Invalid key store %s", filename);
+		err = -EINVAL;
+		goto done;
+	}
+
+	for (i = 0; i < hdr.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			error("Truncated key store %s (%u of %u keys)",
+						filename, i, hdr.count);
+			err = -EIO;
+			break;
+		}
+
+		add_record(ks, &rec);
+	}
+
+done:
+	fclose(fp);
+
+	return err;
+}
+
+static int keystore_write(struct keystore *ks)
+{
+	char filename[PATH_MAX + 1], tmpname[PATH_MAX + 1];
+	struct btd_keystore_hdr *hdr;
+	struct btd_keystore_rec *rec;
+	GHashTableIter iter;
+	gpointer value;
+	size_t size, off;
+	uint8_t *buf;
+	int fd, err = 0;
+
+	create_path(filename, PATH_MAX, &ks->local, BTD_KEYSTORE_NAME);
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+	size = sizeof(*hdr) + sizeof(*rec) *
+				(g_hash_table_size(ks->link_keys) +
+					g_hash_table_size(ks->ltks));
+
+	buf = g_malloc0(size);
+
+	hdr = (void *) buf;
+	memcpy(hdr->magic, BTD_KEYSTORE_MAGIC, sizeof(hdr->magic));
+	hdr->version = BTD_KEYSTORE_VERSION;
+
+	rec = (void *) (buf + sizeof(*hdr));
+
+	g_hash_table_iter_init(&iter, ks->link_keys);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct link_key_info *key = value;
+
+		bacpy(&rec->bdaddr, &key->bdaddr);
+		rec->bdaddr_type = BDADDR_BREDR;
+		rec->kind = BTD_KEYSTORE_LINK_KEY;
+		rec->type = key->type;
+		rec->pin_len = key->pin_len;
+		memcpy(rec->val, key->key, sizeof(key->key));
+		rec++;
+	}
+
+	g_hash_table_iter_init(&iter, ks->ltks);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct smp_ltk_info *ltk = value;
+
+		bacpy(&rec->bdaddr, &ltk->bdaddr);
+		rec->bdaddr_type = ltk->bdaddr_type;
+		rec->kind = BTD_KEYSTORE_LTK;
+		rec->type = ltk->authenticated;
+		rec->master = ltk->master;
+		rec->enc_size = ltk->enc_size;
+		rec->ediv = ltk->ediv;
+		memcpy(rec->val, ltk->val, sizeof(ltk->val));
+		memcpy(rec->rand, ltk->rand, sizeof(ltk->rand));
+		rec++;
+	}
+
+	hdr->count = g_hash_table_size(ks->link_keys) +
+					g_hash_table_size(ks->ltks);
+
+	create_file(tmpname, S_IRUSR | S_IWUSR);
+
+	fd = open(tmpname, O_WRONLY | O_TRUNC);
+	if (fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	for (off = 0; off < size;) {
+		ssize_t ret = write(fd, buf + off, size - off);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err = -errno;
+			close(fd);
+			goto fail;
+		}
+
+		off += ret;
+	}
+
+	/* The new file has to be on disk before it replaces the old one */
+	if (fsync(fd) < 0) {
+		err = -errno;
+		close(fd);
+		goto fail;
+	}
+
+	close(fd);
+
+	if (rename(tmpname, filename) < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	g_free(buf);
+
+	return 0;
+
+fail:
+	error("Unable to write key store %s: %s (%d)", filename,
+							strerror(-err), -err);
+	unlink(tmpname);
+	g_free(buf);
+
+	return err;
+}
+
+static void keystore_free(gpointer data)
+{
+	struct keystore *ks = data;
+
+	g_hash_table_destroy(ks->link_keys);
+	g_hash_table_destroy(ks->ltks);
+	g_free(ks);
+}
+
+static struct keystore *keystore_get(const bdaddr_t *local)
+{
+	char filename[PATH_MAX + 1], badname[PATH_MAX + 1];
+	struct keystore *ks;
+	int err;
+
+	if (stores == NULL)
+		stores = g_hash_table_new_full(bt_bdaddr_hash, bt_bdaddr_equal,
+							NULL, keystore_free);
+
+	ks = g_hash_table_lookup(stores, local);
+	if (ks != NULL)
+		return ks;
+
+	ks = g_new0(struct keystore, 1);
+	bacpy(&ks->local, local);
+	ks->link_keys = g_hash_table_new_full(bt_bdaddr_hash,
+						bt_bdaddr_equal, NULL, g_free);
+	ks->ltks = g_hash_table_new_full(ltk_hash, ltk_equal, NULL, g_free);
+
+	g_hash_table_insert(stores, &ks->local, ks);
+
+	err = keystore_read(ks);
+	if (err == 0)
+		return ks;
+
+	/* None of a damaged store can be trusted, and writing back what
+	 * could be read would lose the rest for good. Keep it aside. */
+	if (err != -ENOENT) {
+		g_hash_table_remove_all(ks->link_keys);
+		g_hash_table_remove_all(ks->ltks);
+
+		create_path(filename, PATH_MAX, local, BTD_KEYSTORE_NAME);
+		snprintf(badname, sizeof(badname), "%s.bad", filename);
+
+		if (rename(filename, badname) < 0)
+			error("Unable to move %s aside: %s (%d)", filename,
+							strerror(errno), errno);
+	}
+
+	/* No usable binary store, import the keys of older versions. The
+	 * text files are left in place and only removals still update
+	 * them, see device_remove_stored(). */
+	create_path(filename, PATH_MAX, local, "linkkeys");
+	textfile_foreach(filename, import_link_key, ks);
+
+	create_path(filename, PATH_MAX, local, "longtermkeys");
+	textfile_foreach(filename, import_ltk, ks);
+
+	if (g_hash_table_size(ks->link_keys) > 0 ||
+					g_hash_table_size(ks->ltks) > 0) {
+		DBG("Imported %u link keys and %u LTKs",
+					g_hash_table_size(ks->link_keys),
+					g_hash_table_size(ks->ltks));
+		keystore_write(ks);
+	}
+
+	return ks;
+}
+
+int keystore_add_link_key(const bdaddr_t *local,
+					const struct link_key_info *key)
+{
+	struct keystore *ks = keystore_get(local);
+
+	add_link_key(ks, g_memdup(key, sizeof(*key)));
+
+	return keystore_write(ks);
+}
+
+struct link_key_info *keystore_find_link_key(const bdaddr_t *local,
+							const bdaddr_t *peer)
+{
+	struct keystore *ks = keystore_get(local);
+
+	return g_hash_table_lookup(ks->link_keys, peer);
+}
+
+int keystore_remove_link_key(const bdaddr_t *local, const bdaddr_t *peer)
+{
+	struct keystore *ks = keystore_get(local);
+
+	if (!g_hash_table_remove(ks->link_keys, peer))
+		return -ENOENT;
+
+	return keystore_write(ks);
+}
+
+int keystore_add_ltk(const bdaddr_t *local, const struct smp_ltk_info *ltk)
+{
+	struct keystore *ks = keystore_get(local);
+
+	add_ltk(ks, g_memdup(ltk, sizeof(*ltk)));
+
+	return keystore_write(ks);
+}
+
+struct smp_ltk_info *keystore_find_ltk(const bdaddr_t *local,
+					const bdaddr_t *peer, uint8_t bdaddr_type)
+{
+	struct keystore *ks = keystore_get(local);
+	struct smp_ltk_info match;
+
+	bacpy(&match.bdaddr, peer);
+	match.bdaddr_type = bdaddr_type;
+
+	return g_hash_table_lookup(ks->ltks, &match);
+}
+
+int keystore_remove_ltk(const bdaddr_t *local, const bdaddr_t *peer,
+							uint8_t bdaddr_type)
+{
+	struct keystore *ks = keystore_get(local);
+	struct smp_ltk_info match;
+
+	bacpy(&match.bdaddr, peer);
+	match.bdaddr_type = bdaddr_type;
+
+	if (!g_hash_table_remove(ks->ltks, &match))
+		return -ENOENT;
+
+	return keystore_write(ks);
+}
+
+void keystore_foreach_link_key(const bdaddr_t *local,
+			void (*func) (struct link_key_info *key, void *data),
+			void *data)
+{
+	struct keystore *ks = keystore_get(local);
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, ks->link_keys);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		func(value, data);
+}
+
+void keystore_foreach_ltk(const bdaddr_t *local,
+			void (*func) (struct smp_ltk_info *ltk, void *data),
+			void *data)
+{
+	struct keystore *ks = keystore_get(local);
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, ks->ltks);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		func(value, data);
+}
+
+void keystore_cleanup(void)
+{
+	if (stores == NULL)
+		return;
+
+	g_hash_table_destroy(stores);
+	stores = NULL;
+}
@@ -0,0 +1,82 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+
+#define BTD_KEYSTORE_NAME	"keys"
+
+#define BTD_KEYSTORE_MAGIC	"BTDKEYS"
+#define BTD_KEYSTORE_VERSION	1
+
+/* Record kinds */
+#define BTD_KEYSTORE_LINK_KEY	0x01
+#define BTD_KEYSTORE_LTK	0x02
+
+/*
+ * File layout: one btd_keystore_hdr followed by count records of fixed
+ * size, in no particular order. Values are in host byte order. The
+ * file is always replaced as a whole through a rename, so readers never
+ * see a partially written store.
+ */
+struct btd_keystore_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+} __attribute__ ((packed));
+
+struct btd_keystore_rec {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	uint8_t kind;
+	uint8_t type;		/* link key type, LTK authenticated */
+	uint8_t pin_len;	/* link keys only */
+	uint8_t master;		/* LTKs only */
+	uint8_t enc_size;	/* LTKs only */
+	uint16_t ediv;		/* LTKs only */
+	uint8_t val[16];
+	uint8_t rand[8];	/* LTKs only */
+} __attribute__ ((packed));
+
+struct link_key_info;
+struct smp_ltk_info;
+
+int keystore_add_link_key(const bdaddr_t *local,
+					const struct link_key_info *key);
+struct link_key_info *keystore_find_link_key(const bdaddr_t *local,
+							const bdaddr_t *peer);
+int keystore_remove_link_key(const bdaddr_t *local, const bdaddr_t *peer);
+
+int keystore_add_ltk(const bdaddr_t *local, const struct smp_ltk_info *ltk);
+struct smp_ltk_info *keystore_find_ltk(const bdaddr_t *local,
+					const bdaddr_t *peer, uint8_t bdaddr_type);
+int keystore_remove_ltk(const bdaddr_t *local, const bdaddr_t *peer,
+							uint8_t bdaddr_type);
+
+void keystore_foreach_link_key(const bdaddr_t *local,
+			void (*func) (struct link_key_info *key, void *data),
+			void *data);
+void keystore_foreach_ltk(const bdaddr_t *local,
+			void (*func) (struct smp_ltk_info *ltk, void *data),
+			void *data);
+
+void keystore_cleanup(void);
@@ -27,11 +27,13 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <syslog.h>
 
 #include <glib.h>
 
 #include "log.h"
+#include "trace.h"
 
 void info(const char *format, ...)
 {
@@ -81,16 +83,17 @@ extern struct btd_debug_desc __start___debug[];
 extern struct btd_debug_desc __stop___debug[];
 
 static gchar **enabled = NULL;
+static gchar **traced = NULL;
 
-static gboolean is_enabled(struct btd_debug_desc *desc)
+static gboolean is_enabled(gchar **patterns, struct btd_debug_desc *desc)
 {
 	int i;
 
-	if (enabled == NULL)
+	if (patterns == NULL)
 		return 0;
 
-	for (i = 0; enabled[i] != NULL; i++)
-		if (desc->file != NULL && g_pattern_match_simple(enabled[i],
+	for (i = 0; patterns[i] != NULL; i++)
+		if (desc->file != NULL && g_pattern_match_simple(patterns[i],
 							desc->file) == TRUE)
 			return 1;
 
@@ -106,26 +109,39 @@ void __btd_enable_debug(struct btd_debug_desc *start,
 		return;
 
 	for (desc = start; desc < stop; desc++) {
-		if (is_enabled(desc))
+		if (is_enabled(enabled, desc))
 			desc->flags |= BTD_DEBUG_FLAG_PRINT;
+		if (is_enabled(traced, desc))
+			desc->flags |= BTD_DEBUG_FLAG_TRACE;
 	}
 }
 
+/* Sends everything to syslog, tracing takes precedence over printing
+ * so it has to be turned off */
 void __btd_toggle_debug(void)
 {
 	struct btd_debug_desc *desc;
 
-	for (desc = __start___debug; desc < __stop___debug; desc++)
+	for (desc = __start___debug; desc < __stop___debug; desc++) {
 		desc->flags |= BTD_DEBUG_FLAG_PRINT;
+		desc->flags &= ~BTD_DEBUG_FLAG_TRACE;
+	}
 }
 
-void __btd_log_init(const char *debug, int detach)
+void __btd_log_init(const char *debug, const char *trace, int detach)
 {
 	int option = LOG_NDELAY | LOG_PID;
+	int err = 0;
 
 	if (debug != NULL)
 		enabled = g_strsplit_set(debug, ":, ", 0);
 
+	if (trace != NULL) {
+		err = __btd_trace_init();
+		if (err == 0)
+			traced = g_strsplit_set(trace, ":, ", 0);
+	}
+
 	__btd_enable_debug(__start___debug, __stop___debug);
 
 	if (!detach)
@@ -134,11 +150,17 @@ void __btd_log_init(const char *debug, int detach)
 	openlog("bluetoothd", option, LOG_DAEMON);
 
 	syslog(LOG_INFO, "Bluetooth daemon %s", VERSION);
+
+	if (err < 0)
+		syslog(LOG_ERR, "Unable to set up tracing: %s", strerror(-err));
 }
 
 void __btd_log_cleanup(void)
 {
 	closelog();
 
+	__btd_trace_cleanup();
+
+	g_strfreev(traced);
 	g_strfreev(enabled);
 }
@@ -26,8 +26,11 @@ void warn(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void error(const char *format, ...) __attribute__((format(printf, 1, 2)));
 
 void btd_debug(const char *format, ...) __attribute__((format(printf, 1, 2)));
+/* Not marked as printf format, DBG() already checks the arguments through
+ * btd_debug() and DBG("") would trip -Wformat-zero-length here */
+void btd_trace(const char *file, const char *func, const char *format, ...);
 
-void __btd_log_init(const char *debug, int detach);
+void __btd_log_init(const char *debug, const char *trace, int detach);
 void __btd_log_cleanup(void);
 void __btd_toggle_debug(void);
 
@@ -35,6 +38,7 @@ struct btd_debug_desc {
 	const char *file;
 #define BTD_DEBUG_FLAG_DEFAULT (0)
 #define BTD_DEBUG_FLAG_PRINT   (1 << 0)
+#define BTD_DEBUG_FLAG_TRACE   (1 << 1)
 	unsigned int flags;
 } __attribute__((aligned(8)));
 
@@ -47,13 +51,16 @@ void __btd_enable_debug(struct btd_debug_desc *start,
  * @arg...: list of arguments
  *
  * Simple macro around btd_debug() which also include the function
- * name it is called in.
+ * name it is called in. Files selected for tracing record into the
+ * binary trace ring through btd_trace() instead of syslog.
  */
 #define DBG(fmt, arg...) do { \
 	static struct btd_debug_desc __btd_debug_desc \
 	__attribute__((used, section("__debug"), aligned(8))) = { \
 		.file = __FILE__, .flags = BTD_DEBUG_FLAG_DEFAULT, \
 	}; \
-	if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_PRINT) \
+	if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_TRACE) \
+		btd_trace(__FILE__, __FUNCTION__, fmt, ## arg); \
+	else if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_PRINT) \
 		btd_debug("%s:%s() " fmt,  __FILE__, __FUNCTION__ , ## arg); \
 } while (0)
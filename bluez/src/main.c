@@ -47,6 +47,9 @@
 #include <gdbus.h>
 
 #include "log.h"
+#include "metrics.h"
+#include "trace.h"
+#include "watchdog.h"
 
 #include "hcid.h"
 #include "sdpd.h"
@@ -54,6 +57,7 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "manager.h"
+#include "keystore.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -252,6 +256,18 @@ static void parse_config(GKeyFile *config)
 	main_opts.link_policy = HCI_LP_RSWITCH | HCI_LP_SNIFF |
 						HCI_LP_HOLD | HCI_LP_PARK;
 
+	val = g_key_file_get_integer(config, "General", "StallThreshold", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		error("Invalid StallThreshold %d, keeping %u", val,
+						main_opts.stall_threshold);
+	} else {
+		main_opts.stall_threshold = val;
+		DBG("stall_threshold=%u", main_opts.stall_threshold);
+	}
+
 	str = g_key_file_get_string(config, "General", "MultiProfile", &err);
 	if (err) {
 		g_clear_error(&err);
@@ -313,6 +329,10 @@ static gboolean signal_handler(GIOChannel *channel, GIOCondition cond,
 
 		__terminated = 1;
 		break;
+	case SIGUSR1:
+		if (__btd_trace_dump(BTD_TRACE_PATH) == 0)
+			info("Trace written to %s", BTD_TRACE_PATH);
+		break;
 	case SIGUSR2:
 		__btd_toggle_debug();
 		break;
@@ -334,6 +354,7 @@ static guint setup_signalfd(void)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 	sigaddset(&mask, SIGUSR2);
 	sigaddset(&mask, SIGPIPE);
 
@@ -364,6 +385,7 @@ static guint setup_signalfd(void)
 }
 
 static gchar *option_debug = NULL;
+static gchar *option_trace = NULL;
 static gchar *option_plugin = NULL;
 static gchar *option_noplugin = NULL;
 static gboolean option_detach = TRUE;
@@ -450,10 +472,24 @@ static gboolean parse_debug(const char *key, const char *value,
 	return TRUE;
 }
 
+static gboolean parse_trace(const char *key, const char *value,
+				gpointer user_data, GError **error)
+{
+	if (value)
+		option_trace = g_strdup(value);
+	else
+		option_trace = g_strdup("*");
+
+	return TRUE;
+}
+
 static GOptionEntry options[] = {
 	{ "debug", 'd', G_OPTION_FLAG_OPTIONAL_ARG,
 				G_OPTION_ARG_CALLBACK, parse_debug,
 				"Specify debug options to enable", "DEBUG" },
+	{ "trace", 't', G_OPTION_FLAG_OPTIONAL_ARG,
+				G_OPTION_ARG_CALLBACK, parse_trace,
+				"Specify debug options to trace", "DEBUG" },
 	{ "plugin", 'p', 0, G_OPTION_ARG_STRING, &option_plugin,
 				"Specify plugins to load", "NAME,..," },
 	{ "noplugin", 'P', 0, G_OPTION_ARG_STRING, &option_noplugin,
@@ -522,12 +558,14 @@ int main(int argc, char *argv[])
 
 	signal = setup_signalfd();
 
-	__btd_log_init(option_debug, option_detach);
+	__btd_log_init(option_debug, option_trace, option_detach);
 
 	config = load_config(CONFIGDIR "/main.conf");
 
 	parse_config(config);
 
+	__btd_watchdog_init(main_opts.stall_threshold);
+
 	agent_init();
 
 	if (option_udev == FALSE) {
@@ -542,6 +580,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	__btd_metrics_init();
+
 	start_sdp_server(mtu, SDP_SERVER_COMPAT);
 
 	if (mps != MPS_OFF)
@@ -566,12 +606,18 @@ int main(int argc, char *argv[])
 
 	g_source_remove(signal);
 
+	__btd_watchdog_cleanup();
+
+	__btd_metrics_cleanup();
+
 	disconnect_dbus();
 
 	rfkill_exit();
 
 	plugin_cleanup();
 
+	keystore_cleanup();
+
 	stop_sdp_server();
 
 	agent_exit();
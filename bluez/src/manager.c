@@ -48,6 +48,7 @@
 #include "dbus-common.h"
 #include "log.h"
 #include "adapter.h"
+#include "device.h"
 #include "error.h"
 #include "manager.h"
 
@@ -196,6 +197,101 @@ static DBusMessage *get_properties(DBusConnection *conn,
 	return reply;
 }
 
+typedef void (*append_func) (void *object, DBusMessageIter *iter);
+
+/* Appends one {path, {interface: properties}} entry */
+static void append_object(DBusMessageIter *objects, const char *path,
+					const char *interface,
+					append_func append_properties,
+					void *object)
+{
+	DBusMessageIter entry, ifaces, iface;
+
+	dbus_message_iter_open_container(objects, DBUS_TYPE_DICT_ENTRY,
+								NULL, &entry);
+
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_OBJECT_PATH, &path);
+
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING
+			DBUS_TYPE_ARRAY_AS_STRING
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &ifaces);
+
+	dbus_message_iter_open_container(&ifaces, DBUS_TYPE_DICT_ENTRY,
+								NULL, &iface);
+
+	dbus_message_iter_append_basic(&iface, DBUS_TYPE_STRING, &interface);
+
+	append_properties(object, &iface);
+
+	dbus_message_iter_close_container(&ifaces, &iface);
+	dbus_message_iter_close_container(&entry, &ifaces);
+	dbus_message_iter_close_container(objects, &entry);
+}
+
+static void append_device(struct btd_device *device, gpointer user_data)
+{
+	DBusMessageIter *objects = user_data;
+
+	append_object(objects, device_get_path(device), DEVICE_INTERFACE,
+				(append_func) device_append_properties, device);
+}
+
+static DBusMessage *get_managed_objects(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter objects;
+	GSList *l;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_OBJECT_PATH_AS_STRING
+			DBUS_TYPE_ARRAY_AS_STRING
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING
+			DBUS_TYPE_ARRAY_AS_STRING
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &objects);
+
+	for (l = adapters; l; l = l->next) {
+		struct btd_adapter *adapter = l->data;
+		char address[18];
+		bdaddr_t src;
+
+		/* Same as Adapter.GetProperties, which fails for adapters
+		 * whose address is not known yet */
+		adapter_get_address(adapter, &src);
+		ba2str(&src, address);
+		if (bachk(address) < 0)
+			continue;
+
+		append_object(&objects, adapter_get_path(adapter),
+				ADAPTER_INTERFACE,
+				(append_func) adapter_append_properties, adapter);
+
+		adapter_foreach_device(adapter, append_device, &objects);
+	}
+
+	dbus_message_iter_close_container(&iter, &objects);
+
+	return reply;
+}
+
 static const GDBusMethodTable manager_methods[] = {
 	{ GDBUS_METHOD("GetProperties",
 			NULL, GDBUS_ARGS({ "properties", "a{sv}" }),
@@ -210,6 +306,9 @@ static const GDBusMethodTable manager_methods[] = {
 	{ GDBUS_ASYNC_METHOD("ListAdapters",
 			NULL, GDBUS_ARGS({ "adapters", "ao" }),
 			list_adapters) },
+	{ GDBUS_METHOD("GetManagedObjects",
+			NULL, GDBUS_ARGS({ "objects", "a{oa{sa{sv}}}" }),
+			get_managed_objects) },
 	{ }
 };
 
@@ -324,47 +423,14 @@ void manager_cleanup(DBusConnection *conn, const char *path)
 	g_dbus_unregister_interface(conn, "/", MANAGER_INTERFACE);
 }
 
-static gint adapter_id_cmp(gconstpointer a, gconstpointer b)
-{
-	struct btd_adapter *adapter = (struct btd_adapter *) a;
-	uint16_t id = GPOINTER_TO_UINT(b);
-	uint16_t dev_id = adapter_get_dev_id(adapter);
-
-	return dev_id == id ? 0 : -1;
-}
-
-static gint adapter_cmp(gconstpointer a, gconstpointer b)
-{
-	struct btd_adapter *adapter = (struct btd_adapter *) a;
-	const bdaddr_t *bdaddr = b;
-	bdaddr_t src;
-
-	adapter_get_address(adapter, &src);
-
-	return bacmp(&src, bdaddr);
-}
-
 struct btd_adapter *manager_find_adapter(const bdaddr_t *sba)
 {
-	GSList *match;
-
-	match = g_slist_find_custom(adapters, sba, adapter_cmp);
-	if (!match)
-		return NULL;
-
-	return match->data;
+	return adapter_find(sba);
 }
 
 struct btd_adapter *manager_find_adapter_by_id(int id)
 {
-	GSList *match;
-
-	match = g_slist_find_custom(adapters, GINT_TO_POINTER(id),
-							adapter_id_cmp);
-	if (!match)
-		return NULL;
-
-	return match->data;
+	return adapter_find_by_id(id);
 }
 
 void manager_foreach_adapter(adapter_cb func, gpointer user_data)
@@ -0,0 +1,417 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+#include <gdbus.h>
+
+#include "log.h"
+#include "dbus-common.h"
+#include "metrics.h"
+
+#define METRICS_INTERFACE	"org.bluez.Metrics"
+#define METRICS_PATH		"/"
+
+struct metrics_client {
+	GString *str;
+	size_t offset;
+	guint watch;
+};
+
+struct metrics_range {
+	struct btd_metric_desc *start;
+	struct btd_metric_desc *stop;
+};
+
+extern struct btd_metric_desc __start___metrics[];
+extern struct btd_metric_desc __stop___metrics[];
+
+static GSList *ranges = NULL;
+static DBusConnection *connection = NULL;
+static guint unix_watch = 0;
+static GSList *clients = NULL;
+
+void __btd_metrics_register(struct btd_metric_desc *start,
+					struct btd_metric_desc *stop)
+{
+	struct metrics_range *range;
+
+	if (start == NULL || stop == NULL || start == stop)
+		return;
+
+	range = g_new0(struct metrics_range, 1);
+	range->start = start;
+	range->stop = stop;
+
+	ranges = g_slist_append(ranges, range);
+}
+
+static gint metric_name_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct btd_metric_desc *da = a, *db = b;
+
+	return strcmp(da->name, db->name);
+}
+
+static void merge_metric(GSList **list, const struct btd_metric_desc *desc)
+{
+	struct btd_metric_desc *sum;
+	GSList *l;
+	int i;
+
+	l = g_slist_find_custom(*list, desc, metric_name_cmp);
+	if (l == NULL) {
+		sum = g_memdup(desc, sizeof(*desc));
+		*list = g_slist_insert_sorted(*list, sum, metric_name_cmp);
+		return;
+	}
+
+	/* Same metric defined in several places counts as one */
+	sum = l->data;
+	sum->count += desc->count;
+	sum->sum += desc->sum;
+
+	for (i = 0; i < BTD_METRIC_BUCKETS; i++)
+		sum->buckets[i] += desc->buckets[i];
+}
+
+/* Snapshot of all metrics, sorted by name and merged by name */
+static GSList *collect_metrics(void)
+{
+	GSList *list = NULL, *l;
+
+	for (l = ranges; l; l = l->next) {
+		struct metrics_range *range = l->data;
+		struct btd_metric_desc *desc;
+
+		for (desc = range->start; desc < range->stop; desc++) {
+			if (desc->name != NULL)
+				merge_metric(&list, desc);
+		}
+	}
+
+	return list;
+}
+
+static void append_metric(DBusMessageIter *dict,
+					const struct btd_metric_desc *desc)
+{
+	DBusMessageIter entry, props;
+	const char *type;
+	const uint64_t *buckets = desc->buckets;
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY,
+							NULL, &entry);
+
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &desc->name);
+
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &props);
+
+	if (desc->type == BTD_METRIC_TYPE_HISTOGRAM)
+		type = "histogram";
+	else
+		type = "counter";
+
+	dict_append_entry(&props, "Type", DBUS_TYPE_STRING, &type);
+	dict_append_entry(&props, "Count", DBUS_TYPE_UINT64,
+						(void *) &desc->count);
+
+	if (desc->type == BTD_METRIC_TYPE_HISTOGRAM) {
+		dict_append_entry(&props, "Sum", DBUS_TYPE_UINT64,
+						(void *) &desc->sum);
+		dict_append_array(&props, "Buckets", DBUS_TYPE_UINT64,
+					&buckets, BTD_METRIC_BUCKETS);
+	}
+
+	dbus_message_iter_close_container(&entry, &props);
+
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static DBusMessage *get_metrics(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter, dict;
+	GSList *list, *l;
+
+	reply = dbus_message_new_method_return(msg);
+	if (reply == NULL)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING
+			DBUS_TYPE_ARRAY_AS_STRING
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+
+	list = collect_metrics();
+
+	for (l = list; l; l = l->next)
+		append_metric(&dict, l->data);
+
+	g_slist_free_full(list, g_free);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
+static const GDBusMethodTable metrics_methods[] = {
+	{ GDBUS_METHOD("GetMetrics", NULL,
+			GDBUS_ARGS({ "metrics", "a{sa{sv}}" }),
+			get_metrics) },
+	{ }
+};
+
+/* Prometheus text exposition format, one scrape per connection */
+static GString *format_metrics(void)
+{
+	GString *str = g_string_new(NULL);
+	GSList *list, *l;
+
+	list = collect_metrics();
+
+	for (l = list; l; l = l->next) {
+		struct btd_metric_desc *desc = l->data;
+		uint64_t total = 0;
+		int i;
+
+		if (desc->type != BTD_METRIC_TYPE_HISTOGRAM) {
+			g_string_append_printf(str,
+				"# TYPE bluetoothd_%s counter\n"
+				"bluetoothd_%s %llu\n", desc->name,
+				desc->name, (unsigned long long) desc->count);
+			continue;
+		}
+
+		g_string_append_printf(str, "# TYPE bluetoothd_%s histogram\n",
+								desc->name);
+
+		for (i = 0; i < BTD_METRIC_BUCKETS - 1; i++) {
+			total += desc->buckets[i];
+			g_string_append_printf(str,
+				"bluetoothd_%s_bucket{le=\"%llu\"} %llu\n",
+				desc->name, (1ULL << i) - 1,
+				(unsigned long long) total);
+		}
+
+		g_string_append_printf(str,
+				"bluetoothd_%s_bucket{le=\"+Inf\"} %llu\n"
+				"bluetoothd_%s_sum %llu\n"
+				"bluetoothd_%s_count %llu\n",
+				desc->name, (unsigned long long) desc->count,
+				desc->name, (unsigned long long) desc->sum,
+				desc->name, (unsigned long long) desc->count);
+	}
+
+	g_slist_free_full(list, g_free);
+
+	return str;
+}
+
+static void client_free(gpointer data)
+{
+	struct metrics_client *client = data;
+
+	clients = g_slist_remove(clients, client);
+
+	g_string_free(client->str, TRUE);
+	g_free(client);
+}
+
+/* The scraper may be slow, so never wait for it on the main loop */
+static gboolean client_write(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct metrics_client *client = user_data;
+	int sk;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	sk = g_io_channel_unix_get_fd(chan);
+
+	while (client->offset < client->str->len) {
+		ssize_t written = send(sk, client->str->str + client->offset,
+					client->str->len - client->offset,
+					MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return TRUE;
+			return FALSE;
+		}
+
+		client->offset += written;
+	}
+
+	return FALSE;
+}
+
+static gboolean unix_accept(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct metrics_client *client;
+	GIOChannel *io;
+	int sk, nsk;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	sk = g_io_channel_unix_get_fd(chan);
+
+	nsk = accept(sk, NULL, NULL);
+	if (nsk < 0) {
+		error("Can't accept metrics connection: %s", strerror(errno));
+		return TRUE;
+	}
+
+	client = g_new0(struct metrics_client, 1);
+	client->str = format_metrics();
+
+	io = g_io_channel_unix_new(nsk);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	client->watch = g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
+				G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+				client_write, client, client_free);
+
+	g_io_channel_unref(io);
+
+	clients = g_slist_prepend(clients, client);
+
+	return TRUE;
+}
+
+static int unix_init(void)
+{
+	struct sockaddr_un addr;
+	GIOChannel *io;
+	int sk, err;
+
+	sk = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, METRICS_UNIX_PATH);
+
+	unlink(addr.sun_path);
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+							listen(sk, 5) < 0) {
+		err = -errno;
+		close(sk);
+		return err;
+	}
+
+	chmod(METRICS_UNIX_PATH, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+	io = g_io_channel_unix_new(sk);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	unix_watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP |
+						G_IO_NVAL, unix_accept, NULL);
+
+	g_io_channel_unref(io);
+
+	return 0;
+}
+
+int __btd_metrics_init(void)
+{
+	int err;
+
+	__btd_metrics_register(__start___metrics, __stop___metrics);
+
+	err = unix_init();
+	if (err < 0)
+		error("Unable to open metrics socket: %s (%d)",
+							strerror(-err), -err);
+
+	connection = get_dbus_connection();
+	if (connection == NULL)
+		return 0;
+
+	dbus_connection_ref(connection);
+
+	if (!g_dbus_register_interface(connection, METRICS_PATH,
+					METRICS_INTERFACE, metrics_methods,
+					NULL, NULL, NULL, NULL)) {
+		error("Failed to register " METRICS_INTERFACE);
+		dbus_connection_unref(connection);
+		connection = NULL;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+void __btd_metrics_cleanup(void)
+{
+	if (connection) {
+		g_dbus_unregister_interface(connection, METRICS_PATH,
+							METRICS_INTERFACE);
+		dbus_connection_unref(connection);
+		connection = NULL;
+	}
+
+	while (clients) {
+		struct metrics_client *client = clients->data;
+
+		g_source_remove(client->watch);
+	}
+
+	if (unix_watch > 0) {
+		g_source_remove(unix_watch);
+		unix_watch = 0;
+		unlink(METRICS_UNIX_PATH);
+	}
+
+	g_slist_free_full(ranges, g_free);
+	ranges = NULL;
+}
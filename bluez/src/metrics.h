@@ -0,0 +1,123 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stdint.h>
+#include <time.h>
+
+#define METRICS_UNIX_PATH "/var/run/bluetooth-metrics"
+
+#define BTD_METRIC_TYPE_COUNTER		0
+#define BTD_METRIC_TYPE_HISTOGRAM	1
+
+/* Histogram bucket i counts values below 2^i microseconds, the last
+ * bucket everything else */
+#define BTD_METRIC_BUCKETS		20
+
+struct btd_metric_desc {
+	const char *name;
+	const char *file;
+	unsigned int type;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[BTD_METRIC_BUCKETS];
+} __attribute__((aligned(8)));
+
+/**
+ * BTD_METRIC_COUNTER:
+ * @var: variable name of the descriptor
+ * @metric: exported name of the counter
+ *
+ * Defines a counter that is exported together with all other metrics.
+ * Names use lower case and underscores, prefixed by the subsystem.
+ */
+#define BTD_METRIC_COUNTER(var, metric) \
+	static struct btd_metric_desc var \
+	__attribute__((used, section("__metrics"), aligned(8))) = { \
+		.name = metric, .file = __FILE__, \
+		.type = BTD_METRIC_TYPE_COUNTER, \
+	}
+
+/**
+ * BTD_METRIC_HISTOGRAM:
+ * @var: variable name of the descriptor
+ * @metric: exported name of the histogram
+ *
+ * Defines a histogram of durations in microseconds with power of two
+ * buckets.
+ */
+#define BTD_METRIC_HISTOGRAM(var, metric) \
+	static struct btd_metric_desc var \
+	__attribute__((used, section("__metrics"), aligned(8))) = { \
+		.name = metric, .file = __FILE__, \
+		.type = BTD_METRIC_TYPE_HISTOGRAM, \
+	}
+
+static inline void btd_metric_add(struct btd_metric_desc *desc,
+							uint64_t value)
+{
+	__sync_fetch_and_add(&desc->count, value);
+}
+
+static inline void btd_metric_inc(struct btd_metric_desc *desc)
+{
+	__sync_fetch_and_add(&desc->count, 1);
+}
+
+static inline uint64_t btd_metric_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void btd_metric_observe(struct btd_metric_desc *desc,
+							uint64_t usec)
+{
+	unsigned int bucket = 0;
+
+	if (usec > 0)
+		bucket = 64 - __builtin_clzll(usec);
+
+	if (bucket >= BTD_METRIC_BUCKETS)
+		bucket = BTD_METRIC_BUCKETS - 1;
+
+	__sync_fetch_and_add(&desc->count, 1);
+	__sync_fetch_and_add(&desc->sum, usec);
+	__sync_fetch_and_add(&desc->buckets[bucket], 1);
+}
+
+/* Records the time passed since start, as returned by btd_metric_now() */
+static inline void btd_metric_observe_since(struct btd_metric_desc *desc,
+							uint64_t start)
+{
+	btd_metric_observe(desc, btd_metric_now() - start);
+}
+
+void __btd_metrics_register(struct btd_metric_desc *start,
+					struct btd_metric_desc *stop);
+
+int __btd_metrics_init(void);
+void __btd_metrics_cleanup(void);
@@ -36,6 +36,7 @@
 
 #include "plugin.h"
 #include "log.h"
+#include "metrics.h"
 #include "hcid.h"
 #include "btio.h"
 
@@ -78,6 +79,7 @@ static gboolean add_plugin(void *handle, struct bluetooth_plugin_desc *desc)
 	plugin->desc = desc;
 
 	__btd_enable_debug(desc->debug_start, desc->debug_stop);
+	__btd_metrics_register(desc->metrics_start, desc->metrics_stop);
 
 	plugins = g_slist_insert_sorted(plugins, plugin, compare_priority);
 
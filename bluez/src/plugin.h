@@ -32,6 +32,8 @@ struct bluetooth_plugin_desc {
 	void (*exit) (void);
 	void *debug_start;
 	void *debug_stop;
+	void *metrics_start;
+	void *metrics_stop;
 };
 
 #ifdef BLUETOOTH_PLUGIN_BUILTIN
@@ -45,10 +47,15 @@ struct bluetooth_plugin_desc {
 				__attribute__ ((weak, visibility("hidden"))); \
 		extern struct btd_debug_desc __stop___debug[] \
 				__attribute__ ((weak, visibility("hidden"))); \
+		extern char __start___metrics[] \
+				__attribute__ ((weak, visibility("hidden"))); \
+		extern char __stop___metrics[] \
+				__attribute__ ((weak, visibility("hidden"))); \
 		extern struct bluetooth_plugin_desc bluetooth_plugin_desc \
 				__attribute__ ((visibility("default"))); \
 		struct bluetooth_plugin_desc bluetooth_plugin_desc = { \
 			#name, version, priority, init, exit, \
-			__start___debug, __stop___debug \
+			__start___debug, __stop___debug, \
+			__start___metrics, __stop___metrics \
 		};
 #endif
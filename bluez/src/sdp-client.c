@@ -36,117 +36,184 @@
 #include "btio.h"
 #include "sdp-client.h"
 
-/* Number of seconds to keep a sdp_session_t in the cache */
+/* Number of seconds to keep an idle sdp_session_t open */
 #define CACHE_TIMEOUT 2
 
-struct cached_sdp_session {
-	bdaddr_t src;
-	bdaddr_t dst;
-	sdp_session_t *session;
-	guint timer;
+/*
+ * All searches towards one remote device share a single SDP session.
+ * SDP allows only one outstanding request per L2CAP channel, so the
+ * searches are queued and the next one is sent as soon as the previous
+ * response, including all of its continuations, has arrived. Profiles
+ * that look up records at the same time then share one connection
+ * instead of each paging the device.
+ */
+struct search_session {
+	bdaddr_t		src;
+	bdaddr_t		dst;
+	sdp_session_t		*session;
+	gboolean		connected;
+	gboolean		busy;		/* Request on the air */
+	struct search_context	*current;	/* NULL once cancelled */
+	GQueue			*queue;		/* Searches not sent yet */
+	guint			io_id;
+	guint			timer;		/* Idle timeout */
+	gint			ref;
 };
 
-static GSList *cached_sdp_sessions = NULL;
-
-static gboolean cached_session_expired(gpointer user_data)
-{
-	struct cached_sdp_session *cached = user_data;
+struct search_context {
+	struct search_session	*sess;
+	bt_callback_t		cb;
+	bt_destroy_t		destroy;
+	gpointer		user_data;
+	uuid_t			uuid;
+};
 
-	cached_sdp_sessions = g_slist_remove(cached_sdp_sessions, cached);
+static GSList *sessions = NULL;
 
-	sdp_close(cached->session);
+static void session_start_next(struct search_session *sess);
 
-	g_free(cached);
+static void search_context_cleanup(struct search_context *ctxt)
+{
+	if (ctxt->destroy)
+		ctxt->destroy(ctxt->user_data);
 
-	return FALSE;
+	g_free(ctxt);
 }
 
-static sdp_session_t *get_cached_sdp_session(const bdaddr_t *src, const bdaddr_t *dst)
+static void search_context_fail(struct search_context *ctxt, int err)
 {
-	GSList *l;
-
-	for (l = cached_sdp_sessions; l != NULL; l = l->next) {
-		struct cached_sdp_session *c = l->data;
-		sdp_session_t *session;
-
-		if (bacmp(&c->src, src) || bacmp(&c->dst, dst))
-			continue;
+	if (ctxt->cb)
+		ctxt->cb(NULL, err, ctxt->user_data);
 
-		g_source_remove(c->timer);
+	search_context_cleanup(ctxt);
+}
 
-		session = c->session;
+static struct search_session *find_session(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	GSList *l;
 
-		cached_sdp_sessions = g_slist_remove(cached_sdp_sessions, c);
-		g_free(c);
+	for (l = sessions; l != NULL; l = l->next) {
+		struct search_session *sess = l->data;
 
-		return session;
+		if (bacmp(&sess->src, src) == 0 && bacmp(&sess->dst, dst) == 0)
+			return sess;
 	}
 
 	return NULL;
 }
 
-static sdp_session_t *get_sdp_session(const bdaddr_t *src, const bdaddr_t *dst)
+static struct search_session *session_ref(struct search_session *sess)
 {
-	sdp_session_t *session;
+	sess->ref++;
+
+	return sess;
+}
 
-	session = get_cached_sdp_session(src, dst);
-	if (session)
-		return session;
+static void session_unref(struct search_session *sess)
+{
+	if (--sess->ref > 0)
+		return;
 
-	return sdp_connect(src, dst, SDP_NON_BLOCKING);
+	g_queue_free(sess->queue);
+	g_free(sess);
 }
 
-static void cache_sdp_session(bdaddr_t *src, bdaddr_t *dst,
-						sdp_session_t *session)
+/* Callbacks may close the session, so the memory stays around until
+ * the last reference is gone */
+static void session_close(struct search_session *sess)
 {
-	struct cached_sdp_session *cached;
+	if (sess->session == NULL)
+		return;
 
-	cached = g_new0(struct cached_sdp_session, 1);
+	sessions = g_slist_remove(sessions, sess);
 
-	bacpy(&cached->src, src);
-	bacpy(&cached->dst, dst);
+	if (sess->timer > 0) {
+		g_source_remove(sess->timer);
+		sess->timer = 0;
+	}
 
-	cached->session = session;
+	if (sess->io_id > 0) {
+		g_source_remove(sess->io_id);
+		sess->io_id = 0;
+	}
 
-	cached_sdp_sessions = g_slist_append(cached_sdp_sessions, cached);
+	sdp_close(sess->session);
+	sess->session = NULL;
 
-	cached->timer = g_timeout_add_seconds(CACHE_TIMEOUT,
-						cached_session_expired,
-						cached);
+	session_unref(sess);
 }
 
-struct search_context {
-	bdaddr_t		src;
-	bdaddr_t		dst;
-	sdp_session_t		*session;
-	bt_callback_t		cb;
-	bt_destroy_t		destroy;
-	gpointer		user_data;
-	uuid_t			uuid;
-	guint			io_id;
-};
+static gboolean session_expired(gpointer user_data)
+{
+	struct search_session *sess = user_data;
 
-static GSList *context_list = NULL;
+	sess->timer = 0;
 
-static void search_context_cleanup(struct search_context *ctxt)
+	session_close(sess);
+
+	return FALSE;
+}
+
+static struct search_session *session_new(const bdaddr_t *src,
+							const bdaddr_t *dst);
+
+/* The current search gets the error. Searches that were only queued
+ * have not been sent yet, so after a failure of an established session
+ * they are retried once on a new connection. */
+static void session_fail(struct search_session *sess, int err)
 {
-	context_list = g_slist_remove(context_list, ctxt);
+	struct search_context *current = sess->current;
+	struct search_session *retry = NULL;
+	GQueue *queue = sess->queue;
+	struct search_context *ctxt;
 
-	if (ctxt->destroy)
-		ctxt->destroy(ctxt->user_data);
+	session_ref(sess);
 
-	g_free(ctxt);
+	sess->current = NULL;
+	sess->queue = g_queue_new();
+
+	session_close(sess);
+
+	if (sess->connected && !g_queue_is_empty(queue))
+		retry = session_new(&sess->src, &sess->dst);
+
+	if (current)
+		search_context_fail(current, err);
+
+	while ((ctxt = g_queue_pop_head(queue)) != NULL) {
+		if (retry == NULL) {
+			search_context_fail(ctxt, err);
+			continue;
+		}
+
+		ctxt->sess = retry;
+		g_queue_push_tail(retry->queue, ctxt);
+	}
+
+	g_queue_free(queue);
+	session_unref(sess);
 }
 
 static void search_completed_cb(uint8_t type, uint16_t status,
 			uint8_t *rsp, size_t size, void *user_data)
 {
-	struct search_context *ctxt = user_data;
+	struct search_session *sess = user_data;
+	struct search_context *ctxt = sess->current;
 	sdp_list_t *recs = NULL;
 	int scanned, seqlen = 0, bytesleft = size;
 	uint8_t dataType;
 	int err = 0;
 
+	sess->current = NULL;
+	sess->busy = FALSE;
+
+	session_ref(sess);
+
+	/* Cancelled while the request was on the air */
+	if (ctxt == NULL)
+		goto next;
+
 	if (status || type != SDP_SVC_SEARCH_ATTR_RSP) {
 		err = -EPROTO;
 		goto done;
@@ -163,7 +230,7 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 		int recsize;
 
 		recsize = 0;
-		rec = sdp_extract_pdu(rsp, bytesleft, &recsize);
+		rec = sdp_extract_pdu_arena(rsp, bytesleft, &recsize);
 		if (!rec)
 			break;
 
@@ -180,8 +247,6 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 	} while (scanned < (ssize_t) size && bytesleft > 0);
 
 done:
-	cache_sdp_session(&ctxt->src, &ctxt->dst, ctxt->session);
-
 	if (ctxt->cb)
 		ctxt->cb(recs, err, ctxt->user_data);
 
@@ -189,49 +254,76 @@ done:
 		sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
 
 	search_context_cleanup(ctxt);
+
+next:
+	session_start_next(sess);
+	session_unref(sess);
 }
 
 static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
 							gpointer user_data)
 {
-	struct search_context *ctxt = user_data;
-	int err = 0;
+	struct search_session *sess = user_data;
 
 	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
-		err = EIO;
-		goto failed;
+		sess->io_id = 0;
+		session_fail(sess, -EIO);
+		return FALSE;
 	}
 
-	if (sdp_process(ctxt->session) < 0)
-		goto failed;
+	/* Errors are reported through search_completed_cb, a broken
+	 * channel shows up as G_IO_HUP next */
+	sdp_process(sess->session);
 
 	return TRUE;
+}
 
-failed:
-	if (err) {
-		sdp_close(ctxt->session);
-		ctxt->session = NULL;
+static void session_start_next(struct search_session *sess)
+{
+	struct search_context *ctxt;
+	sdp_list_t *search, *attrids;
+	uint32_t range = 0x0000ffff;
+	int err;
 
-		if (ctxt->cb)
-			ctxt->cb(NULL, err, ctxt->user_data);
+	if (sess->session == NULL || !sess->connected || sess->busy)
+		return;
 
-		search_context_cleanup(ctxt);
+	ctxt = g_queue_pop_head(sess->queue);
+	if (ctxt == NULL) {
+		if (sess->timer == 0)
+			sess->timer = g_timeout_add_seconds(CACHE_TIMEOUT,
+						session_expired, sess);
+		return;
 	}
 
-	return FALSE;
+	if (sess->timer > 0) {
+		g_source_remove(sess->timer);
+		sess->timer = 0;
+	}
+
+	search = sdp_list_append(NULL, &ctxt->uuid);
+	attrids = sdp_list_append(NULL, &range);
+	err = sdp_service_search_attr_async(sess->session,
+				search, SDP_ATTR_REQ_RANGE, attrids);
+	sdp_list_free(attrids, NULL);
+	sdp_list_free(search, NULL);
+
+	sess->current = ctxt;
+	sess->busy = TRUE;
+
+	if (err < 0)
+		session_fail(sess, -EIO);
 }
 
 static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 							gpointer user_data)
 {
-	struct search_context *ctxt = user_data;
-	sdp_list_t *search, *attrids;
-	uint32_t range = 0x0000ffff;
+	struct search_session *sess = user_data;
 	socklen_t len;
 	int sk, err, sk_err = 0;
 
 	sk = g_io_channel_unix_get_fd(chan);
-	ctxt->io_id = 0;
+	sess->io_id = 0;
 
 	len = sizeof(sk_err);
 	if (getsockopt(sk, SOL_SOCKET, SO_ERROR, &sk_err, &len) < 0)
@@ -242,147 +334,158 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 	if (err != 0)
 		goto failed;
 
-	if (sdp_set_notify(ctxt->session, search_completed_cb, ctxt) < 0) {
+	if (sdp_set_notify(sess->session, search_completed_cb, sess) < 0) {
 		err = -EIO;
 		goto failed;
 	}
 
-	search = sdp_list_append(NULL, &ctxt->uuid);
-	attrids = sdp_list_append(NULL, &range);
-	if (sdp_service_search_attr_async(ctxt->session,
-				search, SDP_ATTR_REQ_RANGE, attrids) < 0) {
-		sdp_list_free(attrids, NULL);
-		sdp_list_free(search, NULL);
-		err = -EIO;
-		goto failed;
-	}
-
-	sdp_list_free(attrids, NULL);
-	sdp_list_free(search, NULL);
+	sess->connected = TRUE;
 
 	/* Set callback responsible for update the internal SDP transaction */
-	ctxt->io_id = g_io_add_watch(chan,
+	sess->io_id = g_io_add_watch(chan,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				search_process_cb, ctxt);
-	return FALSE;
+				search_process_cb, sess);
 
-failed:
-	sdp_close(ctxt->session);
-	ctxt->session = NULL;
+	session_start_next(sess);
 
-	if (ctxt->cb)
-		ctxt->cb(NULL, err, ctxt->user_data);
+	return FALSE;
 
-	search_context_cleanup(ctxt);
+failed:
+	session_fail(sess, err);
 
 	return FALSE;
 }
 
-static int create_search_context(struct search_context **ctxt,
-					const bdaddr_t *src,
-					const bdaddr_t *dst,
-					uuid_t *uuid)
+static struct search_session *session_new(const bdaddr_t *src,
+							const bdaddr_t *dst)
 {
+	struct search_session *sess;
 	sdp_session_t *s;
 	GIOChannel *chan;
 
-	if (!ctxt)
-		return -EINVAL;
-
-	s = get_sdp_session(src, dst);
+	s = sdp_connect(src, dst, SDP_NON_BLOCKING);
 	if (!s)
-		return -errno;
+		return NULL;
 
-	*ctxt = g_try_malloc0(sizeof(struct search_context));
-	if (!*ctxt) {
+	sess = g_try_malloc0(sizeof(struct search_session));
+	if (!sess) {
 		sdp_close(s);
-		return -ENOMEM;
+		errno = ENOMEM;
+		return NULL;
 	}
 
-	bacpy(&(*ctxt)->src, src);
-	bacpy(&(*ctxt)->dst, dst);
-	(*ctxt)->session = s;
-	(*ctxt)->uuid = *uuid;
+	bacpy(&sess->src, src);
+	bacpy(&sess->dst, dst);
+	sess->session = s;
+	sess->queue = g_queue_new();
+	sess->ref = 1;
 
 	chan = g_io_channel_unix_new(sdp_get_socket(s));
-	(*ctxt)->io_id = g_io_add_watch(chan,
+	sess->io_id = g_io_add_watch(chan,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				connect_watch, *ctxt);
+				connect_watch, sess);
 	g_io_channel_unref(chan);
 
-	return 0;
+	sessions = g_slist_append(sessions, sess);
+
+	return sess;
 }
 
 int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 			uuid_t *uuid, bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy)
 {
-	struct search_context *ctxt = NULL;
-	int err;
+	struct search_session *sess;
+	struct search_context *ctxt;
+	gboolean created = FALSE;
 
 	if (!cb)
 		return -EINVAL;
 
-	err = create_search_context(&ctxt, src, dst, uuid);
-	if (err < 0)
-		return err;
+	sess = find_session(src, dst);
+	if (!sess) {
+		sess = session_new(src, dst);
+		if (!sess)
+			return -errno;
+		created = TRUE;
+	}
+
+	ctxt = g_try_malloc0(sizeof(struct search_context));
+	if (!ctxt) {
+		if (created)
+			session_close(sess);
+		return -ENOMEM;
+	}
 
+	ctxt->sess	= sess;
+	ctxt->uuid	= *uuid;
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
 	ctxt->user_data	= user_data;
 
-	context_list = g_slist_append(context_list, ctxt);
+	g_queue_push_tail(sess->queue, ctxt);
+
+	session_start_next(sess);
 
 	return 0;
 }
 
-static gint find_by_bdaddr(gconstpointer data, gconstpointer user_data)
+static gint match_user_data(gconstpointer a, gconstpointer b)
 {
-	const struct search_context *ctxt = data, *search = user_data;
-	int ret;
-
-	ret = bacmp(&ctxt->src, &search->src);
-	if (ret != 0)
-		return ret;
+	const struct search_context *ctxt = a;
 
-	return bacmp(&ctxt->dst, &search->dst);
+	return ctxt->user_data == b ? 0 : -1;
 }
 
-int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
+int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst,
+							void *user_data)
 {
-	struct search_context match, *ctxt;
-	GSList *l;
-
-	memset(&match, 0, sizeof(match));
-	bacpy(&match.src, src);
-	bacpy(&match.dst, dst);
+	struct search_session *sess;
+	struct search_context *ctxt;
+	GList *l;
 
-	/* Ongoing SDP Discovery */
-	l = g_slist_find_custom(context_list, &match, find_by_bdaddr);
-	if (l == NULL)
+	sess = find_session(src, dst);
+	if (sess == NULL)
 		return -ENOENT;
 
-	ctxt = l->data;
+	ctxt = sess->current;
+	if (ctxt != NULL && ctxt->user_data == user_data) {
+		sess->current = NULL;
 
-	if (!ctxt->session)
-		return -ENOTCONN;
+		/* Nothing else needs the session, drop it together with
+		 * the discovery. Otherwise let the request on the air
+		 * finish and ignore its response. */
+		if (g_queue_is_empty(sess->queue))
+			session_close(sess);
 
-	if (ctxt->io_id)
-		g_source_remove(ctxt->io_id);
+		search_context_cleanup(ctxt);
+
+		return 0;
+	}
 
-	if (ctxt->session)
-		sdp_close(ctxt->session);
+	l = g_queue_find_custom(sess->queue, user_data, match_user_data);
+	if (l == NULL)
+		return -ENOENT;
 
+	ctxt = l->data;
+	g_queue_delete_link(sess->queue, l);
 	search_context_cleanup(ctxt);
 
+	/* Still connecting and nobody else is waiting */
+	if (!sess->busy && g_queue_is_empty(sess->queue))
+		session_close(sess);
+
 	return 0;
 }
 
 void bt_clear_cached_session(const bdaddr_t *src, const bdaddr_t *dst)
 {
-	sdp_session_t *session;
+	struct search_session *sess;
+
+	sess = find_session(src, dst);
+	if (sess == NULL)
+		return;
 
-	session = get_cached_sdp_session(src, dst);
-	if (session)
-		sdp_close(session);
+	if (!sess->busy && g_queue_is_empty(sess->queue))
+		session_close(sess);
 }
@@ -44,6 +44,10 @@
 
 #include "sdpd.h"
 #include "log.h"
+#include "metrics.h"
+
+BTD_METRIC_COUNTER(sdp_requests, "sdp_requests");
+BTD_METRIC_HISTOGRAM(sdp_request_us, "sdp_request_us");
 
 typedef struct {
 	uint32_t timestamp;
@@ -1048,6 +1052,7 @@ void handle_request(int sk, uint8_t *data, int len)
 	struct sockaddr_l2 sa;
 	socklen_t size;
 	sdp_req_t req;
+	uint64_t start;
 
 	size = sizeof(sa);
 	if (getpeername(sk, (struct sockaddr *) &sa, &size) < 0) {
@@ -1089,5 +1094,10 @@ void handle_request(int sk, uint8_t *data, int len)
 	req.buf  = data;
 	req.len  = len;
 
+	btd_metric_inc(&sdp_requests);
+	start = btd_metric_now();
+
 	process_request(&req);
+
+	btd_metric_observe_since(&sdp_request_us, start);
 }
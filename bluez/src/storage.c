@@ -37,6 +37,7 @@
 #include <sys/stat.h>
 
 #include <glib.h>
+#include <dbus/dbus.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -45,6 +46,8 @@
 
 #include "textfile.h"
 #include "glib-helper.h"
+#include "adapter.h"
+#include "keystore.h"
 #include "storage.h"
 
 struct match {
@@ -574,61 +577,36 @@ int write_lastused_info(bdaddr_t *local, bdaddr_t *peer, struct tm *tm)
 
 int write_link_key(bdaddr_t *local, bdaddr_t *peer, unsigned char *key, uint8_t type, int length)
 {
-	char filename[PATH_MAX + 1], addr[18], str[38];
-	int i;
-
-	memset(str, 0, sizeof(str));
-	for (i = 0; i < 16; i++)
-		sprintf(str + (i * 2), "%2.2X", key[i]);
-	sprintf(str + 32, " %d %d", type, length);
+	struct link_key_info info, *old;
 
-	create_filename(filename, PATH_MAX, local, "linkkeys");
-
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	ba2str(peer, addr);
+	memset(&info, 0, sizeof(info));
+	bacpy(&info.bdaddr, peer);
+	memcpy(info.key, key, sizeof(info.key));
+	info.type = type;
 
+	/* A negative length keeps the PIN length of the stored key */
 	if (length < 0) {
-		char *tmp = textfile_get(filename, addr);
-		if (tmp) {
-			if (strlen(tmp) > 34)
-				memcpy(str + 34, tmp + 34, 3);
-			free(tmp);
-		}
-	}
+		old = keystore_find_link_key(local, peer);
+		info.pin_len = old ? old->pin_len : 0;
+	} else
+		info.pin_len = length;
 
-	return textfile_put(filename, addr, str);
+	return keystore_add_link_key(local, &info);
 }
 
 int read_link_key(bdaddr_t *local, bdaddr_t *peer, unsigned char *key, uint8_t *type)
 {
-	char filename[PATH_MAX + 1], addr[18], tmp[3], *str;
-	int i;
-
-	create_filename(filename, PATH_MAX, local, "linkkeys");
+	struct link_key_info *info;
 
-	ba2str(peer, addr);
-	str = textfile_get(filename, addr);
-	if (!str)
+	info = keystore_find_link_key(local, peer);
+	if (!info)
 		return -ENOENT;
 
-	if (!key) {
-		free(str);
-		return 0;
-	}
+	if (key)
+		memcpy(key, info->key, sizeof(info->key));
 
-	memset(tmp, 0, sizeof(tmp));
-	for (i = 0; i < 16; i++) {
-		memcpy(tmp, str + (i * 2), 2);
-		key[i] = (uint8_t) strtol(tmp, NULL, 16);
-	}
-
-	if (type) {
-		memcpy(tmp, str + 33, 2);
-		*type = (uint8_t) strtol(tmp, NULL, 10);
-	}
-
-	free(str);
+	if (type)
+		*type = info->type;
 
 	return 0;
 }
@@ -842,7 +820,7 @@ sdp_record_t *record_from_string(const gchar *str)
 		pdata[i] = (uint8_t) strtol(tmp, NULL, 16);
 	}
 
-	rec = sdp_extract_pdu(pdata, size, &len);
+	rec = sdp_extract_pdu_arena(pdata, size, &len);
 	g_free(pdata);
 
 	return rec;
@@ -1359,38 +1337,7 @@ void delete_device_ccc(bdaddr_t *local, bdaddr_t *peer)
 	delete_by_pattern(filename, addr);
 }
 
-int write_longtermkeys(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
-								const char *key)
-{
-	char filename[PATH_MAX + 1], addr[20];
-
-	if (!key)
-		return -EINVAL;
-
-	create_filename(filename, PATH_MAX, local, "longtermkeys");
-
-	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
-	ba2str(peer, addr);
-	sprintf(&addr[17], "#%hhu", bdaddr_type);
-
-	return textfile_put(filename, addr, key);
-}
-
 gboolean has_longtermkeys(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type)
 {
-	char filename[PATH_MAX + 1], key[20], *str;
-
-	create_filename(filename, PATH_MAX, local, "longtermkeys");
-
-	ba2str(peer, key);
-	sprintf(&key[17], "#%hhu", bdaddr_type);
-
-	str = textfile_caseget(filename, key);
-	if (str) {
-		free(str);
-		return TRUE;
-	}
-
-	return FALSE;
+	return keystore_find_ltk(local, peer, bdaddr_type) != NULL;
 }
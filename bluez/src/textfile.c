@@ -39,6 +39,10 @@
 #include <sys/param.h>
 
 #include "textfile.h"
+#include "metrics.h"
+
+BTD_METRIC_HISTOGRAM(storage_write_us, "storage_write_us");
+BTD_METRIC_HISTOGRAM(storage_read_us, "storage_read_us");
 
 int create_dirs(const char *filename, const mode_t mode)
 {
@@ -178,7 +182,8 @@ static char *strnpbrk(const char *s, ssize_t len, const char *accept)
 	return NULL;
 }
 
-static int write_key(const char *pathname, const char *key, const char *value, int icase)
+static int write_key_file(const char *pathname, const char *key,
+					const char *value, int icase)
 {
 	struct stat st;
 	char *map, *off, *end, *str;
@@ -302,7 +307,20 @@ close:
 	return err;
 }
 
-static char *read_key(const char *pathname, const char *key, int icase)
+static int write_key(const char *pathname, const char *key, const char *value,
+								int icase)
+{
+	uint64_t start = btd_metric_now();
+	int err;
+
+	err = write_key_file(pathname, key, value, icase);
+
+	btd_metric_observe_since(&storage_write_us, start);
+
+	return err;
+}
+
+static char *read_key_file(const char *pathname, const char *key, int icase)
 {
 	struct stat st;
 	char *map, *off, *end, *str = NULL;
@@ -366,6 +384,23 @@ close:
 	return str;
 }
 
+static char *read_key(const char *pathname, const char *key, int icase)
+{
+	uint64_t start = btd_metric_now();
+	char *str;
+	int err;
+
+	str = read_key_file(pathname, key, icase);
+	err = errno;
+
+	btd_metric_observe_since(&storage_read_us, start);
+
+	/* Callers look at errno when there is no value */
+	errno = err;
+
+	return str;
+}
+
 int textfile_put(const char *pathname, const char *key, const char *value)
 {
 	return write_key(pathname, key, value, 0);
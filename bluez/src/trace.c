@@ -0,0 +1,480 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "trace.h"
+
+/* 4096 slots of 256 bytes, about the last few seconds of a busy
+ * audio session */
+#define TRACE_RING_SIZE		4096
+#define TRACE_RING_MASK		(TRACE_RING_SIZE - 1)
+#define TRACE_SLOT_SIZE		256
+
+struct trace_slot {
+	uint64_t seq;		/* record number + 1, 0 while written */
+	uint64_t timestamp;
+	const char *file;
+	const char *func;
+	const char *format;
+	uint16_t args_len;
+	uint8_t flags;
+	uint8_t args[0];
+};
+
+#define TRACE_ARGS_SIZE		(TRACE_SLOT_SIZE - sizeof(struct trace_slot))
+
+enum {
+	LEN_HH,
+	LEN_H,
+	LEN_NONE,
+	LEN_L,
+	LEN_LL,
+	LEN_J,
+	LEN_Z,
+	LEN_T,
+	LEN_BIG_L,
+};
+
+static uint8_t *ring = NULL;
+static uint64_t ring_head = 0;
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE,
+								SIGABRT };
+
+static inline struct trace_slot *get_slot(uint64_t seq)
+{
+	return (struct trace_slot *) (ring +
+				(seq & TRACE_RING_MASK) * TRACE_SLOT_SIZE);
+}
+
+static inline int put(struct trace_slot *slot, const void *val, size_t len)
+{
+	if (slot->args_len + len > TRACE_ARGS_SIZE)
+		return -ENOSPC;
+
+	memcpy(slot->args + slot->args_len, val, len);
+	slot->args_len += len;
+
+	return 0;
+}
+
+static inline int put_u64(struct trace_slot *slot, uint64_t val)
+{
+	return put(slot, &val, sizeof(val));
+}
+
+static int put_str(struct trace_slot *slot, const char *str)
+{
+	size_t len, room;
+
+	if (str == NULL)
+		str = "(null)";
+
+	len = strlen(str) + 1;
+	room = TRACE_ARGS_SIZE - slot->args_len;
+
+	if (len <= room)
+		return put(slot, str, len);
+
+	if (room > 0) {
+		memcpy(slot->args + slot->args_len, str, room - 1);
+		slot->args[slot->args_len + room - 1] = '\0';
+		slot->args_len += room;
+	}
+
+	return -ENOSPC;
+}
+
+static int64_t get_signed(int len, va_list *ap)
+{
+	switch (len) {
+	case LEN_HH:
+		return (signed char) va_arg(*ap, int);
+	case LEN_H:
+		return (short) va_arg(*ap, int);
+	case LEN_L:
+		return va_arg(*ap, long);
+	case LEN_LL:
+		return va_arg(*ap, long long);
+	case LEN_J:
+		return va_arg(*ap, intmax_t);
+	case LEN_Z:
+		return va_arg(*ap, ssize_t);
+	case LEN_T:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, int);
+	}
+}
+
+static uint64_t get_unsigned(int len, va_list *ap)
+{
+	switch (len) {
+	case LEN_HH:
+		return (unsigned char) va_arg(*ap, unsigned int);
+	case LEN_H:
+		return (unsigned short) va_arg(*ap, unsigned int);
+	case LEN_L:
+		return va_arg(*ap, unsigned long);
+	case LEN_LL:
+		return va_arg(*ap, unsigned long long);
+	case LEN_J:
+		return va_arg(*ap, uintmax_t);
+	case LEN_Z:
+		return va_arg(*ap, size_t);
+	case LEN_T:
+		return va_arg(*ap, ptrdiff_t);
+	default:
+		return va_arg(*ap, unsigned int);
+	}
+}
+
+/* Walks the format string the same way tools/bttrace.c does when
+ * formatting and stores each argument in the slot. Returns a negative
+ * error when the slot is full or the conversion is not supported, the
+ * arguments stored so far are still valid. */
+static int encode_args(struct trace_slot *slot, const char *format,
+						int err, va_list *ap)
+{
+	const char *p;
+	double d;
+
+	for (p = format; *p != '\0'; p++) {
+		int len = LEN_NONE;
+
+		if (*p != '%')
+			continue;
+
+		p++;
+		if (*p == '%')
+			continue;
+
+		while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+			p++;
+
+		if (*p == '*') {
+			if (put_u64(slot, va_arg(*ap, int)) < 0)
+				return -ENOSPC;
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				if (put_u64(slot, va_arg(*ap, int)) < 0)
+					return -ENOSPC;
+				p++;
+			} else {
+				while (*p >= '0' && *p <= '9')
+					p++;
+			}
+		}
+
+		switch (*p) {
+		case 'h':
+			len = LEN_H;
+			if (*(p + 1) == 'h') {
+				len = LEN_HH;
+				p++;
+			}
+			p++;
+			break;
+		case 'l':
+			len = LEN_L;
+			if (*(p + 1) == 'l') {
+				len = LEN_LL;
+				p++;
+			}
+			p++;
+			break;
+		case 'q':
+			len = LEN_LL;
+			p++;
+			break;
+		case 'j':
+			len = LEN_J;
+			p++;
+			break;
+		case 'z':
+			len = LEN_Z;
+			p++;
+			break;
+		case 't':
+			len = LEN_T;
+			p++;
+			break;
+		case 'L':
+			len = LEN_BIG_L;
+			p++;
+			break;
+		}
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+			if (put_u64(slot, get_signed(len, ap)) < 0)
+				return -ENOSPC;
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			if (put_u64(slot, get_unsigned(len, ap)) < 0)
+				return -ENOSPC;
+			break;
+		case 'c':
+			if (put_u64(slot, va_arg(*ap, int)) < 0)
+				return -ENOSPC;
+			break;
+		case 'p':
+			if (put_u64(slot, (uintptr_t) va_arg(*ap, void *)) < 0)
+				return -ENOSPC;
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (len == LEN_BIG_L)
+				d = va_arg(*ap, long double);
+			else
+				d = va_arg(*ap, double);
+			if (put(slot, &d, sizeof(d)) < 0)
+				return -ENOSPC;
+			break;
+		case 's':
+			if (put_str(slot, va_arg(*ap, const char *)) < 0)
+				return -ENOSPC;
+			break;
+		case 'm':
+			if (put_u64(slot, err) < 0)
+				return -ENOSPC;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+void btd_trace(const char *file, const char *func, const char *format, ...)
+{
+	struct trace_slot *slot;
+	struct timespec ts;
+	uint64_t seq;
+	va_list ap;
+	int err = errno;
+
+	if (ring == NULL)
+		return;
+
+	seq = __sync_fetch_and_add(&ring_head, 1);
+	slot = get_slot(seq);
+
+	slot->seq = 0;
+	__sync_synchronize();
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	slot->timestamp = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	slot->file = file;
+	slot->func = func;
+	slot->format = format;
+	slot->args_len = 0;
+	slot->flags = 0;
+
+	va_start(ap, format);
+
+	if (encode_args(slot, format, err, &ap) < 0)
+		slot->flags |= BTD_TRACE_TRUNCATED;
+
+	va_end(ap);
+
+	__sync_synchronize();
+	slot->seq = seq + 1;
+
+	errno = err;
+}
+
+static uint64_t get_nsec(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int dump_slot(int fd, uint64_t seq)
+{
+	uint8_t buf[TRACE_SLOT_SIZE];
+	struct trace_slot *copy = (struct trace_slot *) buf;
+	struct btd_trace_rec_hdr hdr;
+	struct iovec iov[5];
+
+	memcpy(buf, get_slot(seq), TRACE_SLOT_SIZE);
+	__sync_synchronize();
+
+	/* Skip records that were being written or got overwritten while
+	 * copying */
+	if (copy->seq != seq + 1 || get_slot(seq)->seq != seq + 1)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.seq = seq;
+	hdr.timestamp = copy->timestamp;
+	hdr.file_len = strlen(copy->file);
+	hdr.func_len = strlen(copy->func);
+	hdr.fmt_len = strlen(copy->format);
+	hdr.args_len = copy->args_len;
+	hdr.flags = copy->flags;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) copy->file;
+	iov[1].iov_len = hdr.file_len;
+	iov[2].iov_base = (void *) copy->func;
+	iov[2].iov_len = hdr.func_len;
+	iov[3].iov_base = (void *) copy->format;
+	iov[3].iov_len = hdr.fmt_len;
+	iov[4].iov_base = copy->args;
+	iov[4].iov_len = hdr.args_len;
+
+	if (writev(fd, iov, 5) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Only uses async-signal-safe calls since it also runs from the crash
+ * handler */
+int __btd_trace_dump(const char *path)
+{
+	struct btd_trace_file_hdr hdr;
+	uint64_t head, seq, start;
+	int fd, err = 0;
+
+	if (ring == NULL)
+		return -ENODATA;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+
+	head = __sync_fetch_and_add(&ring_head, 0);
+	start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BTD_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = BTD_TRACE_VERSION;
+	hdr.monotonic = get_nsec(CLOCK_MONOTONIC);
+	hdr.realtime = get_nsec(CLOCK_REALTIME);
+	hdr.dropped = start;
+
+	if (write(fd, &hdr, sizeof(hdr)) < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	for (seq = start; seq < head; seq++) {
+		err = dump_slot(fd, seq);
+		if (err < 0)
+			break;
+	}
+
+done:
+	close(fd);
+
+	return err;
+}
+
+static void crash_handler(int sig)
+{
+	__btd_trace_dump(BTD_TRACE_PATH);
+
+	/* SA_RESETHAND restored the default action */
+	raise(sig);
+}
+
+int __btd_trace_init(void)
+{
+	struct sigaction sa;
+	unsigned int i;
+
+	if (ring != NULL)
+		return 0;
+
+	ring = g_try_malloc0(TRACE_RING_SIZE * TRACE_SLOT_SIZE);
+	if (ring == NULL)
+		return -ENOMEM;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = crash_handler;
+	sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+
+	for (i = 0; i < G_N_ELEMENTS(crash_signals); i++)
+		sigaction(crash_signals[i], &sa, NULL);
+
+	return 0;
+}
+
+void __btd_trace_cleanup(void)
+{
+	uint8_t *p;
+	unsigned int i;
+
+	if (ring == NULL)
+		return;
+
+	for (i = 0; i < G_N_ELEMENTS(crash_signals); i++)
+		signal(crash_signals[i], SIG_DFL);
+
+	p = ring;
+	ring = NULL;
+	g_free(p);
+}
@@ -0,0 +1,69 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+
+#define BTD_TRACE_PATH		"/var/run/bluetoothd.trace"
+
+#define BTD_TRACE_MAGIC		"BTDTRACE"
+#define BTD_TRACE_VERSION	1
+
+/* Record flags */
+#define BTD_TRACE_TRUNCATED	(1 << 0)
+
+/*
+ * Dump file layout: one btd_trace_file_hdr followed by records until
+ * the end of the file. Each record is a btd_trace_rec_hdr followed by
+ * the file name, function name and format string (not terminated) and
+ * then the encoded arguments.
+ *
+ * Arguments are stored in format string order. Integer conversions,
+ * '*' widths and %m (errno) are stored as 64 bit values, already
+ * converted to the type named by the length modifier. Pointers are 64
+ * bit values, floating point conversions are stored as double and
+ * strings are copied including their terminating NUL. All values are
+ * in host byte order.
+ */
+struct btd_trace_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t monotonic;	/* CLOCK_MONOTONIC at dump time, in ns */
+	uint64_t realtime;	/* CLOCK_REALTIME at dump time, in ns */
+	uint64_t dropped;	/* records overwritten before the dump */
+} __attribute__ ((packed));
+
+struct btd_trace_rec_hdr {
+	uint64_t seq;
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, in ns */
+	uint16_t file_len;
+	uint16_t func_len;
+	uint16_t fmt_len;
+	uint16_t args_len;
+	uint8_t flags;
+	uint8_t reserved[7];
+} __attribute__ ((packed));
+
+int __btd_trace_init(void);
+void __btd_trace_cleanup(void);
+int __btd_trace_dump(const char *path);
@@ -0,0 +1,355 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <execinfo.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "watchdog.h"
+
+/*
+ * bluetoothd is linked with -Wl,--wrap for the GLib functions below, so
+ * every watch, timeout and idle source added by the daemon and its
+ * builtin plugins goes through here. While the watchdog is enabled the
+ * callback is replaced by a trampoline that times it, otherwise the
+ * call is passed straight to GLib.
+ */
+
+guint __real_g_io_add_watch_full(GIOChannel *channel, gint priority,
+				GIOCondition condition, GIOFunc func,
+				gpointer user_data, GDestroyNotify notify);
+guint __real_g_timeout_add_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify);
+guint __real_g_timeout_add_seconds_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify);
+guint __real_g_idle_add_full(gint priority, GSourceFunc function,
+				gpointer data, GDestroyNotify notify);
+
+guint __wrap_g_io_add_watch(GIOChannel *channel, GIOCondition condition,
+					GIOFunc func, gpointer user_data);
+guint __wrap_g_io_add_watch_full(GIOChannel *channel, gint priority,
+				GIOCondition condition, GIOFunc func,
+				gpointer user_data, GDestroyNotify notify);
+guint __wrap_g_timeout_add(guint interval, GSourceFunc function,
+							gpointer data);
+guint __wrap_g_timeout_add_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify);
+guint __wrap_g_timeout_add_seconds(guint interval, GSourceFunc function,
+							gpointer data);
+guint __wrap_g_timeout_add_seconds_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify);
+guint __wrap_g_idle_add(GSourceFunc function, gpointer data);
+guint __wrap_g_idle_add_full(gint priority, GSourceFunc function,
+				gpointer data, GDestroyNotify notify);
+
+enum {
+	WATCH_IO,
+	WATCH_TIMEOUT,
+	WATCH_IDLE,
+};
+
+static const char *watch_type[] = { "io watch", "timeout", "idle" };
+
+struct watch {
+	int type;
+	union {
+		GIOFunc io;
+		GSourceFunc source;
+	} func;
+	gpointer data;
+	GDestroyNotify destroy;
+	void *caller;
+	guint interval;		/* timeouts only, in ms */
+	uint64_t expire;	/* timeouts only, in us */
+};
+
+BTD_METRIC_HISTOGRAM(io_time, "mainloop_io_us");
+BTD_METRIC_HISTOGRAM(timeout_time, "mainloop_timeout_us");
+BTD_METRIC_HISTOGRAM(idle_time, "mainloop_idle_us");
+BTD_METRIC_HISTOGRAM(timeout_delay, "mainloop_timeout_delay_us");
+BTD_METRIC_COUNTER(stalls, "mainloop_stalls");
+
+static struct btd_metric_desc *watch_time[] = {
+	&io_time, &timeout_time, &idle_time
+};
+
+/* Stall threshold in us, 0 while disabled */
+static uint64_t stall_threshold = 0;
+
+static void report_stall(struct watch *watch, uint64_t elapsed,
+						const char *detail)
+{
+	void *addr[2];
+	char **sym;
+
+	btd_metric_inc(&stalls);
+
+	addr[0] = watch->type == WATCH_IO ? (void *) watch->func.io :
+						(void *) watch->func.source;
+	addr[1] = watch->caller;
+
+	sym = backtrace_symbols(addr, 2);
+
+	warn("Main loop blocked for %llu ms by %s%s",
+			(unsigned long long) elapsed / 1000,
+			watch_type[watch->type], detail);
+	warn("  callback %s", sym ? sym[0] : "?");
+	warn("  added from %s", sym ? sym[1] : "?");
+
+	free(sym);
+}
+
+static gboolean io_dispatch(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct watch *watch = user_data;
+	uint64_t start, elapsed;
+	gboolean ret;
+
+	start = btd_metric_now();
+
+	ret = watch->func.io(channel, cond, watch->data);
+
+	elapsed = btd_metric_now() - start;
+	btd_metric_observe(&io_time, elapsed);
+
+	if (stall_threshold > 0 && elapsed >= stall_threshold) {
+		char detail[48];
+
+		snprintf(detail, sizeof(detail), " (fd %d condition 0x%x)",
+				g_io_channel_unix_get_fd(channel), cond);
+		report_stall(watch, elapsed, detail);
+	}
+
+	return ret;
+}
+
+static gboolean source_dispatch(gpointer user_data)
+{
+	struct watch *watch = user_data;
+	uint64_t start, elapsed;
+	gboolean ret;
+
+	start = btd_metric_now();
+
+	/* How late the timeout fired is the latency every other event
+	 * sees as well */
+	if (watch->expire > 0) {
+		btd_metric_observe(&timeout_delay, start > watch->expire ?
+						start - watch->expire : 0);
+		watch->expire = start + (uint64_t) watch->interval * 1000;
+	}
+
+	ret = watch->func.source(watch->data);
+
+	elapsed = btd_metric_now() - start;
+	btd_metric_observe(watch_time[watch->type], elapsed);
+
+	if (stall_threshold > 0 && elapsed >= stall_threshold) {
+		char detail[32] = "";
+
+		if (watch->type == WATCH_TIMEOUT)
+			snprintf(detail, sizeof(detail), " (interval %u ms)",
+							watch->interval);
+		report_stall(watch, elapsed, detail);
+	}
+
+	return ret;
+}
+
+static void watch_destroy(gpointer user_data)
+{
+	struct watch *watch = user_data;
+
+	if (watch->destroy)
+		watch->destroy(watch->data);
+
+	g_free(watch);
+}
+
+static struct watch *watch_new(int type, gpointer data,
+					GDestroyNotify destroy, void *caller)
+{
+	struct watch *watch;
+
+	watch = g_new0(struct watch, 1);
+	watch->type = type;
+	watch->data = data;
+	watch->destroy = destroy;
+	watch->caller = caller;
+
+	return watch;
+}
+
+static guint add_io(GIOChannel *channel, gint priority,
+				GIOCondition condition, GIOFunc func,
+				gpointer user_data, GDestroyNotify notify,
+				void *caller)
+{
+	struct watch *watch;
+
+	if (stall_threshold == 0 || func == NULL)
+		return __real_g_io_add_watch_full(channel, priority, condition,
+						func, user_data, notify);
+
+	watch = watch_new(WATCH_IO, user_data, notify, caller);
+	watch->func.io = func;
+
+	return __real_g_io_add_watch_full(channel, priority, condition,
+					io_dispatch, watch, watch_destroy);
+}
+
+guint __wrap_g_io_add_watch(GIOChannel *channel, GIOCondition condition,
+					GIOFunc func, gpointer user_data)
+{
+	return add_io(channel, G_PRIORITY_DEFAULT, condition, func,
+			user_data, NULL, __builtin_return_address(0));
+}
+
+guint __wrap_g_io_add_watch_full(GIOChannel *channel, gint priority,
+				GIOCondition condition, GIOFunc func,
+				gpointer user_data, GDestroyNotify notify)
+{
+	return add_io(channel, priority, condition, func, user_data, notify,
+						__builtin_return_address(0));
+}
+
+static guint add_timeout(gint priority, guint interval, gboolean seconds,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify, void *caller)
+{
+	struct watch *watch;
+
+	if (stall_threshold == 0 || function == NULL) {
+		if (seconds)
+			return __real_g_timeout_add_seconds_full(priority,
+					interval, function, data, notify);
+
+		return __real_g_timeout_add_full(priority, interval,
+						function, data, notify);
+	}
+
+	watch = watch_new(WATCH_TIMEOUT, data, notify, caller);
+	watch->func.source = function;
+
+	if (seconds) {
+		watch->interval = interval * 1000;
+		return __real_g_timeout_add_seconds_full(priority, interval,
+					source_dispatch, watch, watch_destroy);
+	}
+
+	/* Seconds timeouts are coalesced on purpose, so their delay is
+	 * only tracked for millisecond timeouts */
+	watch->interval = interval;
+	watch->expire = btd_metric_now() + (uint64_t) interval * 1000;
+
+	return __real_g_timeout_add_full(priority, interval, source_dispatch,
+						watch, watch_destroy);
+}
+
+guint __wrap_g_timeout_add(guint interval, GSourceFunc function,
+							gpointer data)
+{
+	return add_timeout(G_PRIORITY_DEFAULT, interval, FALSE, function,
+				data, NULL, __builtin_return_address(0));
+}
+
+guint __wrap_g_timeout_add_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify)
+{
+	return add_timeout(priority, interval, FALSE, function, data, notify,
+						__builtin_return_address(0));
+}
+
+guint __wrap_g_timeout_add_seconds(guint interval, GSourceFunc function,
+							gpointer data)
+{
+	return add_timeout(G_PRIORITY_DEFAULT, interval, TRUE, function,
+				data, NULL, __builtin_return_address(0));
+}
+
+guint __wrap_g_timeout_add_seconds_full(gint priority, guint interval,
+				GSourceFunc function, gpointer data,
+				GDestroyNotify notify)
+{
+	return add_timeout(priority, interval, TRUE, function, data, notify,
+						__builtin_return_address(0));
+}
+
+static guint add_idle(gint priority, GSourceFunc function, gpointer data,
+					GDestroyNotify notify, void *caller)
+{
+	struct watch *watch;
+
+	if (stall_threshold == 0 || function == NULL)
+		return __real_g_idle_add_full(priority, function, data, notify);
+
+	watch = watch_new(WATCH_IDLE, data, notify, caller);
+	watch->func.source = function;
+
+	return __real_g_idle_add_full(priority, source_dispatch, watch,
+							watch_destroy);
+}
+
+guint __wrap_g_idle_add(GSourceFunc function, gpointer data)
+{
+	return add_idle(G_PRIORITY_DEFAULT_IDLE, function, data, NULL,
+						__builtin_return_address(0));
+}
+
+guint __wrap_g_idle_add_full(gint priority, GSourceFunc function,
+				gpointer data, GDestroyNotify notify)
+{
+	return add_idle(priority, function, data, notify,
+						__builtin_return_address(0));
+}
+
+void __btd_watchdog_init(unsigned int threshold)
+{
+	if (threshold == 0)
+		return;
+
+	DBG("stall threshold %u ms", threshold);
+
+	stall_threshold = (uint64_t) threshold * 1000;
+}
+
+/* Sources that are already wrapped keep their trampoline, only the
+ * reporting stops */
+void __btd_watchdog_cleanup(void)
+{
+	stall_threshold = 0;
+}
@@ -0,0 +1,1615 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <bluetooth/l2cap.h>
+#include <bluetooth/rfcomm.h>
+#include <bluetooth/sco.h>
+
+/*
+ * Every frame starts with a small header so that the receiving side
+ * can tell frame types apart, detect loss, reordering and duplicates
+ * and, on stream sockets, find the frame boundaries. The payload is
+ * derived from the sequence number so corruption can be detected
+ * without any shared state.
+ */
+
+#define BENCH_DATA	0x01
+#define BENCH_PING	0x02
+#define BENCH_PONG	0x03
+#define BENCH_END	0x04
+#define BENCH_REPORT	0x05
+
+struct bench_hdr {
+	uint8_t  type;
+	uint8_t  flags;
+	uint16_t len;			/* Frame length including header */
+	uint32_t seq;
+} __attribute__ ((packed));
+
+struct bench_report {
+	struct bench_hdr hdr;
+	uint32_t received;
+	uint32_t lost;
+	uint32_t reordered;
+	uint32_t duplicated;
+	uint32_t corrupted;
+	uint64_t bytes;
+	uint64_t duration;		/* First to last frame in usec */
+} __attribute__ ((packed));
+
+#define MAX_FRAME_SIZE 65535
+
+enum {
+	PROTO_L2CAP,
+	PROTO_RFCOMM,
+	PROTO_SCO,
+};
+
+enum {
+	TEST_PING,
+	TEST_THROUGHPUT,
+	TEST_STRESS,
+};
+
+struct lookup_table {
+	const char *name;
+	int flag;
+};
+
+static struct lookup_table protocols[] = {
+	{ "l2cap",	PROTO_L2CAP	},
+	{ "rfcomm",	PROTO_RFCOMM	},
+	{ "sco",	PROTO_SCO	},
+	{ }
+};
+
+static struct lookup_table l2cap_modes[] = {
+	{ "basic",	L2CAP_MODE_BASIC	},
+	{ "ertm",	L2CAP_MODE_ERTM		},
+	{ "streaming",	L2CAP_MODE_STREAMING	},
+	{ }
+};
+
+static struct lookup_table tests[] = {
+	{ "ping",	TEST_PING		},
+	{ "throughput",	TEST_THROUGHPUT		},
+	{ "stress",	TEST_STRESS		},
+	{ }
+};
+
+static bdaddr_t bdaddr;
+static int proto = PROTO_L2CAP;
+static int l2cap_mode = L2CAP_MODE_BASIC;
+static int test = TEST_PING;
+static unsigned short psm = 0x1011;
+static uint8_t channel = 10;
+static int frame_size = -1;
+static int imtu = 672;
+static unsigned int num_frames = 1000;
+static unsigned int num_warmup = 0;
+static unsigned int interval = 0;	/* Between pings in msec */
+static unsigned int timeout = 1000;	/* Ping and report in msec */
+static unsigned int num_channels = 8;
+
+static uint8_t *buf;
+
+static int get_lookup_flag(struct lookup_table *table, const char *name)
+{
+	int i;
+
+	for (i = 0; table[i].name; i++)
+		if (!strcasecmp(table[i].name, name))
+			return table[i].flag;
+
+	return -1;
+}
+
+static const char *get_lookup_name(struct lookup_table *table, int flag)
+{
+	int i;
+
+	for (i = 0; table[i].name; i++)
+		if (table[i].flag == flag)
+			return table[i].name;
+
+	return "unknown";
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int stream_socket(void)
+{
+	return proto == PROTO_RFCOMM;
+}
+
+static void fill_frame(uint8_t *frame, uint8_t type, uint32_t seq,
+								uint16_t len)
+{
+	struct bench_hdr *hdr = (void *) frame;
+	uint16_t i;
+
+	hdr->type = type;
+	hdr->flags = 0;
+	hdr->len = htobs(len);
+	hdr->seq = htobl(seq);
+
+	for (i = sizeof(*hdr); i < len; i++)
+		frame[i] = seq + i;
+}
+
+static int check_frame(const uint8_t *frame, uint16_t len)
+{
+	const struct bench_hdr *hdr = (const void *) frame;
+	uint32_t seq = btohl(hdr->seq);
+	uint16_t i;
+
+	if (btohs(hdr->len) != len)
+		return -EBADMSG;
+
+	for (i = sizeof(*hdr); i < len; i++) {
+		if (frame[i] != (uint8_t) (seq + i))
+			return -EBADMSG;
+	}
+
+	return 0;
+}
+
+static int write_frame(int sk, const uint8_t *frame, uint16_t len)
+{
+	uint16_t offset = 0;
+
+	while (offset < len) {
+		ssize_t written = send(sk, frame + offset, len - offset, 0);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		/* Packet based sockets take the frame in one go */
+		if (!stream_socket())
+			break;
+
+		offset += written;
+	}
+
+	return 0;
+}
+
+static int read_full(int sk, uint8_t *data, size_t len)
+{
+	size_t offset = 0;
+
+	while (offset < len) {
+		ssize_t n = recv(sk, data + offset, len - offset, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return n < 0 ? -errno : -ECONNRESET;
+
+		offset += n;
+	}
+
+	return 0;
+}
+
+/* Returns the frame length, 0 on timeout or a negative error */
+static int read_frame(int sk, uint8_t *frame, int msec)
+{
+	struct bench_hdr *hdr = (void *) frame;
+	struct pollfd p;
+	ssize_t len;
+	int err;
+
+	p.fd = sk;
+	p.events = POLLIN;
+	p.revents = 0;
+
+	err = poll(&p, 1, msec);
+	if (err < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	if (err == 0)
+		return 0;
+
+	if (!stream_socket()) {
+		len = recv(sk, frame, MAX_FRAME_SIZE, 0);
+		if (len < 0)
+			return errno == EINTR ? 0 : -errno;
+
+		if (len == 0)
+			return -ECONNRESET;
+
+		if ((size_t) len < sizeof(*hdr))
+			return -EBADMSG;
+
+		return len;
+	}
+
+	err = read_full(sk, frame, sizeof(*hdr));
+	if (err < 0)
+		return err;
+
+	len = btohs(hdr->len);
+	if ((size_t) len < sizeof(*hdr))
+		return -EBADMSG;
+
+	err = read_full(sk, frame + sizeof(*hdr), len - sizeof(*hdr));
+	if (err < 0)
+		return err;
+
+	return len;
+}
+
+static int l2cap_socket(uint16_t port)
+{
+	struct sockaddr_l2 addr;
+	struct l2cap_options opts;
+	socklen_t optlen;
+	int sk, err;
+
+	sk = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.l2_family = AF_BLUETOOTH;
+	bacpy(&addr.l2_bdaddr, &bdaddr);
+	addr.l2_psm = htobs(port);
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto failed;
+
+	memset(&opts, 0, sizeof(opts));
+	optlen = sizeof(opts);
+
+	if (getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &opts, &optlen) < 0)
+		goto failed;
+
+	opts.imtu = imtu;
+	opts.mode = l2cap_mode;
+
+	if (setsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &opts,
+							sizeof(opts)) < 0)
+		goto failed;
+
+	return sk;
+
+failed:
+	err = -errno;
+	close(sk);
+	return err;
+}
+
+static int rfcomm_socket(uint8_t port)
+{
+	struct sockaddr_rc addr;
+	int sk, err;
+
+	sk = socket(PF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.rc_family = AF_BLUETOOTH;
+	bacpy(&addr.rc_bdaddr, &bdaddr);
+	addr.rc_channel = port;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = -errno;
+		close(sk);
+		return err;
+	}
+
+	return sk;
+}
+
+static int sco_socket(void)
+{
+	struct sockaddr_sco addr;
+	int sk, err;
+
+	sk = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_SCO);
+	if (sk < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sco_family = AF_BLUETOOTH;
+	bacpy(&addr.sco_bdaddr, &bdaddr);
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = -errno;
+		close(sk);
+		return err;
+	}
+
+	return sk;
+}
+
+/* Servers bind to the PSM or channel, clients to any */
+static int create_socket(int server)
+{
+	switch (proto) {
+	case PROTO_L2CAP:
+		return l2cap_socket(server ? psm : 0);
+	case PROTO_RFCOMM:
+		return rfcomm_socket(server ? channel : 0);
+	case PROTO_SCO:
+		return sco_socket();
+	}
+
+	return -EPROTONOSUPPORT;
+}
+
+/* Largest frame the connection takes in one piece */
+static int get_mtu(int sk)
+{
+	struct l2cap_options l2o;
+	struct sco_options so;
+	socklen_t optlen;
+
+	switch (proto) {
+	case PROTO_L2CAP:
+		optlen = sizeof(l2o);
+		if (getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &l2o,
+								&optlen) < 0)
+			return -errno;
+		return l2o.omtu;
+	case PROTO_SCO:
+		optlen = sizeof(so);
+		if (getsockopt(sk, SOL_SCO, SCO_OPTIONS, &so, &optlen) < 0)
+			return -errno;
+		return so.mtu;
+	}
+
+	return MAX_FRAME_SIZE;
+}
+
+union bench_addr {
+	struct sockaddr sa;
+	struct sockaddr_l2 l2;
+	struct sockaddr_rc rc;
+	struct sockaddr_sco sco;
+};
+
+static socklen_t peer_address(const char *svr, union bench_addr *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	switch (proto) {
+	case PROTO_L2CAP:
+		addr->l2.l2_family = AF_BLUETOOTH;
+		str2ba(svr, &addr->l2.l2_bdaddr);
+		addr->l2.l2_psm = htobs(psm);
+		return sizeof(addr->l2);
+	case PROTO_RFCOMM:
+		addr->rc.rc_family = AF_BLUETOOTH;
+		str2ba(svr, &addr->rc.rc_bdaddr);
+		addr->rc.rc_channel = channel;
+		return sizeof(addr->rc);
+	}
+
+	addr->sco.sco_family = AF_BLUETOOTH;
+	str2ba(svr, &addr->sco.sco_bdaddr);
+	return sizeof(addr->sco);
+}
+
+static int do_connect(const char *svr)
+{
+	union bench_addr addr;
+	socklen_t addrlen;
+	int sk, err;
+
+	sk = create_socket(0);
+	if (sk < 0) {
+		fprintf(stderr, "Can't create socket: %s (%d)\n",
+							strerror(-sk), -sk);
+		return -1;
+	}
+
+	addrlen = peer_address(svr, &addr);
+
+	if (connect(sk, &addr.sa, addrlen) < 0) {
+		err = errno;
+		fprintf(stderr, "Can't connect: %s (%d)\n",
+							strerror(err), err);
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+static int do_listen(void)
+{
+	int sk, err;
+
+	sk = create_socket(1);
+	if (sk < 0) {
+		fprintf(stderr, "Can't create socket: %s (%d)\n",
+							strerror(-sk), -sk);
+		return -1;
+	}
+
+	if (listen(sk, 10) < 0) {
+		err = errno;
+		fprintf(stderr, "Can't listen: %s (%d)\n",
+							strerror(err), err);
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+#define MAX_FRAMES (1 << 24)
+
+struct rx_stats {
+	uint8_t *seen;			/* Bitmap of sequence numbers */
+	uint32_t seen_bits;
+	uint32_t highest;
+	uint32_t received;
+	uint32_t reordered;
+	uint32_t duplicated;
+	uint32_t corrupted;
+	uint64_t bytes;
+	uint64_t first;
+	uint64_t last;
+};
+
+static void rx_track(struct rx_stats *rx, const uint8_t *frame, uint16_t len)
+{
+	const struct bench_hdr *hdr = (const void *) frame;
+	uint32_t seq = btohl(hdr->seq);
+	uint64_t now = get_time();
+
+	if (check_frame(frame, len) < 0 || seq >= MAX_FRAMES) {
+		rx->corrupted++;
+		return;
+	}
+
+	if (seq >= rx->seen_bits) {
+		uint32_t bits = rx->seen_bits ? rx->seen_bits : 4096;
+		uint8_t *seen;
+
+		while (bits <= seq)
+			bits *= 2;
+
+		seen = realloc(rx->seen, bits / 8);
+		if (!seen) {
+			rx->corrupted++;
+			return;
+		}
+
+		memset(seen + rx->seen_bits / 8, 0, (bits - rx->seen_bits) / 8);
+		rx->seen = seen;
+		rx->seen_bits = bits;
+	}
+
+	if (rx->seen[seq / 8] & (1 << (seq % 8))) {
+		rx->duplicated++;
+		return;
+	}
+
+	rx->seen[seq / 8] |= 1 << (seq % 8);
+
+	if (rx->received > 0 && seq < rx->highest)
+		rx->reordered++;
+	else
+		rx->highest = seq;
+
+	if (rx->received == 0)
+		rx->first = now;
+
+	rx->last = now;
+	rx->received++;
+	rx->bytes += len;
+}
+
+static void print_rx_stats(const char *indent,
+					const struct bench_report *rep)
+{
+	uint64_t duration = btohll(rep->duration);
+	uint64_t bytes = btohll(rep->bytes);
+
+	printf("%s\"received\": %u,\n", indent, btohl(rep->received));
+	printf("%s\"lost\": %u,\n", indent, btohl(rep->lost));
+	printf("%s\"reordered\": %u,\n", indent, btohl(rep->reordered));
+	printf("%s\"duplicated\": %u,\n", indent, btohl(rep->duplicated));
+	printf("%s\"corrupted\": %u,\n", indent, btohl(rep->corrupted));
+	printf("%s\"bytes\": %llu,\n", indent, (unsigned long long) bytes);
+	printf("%s\"duration_us\": %llu,\n", indent,
+					(unsigned long long) duration);
+	printf("%s\"bytes_per_sec\": %.1f\n", indent,
+			duration ? bytes * 1000000.0 / duration : 0.0);
+}
+
+static void make_report(struct bench_report *rep, const struct rx_stats *rx,
+								uint32_t sent)
+{
+	memset(rep, 0, sizeof(*rep));
+
+	rep->hdr.type = BENCH_REPORT;
+	rep->hdr.len = htobs(sizeof(*rep));
+	rep->hdr.seq = htobl(sent);
+	rep->received = htobl(rx->received);
+	rep->lost = htobl(sent > rx->received ? sent - rx->received : 0);
+	rep->reordered = htobl(rx->reordered);
+	rep->duplicated = htobl(rx->duplicated);
+	rep->corrupted = htobl(rx->corrupted);
+	rep->bytes = htobll(rx->bytes);
+	rep->duration = htobll(rx->last - rx->first);
+}
+
+static void serve(int sk)
+{
+	struct rx_stats rx;
+	struct bench_report rep;
+	struct bench_hdr *hdr = (void *) buf;
+	int len, err;
+
+	memset(&rx, 0, sizeof(rx));
+
+	while (1) {
+		len = read_frame(sk, buf, -1);
+		if (len < 0)
+			break;
+
+		if (len == 0)
+			continue;
+
+		switch (hdr->type) {
+		case BENCH_PING:
+			/* Echo as is, the client checks the payload */
+			hdr->type = BENCH_PONG;
+			err = write_frame(sk, buf, len);
+			break;
+		case BENCH_DATA:
+			rx_track(&rx, buf, len);
+			err = 0;
+			break;
+		case BENCH_END:
+			/* Answer every END, the previous report may have
+			 * been lost on an unreliable channel */
+			make_report(&rep, &rx, btohl(hdr->seq));
+			err = write_frame(sk, (uint8_t *) &rep, sizeof(rep));
+
+			printf("{\n\t\"test\": \"throughput\",\n"
+					"\t\"role\": \"receiver\",\n"
+					"\t\"sent\": %u,\n", btohl(hdr->seq));
+			print_rx_stats("\t", &rep);
+			printf("}\n");
+			fflush(stdout);
+			break;
+		default:
+			err = 0;
+			break;
+		}
+
+		if (err < 0)
+			break;
+	}
+
+	free(rx.seen);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a;
+	uint64_t vb = *(const uint64_t *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+/* Nearest rank on a sorted array */
+static uint64_t percentile(const uint64_t *val, unsigned int num, double p)
+{
+	unsigned int rank;
+
+	if (num == 0)
+		return 0;
+
+	rank = (unsigned int) ceil(p / 100.0 * num);
+	if (rank < 1)
+		rank = 1;
+
+	return val[rank - 1];
+}
+
+static void print_header(const char *name, int size)
+{
+	printf("{\n\t\"test\": \"%s\",\n", name);
+	printf("\t\"protocol\": \"%s\",\n",
+				get_lookup_name(protocols, proto));
+	if (proto == PROTO_L2CAP)
+		printf("\t\"mode\": \"%s\",\n",
+				get_lookup_name(l2cap_modes, l2cap_mode));
+	printf("\t\"frame_size\": %d,\n", size);
+	printf("\t\"frames\": %u,\n", num_frames);
+}
+
+static int ping_test(int sk, int size)
+{
+	struct bench_hdr *hdr = (void *) buf;
+	unsigned int seq, received = 0, lost = 0, late = 0, corrupted = 0;
+	uint64_t *rtt, sum = 0;
+	double mean = 0, var = 0;
+	unsigned int i;
+
+	rtt = calloc(num_frames ? num_frames : 1, sizeof(*rtt));
+	if (!rtt)
+		return -ENOMEM;
+
+	for (seq = 0; seq < num_warmup + num_frames; seq++) {
+		uint64_t start, now, deadline;
+		int len, err;
+
+		if (interval > 0 && seq > 0)
+			usleep(interval * 1000);
+
+		fill_frame(buf, BENCH_PING, seq, size);
+
+		start = get_time();
+		deadline = start + timeout * 1000;
+
+		err = write_frame(sk, buf, size);
+		if (err < 0) {
+			free(rtt);
+			return err;
+		}
+
+		while (1) {
+			now = get_time();
+			if (now >= deadline) {
+				if (seq >= num_warmup)
+					lost++;
+				break;
+			}
+
+			len = read_frame(sk, buf, (deadline - now + 999) / 1000);
+			if (len < 0) {
+				free(rtt);
+				return len;
+			}
+
+			if (len == 0 || hdr->type != BENCH_PONG)
+				continue;
+
+			/* Answer to an earlier ping that already timed out */
+			if (btohl(hdr->seq) != seq) {
+				if (btohl(hdr->seq) >= num_warmup)
+					late++;
+				continue;
+			}
+
+			if (seq < num_warmup)
+				break;
+
+			if (check_frame(buf, len) < 0)
+				corrupted++;
+
+			rtt[received++] = get_time() - start;
+			break;
+		}
+	}
+
+	qsort(rtt, received, sizeof(*rtt), compare_u64);
+
+	for (i = 0; i < received; i++)
+		sum += rtt[i];
+
+	if (received > 0)
+		mean = (double) sum / received;
+
+	for (i = 0; i < received; i++)
+		var += (rtt[i] - mean) * (rtt[i] - mean);
+
+	if (received > 1)
+		var /= received - 1;
+
+	print_header("ping", size);
+	printf("\t\"sent\": %u,\n", num_frames);
+	printf("\t\"received\": %u,\n", received);
+	printf("\t\"lost\": %u,\n", lost);
+	printf("\t\"reordered\": %u,\n", late);
+	printf("\t\"corrupted\": %u,\n", corrupted);
+	printf("\t\"rtt_us\": {\n");
+	printf("\t\t\"min\": %llu,\n", (unsigned long long)
+					(received ? rtt[0] : 0));
+	printf("\t\t\"mean\": %.1f,\n", mean);
+	printf("\t\t\"stddev\": %.1f,\n", sqrt(var));
+	printf("\t\t\"p50\": %llu,\n", (unsigned long long)
+					percentile(rtt, received, 50));
+	printf("\t\t\"p90\": %llu,\n", (unsigned long long)
+					percentile(rtt, received, 90));
+	printf("\t\t\"p99\": %llu,\n", (unsigned long long)
+					percentile(rtt, received, 99));
+	printf("\t\t\"p99.9\": %llu,\n", (unsigned long long)
+					percentile(rtt, received, 99.9));
+	printf("\t\t\"max\": %llu\n", (unsigned long long)
+					(received ? rtt[received - 1] : 0));
+	printf("\t}\n}\n");
+
+	free(rtt);
+
+	return 0;
+}
+
+static int throughput_test(int sk, int size)
+{
+	struct bench_report rep;
+	uint64_t start, duration;
+	unsigned int seq, retry;
+	int err, len, got_report = 0;
+
+	start = get_time();
+
+	for (seq = 0; seq < num_frames; seq++) {
+		fill_frame(buf, BENCH_DATA, seq, size);
+
+		err = write_frame(sk, buf, size);
+		if (err < 0)
+			return err;
+	}
+
+	duration = get_time() - start;
+
+	/* Channels without retransmission may drop END or the report */
+	for (retry = 0; retry < 3 && !got_report; retry++) {
+		uint64_t deadline;
+
+		fill_frame(buf, BENCH_END, num_frames, sizeof(struct bench_hdr));
+
+		err = write_frame(sk, buf, sizeof(struct bench_hdr));
+		if (err < 0)
+			return err;
+
+		deadline = get_time() + timeout * 1000;
+
+		while (get_time() < deadline) {
+			len = read_frame(sk, buf, timeout);
+			if (len < 0)
+				return len;
+
+			if (len >= (int) sizeof(rep) &&
+					buf[0] == BENCH_REPORT) {
+				memcpy(&rep, buf, sizeof(rep));
+				got_report = 1;
+				break;
+			}
+		}
+	}
+
+	print_header("throughput", size);
+	printf("\t\"sender\": {\n");
+	printf("\t\t\"sent\": %u,\n", num_frames);
+	printf("\t\t\"bytes\": %llu,\n",
+			(unsigned long long) num_frames * size);
+	printf("\t\t\"duration_us\": %llu,\n", (unsigned long long) duration);
+	printf("\t\t\"bytes_per_sec\": %.1f\n", duration ?
+			(double) num_frames * size * 1000000.0 / duration : 0.0);
+	printf("\t},\n");
+
+	if (got_report) {
+		printf("\t\"receiver\": {\n");
+		print_rx_stats("\t\t", &rep);
+		printf("\t}\n}\n");
+	} else
+		printf("\t\"receiver\": null\n}\n");
+
+	return 0;
+}
+
+/*
+ * Stress mode drives all channels from a single epoll loop, so what it
+ * measures is the stack multiplexing many links and not the process
+ * scheduler juggling one process per connection.
+ */
+
+#define MAX_CHANNELS 1024
+#define STRESS_BURST 4
+#define MAX_GAP_SAMPLES 65536
+
+enum {
+	CHAN_CONNECTING,
+	CHAN_SENDING,
+	CHAN_WAIT_REPORT,
+	CHAN_DONE,
+	CHAN_FAILED,
+};
+
+struct stress_chan {
+	unsigned int id;
+	const char *peer;
+	int sk;
+	int state;
+	int err;
+	int size;
+	uint8_t *frame;
+	uint16_t frame_len;
+	uint16_t offset;		/* Partial writes on stream sockets */
+	uint32_t seq;
+	unsigned int end_retries;
+	uint64_t connect_start;
+	uint64_t connected;
+	uint64_t first_send;
+	uint64_t last_send;
+	uint64_t end_sent;
+	uint64_t max_gap;
+	uint8_t rbuf[sizeof(struct bench_report)];
+	uint16_t rlen;
+	int got_report;
+	struct bench_report report;
+};
+
+struct stress {
+	int epoll_fd;
+	struct stress_chan *chans;
+	unsigned int num_chans;
+	unsigned int active;
+	uint64_t *gaps;			/* Time between sends of a channel */
+	unsigned int num_gaps;
+	uint64_t gaps_seen;
+};
+
+/* Uniform sample of all gaps, so memory doesn't grow with the run */
+static void add_gap(struct stress *st, uint64_t gap)
+{
+	uint64_t i = st->gaps_seen++;
+
+	if (st->num_gaps < MAX_GAP_SAMPLES) {
+		st->gaps[st->num_gaps++] = gap;
+		return;
+	}
+
+	i = random() % (i + 1);
+	if (i < MAX_GAP_SAMPLES)
+		st->gaps[i] = gap;
+}
+
+static void chan_finish(struct stress *st, struct stress_chan *chan,
+								int state)
+{
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, chan->sk, NULL);
+	chan->state = state;
+	st->active--;
+}
+
+static void chan_fail(struct stress *st, struct stress_chan *chan, int err)
+{
+	chan->err = err;
+	chan_finish(st, chan, CHAN_FAILED);
+}
+
+static void chan_set_events(struct stress *st, struct stress_chan *chan,
+							uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = chan;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_MOD, chan->sk, &ev);
+}
+
+static void chan_connected(struct stress *st, struct stress_chan *chan)
+{
+	int mtu;
+
+	chan->connected = get_time();
+
+	mtu = get_mtu(chan->sk);
+	if (mtu < 0) {
+		chan_fail(st, chan, mtu);
+		return;
+	}
+
+	if (mtu > MAX_FRAME_SIZE)
+		mtu = MAX_FRAME_SIZE;
+
+	if (frame_size < 0)
+		chan->size = stream_socket() ? 1024 : mtu;
+	else
+		chan->size = frame_size;
+
+	if (chan->size > mtu || chan->size < (int) sizeof(struct bench_hdr)) {
+		chan_fail(st, chan, -EMSGSIZE);
+		return;
+	}
+
+	chan->frame = malloc(chan->size);
+	if (!chan->frame) {
+		chan_fail(st, chan, -ENOMEM);
+		return;
+	}
+
+	chan->state = CHAN_SENDING;
+}
+
+/* Returns 1 once the current frame is out, 0 if the socket is full */
+static int chan_write(struct stress *st, struct stress_chan *chan)
+{
+	ssize_t written;
+
+	written = send(chan->sk, chan->frame + chan->offset,
+				chan->frame_len - chan->offset, MSG_DONTWAIT);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+
+		chan_fail(st, chan, -errno);
+		return -1;
+	}
+
+	if (stream_socket() && chan->offset + written < chan->frame_len) {
+		chan->offset += written;
+		return 0;
+	}
+
+	chan->offset = 0;
+
+	return 1;
+}
+
+static void chan_send_end(struct stress *st, struct stress_chan *chan)
+{
+	fill_frame(chan->frame, BENCH_END, num_frames,
+						sizeof(struct bench_hdr));
+	chan->frame_len = sizeof(struct bench_hdr);
+	chan->end_sent = get_time();
+}
+
+static void chan_send(struct stress *st, struct stress_chan *chan)
+{
+	unsigned int burst;
+	int err;
+
+	/* A few frames per wakeup so one channel can not hog the loop */
+	for (burst = 0; burst < STRESS_BURST; burst++) {
+		uint64_t now;
+
+		if (chan->offset == 0) {
+			if (chan->seq < num_frames) {
+				fill_frame(chan->frame, BENCH_DATA, chan->seq,
+								chan->size);
+				chan->frame_len = chan->size;
+			} else
+				chan_send_end(st, chan);
+		}
+
+		err = chan_write(st, chan);
+		if (err <= 0)
+			return;
+
+		if (chan->frame[0] == BENCH_END) {
+			chan->state = CHAN_WAIT_REPORT;
+			chan_set_events(st, chan, EPOLLIN);
+			return;
+		}
+
+		now = get_time();
+
+		if (chan->seq == 0)
+			chan->first_send = now;
+		else {
+			uint64_t gap = now - chan->last_send;
+
+			add_gap(st, gap);
+			if (gap > chan->max_gap)
+				chan->max_gap = gap;
+		}
+
+		chan->last_send = now;
+		chan->seq++;
+	}
+}
+
+static void chan_read(struct stress *st, struct stress_chan *chan)
+{
+	ssize_t len;
+
+	if (!stream_socket()) {
+		len = recv(chan->sk, buf, MAX_FRAME_SIZE, MSG_DONTWAIT);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		if (len <= 0) {
+			chan_finish(st, chan, CHAN_DONE);
+			return;
+		}
+
+		if (len < (ssize_t) sizeof(chan->report) ||
+						buf[0] != BENCH_REPORT)
+			return;
+
+		memcpy(&chan->report, buf, sizeof(chan->report));
+	} else {
+		len = recv(chan->sk, chan->rbuf + chan->rlen,
+				sizeof(chan->rbuf) - chan->rlen, MSG_DONTWAIT);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		if (len <= 0) {
+			chan_finish(st, chan, CHAN_DONE);
+			return;
+		}
+
+		chan->rlen += len;
+		if (chan->rlen < sizeof(chan->rbuf))
+			return;
+
+		memcpy(&chan->report, chan->rbuf, sizeof(chan->report));
+	}
+
+	chan->got_report = 1;
+	chan_finish(st, chan, CHAN_DONE);
+}
+
+static void chan_check_timeout(struct stress *st, struct stress_chan *chan,
+								uint64_t now)
+{
+	if (chan->state != CHAN_WAIT_REPORT)
+		return;
+
+	if (now - chan->end_sent < timeout * 1000)
+		return;
+
+	/* Packet based channels may lose END, stream ones never do */
+	if (stream_socket() || ++chan->end_retries > 3) {
+		chan_finish(st, chan, CHAN_DONE);
+		return;
+	}
+
+	chan_send_end(st, chan);
+	if (chan_write(st, chan) == 0)
+		chan->offset = 0;
+}
+
+static int stress_connect(struct stress *st, struct stress_chan *chan)
+{
+	union bench_addr addr;
+	struct epoll_event ev;
+	socklen_t addrlen;
+
+	chan->sk = create_socket(0);
+	if (chan->sk < 0)
+		return chan->sk;
+
+	if (fcntl(chan->sk, F_SETFL, O_NONBLOCK) < 0)
+		return -errno;
+
+	addrlen = peer_address(chan->peer, &addr);
+
+	chan->connect_start = get_time();
+
+	if (connect(chan->sk, &addr.sa, addrlen) < 0 && errno != EINPROGRESS)
+		return -errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT;
+	ev.data.ptr = chan;
+
+	if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, chan->sk, &ev) < 0)
+		return -errno;
+
+	st->active++;
+
+	return 0;
+}
+
+static void stress_event(struct stress *st, struct stress_chan *chan,
+							uint32_t events)
+{
+	socklen_t len;
+	int err;
+
+	switch (chan->state) {
+	case CHAN_CONNECTING:
+		err = 0;
+		len = sizeof(err);
+
+		if (getsockopt(chan->sk, SOL_SOCKET, SO_ERROR, &err,
+								&len) < 0)
+			err = errno;
+
+		if (err) {
+			chan_fail(st, chan, -err);
+			break;
+		}
+
+		chan_connected(st, chan);
+		break;
+	case CHAN_SENDING:
+		if (events & (EPOLLERR | EPOLLHUP)) {
+			chan_fail(st, chan, -ECONNRESET);
+			break;
+		}
+
+		chan_send(st, chan);
+		break;
+	case CHAN_WAIT_REPORT:
+		chan_read(st, chan);
+		break;
+	}
+}
+
+static void print_stress(struct stress *st, uint64_t start, uint64_t end)
+{
+	double sum = 0, sum_sq = 0, fairness = 0;
+	uint64_t bytes = 0;
+	unsigned int i, connected = 0;
+	int size = frame_size;
+
+	for (i = 0; i < st->num_chans; i++) {
+		struct stress_chan *chan = &st->chans[i];
+		uint64_t duration = chan->last_send - chan->first_send;
+		double rate;
+
+		if (!chan->connected || chan->seq == 0)
+			continue;
+
+		connected++;
+		bytes += (uint64_t) chan->seq * chan->size;
+
+		if (size < 0)
+			size = chan->size;
+
+		rate = duration ? (double) chan->seq * chan->size *
+						1000000.0 / duration : 0;
+		sum += rate;
+		sum_sq += rate * rate;
+	}
+
+	/* Jain's index, 1.0 when all channels got the same rate */
+	if (connected > 0 && sum_sq > 0)
+		fairness = sum * sum / (connected * sum_sq);
+
+	if (size < 0)
+		size = 0;
+
+	qsort(st->gaps, st->num_gaps, sizeof(*st->gaps), compare_u64);
+
+	print_header("stress", size);
+	printf("\t\"channels\": %u,\n", st->num_chans);
+	printf("\t\"connected\": %u,\n", connected);
+	printf("\t\"aggregate\": {\n");
+	printf("\t\t\"bytes\": %llu,\n", (unsigned long long) bytes);
+	printf("\t\t\"duration_us\": %llu,\n",
+				(unsigned long long) (end - start));
+	printf("\t\t\"bytes_per_sec\": %.1f,\n", end > start ?
+				bytes * 1000000.0 / (end - start) : 0.0);
+	printf("\t\t\"fairness\": %.4f\n", fairness);
+	printf("\t},\n");
+	printf("\t\"send_gap_us\": {\n");
+	printf("\t\t\"p50\": %llu,\n", (unsigned long long)
+				percentile(st->gaps, st->num_gaps, 50));
+	printf("\t\t\"p90\": %llu,\n", (unsigned long long)
+				percentile(st->gaps, st->num_gaps, 90));
+	printf("\t\t\"p99\": %llu,\n", (unsigned long long)
+				percentile(st->gaps, st->num_gaps, 99));
+	printf("\t\t\"max\": %llu\n", (unsigned long long) (st->num_gaps ?
+				st->gaps[st->num_gaps - 1] : 0));
+	printf("\t},\n");
+	printf("\t\"channel_list\": [\n");
+
+	for (i = 0; i < st->num_chans; i++) {
+		struct stress_chan *chan = &st->chans[i];
+		uint64_t duration = chan->last_send - chan->first_send;
+
+		printf("\t\t{\n");
+		printf("\t\t\t\"id\": %u,\n", chan->id);
+		printf("\t\t\t\"peer\": \"%s\",\n", chan->peer);
+
+		if (chan->state == CHAN_FAILED)
+			printf("\t\t\t\"error\": \"%s\",\n",
+						strerror(-chan->err));
+
+		printf("\t\t\t\"connect_us\": %llu,\n", (unsigned long long)
+				(chan->connected ? chan->connected -
+						chan->connect_start : 0));
+		printf("\t\t\t\"frame_size\": %d,\n", chan->size);
+		printf("\t\t\t\"sent\": %u,\n", chan->seq);
+		printf("\t\t\t\"duration_us\": %llu,\n",
+					(unsigned long long) duration);
+		printf("\t\t\t\"bytes_per_sec\": %.1f,\n", duration ?
+				(double) chan->seq * chan->size *
+						1000000.0 / duration : 0.0);
+		printf("\t\t\t\"max_gap_us\": %llu,\n",
+					(unsigned long long) chan->max_gap);
+
+		if (chan->got_report) {
+			printf("\t\t\t\"receiver\": {\n");
+			print_rx_stats("\t\t\t\t", &chan->report);
+			printf("\t\t\t}\n");
+		} else
+			printf("\t\t\t\"receiver\": null\n");
+
+		printf("\t\t}%s\n", i + 1 < st->num_chans ? "," : "");
+	}
+
+	printf("\t]\n}\n");
+}
+
+static int stress_test(char *peers[], unsigned int num_peers)
+{
+	struct stress st;
+	uint64_t start, end;
+	unsigned int i;
+	int err = 0;
+
+	memset(&st, 0, sizeof(st));
+
+	st.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (st.epoll_fd < 0)
+		return -errno;
+
+	st.num_chans = num_channels;
+	st.chans = calloc(st.num_chans, sizeof(*st.chans));
+	st.gaps = calloc(MAX_GAP_SAMPLES, sizeof(*st.gaps));
+	if (!st.chans || !st.gaps) {
+		err = -ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < st.num_chans; i++)
+		st.chans[i].sk = -1;
+
+	start = get_time();
+
+	/* Channels are spread over the peers round robin */
+	for (i = 0; i < st.num_chans; i++) {
+		struct stress_chan *chan = &st.chans[i];
+
+		chan->id = i;
+		chan->peer = peers[i % num_peers];
+		chan->state = CHAN_CONNECTING;
+
+		err = stress_connect(&st, chan);
+		if (err < 0) {
+			chan->state = CHAN_FAILED;
+			chan->err = err;
+			if (chan->sk >= 0)
+				close(chan->sk);
+			chan->sk = -1;
+			err = 0;
+		}
+	}
+
+	while (st.active > 0) {
+		struct epoll_event events[64];
+		uint64_t now;
+		int n, nfds;
+
+		nfds = epoll_wait(st.epoll_fd, events, 64, 100);
+		if (nfds < 0 && errno != EINTR) {
+			err = -errno;
+			break;
+		}
+
+		for (n = 0; n < nfds; n++)
+			stress_event(&st, events[n].data.ptr,
+							events[n].events);
+
+		now = get_time();
+
+		for (i = 0; i < st.num_chans; i++)
+			chan_check_timeout(&st, &st.chans[i], now);
+	}
+
+	end = get_time();
+
+	if (err == 0)
+		print_stress(&st, start, end);
+
+done:
+	for (i = 0; st.chans && i < st.num_chans; i++) {
+		if (st.chans[i].sk >= 0)
+			close(st.chans[i].sk);
+		free(st.chans[i].frame);
+	}
+
+	free(st.chans);
+	free(st.gaps);
+	close(st.epoll_fd);
+
+	return err;
+}
+
+static int run_client(const char *svr)
+{
+	int sk, mtu, size, err;
+
+	sk = do_connect(svr);
+	if (sk < 0)
+		return -1;
+
+	mtu = get_mtu(sk);
+	if (mtu < 0) {
+		fprintf(stderr, "Can't get MTU: %s (%d)\n",
+						strerror(-mtu), -mtu);
+		close(sk);
+		return -1;
+	}
+
+	if (mtu > MAX_FRAME_SIZE)
+		mtu = MAX_FRAME_SIZE;
+
+	if (frame_size < 0)
+		size = stream_socket() ? 1024 : mtu;
+	else
+		size = frame_size;
+
+	if (size > mtu || size < (int) sizeof(struct bench_hdr)) {
+		fprintf(stderr, "Invalid frame size %d (MTU %d)\n", size, mtu);
+		close(sk);
+		return -1;
+	}
+
+	if (test == TEST_PING)
+		err = ping_test(sk, size);
+	else
+		err = throughput_test(sk, size);
+
+	close(sk);
+
+	if (err < 0) {
+		fprintf(stderr, "Test failed: %s (%d)\n", strerror(-err), -err);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run_server(void)
+{
+	struct sockaddr_l2 addr;
+	socklen_t addrlen;
+	int sk, nsk;
+
+	sk = do_listen();
+	if (sk < 0)
+		return -1;
+
+	while (1) {
+		memset(&addr, 0, sizeof(addr));
+		addrlen = sizeof(addr);
+
+		nsk = accept(sk, (struct sockaddr *) &addr, &addrlen);
+		if (nsk < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Accept failed: %s (%d)\n",
+							strerror(errno), errno);
+			break;
+		}
+
+		if (fork()) {
+			/* Parent */
+			close(nsk);
+			continue;
+		}
+
+		/* Child */
+		close(sk);
+		serve(nsk);
+		close(nsk);
+		exit(0);
+	}
+
+	close(sk);
+
+	return -1;
+}
+
+static void usage(void)
+{
+	printf("btbench - Bluetooth latency and throughput benchmark\n"
+		"Usage:\n");
+	printf("\tbtbench -l [options]\n"
+		"\tbtbench [options] <bdaddr>\n"
+		"\tbtbench -t stress [options] <bdaddr> [bdaddr ...]\n");
+	printf("Options:\n"
+		"\t-l, --listen          Serve benchmark clients\n"
+		"\t-t, --test <name>     ping, throughput or stress\n"
+		"\t-P, --protocol <name> l2cap, rfcomm or sco (default l2cap)\n"
+		"\t-X, --mode <name>     basic, ertm or streaming L2CAP mode\n"
+		"\t-i, --device <hciX>   Local adapter\n"
+		"\t-p, --psm <psm>       L2CAP PSM (default 0x1011)\n"
+		"\t-c, --channel <num>   RFCOMM channel (default 10)\n"
+		"\t-I, --imtu <size>     L2CAP incoming MTU (default 672)\n"
+		"\t-s, --size <bytes>    Frame size (default MTU)\n"
+		"\t-n, --frames <num>    Number of frames (default 1000)\n"
+		"\t-N, --channels <num>  Stress test channels (default 8)\n"
+		"\t-w, --warmup <num>    Pings not counted (default 0)\n"
+		"\t-D, --interval <ms>   Delay between pings (default 0)\n"
+		"\t-T, --timeout <ms>    Ping and report timeout (default 1000)\n"
+		"\t-h, --help            Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "listen",	no_argument,	   NULL, 'l' },
+	{ "test",	required_argument, NULL, 't' },
+	{ "protocol",	required_argument, NULL, 'P' },
+	{ "mode",	required_argument, NULL, 'X' },
+	{ "device",	required_argument, NULL, 'i' },
+	{ "psm",	required_argument, NULL, 'p' },
+	{ "channel",	required_argument, NULL, 'c' },
+	{ "imtu",	required_argument, NULL, 'I' },
+	{ "size",	required_argument, NULL, 's' },
+	{ "frames",	required_argument, NULL, 'n' },
+	{ "channels",	required_argument, NULL, 'N' },
+	{ "warmup",	required_argument, NULL, 'w' },
+	{ "interval",	required_argument, NULL, 'D' },
+	{ "timeout",	required_argument, NULL, 'T' },
+	{ "help",	no_argument,	   NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	int opt, listen_mode = 0, err;
+
+	bacpy(&bdaddr, BDADDR_ANY);
+
+	while ((opt = getopt_long(argc, argv, "lt:P:X:i:p:c:I:s:n:N:w:D:T:h",
+						main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'l':
+			listen_mode = 1;
+			break;
+		case 't':
+			test = get_lookup_flag(tests, optarg);
+			if (test < 0) {
+				fprintf(stderr, "Unknown test %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'P':
+			proto = get_lookup_flag(protocols, optarg);
+			if (proto < 0) {
+				fprintf(stderr, "Unknown protocol %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'X':
+			l2cap_mode = get_lookup_flag(l2cap_modes, optarg);
+			if (l2cap_mode < 0) {
+				fprintf(stderr, "Unknown mode %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'i':
+			if (!strncasecmp(optarg, "hci", 3))
+				hci_devba(atoi(optarg + 3), &bdaddr);
+			else
+				str2ba(optarg, &bdaddr);
+			break;
+		case 'p':
+			psm = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			channel = atoi(optarg);
+			break;
+		case 'I':
+			imtu = atoi(optarg);
+			break;
+		case 's':
+			frame_size = atoi(optarg);
+			break;
+		case 'n':
+			num_frames = strtoul(optarg, NULL, 10);
+			if (num_frames > MAX_FRAMES) {
+				fprintf(stderr, "At most %u frames\n",
+								MAX_FRAMES);
+				exit(1);
+			}
+			break;
+		case 'N':
+			num_channels = strtoul(optarg, NULL, 10);
+			if (num_channels < 1 || num_channels > MAX_CHANNELS) {
+				fprintf(stderr, "Between 1 and %u channels\n",
+								MAX_CHANNELS);
+				exit(1);
+			}
+			break;
+		case 'w':
+			num_warmup = strtoul(optarg, NULL, 10);
+			break;
+		case 'D':
+			interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'T':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			exit(1);
+		}
+	}
+
+	if (!listen_mode && optind >= argc) {
+		usage();
+		exit(1);
+	}
+
+	buf = malloc(MAX_FRAME_SIZE);
+	if (!buf) {
+		perror("Can't allocate data buffer");
+		exit(1);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if (listen_mode)
+		err = run_server();
+	else if (test == TEST_STRESS) {
+		err = stress_test(argv + optind, argc - optind);
+		if (err < 0)
+			fprintf(stderr, "Test failed: %s (%d)\n",
+							strerror(-err), -err);
+	} else
+		err = run_client(argv[optind]);
+
+	free(buf);
+
+	return err < 0 ? 1 : 0;
+}
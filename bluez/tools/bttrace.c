@@ -0,0 +1,371 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct args {
+	const uint8_t *data;
+	size_t len;
+};
+
+static int get_u64(struct args *args, uint64_t *val)
+{
+	if (args->len < sizeof(*val))
+		return -1;
+
+	memcpy(val, args->data, sizeof(*val));
+	args->data += sizeof(*val);
+	args->len -= sizeof(*val);
+
+	return 0;
+}
+
+static int get_str(struct args *args, const char **str)
+{
+	const uint8_t *end;
+
+	end = memchr(args->data, '\0', args->len);
+	if (end == NULL)
+		return -1;
+
+	*str = (const char *) args->data;
+	args->len -= end - args->data + 1;
+	args->data = end + 1;
+
+	return 0;
+}
+
+/* Parses the format the same way src/trace.c does when recording and
+ * prints one conversion at a time with the stored values */
+static void print_message(const char *fmt, size_t fmt_len, struct args *args,
+								int truncated)
+{
+	const char *p = fmt, *end = fmt + fmt_len;
+
+	while (p < end) {
+		char spec[64];
+		const char *start, *str;
+		uint64_t val;
+		double d;
+		size_t n;
+
+		if (*p != '%') {
+			putchar(*p++);
+			continue;
+		}
+
+		start = p++;
+		if (p < end && *p == '%') {
+			putchar('%');
+			p++;
+			continue;
+		}
+
+		n = 0;
+		spec[n++] = '%';
+
+		while (p < end && strchr("-+ #0'", *p) != NULL &&
+							n < sizeof(spec) - 32)
+			spec[n++] = *p++;
+
+		if (p < end && *p == '*') {
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			n += snprintf(spec + n, sizeof(spec) - n, "%d",
+								(int) val);
+			p++;
+		} else {
+			while (p < end && *p >= '0' && *p <= '9' &&
+							n < sizeof(spec) - 32)
+				spec[n++] = *p++;
+		}
+
+		if (p < end && *p == '.') {
+			spec[n++] = *p++;
+			if (p < end && *p == '*') {
+				if (get_u64(args, &val) < 0)
+					goto truncated;
+				n += snprintf(spec + n, sizeof(spec) - n, "%d",
+								(int) val);
+				p++;
+			} else {
+				while (p < end && *p >= '0' && *p <= '9' &&
+							n < sizeof(spec) - 32)
+					spec[n++] = *p++;
+			}
+		}
+
+		/* Values are stored as 64 bit, the length modifier was
+		 * already applied when recording */
+		while (p < end && strchr("hlqjztL", *p) != NULL)
+			p++;
+
+		if (p == end) {
+			fwrite(start, 1, p - start, stdout);
+			break;
+		}
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			/* fall through */
+		case 'c':
+		case 'p':
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+		case 's':
+			spec[n++] = *p;
+			break;
+		case 'm':
+			spec[n++] = 's';
+			break;
+		default:
+			fwrite(start, 1, p - start + 1, stdout);
+			return;
+		}
+
+		spec[n] = '\0';
+
+		switch (*p) {
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			memcpy(&d, &val, sizeof(d));
+			printf(spec, d);
+			break;
+		case 's':
+			if (get_str(args, &str) < 0)
+				goto truncated;
+			printf(spec, str);
+			break;
+		case 'm':
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			printf(spec, strerror((int) val));
+			break;
+		case 'p':
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			printf(spec, (void *) (uintptr_t) val);
+			break;
+		case 'c':
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			printf(spec, (int) val);
+			break;
+		default:
+			if (get_u64(args, &val) < 0)
+				goto truncated;
+			printf(spec, (long long) val);
+			break;
+		}
+
+		p++;
+	}
+
+	if (truncated)
+		printf("...");
+
+	return;
+
+truncated:
+	printf("...");
+}
+
+static void print_time(const struct btd_trace_file_hdr *hdr,
+					uint64_t timestamp, int monotonic)
+{
+	char buf[32];
+	uint64_t ns;
+	struct tm tm;
+	time_t t;
+
+	if (monotonic) {
+		printf("%llu.%06llu ",
+				(unsigned long long) timestamp / 1000000000,
+				(unsigned long long) timestamp % 1000000000
+									/ 1000);
+		return;
+	}
+
+	ns = hdr->realtime - (hdr->monotonic - timestamp);
+	t = ns / 1000000000;
+
+	localtime_r(&t, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+
+	printf("%s.%06llu ", buf,
+			(unsigned long long) (ns % 1000000000) / 1000);
+}
+
+static int decode(FILE *fp, int monotonic)
+{
+	struct btd_trace_file_hdr hdr;
+	struct btd_trace_rec_hdr rec;
+	unsigned long records = 0;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			memcmp(hdr.magic, BTD_TRACE_MAGIC,
+						sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "Not a bluetoothd trace file\n");
+		return -EINVAL;
+	}
+
+	if (hdr.version != BTD_TRACE_VERSION) {
+		fprintf(stderr, "Unsupported trace version %u\n", hdr.version);
+		return -EINVAL;
+	}
+
+	if (hdr.dropped > 0)
+		printf("# %llu older records were overwritten\n",
+					(unsigned long long) hdr.dropped);
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		size_t len = rec.file_len + rec.func_len + rec.fmt_len +
+								rec.args_len;
+		uint8_t *buf;
+		struct args args;
+
+		buf = malloc(len);
+		if (buf == NULL)
+			return -ENOMEM;
+
+		if (fread(buf, len, 1, fp) != 1) {
+			free(buf);
+			fprintf(stderr, "Truncated record %llu\n",
+					(unsigned long long) rec.seq);
+			return -EIO;
+		}
+
+		print_time(&hdr, rec.timestamp, monotonic);
+
+		printf("%.*s:%.*s() ", rec.file_len, buf,
+				rec.func_len, buf + rec.file_len);
+
+		args.data = buf + rec.file_len + rec.func_len + rec.fmt_len;
+		args.len = rec.args_len;
+
+		print_message((const char *) buf + rec.file_len + rec.func_len,
+					rec.fmt_len, &args,
+					rec.flags & BTD_TRACE_TRUNCATED);
+
+		putchar('\n');
+
+		free(buf);
+		records++;
+	}
+
+	fprintf(stderr, "%lu records\n", records);
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("bttrace - bluetoothd trace decoder\n"
+		"Usage:\n");
+	printf("\tbttrace [options] [file]\n");
+	printf("options:\n"
+		"\t-m, --monotonic         Print monotonic timestamps\n"
+		"\t-h, --help              Show help options\n");
+	printf("The default file is %s\n", BTD_TRACE_PATH);
+}
+
+static const struct option main_options[] = {
+	{ "monotonic",	no_argument,	NULL, 'm' },
+	{ "help",	no_argument,	NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	const char *path = BTD_TRACE_PATH;
+	int monotonic = 0;
+	FILE *fp;
+	int err;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "mh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'm':
+			monotonic = 1;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		path = argv[optind];
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror("Failed to open trace file");
+		return EXIT_FAILURE;
+	}
+
+	err = decode(fp, monotonic);
+
+	fclose(fp);
+
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -46,6 +46,7 @@
 #include <bluetooth/hci_lib.h>
 
 #include "textfile.h"
+#include "keystore.h"
 #include "csr.h"
 
 static struct hci_dev_info di;
@@ -956,13 +957,65 @@ static void cmd_voice(int ctl, int hdev, char *opt)
 	}
 }
 
+static int get_stored_link_key(const char *filename, const bdaddr_t *peer,
+								uint8_t *key)
+{
+	struct btd_keystore_hdr hdr;
+	struct btd_keystore_rec rec;
+	uint32_t i;
+	FILE *fp;
+	int err = -ENODATA;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		return -errno;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			memcmp(hdr.magic, BTD_KEYSTORE_MAGIC,
+						sizeof(hdr.magic)) != 0 ||
+			hdr.version != BTD_KEYSTORE_VERSION) {
+		fclose(fp);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < hdr.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			err = -EIO;
+			break;
+		}
+
+		if (rec.kind != BTD_KEYSTORE_LINK_KEY ||
+					bacmp(&rec.bdaddr, peer) != 0)
+			continue;
+
+		memcpy(key, rec.val, 16);
+		err = 0;
+		break;
+	}
+
+	fclose(fp);
+
+	return err;
+}
+
 static int get_link_key(const bdaddr_t *local, const bdaddr_t *peer,
 			uint8_t *key)
 {
 	char filename[PATH_MAX + 1], addr[18], tmp[3], *str;
-	int i;
+	int i, err;
 
 	ba2str(local, addr);
+	create_name(filename, PATH_MAX, STORAGEDIR, addr, BTD_KEYSTORE_NAME);
+
+	/* Keys are only read from the text file if bluetoothd hasn't
+	 * converted it yet */
+	err = get_stored_link_key(filename, peer, key);
+	if (err == 0)
+		return 0;
+
+	if (err != -ENOENT && err != -EINVAL)
+		return -EIO;
+
 	create_name(filename, PATH_MAX, STORAGEDIR, addr, "linkkeys");
 
 	ba2str(peer, addr);
@@ -0,0 +1,257 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/sdp.h>
+#include <bluetooth/sdp_lib.h>
+
+static void check_data(const sdp_data_t *d1, const sdp_data_t *d2)
+{
+	for (; d1 && d2; d1 = d1->next, d2 = d2->next) {
+		ck_assert(d1->dtd == d2->dtd);
+		ck_assert(d1->attrId == d2->attrId);
+
+		switch (d1->dtd) {
+		case SDP_DATA_NIL:
+			break;
+		case SDP_UUID16:
+		case SDP_UUID32:
+		case SDP_UUID128:
+			ck_assert(sdp_uuid_cmp(&d1->val.uuid,
+						&d2->val.uuid) == 0);
+			break;
+		case SDP_TEXT_STR8:
+		case SDP_TEXT_STR16:
+		case SDP_URL_STR8:
+		case SDP_URL_STR16:
+			ck_assert(d1->unitSize == d2->unitSize);
+			ck_assert(memcmp(d1->val.str, d2->val.str,
+					d1->unitSize - sizeof(uint8_t)) == 0);
+			break;
+		case SDP_SEQ8:
+		case SDP_SEQ16:
+		case SDP_SEQ32:
+		case SDP_ALT8:
+		case SDP_ALT16:
+		case SDP_ALT32:
+			check_data(d1->val.dataseq, d2->val.dataseq);
+			break;
+		default:
+			ck_assert(memcmp(&d1->val, &d2->val,
+						sizeof(d1->val)) == 0);
+			break;
+		}
+	}
+
+	ck_assert(d1 == NULL && d2 == NULL);
+}
+
+static void check_list(const sdp_list_t *l1, const sdp_list_t *l2)
+{
+	for (; l1 && l2; l1 = l1->next, l2 = l2->next)
+		check_data(l1->data, l2->data);
+
+	ck_assert(l1 == NULL && l2 == NULL);
+}
+
+static void check_pattern(const sdp_list_t *l1, const sdp_list_t *l2)
+{
+	for (; l1 && l2; l1 = l1->next, l2 = l2->next)
+		ck_assert(sdp_uuid128_cmp(l1->data, l2->data) == 0);
+
+	ck_assert(l1 == NULL && l2 == NULL);
+}
+
+/* Both parsers have to agree on any input, truncated ones included */
+static void check_extract(const uint8_t *buf, int size)
+{
+	sdp_record_t *rec, *arena;
+	int scanned = 0, arena_scanned = 0;
+
+	rec = sdp_extract_pdu(buf, size, &scanned);
+	arena = sdp_extract_pdu_arena(buf, size, &arena_scanned);
+
+	ck_assert(rec != NULL && arena != NULL);
+	ck_assert(scanned == arena_scanned);
+	ck_assert(rec->handle == arena->handle);
+	ck_assert(sdp_uuid_cmp(&rec->svclass, &arena->svclass) == 0);
+
+	check_list(rec->attrlist, arena->attrlist);
+	check_pattern(rec->pattern, arena->pattern);
+
+	sdp_record_free(arena);
+	sdp_record_free(rec);
+}
+
+static sdp_record_t *create_record(void)
+{
+	sdp_record_t *rec = sdp_record_alloc();
+	sdp_list_t *root, *svclass, *proto[2], *apseq, *aproto, *profiles;
+	uuid_t root_uuid, svclass_uuid, l2cap, rfcomm;
+	sdp_profile_desc_t profile;
+	sdp_data_t *channel;
+	uint8_t ch = 3;
+
+	sdp_uuid16_create(&root_uuid, PUBLIC_BROWSE_GROUP);
+	root = sdp_list_append(NULL, &root_uuid);
+	sdp_set_browse_groups(rec, root);
+
+	sdp_uuid16_create(&svclass_uuid, SERIAL_PORT_SVCLASS_ID);
+	svclass = sdp_list_append(NULL, &svclass_uuid);
+	sdp_set_service_classes(rec, svclass);
+
+	sdp_uuid16_create(&profile.uuid, SERIAL_PORT_PROFILE_ID);
+	profile.version = 0x0100;
+	profiles = sdp_list_append(NULL, &profile);
+	sdp_set_profile_descs(rec, profiles);
+
+	sdp_uuid16_create(&l2cap, L2CAP_UUID);
+	proto[0] = sdp_list_append(NULL, &l2cap);
+	apseq = sdp_list_append(NULL, proto[0]);
+
+	sdp_uuid16_create(&rfcomm, RFCOMM_UUID);
+	proto[1] = sdp_list_append(NULL, &rfcomm);
+	channel = sdp_data_alloc(SDP_UINT8, &ch);
+	proto[1] = sdp_list_append(proto[1], channel);
+	apseq = sdp_list_append(apseq, proto[1]);
+
+	aproto = sdp_list_append(NULL, apseq);
+	sdp_set_access_protos(rec, aproto);
+
+	sdp_set_info_attr(rec, "Serial Port", "BlueZ", "COM Port");
+
+	rec->handle = 0x10001;
+	sdp_attr_add_new(rec, SDP_ATTR_RECORD_HANDLE, SDP_UINT32,
+								&rec->handle);
+
+	sdp_data_free(channel);
+	sdp_list_free(proto[0], NULL);
+	sdp_list_free(proto[1], NULL);
+	sdp_list_free(apseq, NULL);
+	sdp_list_free(aproto, NULL);
+	sdp_list_free(profiles, NULL);
+	sdp_list_free(svclass, NULL);
+	sdp_list_free(root, NULL);
+
+	return rec;
+}
+
+START_TEST(test_arena_valid)
+{
+	sdp_record_t *rec = create_record();
+	sdp_buf_t pdu;
+
+	ck_assert(sdp_gen_record_pdu(rec, &pdu) == 0);
+
+	check_extract(pdu.data, pdu.data_size);
+
+	free(pdu.data);
+	sdp_record_free(rec);
+}
+END_TEST
+
+START_TEST(test_arena_truncated)
+{
+	sdp_record_t *rec = create_record();
+	sdp_buf_t pdu;
+	unsigned int len;
+
+	ck_assert(sdp_gen_record_pdu(rec, &pdu) == 0);
+
+	for (len = 1; len < pdu.data_size; len++) {
+		uint8_t *buf = malloc(len);
+
+		/* Exact size, so that reading past the end gets noticed */
+		memcpy(buf, pdu.data, len);
+		check_extract(buf, len);
+		free(buf);
+	}
+
+	free(pdu.data);
+	sdp_record_free(rec);
+}
+END_TEST
+
+START_TEST(test_arena_truncated_seq)
+{
+	/* Attribute 0x0001 is a SEQ8 without its length */
+	const uint8_t buf[] = { 0x35, 0x04, 0x09, 0x00, 0x01, 0x35 };
+	sdp_record_t *rec;
+	sdp_data_t *d;
+	int scanned;
+
+	check_extract(buf, sizeof(buf));
+
+	rec = sdp_extract_pdu_arena(buf, sizeof(buf), &scanned);
+	d = sdp_data_get(rec, SDP_ATTR_SVCLASS_ID_LIST);
+	ck_assert(d != NULL);
+	ck_assert(d->dtd == SDP_SEQ8);
+	ck_assert(d->val.dataseq == NULL);
+	sdp_record_free(rec);
+}
+END_TEST
+
+static void add_test(Suite *s, const char *name, TFun func)
+{
+	TCase *t;
+
+	t = tcase_create(name);
+	tcase_add_test(t, func);
+	suite_add_tcase(s, t);
+}
+
+int main(int argc, char *argv[])
+{
+	int fails;
+	SRunner *sr;
+	Suite *s;
+
+	s = suite_create("SDP");
+
+	add_test(s, "arena valid", test_arena_valid);
+	add_test(s, "arena truncated", test_arena_truncated);
+	add_test(s, "arena truncated seq", test_arena_truncated_seq);
+
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+
+	fails = srunner_ntests_failed(sr);
+
+	srunner_free(sr);
+
+	if (fails > 0)
+		return -1;
+
+	return 0;
+}